@@ -0,0 +1,202 @@
+#pragma once
+
+#include "Math/Quantization.h"
+#include "UnitTest.h"
+
+// round trip error bounds of Math/Quantization.h encoders,
+// and SSE encoders against scalar ones, which must give the same bits
+
+inline int UT_QuantizationCheck(bool bPass, const char* name, float input)
+{
+	if (bPass)
+		return 0;
+	IntFloatUnion u;
+	u.f = input;
+	DebugLog("%s failed: [%08x, %+.07e]\n", name, u.i, u.f);
+	return 1;
+}
+
+inline Vector4_3 UT_RandUnitVector()
+{
+	Vector4_3 v;
+	do
+	{
+		v = Vector4_3(RandRangeF(-1.f, 1.f), RandRangeF(-1.f, 1.f), RandRangeF(-1.f, 1.f));
+	} while (v.Size3() < 0.1f);
+	return v.GetNormalized3();
+}
+
+inline int UT_Quantization_Half(int count)
+{
+	int failCount = 0;
+	for (int i = 0; i < count; i += 4)
+	{
+		float src[4];
+		for (int j = 0; j < 4; ++j)
+		{
+			int idx = i + j;
+			if (idx < FloatSpecialNum)
+				src[j] = FloatSpecials[idx].f;
+			else if (idx & 1)
+				src[j] = RandRangeF(-65504.f, 65504.f);
+			else
+				src[j] = RandRangeF(-1.f, 1.f) * powf(2.f, -(float)(rand() % 24));
+		}
+
+		unsigned __int16 dst[4];
+		FloatToHalfBatch(src, dst, 4);
+		for (int j = 0; j < 4; ++j)
+		{
+			unsigned __int16 h = FloatToHalf(src[j]);
+			failCount += UT_QuantizationCheck(h == dst[j], "half SSE", src[j]);
+
+			if (i + j < FloatSpecialNum)
+				continue;
+			// half has 11 significant bits, subnormal step is 2^-24
+			float error = Abs(HalfToFloat(h) - src[j]);
+			failCount += UT_QuantizationCheck(error <= Max(Abs(src[j]) * (1.f / 2048.f), 1.f / 33554432.f), "half round trip", src[j]);
+		}
+	}
+	return failCount;
+}
+
+inline int UT_Quantization_Norm(int count, int bits)
+{
+	int failCount = 0;
+	float snormScale = (float)((1 << (bits - 1)) - 1);
+	float unormScale = (float)((1u << bits) - 1);
+	for (int i = 0; i < count; i += 4)
+	{
+		__declspec(align(16)) float src[4];
+		for (int j = 0; j < 4; ++j)
+		{
+			// every other value is a tie, half way between two steps
+			if (j & 1)
+				src[j] = ((float)(rand() % (int)snormScale) + 0.5f) / snormScale * ((rand() & 1) ? 1.f : -1.f);
+			else
+				src[j] = RandRangeF(-1.2f, 1.2f);
+		}
+		Vec128 f = _mm_load_ps(src);
+
+		__declspec(align(16)) __int32 snorm[4];
+		__declspec(align(16)) unsigned __int32 unorm[4];
+		_mm_store_si128((Vec128i*)snorm, VecFloatToSnorm(f, bits));
+		_mm_store_si128((Vec128i*)unorm, VecFloatToUnorm(f, bits));
+		for (int j = 0; j < 4; ++j)
+		{
+			__int32 is = FloatToSnorm(src[j], bits);
+			unsigned __int32 iu = FloatToUnorm(src[j], bits);
+			failCount += UT_QuantizationCheck(is == snorm[j], "snorm SSE", src[j]);
+			failCount += UT_QuantizationCheck(iu == unorm[j], "unorm SSE", src[j]);
+
+			// half a step, and float error of the division
+			float snormError = Abs(SnormToFloat(is, bits) - Clamp(src[j], -1.f, 1.f));
+			float unormError = Abs(UnormToFloat(iu, bits) - Clamp(src[j], 0.f, 1.f));
+			failCount += UT_QuantizationCheck(snormError <= 0.5f / snormScale + 1e-6f, "snorm round trip", src[j]);
+			failCount += UT_QuantizationCheck(unormError <= 0.5f / unormScale + 1e-6f, "unorm round trip", src[j]);
+		}
+	}
+	return failCount;
+}
+
+inline int UT_Quantization_Oct(int count)
+{
+	int failCount = 0;
+	for (int i = 0; i < count; i += 4)
+	{
+		Vector4_3 n[4];
+		for (int j = 0; j < 4; ++j)
+			n[j] = UT_RandUnitVector();
+
+		Vec128 ex, ey;
+		VecOctEncode(VecSet(n[0].x, n[1].x, n[2].x, n[3].x), VecSet(n[0].y, n[1].y, n[2].y, n[3].y), VecSet(n[0].z, n[1].z, n[2].z, n[3].z), ex, ey);
+		Vector4 vecX = ex;
+		Vector4 vecY = ey;
+		for (int j = 0; j < 4; ++j)
+		{
+			Vector4_2 e = OctEncode(n[j]);
+			failCount += UT_QuantizationCheck(e.x == vecX.m[j] && e.y == vecY.m[j], "oct SSE", n[j].x);
+
+			float error = (OctDecode(e) - n[j]).Size3();
+			failCount += UT_QuantizationCheck(error <= 1e-5f, "oct round trip", n[j].x);
+
+			// 2 x 16 bits, and 2 x 10 bits of the tangent frame
+			Vector4_2 e16(SnormToFloat(FloatToSnorm(e.x, 16), 16), SnormToFloat(FloatToSnorm(e.y, 16), 16));
+			Vector4_2 e10(SnormToFloat(FloatToSnorm(e.x, 10), 10), SnormToFloat(FloatToSnorm(e.y, 10), 10));
+			failCount += UT_QuantizationCheck((OctDecode(e16) - n[j]).Size3() <= 1e-4f, "oct 16 bits round trip", n[j].x);
+			failCount += UT_QuantizationCheck((OctDecode(e10) - n[j]).Size3() <= 6e-3f, "oct 10 bits round trip", n[j].x);
+		}
+	}
+	return failCount;
+}
+
+inline int UT_Quantization_TangentFrame(int count)
+{
+	int failCount = 0;
+	for (int i = 0; i < count; i += 4)
+	{
+		Vector4_3 n[4];
+		Vector4 t[4];
+		for (int j = 0; j < 4; ++j)
+		{
+			n[j] = UT_RandUnitVector();
+			Vector4_3 side;
+			do
+			{
+				side = n[j].Cross3(UT_RandUnitVector());
+			} while (side.Size3() < 0.1f);
+			t[j] = Vector4(side.GetNormalized3(), (rand() & 1) ? 1.f : -1.f);
+		}
+
+		__declspec(align(16)) unsigned __int32 vecFrame[4];
+		_mm_store_si128((Vec128i*)vecFrame, VecPackTangentFrame(
+			VecSet(n[0].x, n[1].x, n[2].x, n[3].x), VecSet(n[0].y, n[1].y, n[2].y, n[3].y), VecSet(n[0].z, n[1].z, n[2].z, n[3].z),
+			VecSet(t[0].x, t[1].x, t[2].x, t[3].x), VecSet(t[0].y, t[1].y, t[2].y, t[3].y), VecSet(t[0].z, t[1].z, t[2].z, t[3].z),
+			VecSet(t[0].w, t[1].w, t[2].w, t[3].w)));
+
+		for (int j = 0; j < 4; ++j)
+		{
+			unsigned __int32 frame = PackTangentFrame(n[j], t[j]);
+			// normal and sign bits are the same, angle goes through atan2f or VecAtan2, 1 step apart at most
+			__int32 angle = ((__int32)(frame << 2)) >> 22;
+			__int32 vecAngle = ((__int32)(vecFrame[j] << 2)) >> 22;
+			failCount += UT_QuantizationCheck((frame & 0xc00fffff) == (vecFrame[j] & 0xc00fffff), "tangent frame SSE normal", n[j].x);
+			failCount += UT_QuantizationCheck(abs(angle - vecAngle) <= 1, "tangent frame SSE angle", n[j].x);
+
+			unsigned __int32 frames[2] = { frame, vecFrame[j] };
+			for (int k = 0; k < 2; ++k)
+			{
+				Vector4_3 dn;
+				Vector4 dt;
+				UnpackTangentFrame(frames[k], dn, dt);
+				failCount += UT_QuantizationCheck((dn - n[j]).Size3() <= 6e-3f, "tangent frame normal round trip", n[j].x);
+				failCount += UT_QuantizationCheck((Vector4_3(dt.x, dt.y, dt.z) - Vector4_3(t[j].x, t[j].y, t[j].z)).Size3() <= 1.5e-2f, "tangent frame tangent round trip", n[j].x);
+				failCount += UT_QuantizationCheck(dt.w == t[j].w, "tangent frame sign", n[j].x);
+			}
+
+			__int16 packed[4];
+			PackQTangent(EncodeQTangent(n[j], t[j]), packed);
+			Vector4_3 qn;
+			Vector4 qt;
+			DecodeQTangent(UnpackQTangent(packed), qn, qt);
+			failCount += UT_QuantizationCheck((qn - n[j]).Size3() <= 1e-3f, "QTangent normal round trip", n[j].x);
+			failCount += UT_QuantizationCheck((Vector4_3(qt.x, qt.y, qt.z) - Vector4_3(t[j].x, t[j].y, t[j].z)).Size3() <= 1e-3f, "QTangent tangent round trip", n[j].x);
+			failCount += UT_QuantizationCheck(qt.w == t[j].w, "QTangent sign", n[j].x);
+		}
+	}
+	return failCount;
+}
+
+// returns failed check count, failures are logged
+inline int UT_Quantization_Test(int count = 100000)
+{
+	int failCount = 0;
+	failCount += UT_Quantization_Half(count);
+	failCount += UT_Quantization_Norm(count, 8);
+	failCount += UT_Quantization_Norm(count, 10);
+	failCount += UT_Quantization_Norm(count, 16);
+	failCount += UT_Quantization_Oct(count);
+	failCount += UT_Quantization_TangentFrame(count);
+	DebugLog("quantization: %d failed\n", failCount);
+	return failCount;
+}
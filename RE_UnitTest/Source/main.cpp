@@ -6,6 +6,7 @@
 #include "../../3rdparty/glm/glm/glm.hpp"
 
 #include "UnitTest.h"
+#include "UT_Quantization.h"
 
 #include "Windows.h"
 
@@ -206,6 +207,8 @@ int main(int argc, char **argv)
 
 	//ExhaustTest();
 
+	UT_Quantization_Test();
+
 	//TransformRandomTest<FuncM2Q>(
 	//	[](const Matrix4& m1) { return Matrix4ToQuat(m1);},
 	//	[](const Matrix4& m1) { return Matrix4ToQuat(m1);},
@@ -26,8 +26,11 @@ void main()
 		dot(modelMat[2], modelMat[2]));		
 	
 	mat3 viewNormalMat = mat3(viewMat) * mat3(modelMat);	
-	vs_out.normal = viewNormalMat * (normal / normalScalar);
-	vs_out.tangent = vec4(viewNormalMat * tangent.xyz, tangent.w);
+	vec3 vertNormal;
+	vec4 vertTangent;
+	GetVertexNormalTangent(vertNormal, vertTangent);
+	vs_out.normal = viewNormalMat * (vertNormal / normalScalar);
+	vs_out.tangent = vec4(viewNormalMat * vertTangent.xyz, vertTangent.w);
 	
 	vs_out.texCoords = texCoords;
 }
\ No newline at end of file
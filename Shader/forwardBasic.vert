@@ -2,6 +2,7 @@
 
 #include "Include/CommonUBO.incl"
 #include "Include/CommonVertexInput.incl"
+#include "Include/DrawData.incl"
 
 out VS_OUT
 {
@@ -13,15 +14,15 @@ out VS_OUT
 	vec4 prevPosCS;
 } vs_out;
 
-uniform mat4 prevModelMat;
-uniform mat4 modelMat;
-
 void main()
 {
+	mat4 worldMat = GetModelMat();
+	mat4 prevWorldMat = GetPrevModelMat();
+
 	// output everything in view space	
-	vs_out.posVS = (viewMat * modelMat * vec4(position, 1.0f)).xyz;
-	vs_out.posCS = viewProjMat * modelMat * vec4(position, 1.0f);
-	vs_out.prevPosCS = prevViewProjMat * prevModelMat * vec4(position, 1.0f);
+	vs_out.posVS = (viewMat * worldMat * vec4(position, 1.0f)).xyz;
+	vs_out.posCS = viewProjMat * worldMat * vec4(position, 1.0f);
+	vs_out.prevPosCS = prevViewProjMat * prevWorldMat * vec4(position, 1.0f);
 	gl_Position = vs_out.posCS;
 	
 	// unjitter
@@ -29,13 +30,16 @@ void main()
 	vs_out.prevPosCS.xy += prevProjMat[2].xy * vs_out.prevPosCS.w;
 		
 	vec3 normalScalar = vec3(
-		dot(modelMat[0], modelMat[0]), 
-		dot(modelMat[1], modelMat[1]), 
-		dot(modelMat[2], modelMat[2]));		
+		dot(worldMat[0], worldMat[0]), 
+		dot(worldMat[1], worldMat[1]), 
+		dot(worldMat[2], worldMat[2]));		
 	
-	mat3 viewNormalMat = mat3(viewMat) * mat3(modelMat);	
-	vs_out.normal = viewNormalMat * (normal / normalScalar);
-	vs_out.tangent = vec4(viewNormalMat * tangent.xyz, tangent.w);
+	mat3 viewNormalMat = mat3(viewMat) * mat3(worldMat);	
+	vec3 vertNormal;
+	vec4 vertTangent;
+	GetVertexNormalTangent(vertNormal, vertTangent);
+	vs_out.normal = viewNormalMat * (vertNormal / normalScalar);
+	vs_out.tangent = vec4(viewNormalMat * vertTangent.xyz, vertTangent.w);
 	
 	vs_out.texCoords = texCoords;
 }
\ No newline at end of file
@@ -2,10 +2,10 @@
 
 #include "Include/CommonUBO.incl"
 #include "Include/CommonVertexInput.incl"
-
-uniform mat4 modelMat;
+#include "Include/DrawData.incl"
 
 void main()
-{	
-	gl_Position = viewProjMat * modelMat * vec4(position, 1.0f);
+{
+	mat4 worldMat = GetModelMat();
+	gl_Position = viewProjMat * worldMat * vec4(position, 1.0f);
 }
\ No newline at end of file
@@ -2,16 +2,16 @@
 
 #include "Include/CommonUBO.incl"
 #include "Include/CommonVertexInput.incl"
+#include "Include/DrawData.incl"
 
 out VS_OUT
 {
 	vec2 texCoords;
 } vs_out;
 
-uniform mat4 modelMat;
-
 void main()
-{	
-	gl_Position = viewProjMat * modelMat * vec4(position, 1.0f);
+{
+	mat4 worldMat = GetModelMat();
+	gl_Position = viewProjMat * worldMat * vec4(position, 1.0f);
 	vs_out.texCoords = texCoords;
 }
\ No newline at end of file
@@ -2,13 +2,14 @@
 
 #include "Include/CommonUBO.incl"
 #include "Include/CommonVertexInput.incl"
+#include "Include/DrawData.incl"
 
 uniform vec4 clippingValue; // -x, +x, -y, +y
-uniform mat4 modelMat;
 
 void main()
-{	
-	gl_Position = viewProjMat * modelMat * vec4(position, 1.0f);
+{
+	mat4 worldMat = GetModelMat();
+	gl_Position = viewProjMat * worldMat * vec4(position, 1.0f);
 	vec4 clipping = clippingValue * gl_Position.w;
 	gl_ClipDistance[0] = gl_Position.x - clipping.x;
 	gl_ClipDistance[1] = clipping.y - gl_Position.x;
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string.h>
+
+// sort key with index of the item it sorts, the item itself is moved once after sorting
+struct SortKeyIndex
+{
+	unsigned __int64 key;
+	unsigned int index;
+};
+
+// stable LSD radix sort on key, 8 bit digits
+// histograms of all digits are built in one pass, digits where all keys fall into one bucket are skipped,
+// so keys with few used bits only pay for the passes they need.
+// scratch must hold count elements, result is in data
+inline void RadixSort(SortKeyIndex* data, SortKeyIndex* scratch, int count)
+{
+	const int digitCount = 8;
+	const int bucketCount = 256;
+
+	if (count < 2)
+		return;
+
+	unsigned int histogram[digitCount][bucketCount];
+	memset(histogram, 0, sizeof(histogram));
+	for (int i = 0; i < count; ++i)
+	{
+		unsigned __int64 key = data[i].key;
+		for (int d = 0; d < digitCount; ++d)
+			++histogram[d][(key >> (d * 8)) & 0xFF];
+	}
+
+	SortKeyIndex* src = data;
+	SortKeyIndex* dst = scratch;
+	for (int d = 0; d < digitCount; ++d)
+	{
+		unsigned int* counts = histogram[d];
+		// all keys have the same digit
+		if (counts[(data[0].key >> (d * 8)) & 0xFF] == (unsigned int)count)
+			continue;
+
+		// exclusive prefix sum
+		unsigned int offset = 0;
+		for (int b = 0; b < bucketCount; ++b)
+		{
+			unsigned int c = counts[b];
+			counts[b] = offset;
+			offset += c;
+		}
+
+		int shift = d * 8;
+		for (int i = 0; i < count; ++i)
+			dst[counts[(src[i].key >> shift) & 0xFF]++] = src[i];
+
+		SortKeyIndex* tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	if (src != data)
+		memcpy(data, src, count * sizeof(SortKeyIndex));
+}
+
+// insertion sort, close to linear on nearly sorted input such as last frame's order.
+// stops once more than maxMoves elements were shifted and returns false, data is then only partly sorted.
+// stable, compare(a, b) returns true if a goes before b
+template<typename T, typename TCompare>
+inline bool InsertionSort(T* data, int count, int maxMoves, TCompare compare)
+{
+	int moveCount = 0;
+	for (int i = 1; i < count; ++i)
+	{
+		if (!compare(data[i], data[i - 1]))
+			continue;
+
+		T item = data[i];
+		int j = i;
+		do
+		{
+			data[j] = data[j - 1];
+			--j;
+		} while (j > 0 && compare(item, data[j - 1]));
+		data[j] = item;
+
+		moveCount += i - j;
+		if (moveCount > maxMoves)
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,563 @@
+#include <algorithm>
+#include <string.h>
+
+#include "SDL.h"
+
+#include "Viewpoint.h"
+
+#include "BVH.h"
+
+BoundingVolumeHierarchy gMeshBVH;
+
+// half surface area, enough for SAH comparison
+static inline float HalfArea(const BoxBounds& bounds)
+{
+	Vector4_3 d = bounds.max - bounds.min;
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+static inline bool IsAABBInsideAABB(const Vector4_3& innerMin, const Vector4_3& innerMax, const Vector4_3& outerMin, const Vector4_3& outerMax)
+{
+	Vec128 t0 = VecCmpGE(innerMin.m128, outerMin.m128);
+	Vec128 t1 = VecCmpLE(innerMax.m128, outerMax.m128);
+	return (VecMoveMask(VecAnd(t0, t1)) & 0x7) == 0x7; // ignore w component
+}
+
+BoundingVolumeHierarchy::BoundingVolumeHierarchy()
+	: refitFrame(0)
+	, bNeedBuild(false)
+{
+}
+
+void BoundingVolumeHierarchy::Resize(int inCount)
+{
+	objectBounds.resize(inCount);
+	bNeedBuild = true;
+}
+
+void BoundingVolumeHierarchy::SetBounds(int index, const BoxBounds& bounds)
+{
+	objectBounds[index] = bounds;
+}
+
+void BoundingVolumeHierarchy::Build()
+{
+	bNeedBuild = false;
+
+	int count = GetCount();
+	nodes.clear();
+	objectIndices.resize(count);
+	objectLeaf.resize(count);
+	if (count == 0)
+		return;
+
+	REArray<Vector4_3, 16> centroids(count);
+	for (int i = 0; i < count; ++i)
+	{
+		objectIndices[i] = i;
+		centroids[i] = (objectBounds[i].min + objectBounds[i].max) * 0.5f;
+	}
+
+	nodes.reserve(count * 2);
+	nodes.resize(1);
+	nodes[0].parent = -1;
+	nodes[0].firstObject = 0;
+	nodes[0].objectCount = count;
+
+	struct BuildTask
+	{
+		int node;
+		int depth;
+	};
+	REArray<BuildTask> tasks;
+	tasks.push_back({ 0, 0 });
+
+	while (tasks.size() > 0)
+	{
+		BuildTask task = tasks.back();
+		tasks.pop_back();
+
+		int first = nodes[task.node].firstObject;
+		int objectCount = nodes[task.node].objectCount;
+		int* indices = objectIndices.data() + first;
+
+		BoxBounds bounds;
+		BoxBounds centroidBounds;
+		for (int k = 0; k < objectCount; ++k)
+		{
+			bounds += objectBounds[indices[k]];
+			centroidBounds += centroids[indices[k]];
+		}
+		nodes[task.node].min = bounds.min;
+		nodes[task.node].max = bounds.max;
+		nodes[task.node].child = -1;
+
+		if (objectCount <= maxLeafSize || task.depth >= maxDepth - 1)
+			continue;
+
+		// split on longest centroid axis
+		Vector4_3 centroidExtent = centroidBounds.max - centroidBounds.min;
+		int axis = 0;
+		if (centroidExtent.y > centroidExtent.m[axis]) axis = 1;
+		if (centroidExtent.z > centroidExtent.m[axis]) axis = 2;
+
+		int splitCount = 0;
+		if (centroidExtent.m[axis] <= 0.f)
+		{
+			// all centroids at the same spot, any split is as good
+			splitCount = objectCount / 2;
+		}
+		else
+		{
+			BoxBounds binBounds[binCount];
+			int binObjectCount[binCount] = {};
+			float binMin = centroidBounds.min.m[axis];
+			// keep max centroid inside last bin
+			float binScale = binCount * 0.9999f / centroidExtent.m[axis];
+			for (int k = 0; k < objectCount; ++k)
+			{
+				int b = (int)((centroids[indices[k]].m[axis] - binMin) * binScale);
+				b = Min(b, binCount - 1);
+				binBounds[b] += objectBounds[indices[k]];
+				++binObjectCount[b];
+			}
+
+			// sweep from right, rightCost[i] is for bins [i, binCount)
+			float rightCost[binCount];
+			BoxBounds accBounds;
+			int accCount = 0;
+			for (int b = binCount - 1; b > 0; --b)
+			{
+				accBounds += binBounds[b];
+				accCount += binObjectCount[b];
+				rightCost[b] = accCount > 0 ? HalfArea(accBounds) * accCount : 0.f;
+			}
+
+			// sweep from left, split between bin b - 1 and b
+			int bestSplit = -1;
+			float bestCost = FLT_MAX;
+			accBounds = BoxBounds();
+			accCount = 0;
+			for (int b = 1; b < binCount; ++b)
+			{
+				accBounds += binBounds[b - 1];
+				accCount += binObjectCount[b - 1];
+				if (accCount == 0 || accCount == objectCount)
+					continue;
+				float cost = HalfArea(accBounds) * accCount + rightCost[b];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestSplit = b;
+				}
+			}
+
+			// node test costs about the same as an object test
+			float nodeArea = HalfArea(bounds);
+			if (bestSplit < 0 || (bestCost + nodeArea >= nodeArea * objectCount && objectCount <= maxLeafSize * 4))
+				continue;
+
+			int* mid = std::partition(indices, indices + objectCount, [&](int i)
+			{
+				int b = (int)((centroids[i].m[axis] - binMin) * binScale);
+				return Min(b, binCount - 1) < bestSplit;
+			});
+			splitCount = (int)(mid - indices);
+		}
+
+		int child = (int)nodes.size();
+		nodes.resize(child + 2);
+		nodes[task.node].child = child;
+
+		nodes[child].parent = task.node;
+		nodes[child].firstObject = first;
+		nodes[child].objectCount = splitCount;
+		nodes[child + 1].parent = task.node;
+		nodes[child + 1].firstObject = first + splitCount;
+		nodes[child + 1].objectCount = objectCount - splitCount;
+
+		tasks.push_back({ child + 1, task.depth + 1 });
+		tasks.push_back({ child, task.depth + 1 });
+	}
+
+	for (int n = 0, nn = (int)nodes.size(); n < nn; ++n)
+	{
+		const BVHNode& node = nodes[n];
+		if (node.child >= 0)
+			continue;
+		for (int k = node.firstObject, nk = node.firstObject + node.objectCount; k < nk; ++k)
+			objectLeaf[objectIndices[k]] = n;
+	}
+
+	refitStamp.clear();
+	refitStamp.resize(nodes.size(), 0);
+	refitFrame = 0;
+}
+
+void BoundingVolumeHierarchy::Refit(const int* movedIndices, int movedCount)
+{
+	if (bNeedBuild)
+	{
+		Build();
+		return;
+	}
+
+	// collect leaves of moved objects and all their ancestors once
+	++refitFrame;
+	refitList.clear();
+	for (int k = 0; k < movedCount; ++k)
+	{
+		for (int n = objectLeaf[movedIndices[k]]; n >= 0 && refitStamp[n] != refitFrame; n = nodes[n].parent)
+		{
+			refitStamp[n] = refitFrame;
+			refitList.push_back(n);
+		}
+	}
+
+	// children are stored after parents, so descending order updates children first
+	std::sort(refitList.begin(), refitList.end(), [](int a, int b) { return a > b; });
+	for (int k = 0, nk = (int)refitList.size(); k < nk; ++k)
+		UpdateNodeBounds(refitList[k]);
+}
+
+void BoundingVolumeHierarchy::UpdateNodeBounds(int nodeIndex)
+{
+	BVHNode& node = nodes[nodeIndex];
+	BoxBounds bounds;
+	if (node.child < 0)
+	{
+		for (int k = node.firstObject, nk = node.firstObject + node.objectCount; k < nk; ++k)
+			bounds += objectBounds[objectIndices[k]];
+	}
+	else
+	{
+		bounds.min = VecMin(nodes[node.child].min.m128, nodes[node.child + 1].min.m128);
+		bounds.max = VecMax(nodes[node.child].max.m128, nodes[node.child + 1].max.m128);
+	}
+	node.min = bounds.min;
+	node.max = bounds.max;
+}
+
+// same result as IsAABBIntersectFrustum
+// planeMask holds planes the box is not fully inside, subtree is accepted when it drops to 0
+template<class TFunc>
+void BoundingVolumeHierarchy::QueryFrustumImpl(const Plane* planes, int planeCount, TFunc func) const
+{
+	if (nodes.size() == 0)
+		return;
+
+	struct StackEntry
+	{
+		int node;
+		unsigned int planeMask;
+	};
+	StackEntry stack[maxDepth * 2];
+	int stackSize = 0;
+	stack[stackSize++] = { 0, (1u << planeCount) - 1 };
+
+	while (stackSize > 0)
+	{
+		StackEntry entry = stack[--stackSize];
+		const BVHNode& node = nodes[entry.node];
+
+		// (center, 1) and (extent, 0)
+		Vec128 center = VecBlend(VecMul(VecAdd(node.min.m128, node.max.m128), VecSet1(0.5f)), VecConst::Vec_One, 0, 0, 0, 1);
+		Vec128 extent = VecMul(VecSub(node.max.m128, node.min.m128), VecSet1(0.5f));
+
+		unsigned int planeMask = entry.planeMask;
+		bool bOutside = false;
+		for (int i = 0; i < planeCount; ++i)
+		{
+			if ((planeMask & (1u << i)) == 0)
+				continue;
+			float dist = VecDot(center, planes[i].m128);
+			float radius = VecDot3(extent, VecAbs(planes[i].m128));
+			if (dist + radius < 0.f)
+			{
+				bOutside = true;
+				break;
+			}
+			if (dist - radius >= 0.f)
+				planeMask &= ~(1u << i);
+		}
+		if (bOutside)
+			continue;
+
+		if (planeMask == 0)
+		{
+			for (int k = node.firstObject, nk = node.firstObject + node.objectCount; k < nk; ++k)
+				func(objectIndices[k]);
+			continue;
+		}
+
+		if (node.child >= 0)
+		{
+			stack[stackSize++] = { node.child + 1, planeMask };
+			stack[stackSize++] = { node.child, planeMask };
+			continue;
+		}
+
+		// leaf bounds may be larger than each object
+		for (int k = node.firstObject, nk = node.firstObject + node.objectCount; k < nk; ++k)
+		{
+			int objectIndex = objectIndices[k];
+			const BoxBounds& bounds = objectBounds[objectIndex];
+			Vec128 pMin = VecBlend(bounds.min.m128, VecConst::Vec_One, 0, 0, 0, 1);
+			Vec128 pMax = VecBlend(bounds.max.m128, VecConst::Vec_One, 0, 0, 0, 1);
+			bool bVisible = true;
+			for (int i = 0; i < planeCount && bVisible; ++i)
+			{
+				if ((planeMask & (1u << i)) == 0)
+					continue;
+				// positive vertex
+				Vec128 pVert = VecBlendVar(pMin, pMax, VecCmpGE(planes[i].m128, VecZero()));
+				bVisible = VecDot(pVert, planes[i].m128) >= 0.f;
+			}
+			if (bVisible)
+				func(objectIndex);
+		}
+	}
+}
+
+void BoundingVolumeHierarchy::QueryFrustum(const Plane* planes, int planeCount, REArray<int>& outIndices) const
+{
+	QueryFrustumImpl(planes, planeCount, [&](int i) { outIndices.push_back(i); });
+}
+
+void BoundingVolumeHierarchy::QueryFrustum(const Plane* planes, int planeCount, unsigned __int32* outMask) const
+{
+	memset(outMask, 0, GetMaskWordCount() * sizeof(unsigned __int32));
+	QueryFrustumImpl(planes, planeCount, [&](int i) { outMask[i >> 5] |= 1u << (i & 31); });
+}
+
+void BoundingVolumeHierarchy::QueryAABB(const Vector4_3& min, const Vector4_3& max, REArray<int>& outIndices) const
+{
+	if (nodes.size() == 0)
+		return;
+
+	int stack[maxDepth * 2];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const BVHNode& node = nodes[stack[--stackSize]];
+		if (!IsAABBIntersectAABB(node.min, node.max, min, max))
+			continue;
+
+		if (node.child >= 0 && !IsAABBInsideAABB(node.min, node.max, min, max))
+		{
+			stack[stackSize++] = node.child + 1;
+			stack[stackSize++] = node.child;
+			continue;
+		}
+
+		bool bInside = node.child >= 0;
+		for (int k = node.firstObject, nk = node.firstObject + node.objectCount; k < nk; ++k)
+		{
+			int objectIndex = objectIndices[k];
+			const BoxBounds& bounds = objectBounds[objectIndex];
+			if (bInside || IsAABBIntersectAABB(bounds.min, bounds.max, min, max))
+				outIndices.push_back(objectIndex);
+		}
+	}
+}
+
+void BoundingVolumeHierarchy::QuerySphere(const Vector4_3& center, float radius, REArray<int>& outIndices) const
+{
+	if (nodes.size() == 0)
+		return;
+
+	float radiusSqr = radius * radius;
+
+	int stack[maxDepth * 2];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const BVHNode& node = nodes[stack[--stackSize]];
+		if (!IsAABBIntersectSphere(node.min, node.max, center, radius))
+			continue;
+
+		if (node.child >= 0)
+		{
+			// inside if farthest corner is inside
+			Vector4_3 farCorner = Max(Abs(center - node.min), Abs(center - node.max));
+			if (farCorner.SizeSqr3() > radiusSqr)
+			{
+				stack[stackSize++] = node.child + 1;
+				stack[stackSize++] = node.child;
+				continue;
+			}
+		}
+
+		bool bInside = node.child >= 0;
+		for (int k = node.firstObject, nk = node.firstObject + node.objectCount; k < nk; ++k)
+		{
+			int objectIndex = objectIndices[k];
+			const BoxBounds& bounds = objectBounds[objectIndex];
+			if (bInside || IsAABBIntersectSphere(bounds.min, bounds.max, center, radius))
+				outIndices.push_back(objectIndex);
+		}
+	}
+}
+
+void BenchmarkBVH(int objectCount)
+{
+	// same setup as BenchmarkCulling, camera at origin, roughly 1/8 is visible
+	Viewpoint viewpoint;
+	viewpoint.position = Vector4_3(0.f, 0.f, 0.f);
+	viewpoint.rotation = Quat::Identity();
+	viewpoint.fov = 90.f * PI / 180.f;
+	viewpoint.width = 1920.f;
+	viewpoint.height = 1080.f;
+	viewpoint.nearPlane = 0.1f;
+	viewpoint.farPlane = 500.f;
+	viewpoint.jitterX = 0.f;
+	viewpoint.jitterY = 0.f;
+	viewpoint.CacheMatrices();
+	Plane* planes = viewpoint.frustumPlanes;
+
+	REArray<BoxBounds, 16> boundsList(objectCount);
+	BoundingVolumeHierarchy bvh;
+	bvh.Resize(objectCount);
+
+	BoxBounds unitBox;
+	unitBox.min = Vector4_3(-1.f);
+	unitBox.max = Vector4_3(1.f);
+	OrientedBoxBounds OBB;
+	for (int i = 0; i < objectCount; ++i)
+	{
+		Vector4_3 position(RandRange(-500.f, 500.f), RandRange(-500.f, 500.f), RandRange(-100.f, 100.f));
+		Vector4_3 rotation(RandRange(-180.f, 180.f), RandRange(-180.f, 180.f), RandRange(-180.f, 180.f));
+		Vector4_3 scale(RandRange(0.5f, 5.f), RandRange(0.5f, 5.f), RandRange(0.5f, 5.f));
+		Matrix4 modelMat = QuatToMatrix4(EulerToQuat(rotation));
+		modelMat.SetTranslation(position);
+		modelMat.ApplyScale(scale);
+		OBB.SetBounds(unitBox, modelMat, scale);
+		boundsList[i] = OBB.GetAABB();
+		bvh.SetBounds(i, boundsList[i]);
+	}
+
+	const int loopCount = 10;
+	double invFreq = 1000.0 / (double)SDL_GetPerformanceFrequency();
+
+	// build
+	double buildTime = DBL_MAX;
+	for (int loop = 0; loop < loopCount; ++loop)
+	{
+		Uint64 start = SDL_GetPerformanceCounter();
+		bvh.Build();
+		double time = (SDL_GetPerformanceCounter() - start) * invFreq;
+		if (time < buildTime)
+			buildTime = time;
+	}
+
+	// refit after moving 1% of objects a little
+	int movedCount = Max(objectCount / 100, 1);
+	REArray<int> movedIndices(movedCount);
+	for (int k = 0; k < movedCount; ++k)
+		movedIndices[k] = (int)(k * (objectCount / (float)movedCount));
+	double refitTime = DBL_MAX;
+	for (int loop = 0; loop < loopCount; ++loop)
+	{
+		Vector4_3 offset(loop % 2 ? -1.f : 1.f, 0.f, 0.f);
+		for (int k = 0; k < movedCount; ++k)
+		{
+			BoxBounds& bounds = boundsList[movedIndices[k]];
+			bounds.min += offset;
+			bounds.max += offset;
+			bvh.SetBounds(movedIndices[k], bounds);
+		}
+		Uint64 start = SDL_GetPerformanceCounter();
+		bvh.Refit(movedIndices.data(), movedCount);
+		double time = (SDL_GetPerformanceCounter() - start) * invFreq;
+		if (time < refitTime)
+			refitTime = time;
+	}
+
+	REArray<char> expected(objectCount);
+	REArray<char> found(objectCount);
+	REArray<int> result;
+	result.reserve(objectCount);
+
+	// returns mismatch count against expected
+	auto compareResult = [&]()
+	{
+		memset(found.data(), 0, objectCount);
+		for (int k = 0, nk = (int)result.size(); k < nk; ++k)
+			found[result[k]] += 1;
+		int mismatchCount = 0;
+		for (int i = 0; i < objectCount; ++i)
+			mismatchCount += (found[i] != expected[i]);
+		return mismatchCount;
+	};
+
+	// frustum
+	double bruteFrustumTime = DBL_MAX;
+	for (int loop = 0; loop < loopCount; ++loop)
+	{
+		Uint64 start = SDL_GetPerformanceCounter();
+		for (int i = 0; i < objectCount; ++i)
+			expected[i] = IsAABBIntersectFrustum(boundsList[i].min, boundsList[i].max, planes, 6);
+		double time = (SDL_GetPerformanceCounter() - start) * invFreq;
+		if (time < bruteFrustumTime)
+			bruteFrustumTime = time;
+	}
+	double frustumTime = DBL_MAX;
+	for (int loop = 0; loop < loopCount; ++loop)
+	{
+		result.clear();
+		Uint64 start = SDL_GetPerformanceCounter();
+		bvh.QueryFrustum(planes, 6, result);
+		double time = (SDL_GetPerformanceCounter() - start) * invFreq;
+		if (time < frustumTime)
+			frustumTime = time;
+	}
+	int frustumCount = (int)result.size();
+	int frustumMismatch = compareResult();
+
+	// AABB, about the size of a close cascade
+	Vector4_3 queryMin(-50.f, 0.f, -20.f);
+	Vector4_3 queryMax(50.f, 100.f, 20.f);
+	for (int i = 0; i < objectCount; ++i)
+		expected[i] = IsAABBIntersectAABB(boundsList[i].min, boundsList[i].max, queryMin, queryMax);
+	double AABBTime = DBL_MAX;
+	for (int loop = 0; loop < loopCount; ++loop)
+	{
+		result.clear();
+		Uint64 start = SDL_GetPerformanceCounter();
+		bvh.QueryAABB(queryMin, queryMax, result);
+		double time = (SDL_GetPerformanceCounter() - start) * invFreq;
+		if (time < AABBTime)
+			AABBTime = time;
+	}
+	int AABBCount = (int)result.size();
+	int AABBMismatch = compareResult();
+
+	// sphere, local light
+	Vector4_3 sphereCenter(10.f, 20.f, 0.f);
+	float sphereRadius = 30.f;
+	for (int i = 0; i < objectCount; ++i)
+		expected[i] = IsAABBIntersectSphere(boundsList[i].min, boundsList[i].max, sphereCenter, sphereRadius);
+	double sphereTime = DBL_MAX;
+	for (int loop = 0; loop < loopCount; ++loop)
+	{
+		result.clear();
+		Uint64 start = SDL_GetPerformanceCounter();
+		bvh.QuerySphere(sphereCenter, sphereRadius, result);
+		double time = (SDL_GetPerformanceCounter() - start) * invFreq;
+		if (time < sphereTime)
+			sphereTime = time;
+	}
+	int sphereCount = (int)result.size();
+	int sphereMismatch = compareResult();
+
+	printf("BenchmarkBVH: %d objects, %d nodes\n", objectCount, bvh.GetNodeCount());
+	printf("  build:   %.3f ms\n", buildTime);
+	printf("  refit:   %.3f ms (%d moved)\n", refitTime, movedCount);
+	printf("  frustum: %.3f ms, brute force %.3f ms, %d found, %d mismatch\n", frustumTime, bruteFrustumTime, frustumCount, frustumMismatch);
+	printf("  AABB:    %.3f ms, %d found, %d mismatch\n", AABBTime, AABBCount, AABBMismatch);
+	printf("  sphere:  %.3f ms, %d found, %d mismatch\n", sphereTime, sphereCount, sphereMismatch);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Containers/Containers.h"
+#include "Math/REMath.h"
+
+#include "Bounds.h"
+
+// children of an internal node are always stored after it, right child is child + 1
+// every node covers objects [firstObject, firstObject + objectCount) of the object index list,
+// so a subtree fully inside a query is accepted without visiting its children
+struct BVHNode
+{
+	Vector4_3 min;
+	Vector4_3 max;
+	int child; // -1 for leaf
+	int parent;
+	int firstObject;
+	int objectCount;
+};
+
+// bounding volume hierarchy over world space AABBs, indexed by object
+// built with binned SAH, refit bottom up when objects move.
+// refit keeps topology, call Build() again if objects moved far from where they were built
+class BoundingVolumeHierarchy
+{
+public:
+	static const int binCount = 16;
+	static const int maxLeafSize = 4;
+	// leaf is forced at this depth, query stack size
+	static const int maxDepth = 64;
+
+	BoundingVolumeHierarchy();
+
+	// new objects are not in the tree until next Build()
+	void Resize(int inCount);
+	// only writes object bounds, safe to call for different objects in parallel
+	void SetBounds(int index, const BoxBounds& bounds);
+
+	void Build();
+	// update nodes above moved objects, rebuild if object count changed since last build
+	void Refit(const int* movedIndices, int movedCount);
+
+	// append indices of objects intersecting the volume to outIndices, in tree order
+	// frustum plane normals point inside the volume
+	void QueryFrustum(const Plane* planes, int planeCount, REArray<int>& outIndices) const;
+	void QueryAABB(const Vector4_3& min, const Vector4_3& max, REArray<int>& outIndices) const;
+	void QuerySphere(const Vector4_3& center, float radius, REArray<int>& outIndices) const;
+
+	// set bit (i & 31) of word (i >> 5) for visible objects, outMask needs GetMaskWordCount() elements
+	void QueryFrustum(const Plane* planes, int planeCount, unsigned __int32* outMask) const;
+
+	int GetCount() const { return (int)objectBounds.size(); }
+	int GetMaskWordCount() const { return (GetCount() + 31) / 32; }
+	int GetNodeCount() const { return (int)nodes.size(); }
+	bool NeedBuild() const { return bNeedBuild; }
+
+protected:
+	REArray<BoxBounds, 16> objectBounds;
+	REArray<BVHNode, 16> nodes;
+	// objects sorted by leaf
+	REArray<int> objectIndices;
+	// leaf node of each object
+	REArray<int> objectLeaf;
+
+	// nodes touched by refit, visit stamp per node
+	REArray<int> refitList;
+	REArray<unsigned int> refitStamp;
+	unsigned int refitFrame;
+
+	bool bNeedBuild;
+
+	void UpdateNodeBounds(int nodeIndex);
+
+	template<class TFunc>
+	void QueryFrustumImpl(const Plane* planes, int planeCount, TFunc func) const;
+};
+
+// indexed by MeshComponent::cullingIndex
+extern BoundingVolumeHierarchy gMeshBVH;
+
+// build, refit and query random bounds, compare with brute force, print timing
+void BenchmarkBVH(int objectCount);
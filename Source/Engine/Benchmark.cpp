@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "Benchmark.h"
+
+static bool ParseCameraKey(const char* values, CameraPathKey& outKey)
+{
+	float v[6];
+	if (sscanf_s(values, "%f %f %f %f %f %f", &v[0], &v[1], &v[2], &v[3], &v[4], &v[5]) != 6)
+		return false;
+	outKey.position = Vector4_3(v[0], v[1], v[2]);
+	outKey.euler = Vector4_3(v[3], v[4], v[5]);
+	return true;
+}
+
+// strip comment and line end, false if nothing is left
+static bool TrimLine(char* line)
+{
+	char* comment = strchr(line, '#');
+	if (comment)
+		*comment = 0;
+	size_t len = strlen(line);
+	while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' ' || line[len - 1] == '\t'))
+		line[--len] = 0;
+	for (const char* c = line; *c; ++c)
+	{
+		if (*c != ' ' && *c != '\t')
+			return true;
+	}
+	return false;
+}
+
+void CameraPath::AddKey(const Vector4_3& position, const Vector4_3& euler)
+{
+	CameraPathKey key;
+	key.position = position;
+	key.euler = euler;
+	keys.push_back(key);
+}
+
+bool CameraPath::Load(const char* path)
+{
+	FILE* file = 0;
+	fopen_s(&file, path, "r");
+	if (!file)
+	{
+		printf("Camera path could not be opened: %s\n", path);
+		return false;
+	}
+
+	char line[512];
+	int lineIndex = 0;
+	bool bSuccess = true;
+	while (fgets(line, sizeof(line), file))
+	{
+		++lineIndex;
+		if (!TrimLine(line))
+			continue;
+		CameraPathKey key;
+		if (!ParseCameraKey(line, key))
+		{
+			printf("Invalid camera key %s:%d\n", path, lineIndex);
+			bSuccess = false;
+			break;
+		}
+		keys.push_back(key);
+	}
+	fclose(file);
+	return bSuccess;
+}
+
+bool CameraPath::Save(const char* path) const
+{
+	FILE* file = 0;
+	fopen_s(&file, path, "w");
+	if (!file)
+	{
+		printf("Camera path could not be written: %s\n", path);
+		return false;
+	}
+
+	for (int i = 0, ni = (int)keys.size(); i < ni; ++i)
+	{
+		const CameraPathKey& key = keys[i];
+		fprintf(file, "%f %f %f %f %f %f\n", key.position.x, key.position.y, key.position.z, key.euler.x, key.euler.y, key.euler.z);
+	}
+	fclose(file);
+	return true;
+}
+
+void CameraPath::Evaluate(float t, Vector4_3& outPosition, Vector4_3& outEuler) const
+{
+	int keyCount = (int)keys.size();
+	if (keyCount == 0)
+		return;
+	if (keyCount == 1)
+	{
+		outPosition = keys[0].position;
+		outEuler = keys[0].euler;
+		return;
+	}
+
+	float keyT = Clamp(t, 0.f, 1.f) * (keyCount - 1);
+	int i1 = Min((int)keyT, keyCount - 2);
+	float s = keyT - i1;
+	// end keys repeat
+	const CameraPathKey& k0 = keys[Max(i1 - 1, 0)];
+	const CameraPathKey& k1 = keys[i1];
+	const CameraPathKey& k2 = keys[i1 + 1];
+	const CameraPathKey& k3 = keys[Min(i1 + 2, keyCount - 1)];
+
+	// Catmull-Rom weights of k0 - k3
+	float s2 = s * s;
+	float s3 = s2 * s;
+	float w0 = 0.5f * (-s3 + 2.f * s2 - s);
+	float w1 = 0.5f * (3.f * s3 - 5.f * s2 + 2.f);
+	float w2 = 0.5f * (-3.f * s3 + 4.f * s2 + s);
+	float w3 = 0.5f * (s3 - s2);
+
+	outPosition = k0.position * w0 + k1.position * w1 + k2.position * w2 + k3.position * w3;
+	outEuler = k0.euler * w0 + k1.euler * w1 + k2.euler * w2 + k3.euler * w3;
+}
+
+bool LoadBenchmarkConfig(const char* path, BenchmarkConfig& outConfig)
+{
+	FILE* file = 0;
+	fopen_s(&file, path, "r");
+	if (!file)
+	{
+		printf("Benchmark config could not be opened: %s\n", path);
+		return false;
+	}
+
+	char line[512];
+	int lineIndex = 0;
+	bool bSuccess = true;
+	while (bSuccess && fgets(line, sizeof(line), file))
+	{
+		++lineIndex;
+		if (!TrimLine(line))
+			continue;
+
+		char name[64];
+		int nameLength = 0;
+		if (sscanf_s(line, " %63s%n", name, (unsigned)_countof(name), &nameLength) != 1)
+			continue;
+		const char* values = line + nameLength;
+
+		if (strcmp(name, "seed") == 0)
+			bSuccess = sscanf_s(values, "%u", &outConfig.seed) == 1;
+		else if (strcmp(name, "meshes") == 0)
+			bSuccess = sscanf_s(values, "%d", &outConfig.meshCount) == 1 && outConfig.meshCount > 0;
+		else if (strcmp(name, "materials") == 0)
+			bSuccess = sscanf_s(values, "%d", &outConfig.materialCount) == 1 && outConfig.materialCount > 0;
+		else if (strcmp(name, "components") == 0)
+			bSuccess = sscanf_s(values, "%d", &outConfig.componentCount) == 1 && outConfig.componentCount >= 0;
+		else if (strcmp(name, "pointLights") == 0)
+			bSuccess = sscanf_s(values, "%d", &outConfig.pointLightCount) == 1 && outConfig.pointLightCount >= 0;
+		else if (strcmp(name, "spotLights") == 0)
+			bSuccess = sscanf_s(values, "%d", &outConfig.spotLightCount) == 1 && outConfig.spotLightCount >= 0;
+		else if (strcmp(name, "shadowLights") == 0)
+			bSuccess = sscanf_s(values, "%d", &outConfig.shadowLightCount) == 1 && outConfig.shadowLightCount >= 0;
+		else if (strcmp(name, "extent") == 0)
+		{
+			float x, y, z;
+			bSuccess = sscanf_s(values, "%f %f %f", &x, &y, &z) == 3;
+			outConfig.extent = Vector4_3(x, y, z);
+		}
+		else if (strcmp(name, "scale") == 0)
+			bSuccess = sscanf_s(values, "%f %f", &outConfig.minScale, &outConfig.maxScale) == 2;
+		else if (strcmp(name, "fov") == 0)
+			bSuccess = sscanf_s(values, "%f", &outConfig.fov) == 1;
+		else if (strcmp(name, "camera") == 0)
+		{
+			CameraPathKey key;
+			bSuccess = ParseCameraKey(values, key);
+			if (bSuccess)
+				outConfig.cameraPath.AddKey(key.position, key.euler);
+		}
+		else if (strcmp(name, "cameraPath") == 0)
+		{
+			char cameraPathFile[256];
+			bSuccess = sscanf_s(values, " %255s", cameraPathFile, (unsigned)_countof(cameraPathFile)) == 1
+				&& outConfig.cameraPath.Load(cameraPathFile);
+		}
+		else
+		{
+			printf("Unknown benchmark config entry %s:%d %s\n", path, lineIndex, name);
+			bSuccess = false;
+			continue;
+		}
+
+		if (!bSuccess)
+			printf("Invalid benchmark config entry %s:%d %s\n", path, lineIndex, name);
+	}
+	fclose(file);
+
+	outConfig.bEnabled = bSuccess;
+	return bSuccess;
+}
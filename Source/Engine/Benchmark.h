@@ -0,0 +1,64 @@
+#pragma once
+
+#include "Containers/Containers.h"
+#include "Math/REMath.h"
+
+struct CameraPathKey
+{
+	Vector4_3 position;
+	Vector4_3 euler; // degree
+};
+
+// camera keys, played as a Catmull-Rom spline through all of them.
+// a path recorded every frame and played over the same frame count gives back the recorded frames
+class CameraPath
+{
+public:
+	void AddKey(const Vector4_3& position, const Vector4_3& euler);
+	void Clear() { keys.clear(); }
+	int GetKeyCount() const { return (int)keys.size(); }
+
+	// one "x y z eulerX eulerY eulerZ" key per line, same as a config camera line. Load appends keys
+	bool Load(const char* path);
+	bool Save(const char* path) const;
+
+	// t in [0, 1] over the whole path
+	void Evaluate(float t, Vector4_3& outPosition, Vector4_3& outEuler) const;
+
+protected:
+	REArray<CameraPathKey> keys;
+};
+
+// procedural scene and camera path of a benchmark run, everything random comes from seed.
+// config file is one "name values" per line, # starts a comment:
+//   seed 1
+//   meshes 8              mesh shapes, cube, sphere, icosahedron, cone at increasing tessellation
+//   materials 16
+//   components 20000      each picks a mesh and a material
+//   pointLights 1000
+//   spotLights 20
+//   shadowLights 4        first N point lights and first N spot lights cast shadows
+//   extent 100 100 30     components and lights are placed in [-x, x] [-y, y] [0, z]
+//   scale 0.2 1           component scale range
+//   fov 90
+//   camera 0 -20 5 -10 0 0    path key, position and euler
+//   cameraPath path.txt       keys from file, recorded with K in window mode
+struct BenchmarkConfig
+{
+	bool bEnabled = false;
+	unsigned int seed = 1;
+	int meshCount = 4;
+	int materialCount = 8;
+	int componentCount = 10000;
+	int pointLightCount = 1000;
+	int spotLightCount = 20;
+	int shadowLightCount = 4;
+	Vector4_3 extent = Vector4_3(100.f, 100.f, 30.f);
+	float minScale = 0.2f;
+	float maxScale = 1.f;
+	float fov = 90.f;
+	CameraPath cameraPath;
+};
+
+// false on unknown or malformed line
+bool LoadBenchmarkConfig(const char* path, BenchmarkConfig& outConfig);
@@ -130,6 +130,19 @@ public:
 		permutedAxisCenter[2] = tmp.mLine[2];
 
 	}
+
+	// world space AABB enclosing this box
+	BoxBounds GetAABB() const
+	{
+		// half size on each world axis is sum of |axis component| * extent
+		Vector4_3 worldExtent(
+			VecDot3(VecAbs(permutedAxisCenter[0].m128), extent.m128),
+			VecDot3(VecAbs(permutedAxisCenter[1].m128), extent.m128),
+			VecDot3(VecAbs(permutedAxisCenter[2].m128), extent.m128));
+		BoxBounds outBounds;
+		outBounds.SetCenterAndExtent(center, worldExtent);
+		return outBounds;
+	}
 };
 
 class SphereBounds
@@ -0,0 +1,174 @@
+
+#include "Render.h"
+
+#include "Mesh.h"
+#include "MeshComponent.h"
+#include "MultiDraw.h"
+
+#include "CommandList.h"
+
+// SDL
+#include "SDL.h"
+
+struct SetParameterCommand
+{
+	Material* material;
+	const char* name;
+	int bytes;
+	EMaterialParameterType type;
+	// followed by value
+};
+
+struct DrawRenderDataCommand
+{
+	const MeshRenderData* renderData;
+	Material* material;
+};
+
+struct DrawComponentCommand
+{
+	MeshComponent* meshComp;
+	Material* material;
+};
+
+struct MultiDrawCommand
+{
+	MultiDrawList* list;
+};
+
+static inline int AlignCommandSize(int bytes)
+{
+	return (bytes + 15) & ~15;
+}
+
+CommandList::CommandList()
+	: recordTime(0)
+	, replayTime(0)
+	, size(0)
+	, multiDrawListCount(0)
+{
+}
+
+CommandList::~CommandList()
+{
+	for (int i = 0, ni = (int)multiDrawLists.size(); i < ni; ++i)
+		delete multiDrawLists[i];
+}
+
+void CommandList::Reset()
+{
+	size = 0;
+	multiDrawListCount = 0;
+}
+
+template<class T>
+T* CommandList::Allocate(ERenderCommand type, int extraBytes)
+{
+	const int headerSize = AlignCommandSize(sizeof(CommandHeader));
+	int stride = headerSize + AlignCommandSize(sizeof(T) + extraBytes);
+	if (size + stride > (int)data.size())
+		data.resize(Max((int)data.size() * 2, Max(size + stride, 4096)));
+
+	CommandHeader* header = (CommandHeader*)(data.data() + size);
+	header->type = type;
+	header->stride = stride;
+	T* command = (T*)(data.data() + size + headerSize);
+	size += stride;
+	return command;
+}
+
+void CommandList::SetParameter(Material* material, const char* name, const char* value, int bytes, EMaterialParameterType type)
+{
+	SetParameterCommand* command = Allocate<SetParameterCommand>(ERenderCommand::SetParameter, bytes);
+	command->material = material;
+	command->name = name;
+	command->bytes = bytes;
+	command->type = type;
+	memcpy(command + 1, value, bytes);
+}
+
+void CommandList::CopyParameter(Material* material, const Material* srcMaterial, const REArray<char*>& names)
+{
+	for (int j = 0, nj = (int)names.size(); j < nj; ++j)
+	{
+		const char* name = names[j];
+		for (int i = 0, ni = (int)srcMaterial->parameterList.size(); i < ni; ++i)
+		{
+			const MaterialParameter& param = srcMaterial->parameterList[i];
+			if (strcmp(param.name, name) == 0)
+			{
+				SetParameter(material, name, srcMaterial->parameterData.data() + param.offset, param.count, param.type);
+				break;
+			}
+		}
+	}
+}
+
+void CommandList::Draw(const MeshRenderData* renderData, Material* overrideMaterial)
+{
+	DrawRenderDataCommand* command = Allocate<DrawRenderDataCommand>(ERenderCommand::DrawRenderData);
+	command->renderData = renderData;
+	command->material = overrideMaterial;
+}
+
+void CommandList::Draw(MeshComponent* meshComp, Material* overrideMaterial)
+{
+	DrawComponentCommand* command = Allocate<DrawComponentCommand>(ERenderCommand::DrawComponent);
+	command->meshComp = meshComp;
+	command->material = overrideMaterial;
+}
+
+MultiDrawList& CommandList::MultiDraw()
+{
+	if (multiDrawListCount == (int)multiDrawLists.size())
+		multiDrawLists.push_back(new MultiDrawList());
+	MultiDrawList* list = multiDrawLists[multiDrawListCount++];
+	list->Clear();
+
+	MultiDrawCommand* command = Allocate<MultiDrawCommand>(ERenderCommand::MultiDraw);
+	command->list = list;
+	return *list;
+}
+
+void CommandList::Replay(RenderContext& renderContext)
+{
+	Uint64 replayStart = SDL_GetPerformanceCounter();
+
+	const int headerSize = AlignCommandSize(sizeof(CommandHeader));
+	int offset = 0;
+	while (offset < size)
+	{
+		const CommandHeader* header = (const CommandHeader*)(data.data() + offset);
+		char* commandPtr = data.data() + offset + headerSize;
+		switch (header->type)
+		{
+		case ERenderCommand::SetParameter:
+		{
+			SetParameterCommand* command = (SetParameterCommand*)commandPtr;
+			command->material->SetParameter(command->name, (const char*)(command + 1), command->bytes, command->type);
+			break;
+		}
+		case ERenderCommand::DrawRenderData:
+		{
+			DrawRenderDataCommand* command = (DrawRenderDataCommand*)commandPtr;
+			command->renderData->Draw(renderContext, command->material);
+			break;
+		}
+		case ERenderCommand::DrawComponent:
+		{
+			DrawComponentCommand* command = (DrawComponentCommand*)commandPtr;
+			command->meshComp->Draw(renderContext, command->material);
+			break;
+		}
+		case ERenderCommand::MultiDraw:
+		{
+			MultiDrawCommand* command = (MultiDrawCommand*)commandPtr;
+			command->list->Submit(renderContext);
+			break;
+		}
+		}
+		offset += header->stride;
+	}
+
+	replayTime = (double)(SDL_GetPerformanceCounter() - replayStart) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
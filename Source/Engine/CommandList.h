@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Containers/Containers.h"
+
+#include "Material.h"
+
+class MeshComponent;
+class MultiDrawList;
+struct MeshRenderData;
+struct RenderContext;
+
+enum class ERenderCommand : int
+{
+	SetParameter,
+	DrawRenderData,
+	DrawComponent,
+	MultiDraw,
+};
+
+// draws and material parameter updates recorded on any thread, replayed on the render thread.
+// recording makes no GL calls and doesn't write materials, so lists of different passes or shadow views
+// can be recorded by parallel jobs. Replay() does everything in recorded order.
+// commands are packed into one linear buffer, Reset() rewinds it and keeps capacity and multi draw lists for next frame.
+// recorded render data, components and materials must stay unchanged until replay
+class CommandList
+{
+public:
+	CommandList();
+	~CommandList();
+
+	void Reset();
+	bool IsEmpty() const { return size == 0; }
+
+	// value is copied now, Material::SetParameter() at replay
+	void SetParameter(Material* material, const char* name, const char* data, int bytes, EMaterialParameterType type);
+	// same as material->CopyParameter(srcMaterial, &names) at replay, with values of srcMaterial now
+	void CopyParameter(Material* material, const Material* srcMaterial, const REArray<char*>& names);
+	void Draw(const MeshRenderData* renderData, Material* overrideMaterial = 0);
+	void Draw(MeshComponent* meshComp, Material* overrideMaterial = 0);
+	// empty multi draw list to fill, submitted at its place in the list
+	MultiDrawList& MultiDraw();
+
+	void Replay(RenderContext& renderContext);
+
+	// ms, last record (set by recording code) and last replay
+	double recordTime;
+	double replayTime;
+
+protected:
+	struct CommandHeader
+	{
+		ERenderCommand type;
+		// bytes to next command
+		int stride;
+	};
+
+	// room for a command with extraBytes after T, 16 byte aligned
+	template<class T>
+	T* Allocate(ERenderCommand type, int extraBytes = 0);
+
+	REArray<char, 16> data;
+	int size;
+
+	REArray<MultiDrawList*> multiDrawLists;
+	int multiDrawListCount;
+};
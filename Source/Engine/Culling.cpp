@@ -0,0 +1,284 @@
+#include <intrin.h>
+#include <immintrin.h>
+
+#include "SDL.h"
+
+#include "Bounds.h"
+#include "Viewpoint.h"
+
+#include "Culling.h"
+
+CullingBounds gMeshCullingBounds;
+
+static bool IsAVXSupported()
+{
+	int info[4];
+	__cpuid(info, 1);
+	// AVX and OSXSAVE
+	if ((info[2] & (1 << 28)) == 0 || (info[2] & (1 << 27)) == 0)
+		return false;
+	// OS saves ymm state
+	return (_xgetbv(0) & 0x6) == 0x6;
+}
+
+CullingBounds::CullingBounds()
+	: bForceSSE(false)
+	, count(0)
+{
+	bHasAVX = IsAVXSupported();
+}
+
+void CullingBounds::Resize(int inCount)
+{
+	count = inCount;
+	// new blocks are zero filled, unused lanes are masked out of the result
+	int blockCount = (count + blockSize - 1) / blockSize;
+	sphereBlocks.resize(blockCount);
+	axisBlocks.resize(blockCount);
+}
+
+void CullingBounds::SetOBB(int index, const OrientedBoxBounds& OBB)
+{
+	SphereBlock& sphereBlock = sphereBlocks[index / blockSize];
+	OBBAxisBlock& axisBlock = axisBlocks[index / blockSize];
+	int lane = index % blockSize;
+
+	sphereBlock.radius[lane] = OBB.extent.Size3();
+
+	const Vector4* pac = OBB.permutedAxisCenter;
+	for (int c = 0; c < 3; ++c)
+	{
+		sphereBlock.center[c][lane] = pac[c].w;
+		axisBlock.halfAxis[0][c][lane] = pac[c].x * OBB.extent.x;
+		axisBlock.halfAxis[1][c][lane] = pac[c].y * OBB.extent.y;
+		axisBlock.halfAxis[2][c][lane] = pac[c].z * OBB.extent.z;
+	}
+}
+
+void CullingBounds::CullFrustum(const Plane* planes, int planeCount, unsigned __int32* outMask) const
+{
+	CullFrustum(planes, planeCount, 0, GetBlockCount(), outMask);
+}
+
+// same result as IsOBBIntersectFrustum:
+// outside if dot(n, C) + w + |dot(n, HX)| + |dot(n, HY)| + |dot(n, HZ)| < 0 for any plane
+// bounding sphere pass first, OBB pass only if some object crosses a plane
+static unsigned __int32 CullBlockAVX(const SphereBlock& block, const OBBAxisBlock& axisBlock, const Plane* planes, int planeCount)
+{
+	const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+
+	__m256 cx = _mm256_load_ps(block.center[0]);
+	__m256 cy = _mm256_load_ps(block.center[1]);
+	__m256 cz = _mm256_load_ps(block.center[2]);
+	__m256 r = _mm256_load_ps(block.radius);
+	__m256 negR = _mm256_xor_ps(r, _mm256_castsi256_ps(_mm256_set1_epi32(0x80000000)));
+
+	__m256 outside = _mm256_setzero_ps();
+	__m256 crossing = _mm256_setzero_ps();
+	for (int i = 0; i < planeCount; ++i)
+	{
+		__m256 dist = _mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(planes[i].x)), _mm256_set1_ps(planes[i].w));
+		dist = _mm256_add_ps(dist, _mm256_mul_ps(cy, _mm256_set1_ps(planes[i].y)));
+		dist = _mm256_add_ps(dist, _mm256_mul_ps(cz, _mm256_set1_ps(planes[i].z)));
+		outside = _mm256_or_ps(outside, _mm256_cmp_ps(dist, negR, _CMP_LT_OQ));
+		crossing = _mm256_or_ps(crossing, _mm256_cmp_ps(dist, r, _CMP_LT_OQ));
+	}
+
+	unsigned __int32 outsideMask = (unsigned __int32)_mm256_movemask_ps(outside);
+	// crossing but not outside
+	if ((unsigned __int32)_mm256_movemask_ps(_mm256_andnot_ps(outside, crossing)) == 0)
+		return ~outsideMask & 0xFF;
+
+	__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+	for (int i = 0; i < planeCount; ++i)
+	{
+		__m256 px = _mm256_set1_ps(planes[i].x);
+		__m256 py = _mm256_set1_ps(planes[i].y);
+		__m256 pz = _mm256_set1_ps(planes[i].z);
+
+		__m256 dist = _mm256_add_ps(_mm256_mul_ps(cx, px), _mm256_set1_ps(planes[i].w));
+		dist = _mm256_add_ps(dist, _mm256_mul_ps(cy, py));
+		dist = _mm256_add_ps(dist, _mm256_mul_ps(cz, pz));
+
+		for (int a = 0; a < 3; ++a)
+		{
+			__m256 d = _mm256_mul_ps(_mm256_load_ps(axisBlock.halfAxis[a][0]), px);
+			d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_load_ps(axisBlock.halfAxis[a][1]), py));
+			d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_load_ps(axisBlock.halfAxis[a][2]), pz));
+			dist = _mm256_add_ps(dist, _mm256_and_ps(d, absMask));
+		}
+
+		inside = _mm256_and_ps(inside, _mm256_cmp_ps(dist, _mm256_setzero_ps(), _CMP_GE_OQ));
+	}
+
+	return (unsigned __int32)_mm256_movemask_ps(inside);
+}
+
+static unsigned __int32 CullBlockSSE(const SphereBlock& block, const OBBAxisBlock& axisBlock, const Plane* planes, int planeCount)
+{
+	unsigned __int32 mask = 0;
+	// 2 x 4 objects
+	for (int h = 0; h < 8; h += 4)
+	{
+		Vec128 cx = _mm_load_ps(block.center[0] + h);
+		Vec128 cy = _mm_load_ps(block.center[1] + h);
+		Vec128 cz = _mm_load_ps(block.center[2] + h);
+		Vec128 r = _mm_load_ps(block.radius + h);
+		Vec128 negR = VecNegate(r);
+
+		Vec128 outside = VecZero();
+		Vec128 crossing = VecZero();
+		for (int i = 0; i < planeCount; ++i)
+		{
+			Vec128 dist = VecAdd(VecMul(cx, VecSet1(planes[i].x)), VecSet1(planes[i].w));
+			dist = VecAdd(dist, VecMul(cy, VecSet1(planes[i].y)));
+			dist = VecAdd(dist, VecMul(cz, VecSet1(planes[i].z)));
+			outside = VecOr(outside, VecCmpLT(dist, negR));
+			crossing = VecOr(crossing, VecCmpLT(dist, r));
+		}
+
+		int outsideMask = VecMoveMask(outside);
+		if (VecMoveMask(_mm_andnot_ps(outside, crossing)) == 0)
+		{
+			mask |= (unsigned __int32)(~outsideMask & 0xF) << h;
+			continue;
+		}
+
+		Vec128 inside = VecCmpEQ(cx, cx); // all set unless NaN
+		for (int i = 0; i < planeCount; ++i)
+		{
+			Vec128 px = VecSet1(planes[i].x);
+			Vec128 py = VecSet1(planes[i].y);
+			Vec128 pz = VecSet1(planes[i].z);
+
+			Vec128 dist = VecAdd(VecMul(cx, px), VecSet1(planes[i].w));
+			dist = VecAdd(dist, VecMul(cy, py));
+			dist = VecAdd(dist, VecMul(cz, pz));
+
+			for (int a = 0; a < 3; ++a)
+			{
+				Vec128 d = VecMul(_mm_load_ps(axisBlock.halfAxis[a][0] + h), px);
+				d = VecAdd(d, VecMul(_mm_load_ps(axisBlock.halfAxis[a][1] + h), py));
+				d = VecAdd(d, VecMul(_mm_load_ps(axisBlock.halfAxis[a][2] + h), pz));
+				dist = VecAdd(dist, VecAbs(d));
+			}
+
+			inside = VecAnd(inside, VecCmpGE(dist, VecZero()));
+		}
+		mask |= (unsigned __int32)VecMoveMask(inside) << h;
+	}
+	return mask;
+}
+
+void CullingBounds::CullFrustum(const Plane* planes, int planeCount, int startBlock, int endBlock, unsigned __int32* outMask) const
+{
+	assert(startBlock % blocksPerMaskWord == 0);
+
+	bool bUseAVX = bHasAVX && !bForceSSE;
+	int lastBlock = GetBlockCount() - 1;
+	for (int b = startBlock; b < endBlock; b += blocksPerMaskWord)
+	{
+		unsigned __int32 word = 0;
+		for (int k = 0, nk = Min(blocksPerMaskWord, endBlock - b); k < nk; ++k)
+		{
+			const SphereBlock& sphereBlock = sphereBlocks[b + k];
+			const OBBAxisBlock& axisBlock = axisBlocks[b + k];
+			unsigned __int32 bits = bUseAVX ?
+				CullBlockAVX(sphereBlock, axisBlock, planes, planeCount) :
+				CullBlockSSE(sphereBlock, axisBlock, planes, planeCount);
+			// mask out unused lanes
+			if (b + k == lastBlock && count % blockSize != 0)
+				bits &= (1u << (count % blockSize)) - 1;
+			word |= bits << (k * blockSize);
+		}
+		outMask[b / blocksPerMaskWord] = word;
+	}
+
+	if (bUseAVX)
+		_mm256_zeroupper();
+}
+
+void BenchmarkCulling(int objectCount)
+{
+	// camera at origin, objects spread around so roughly 1/8 is visible
+	Viewpoint viewpoint;
+	viewpoint.position = Vector4_3(0.f, 0.f, 0.f);
+	viewpoint.rotation = Quat::Identity();
+	viewpoint.fov = 90.f * PI / 180.f;
+	viewpoint.width = 1920.f;
+	viewpoint.height = 1080.f;
+	viewpoint.nearPlane = 0.1f;
+	viewpoint.farPlane = 500.f;
+	viewpoint.jitterX = 0.f;
+	viewpoint.jitterY = 0.f;
+	viewpoint.CacheMatrices();
+	Plane* planes = viewpoint.frustumPlanes;
+
+	REArray<OrientedBoxBounds, 16> OBBList(objectCount);
+	CullingBounds cullingBounds;
+	cullingBounds.Resize(objectCount);
+
+	BoxBounds unitBox;
+	unitBox.min = Vector4_3(-1.f);
+	unitBox.max = Vector4_3(1.f);
+	for (int i = 0; i < objectCount; ++i)
+	{
+		Vector4_3 position(RandRange(-500.f, 500.f), RandRange(-500.f, 500.f), RandRange(-100.f, 100.f));
+		Vector4_3 rotation(RandRange(-180.f, 180.f), RandRange(-180.f, 180.f), RandRange(-180.f, 180.f));
+		Vector4_3 scale(RandRange(0.5f, 5.f), RandRange(0.5f, 5.f), RandRange(0.5f, 5.f));
+		Matrix4 modelMat = QuatToMatrix4(EulerToQuat(rotation));
+		modelMat.SetTranslation(position);
+		modelMat.ApplyScale(scale);
+		OBBList[i].SetBounds(unitBox, modelMat, scale);
+		cullingBounds.SetOBB(i, OBBList[i]);
+	}
+
+	const int loopCount = 20;
+	double invFreq = 1000.0 / (double)SDL_GetPerformanceFrequency();
+
+	// per object
+	REArray<char> visibleList(objectCount);
+	double perObjectTime = DBL_MAX;
+	for (int loop = 0; loop < loopCount; ++loop)
+	{
+		Uint64 start = SDL_GetPerformanceCounter();
+		for (int i = 0; i < objectCount; ++i)
+			visibleList[i] = IsOBBIntersectFrustum(OBBList[i].permutedAxisCenter, OBBList[i].extent, planes, 6);
+		double time = (SDL_GetPerformanceCounter() - start) * invFreq;
+		if (time < perObjectTime)
+			perObjectTime = time;
+	}
+
+	// SoA
+	REArray<unsigned __int32> mask(cullingBounds.GetMaskWordCount());
+	double SoATime[2] = { DBL_MAX, DBL_MAX };
+	int mismatchCount[2] = { 0, 0 };
+	for (int path = 0; path < 2; ++path)
+	{
+		cullingBounds.bForceSSE = (path == 1);
+		for (int loop = 0; loop < loopCount; ++loop)
+		{
+			Uint64 start = SDL_GetPerformanceCounter();
+			cullingBounds.CullFrustum(planes, 6, mask.data());
+			double time = (SDL_GetPerformanceCounter() - start) * invFreq;
+			if (time < SoATime[path])
+				SoATime[path] = time;
+		}
+		for (int i = 0; i < objectCount; ++i)
+		{
+			bool bVisible = (mask[i >> 5] >> (i & 31)) & 1;
+			if (bVisible != (visibleList[i] != 0))
+				++mismatchCount[path];
+		}
+	}
+
+	int visibleCount = 0;
+	for (int i = 0; i < objectCount; ++i)
+		visibleCount += visibleList[i];
+
+	printf("BenchmarkCulling: %d objects, %d visible\n", objectCount, visibleCount);
+	printf("  per object:  %.3f ms (%.2f M tests/ms)\n", perObjectTime, objectCount / perObjectTime * 1e-6);
+	printf("  SoA AVX x8:  %.3f ms (%.2f M tests/ms) %d mismatch%s\n", SoATime[0], objectCount / SoATime[0] * 1e-6, mismatchCount[0],
+		cullingBounds.HasAVX() ? "" : ", AVX not supported, ran SSE");
+	printf("  SoA SSE x4:  %.3f ms (%.2f M tests/ms) %d mismatch\n", SoATime[1], objectCount / SoATime[1] * 1e-6, mismatchCount[1]);
+}
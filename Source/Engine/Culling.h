@@ -0,0 +1,79 @@
+#pragma once
+
+#include <intrin.h>
+
+#include "Containers/Containers.h"
+#include "Math/REMath.h"
+
+class OrientedBoxBounds;
+
+// bounds of 8 objects in SoA, one block is tested in one AVX iteration
+// most objects are accepted or rejected by the bounding sphere alone,
+// OBB axes are kept in a separate array so they are only fetched for objects crossing a plane
+__declspec(align(32)) struct SphereBlock
+{
+	float center[3][8];
+	float radius[8];
+};
+
+// half axis is OBB axis scaled by extent: [axis][component][object]
+__declspec(align(32)) struct OBBAxisBlock
+{
+	float halfAxis[3][3][8];
+};
+
+// contiguous bounds for frustum culling, indexed by object
+// result is a bitmask, object i is visible if bit (i & 31) of word (i >> 5) is set
+class CullingBounds
+{
+public:
+	static const int blockSize = 8;
+	// one mask word covers this many blocks
+	static const int blocksPerMaskWord = 32 / blockSize;
+
+	CullingBounds();
+
+	void Resize(int inCount);
+	void SetOBB(int index, const OrientedBoxBounds& OBB);
+
+	int GetCount() const { return count; }
+	int GetBlockCount() const { return (int)sphereBlocks.size(); }
+	int GetMaskWordCount() const { return (count + 31) / 32; }
+	bool HasAVX() const { return bHasAVX; }
+
+	// outMask needs GetMaskWordCount() elements
+	void CullFrustum(const Plane* planes, int planeCount, unsigned __int32* outMask) const;
+	// test blocks [startBlock, endBlock), startBlock must be a multiple of blocksPerMaskWord
+	// so different ranges never write the same mask word
+	void CullFrustum(const Plane* planes, int planeCount, int startBlock, int endBlock, unsigned __int32* outMask) const;
+
+	// use 4 wide SSE path even if AVX is available
+	bool bForceSSE;
+
+protected:
+	REArray<SphereBlock, 32> sphereBlocks;
+	REArray<OBBAxisBlock, 32> axisBlocks;
+	int count;
+	bool bHasAVX;
+};
+
+// indexed by MeshComponent::cullingIndex
+extern CullingBounds gMeshCullingBounds;
+
+// compare per object IsOBBIntersectFrustum with SoA culling on random bounds, print timing
+void BenchmarkCulling(int objectCount);
+
+// call func(index) for each set bit of mask, in index order
+template<typename TFunc>
+inline void ForEachVisible(const unsigned __int32* mask, int wordCount, TFunc func)
+{
+	for (int w = 0; w < wordCount; ++w)
+	{
+		for (unsigned __int32 bits = mask[w]; bits; bits &= bits - 1)
+		{
+			unsigned long bit;
+			_BitScanForward(&bit, bits);
+			func(w * 32 + (int)bit);
+		}
+	}
+}
@@ -9,6 +9,7 @@
 #include <stdio.h>
 
 #include "Texture.h"
+#include "GLState.h"
 
 class FrameBuffer
 {
@@ -16,7 +17,7 @@ public:
 	
 	inline void Bind(GLenum target = GL_FRAMEBUFFER)
 	{
-		glBindFramebuffer(target, frameBufferID);
+		gGLState.BindFramebuffer(target, frameBufferID);
 	}
 
 	void StartSetup()
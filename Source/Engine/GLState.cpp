@@ -0,0 +1,402 @@
+
+#include <string.h>
+
+#include "GLState.h"
+
+GLStateCache gGLState;
+
+// value of unknown state, never a valid enum or object name
+static const GLuint gUnknownGLValue = 0xFFFFFFFF;
+static const GLboolean gUnknownGLBoolean = 0xFF;
+
+GLStateCache::GLStateCache()
+	: currentPass(-1)
+{
+	Invalidate();
+}
+
+void GLStateCache::Invalidate()
+{
+	for (int i = 0; i < CapCount; ++i)
+		caps[i] = -1;
+
+	for (int i = 0; i < 4; ++i)
+		colorMask[i] = gUnknownGLBoolean;
+	depthFunc = gUnknownGLValue;
+	depthMask = gUnknownGLBoolean;
+	stencilFunc = gUnknownGLValue;
+	stencilRef = 0;
+	stencilFuncMask = 0;
+	for (int i = 0; i < 3; ++i)
+		stencilOp[i] = gUnknownGLValue;
+	stencilMask = 0;
+	bStencilMaskValid = false;
+	cullFaceMode = gUnknownGLValue;
+	for (int i = 0; i < 2; ++i)
+		blendEquation[i] = gUnknownGLValue;
+	for (int i = 0; i < 4; ++i)
+		blendFunc[i] = gUnknownGLValue;
+	viewport[0] = viewport[1] = 0;
+	viewport[2] = viewport[3] = -1;
+
+	program = gUnknownGLValue;
+	VAO = gUnknownGLValue;
+	drawFrameBuffer = gUnknownGLValue;
+	readFrameBuffer = gUnknownGLValue;
+	activeTextureUnit = gUnknownGLValue;
+	for (int i = 0; i < maxTextureUnits; ++i)
+		for (int t = 0; t < TextureTargetCount; ++t)
+			textures[i][t] = gUnknownGLValue;
+	for (int i = 0; i < maxImageUnits; ++i)
+		images[i].texture = gUnknownGLValue;
+	for (int i = 0; i < maxBufferBindings; ++i)
+	{
+		uniformBuffers[i].buffer = gUnknownGLValue;
+		storageBuffers[i].buffer = gUnknownGLValue;
+	}
+}
+
+void GLStateCache::InvalidateTexture(GLuint texture)
+{
+	for (int i = 0; i < maxTextureUnits; ++i)
+		for (int t = 0; t < TextureTargetCount; ++t)
+			if (textures[i][t] == texture)
+				textures[i][t] = gUnknownGLValue;
+	for (int i = 0; i < maxImageUnits; ++i)
+		if (images[i].texture == texture)
+			images[i].texture = gUnknownGLValue;
+}
+
+void GLStateCache::InvalidateBuffer(GLuint buffer)
+{
+	for (int i = 0; i < maxBufferBindings; ++i)
+	{
+		if (uniformBuffers[i].buffer == buffer)
+			uniformBuffers[i].buffer = gUnknownGLValue;
+		if (storageBuffers[i].buffer == buffer)
+			storageBuffers[i].buffer = gUnknownGLValue;
+	}
+}
+
+void GLStateCache::InvalidateProgram(GLuint inProgram)
+{
+	if (program == inProgram)
+		program = gUnknownGLValue;
+}
+
+void GLStateCache::InvalidateVertexArray(GLuint inVAO)
+{
+	if (VAO == inVAO)
+		VAO = gUnknownGLValue;
+}
+
+void GLStateCache::BeginFrame()
+{
+	lastFrameStats = stats;
+	stats.total = GLStateCounters();
+	// keep pass order stable between frames
+	for (int i = 0, ni = (int)stats.passes.size(); i < ni; ++i)
+		stats.passes[i].counters = GLStateCounters();
+	currentPass = -1;
+}
+
+int GLStateCache::BeginPass(const char* name)
+{
+	int prevPass = currentPass;
+	currentPass = -1;
+	for (int i = 0, ni = (int)stats.passes.size(); i < ni; ++i)
+	{
+		if (stats.passes[i].name == name || strcmp(stats.passes[i].name, name) == 0)
+		{
+			currentPass = i;
+			break;
+		}
+	}
+	if (currentPass < 0)
+	{
+		GLStatePassStats pass;
+		pass.name = name;
+		stats.passes.push_back(pass);
+		currentPass = (int)stats.passes.size() - 1;
+	}
+	return prevPass;
+}
+
+void GLStateCache::EndPass(int prevPass)
+{
+	currentPass = prevPass;
+}
+
+int GLStateCache::GetCapIndex(GLenum cap)
+{
+	switch (cap)
+	{
+	case GL_DEPTH_TEST: return CapDepthTest;
+	case GL_STENCIL_TEST: return CapStencilTest;
+	case GL_CULL_FACE: return CapCullFace;
+	case GL_BLEND: return CapBlend;
+	case GL_SCISSOR_TEST: return CapScissorTest;
+	case GL_CLIP_DISTANCE0: return CapClipDistance0;
+	case GL_CLIP_DISTANCE1: return CapClipDistance1;
+	case GL_CLIP_DISTANCE2: return CapClipDistance2;
+	case GL_CLIP_DISTANCE3: return CapClipDistance3;
+	}
+	return -1;
+}
+
+int GLStateCache::GetTextureTargetIndex(GLenum target)
+{
+	switch (target)
+	{
+	case GL_TEXTURE_2D: return Texture2D;
+	case GL_TEXTURE_2D_ARRAY: return Texture2DArray;
+	case GL_TEXTURE_CUBE_MAP: return TextureCube;
+	case GL_TEXTURE_CUBE_MAP_ARRAY: return TextureCubeArray;
+	case GL_TEXTURE_3D: return Texture3D;
+	}
+	return -1;
+}
+
+void GLStateCache::Enable(GLenum cap)
+{
+	int idx = GetCapIndex(cap);
+	if (Check(idx < 0 || caps[idx] != 1))
+	{
+		glEnable(cap);
+		if (idx >= 0)
+			caps[idx] = 1;
+	}
+}
+
+void GLStateCache::Disable(GLenum cap)
+{
+	int idx = GetCapIndex(cap);
+	if (Check(idx < 0 || caps[idx] != 0))
+	{
+		glDisable(cap);
+		if (idx >= 0)
+			caps[idx] = 0;
+	}
+}
+
+void GLStateCache::ColorMask(GLboolean r, GLboolean g, GLboolean b, GLboolean a)
+{
+	if (Check(colorMask[0] != r || colorMask[1] != g || colorMask[2] != b || colorMask[3] != a))
+	{
+		glColorMask(r, g, b, a);
+		colorMask[0] = r;
+		colorMask[1] = g;
+		colorMask[2] = b;
+		colorMask[3] = a;
+	}
+}
+
+void GLStateCache::DepthFunc(GLenum func)
+{
+	if (Check(depthFunc != func))
+	{
+		glDepthFunc(func);
+		depthFunc = func;
+	}
+}
+
+void GLStateCache::DepthMask(GLboolean flag)
+{
+	if (Check(depthMask != flag))
+	{
+		glDepthMask(flag);
+		depthMask = flag;
+	}
+}
+
+void GLStateCache::StencilFunc(GLenum func, GLint ref, GLuint mask)
+{
+	if (Check(stencilFunc != func || stencilRef != ref || stencilFuncMask != mask))
+	{
+		glStencilFunc(func, ref, mask);
+		stencilFunc = func;
+		stencilRef = ref;
+		stencilFuncMask = mask;
+	}
+}
+
+void GLStateCache::StencilOp(GLenum sfail, GLenum dpfail, GLenum dppass)
+{
+	if (Check(stencilOp[0] != sfail || stencilOp[1] != dpfail || stencilOp[2] != dppass))
+	{
+		glStencilOp(sfail, dpfail, dppass);
+		stencilOp[0] = sfail;
+		stencilOp[1] = dpfail;
+		stencilOp[2] = dppass;
+	}
+}
+
+void GLStateCache::StencilMask(GLuint mask)
+{
+	if (Check(!bStencilMaskValid || stencilMask != mask))
+	{
+		glStencilMask(mask);
+		stencilMask = mask;
+		bStencilMaskValid = true;
+	}
+}
+
+void GLStateCache::CullFace(GLenum mode)
+{
+	if (Check(cullFaceMode != mode))
+	{
+		glCullFace(mode);
+		cullFaceMode = mode;
+	}
+}
+
+void GLStateCache::BlendEquationSeparate(GLenum modeRGB, GLenum modeAlpha)
+{
+	if (Check(blendEquation[0] != modeRGB || blendEquation[1] != modeAlpha))
+	{
+		glBlendEquationSeparate(modeRGB, modeAlpha);
+		blendEquation[0] = modeRGB;
+		blendEquation[1] = modeAlpha;
+	}
+}
+
+void GLStateCache::BlendFuncSeparate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha)
+{
+	if (Check(blendFunc[0] != srcRGB || blendFunc[1] != dstRGB || blendFunc[2] != srcAlpha || blendFunc[3] != dstAlpha))
+	{
+		glBlendFuncSeparate(srcRGB, dstRGB, srcAlpha, dstAlpha);
+		blendFunc[0] = srcRGB;
+		blendFunc[1] = dstRGB;
+		blendFunc[2] = srcAlpha;
+		blendFunc[3] = dstAlpha;
+	}
+}
+
+void GLStateCache::Viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	if (Check(viewport[0] != x || viewport[1] != y || viewport[2] != width || viewport[3] != height))
+	{
+		glViewport(x, y, width, height);
+		viewport[0] = x;
+		viewport[1] = y;
+		viewport[2] = width;
+		viewport[3] = height;
+	}
+}
+
+void GLStateCache::UseProgram(GLuint inProgram)
+{
+	if (Check(program != inProgram))
+	{
+		glUseProgram(inProgram);
+		program = inProgram;
+	}
+}
+
+void GLStateCache::BindVertexArray(GLuint inVAO)
+{
+	if (Check(VAO != inVAO))
+	{
+		glBindVertexArray(inVAO);
+		VAO = inVAO;
+	}
+}
+
+void GLStateCache::BindFramebuffer(GLenum target, GLuint frameBuffer)
+{
+	bool bDraw = (target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER);
+	bool bRead = (target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER);
+	if (Check((bDraw && drawFrameBuffer != frameBuffer) || (bRead && readFrameBuffer != frameBuffer)))
+	{
+		glBindFramebuffer(target, frameBuffer);
+		if (bDraw)
+			drawFrameBuffer = frameBuffer;
+		if (bRead)
+			readFrameBuffer = frameBuffer;
+	}
+}
+
+void GLStateCache::ActiveTexture(GLuint unit)
+{
+	if (activeTextureUnit != unit)
+	{
+		glActiveTexture(GL_TEXTURE0 + unit);
+		activeTextureUnit = unit;
+		++stats.total.issued;
+		if (currentPass >= 0)
+			++stats.passes[currentPass].counters.issued;
+	}
+}
+
+void GLStateCache::BindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+	int targetIdx = GetTextureTargetIndex(target);
+	bool bCached = unit < maxTextureUnits && targetIdx >= 0;
+	if (Check(!bCached || textures[unit][targetIdx] != texture))
+	{
+		ActiveTexture(unit);
+		glBindTexture(target, texture);
+		if (bCached)
+			textures[unit][targetIdx] = texture;
+	}
+}
+
+void GLStateCache::BindTexture(GLenum target, GLuint texture)
+{
+	if (activeTextureUnit == gUnknownGLValue)
+	{
+		// texture setup before anything is bound, pick unit 0
+		ActiveTexture(0);
+	}
+	BindTexture(activeTextureUnit, target, texture);
+}
+
+void GLStateCache::BindImageTexture(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format)
+{
+	bool bCached = unit < maxImageUnits;
+	ImageBinding* image = bCached ? &images[unit] : 0;
+	if (Check(!bCached || image->texture != texture || image->level != level || image->layered != layered ||
+		image->layer != layer || image->access != access || image->format != format))
+	{
+		glBindImageTexture(unit, texture, level, layered, layer, access, format);
+		if (bCached)
+		{
+			image->texture = texture;
+			image->level = level;
+			image->layered = layered;
+			image->layer = layer;
+			image->access = access;
+			image->format = format;
+		}
+	}
+}
+
+void GLStateCache::BindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+	BindBufferRange(target, index, buffer, 0, -1);
+}
+
+void GLStateCache::BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	BufferBinding* binding = 0;
+	if (index < maxBufferBindings)
+	{
+		if (target == GL_UNIFORM_BUFFER)
+			binding = &uniformBuffers[index];
+		else if (target == GL_SHADER_STORAGE_BUFFER)
+			binding = &storageBuffers[index];
+	}
+	if (Check(!binding || binding->buffer != buffer || binding->offset != offset || binding->size != size))
+	{
+		if (size < 0)
+			glBindBufferBase(target, index, buffer);
+		else
+			glBindBufferRange(target, index, buffer, offset, size);
+		if (binding)
+		{
+			binding->buffer = buffer;
+			binding->offset = offset;
+			binding->size = size;
+		}
+	}
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+// glew
+#include "gl/glew.h"
+
+// opengl
+#include "SDL_opengl.h"
+
+#include "Containers/Containers.h"
+
+#define GL_STATE_SCOPED_PASS(name) ScopedGLStatePass _gl_state_pass(name)
+
+struct GLStateCounters
+{
+	// calls sent to GL, and calls dropped because GL already had that state
+	int issued = 0;
+	int filtered = 0;
+};
+
+struct GLStatePassStats
+{
+	const char* name;
+	GLStateCounters counters;
+};
+
+struct GLStateStats
+{
+	GLStateCounters total;
+	// by pass in first use order, calls outside any pass are only in total
+	REArray<GLStatePassStats> passes;
+};
+
+// shadow copy of the GL state the engine touches, every state change and binding goes through here
+// and is only sent to GL when it differs from the copy.
+// anything changing GL state behind it (ImGui, object deletion) must call Invalidate() or the matching Invalidate*()
+class GLStateCache
+{
+public:
+	static const int maxTextureUnits = 32;
+	static const int maxImageUnits = 8;
+	static const int maxBufferBindings = 16;
+
+	GLStateCache();
+
+	// forget all, next call of each state goes to GL
+	void Invalidate();
+	// forget bindings of a deleted object, GL resets them to 0
+	void InvalidateTexture(GLuint texture);
+	void InvalidateBuffer(GLuint buffer);
+	void InvalidateProgram(GLuint program);
+	void InvalidateVertexArray(GLuint VAO);
+
+	// move this frame's stats to lastFrameStats
+	void BeginFrame();
+	// pass counters are kept by name, returns previous pass for EndPass()
+	int BeginPass(const char* name);
+	void EndPass(int prevPass);
+
+	// capabilities, GL_DEPTH_TEST, GL_STENCIL_TEST, GL_CULL_FACE, GL_BLEND, GL_SCISSOR_TEST, GL_CLIP_DISTANCE0-3 are cached
+	void Enable(GLenum cap);
+	void Disable(GLenum cap);
+	inline void SetEnabled(GLenum cap, bool bEnabled) { bEnabled ? Enable(cap) : Disable(cap); }
+
+	void ColorMask(GLboolean r, GLboolean g, GLboolean b, GLboolean a);
+	void DepthFunc(GLenum func);
+	void DepthMask(GLboolean flag);
+	void StencilFunc(GLenum func, GLint ref, GLuint mask);
+	void StencilOp(GLenum sfail, GLenum dpfail, GLenum dppass);
+	void StencilMask(GLuint mask);
+	void CullFace(GLenum mode);
+	void BlendEquationSeparate(GLenum modeRGB, GLenum modeAlpha);
+	void BlendFuncSeparate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha);
+	inline void BlendFunc(GLenum src, GLenum dst) { BlendFuncSeparate(src, dst, src, dst); }
+	void Viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+	void UseProgram(GLuint program);
+	void BindVertexArray(GLuint VAO);
+	// GL_FRAMEBUFFER sets both draw and read
+	void BindFramebuffer(GLenum target, GLuint frameBuffer);
+	void BindTexture(GLuint unit, GLenum target, GLuint texture);
+	// on active unit, for texture setup
+	void BindTexture(GLenum target, GLuint texture);
+	void BindImageTexture(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format);
+	// GL_UNIFORM_BUFFER and GL_SHADER_STORAGE_BUFFER indexed bindings are cached
+	void BindBufferBase(GLenum target, GLuint index, GLuint buffer);
+	void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+	GLStateStats stats;
+	GLStateStats lastFrameStats;
+
+protected:
+	enum ECap
+	{
+		CapDepthTest,
+		CapStencilTest,
+		CapCullFace,
+		CapBlend,
+		CapScissorTest,
+		CapClipDistance0,
+		CapClipDistance1,
+		CapClipDistance2,
+		CapClipDistance3,
+		CapCount,
+	};
+
+	enum ETextureTarget
+	{
+		Texture2D,
+		Texture2DArray,
+		TextureCube,
+		TextureCubeArray,
+		Texture3D,
+		TextureTargetCount,
+	};
+
+	struct ImageBinding
+	{
+		GLuint texture;
+		GLint level;
+		GLboolean layered;
+		GLint layer;
+		GLenum access;
+		GLenum format;
+	};
+
+	struct BufferBinding
+	{
+		GLuint buffer;
+		// size -1 for whole buffer
+		GLintptr offset;
+		GLsizeiptr size;
+	};
+
+	static int GetCapIndex(GLenum cap);
+	static int GetTextureTargetIndex(GLenum target);
+
+	// count a call, true if it has to go to GL
+	inline bool Check(bool bChanged)
+	{
+		GLStateCounters* passCounters = currentPass >= 0 ? &stats.passes[currentPass].counters : 0;
+		if (bChanged)
+		{
+			++stats.total.issued;
+			if (passCounters)
+				++passCounters->issued;
+		}
+		else
+		{
+			++stats.total.filtered;
+			if (passCounters)
+				++passCounters->filtered;
+		}
+		return bChanged;
+	}
+
+	void ActiveTexture(GLuint unit);
+
+	// -1 unknown, 0 disabled, 1 enabled
+	signed char caps[CapCount];
+
+	// unknown state uses values GL never takes
+	GLboolean colorMask[4];
+	GLenum depthFunc;
+	GLboolean depthMask;
+	GLenum stencilFunc;
+	GLint stencilRef;
+	GLuint stencilFuncMask;
+	GLenum stencilOp[3];
+	GLuint stencilMask;
+	bool bStencilMaskValid;
+	GLenum cullFaceMode;
+	GLenum blendEquation[2];
+	GLenum blendFunc[4];
+	GLint viewport[4];
+
+	GLuint program;
+	GLuint VAO;
+	GLuint drawFrameBuffer;
+	GLuint readFrameBuffer;
+	GLuint activeTextureUnit;
+	GLuint textures[maxTextureUnits][TextureTargetCount];
+	ImageBinding images[maxImageUnits];
+	BufferBinding uniformBuffers[maxBufferBindings];
+	BufferBinding storageBuffers[maxBufferBindings];
+
+	int currentPass;
+};
+
+extern GLStateCache gGLState;
+
+class ScopedGLStatePass
+{
+	int prevPass;
+
+public:
+	ScopedGLStatePass(const char* name)
+	{
+		prevPass = gGLState.BeginPass(name);
+	}
+
+	~ScopedGLStatePass()
+	{
+		gGLState.EndPass(prevPass);
+	}
+};
@@ -0,0 +1,390 @@
+
+#include "Render.h"
+
+#include "Mesh.h"
+#include "MeshComponent.h"
+#include "GeometryArena.h"
+#include "TransformSystem.h"
+#include "GLState.h"
+
+#include "GPUCulling.h"
+
+// SDL
+#include "SDL.h"
+
+GPUCulling gGPUCulling;
+
+// hi-Z reduce and culling group sizes, must match Shader/hiZReduce.comp and Shader/gpuCulling.comp
+static const int gHiZGroupSize = 8;
+static const int gCullGroupSize = 64;
+
+GPUCulling::GPUCulling()
+	: updateTime(0)
+	, uploadCount(0)
+	, componentCount(-1)
+	, bIndirectCount(false)
+	, drawBuffer(0)
+	, drawDataBuffer(0)
+	, lodBuffer(0)
+	, commandBuffer(0)
+	, countBuffer(0)
+	, hiZWidth(0)
+	, hiZHeight(0)
+{
+}
+
+bool GPUCulling::IsGPUDriven(const Mesh* mesh)
+{
+	const Material* material = mesh->material;
+	return mesh->meshData && material && material->shader && !material->bAlphaBlend && !material->bMasked &&
+		material->shader->multiDrawLocation >= 0 && gGeometryArena.IsArenaVAO(mesh->meshData->VAO);
+}
+
+void GPUCulling::Update()
+{
+	Uint64 updateStart = SDL_GetPerformanceCounter();
+	uploadCount = 0;
+
+	if (!drawBuffer)
+	{
+		bIndirectCount = GLEW_ARB_indirect_parameters != 0;
+		glGenBuffers(1, &drawBuffer);
+		glGenBuffers(1, &drawDataBuffer);
+		glGenBuffers(1, &lodBuffer);
+		glGenBuffers(1, &commandBuffer);
+		glGenBuffers(1, &countBuffer);
+	}
+
+	// components moved this and last frame, the ones moved last frame get new prevModelMat
+	static REArray<int> dirtyIndices;
+	dirtyIndices = movedIndices;
+	movedIndices.clear();
+	for (int k = 0, nk = gTransformSystem.GetLastUpdateCount(); k < nk; ++k)
+	{
+		MeshComponent* meshComp = gTransformSystem.GetLastUpdatedOwner(k);
+		if (meshComp && meshComp->GetCullingIndex() >= 0)
+		{
+			movedIndices.push_back(meshComp->GetCullingIndex());
+			dirtyIndices.push_back(meshComp->GetCullingIndex());
+		}
+	}
+
+	// components are only ever added
+	if (componentCount != (int)MeshComponent::gMeshComponentContainer.size())
+	{
+		Rebuild();
+		UploadAll();
+	}
+	else if ((int)dirtyIndices.size() * 4 > componentCount)
+	{
+		for (int i = 0, ni = (int)dirtyIndices.size(); i < ni; ++i)
+			UpdateComponent(dirtyIndices[i]);
+		UploadAll();
+	}
+	else
+	{
+		for (int i = 0, ni = (int)dirtyIndices.size(); i < ni; ++i)
+		{
+			int c = dirtyIndices[i];
+			const ComponentDraws& range = componentDraws[c];
+			if (range.count == 0)
+				continue;
+			UpdateComponent(c);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, drawBuffer);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(GPUCullDraw) * range.first, sizeof(GPUCullDraw) * range.count, draws.data() + range.first);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, drawDataBuffer);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(MultiDrawData) * range.first, sizeof(MultiDrawData) * range.count, drawData.data() + range.first);
+			uploadCount += range.count;
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	updateTime = (double)(SDL_GetPerformanceCounter() - updateStart) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+void GPUCulling::Rebuild()
+{
+	const REArray<MeshComponent*>& components = MeshComponent::gMeshComponentContainer;
+	componentCount = (int)components.size();
+
+	draws.clear();
+	drawMeshes.clear();
+	lods.clear();
+	batches.clear();
+	componentDraws.resize(componentCount);
+
+	REMap<const MeshData*, int> lodFirstMap;
+	RESortedMap<std::pair<Material*, GLuint>, int> batchMap;
+	for (int c = 0; c < componentCount; ++c)
+	{
+		MeshComponent* meshComp = components[c];
+		ComponentDraws& range = componentDraws[c];
+		range.first = (int)draws.size();
+		range.count = 0;
+
+		const REArray<Mesh*>& meshList = meshComp->GetMeshList();
+		for (int i = 0, ni = (int)meshList.size(); i < ni; ++i)
+		{
+			Mesh* mesh = meshList[i];
+			if (!IsGPUDriven(mesh))
+				continue;
+			const MeshData* meshData = mesh->meshData;
+
+			auto lodIt = lodFirstMap.find(meshData);
+			if (lodIt == lodFirstMap.end())
+			{
+				lodIt = lodFirstMap.emplace(meshData, (int)lods.size()).first;
+				for (int lod = 0, nlod = meshData->GetLODCount(); lod < nlod; ++lod)
+				{
+					GPUCullLOD cullLOD;
+					cullLOD.count = (GLuint)meshData->lods[lod].idxCount;
+					cullLOD.firstIndex = (GLuint)(meshData->firstIndex + meshData->lods[lod].idxOffset);
+					cullLOD.baseVertex = meshData->baseVertex;
+					cullLOD.error = meshData->lods[lod].error;
+					lods.push_back(cullLOD);
+				}
+			}
+
+			auto batchIt = batchMap.find(std::make_pair(mesh->material, meshData->VAO));
+			if (batchIt == batchMap.end())
+			{
+				Batch batch;
+				batch.material = mesh->material;
+				batch.VAO = meshData->VAO;
+				batch.commandOffset = 0;
+				batch.capacity = 0;
+				batchIt = batchMap.emplace(std::make_pair(mesh->material, meshData->VAO), (int)batches.size()).first;
+				batches.push_back(batch);
+			}
+			++batches[batchIt->second].capacity;
+
+			GPUCullDraw draw;
+			draw.batch = (GLuint)batchIt->second;
+			draw.commandOffset = 0;
+			draw.lodFirst = (GLuint)lodIt->second;
+			draw.lodCount = (GLuint)meshData->GetLODCount();
+			draws.push_back(draw);
+			drawMeshes.push_back(mesh);
+			++range.count;
+		}
+	}
+
+	// one command slot per draw, batches in creation order
+	int commandOffset = 0;
+	for (int b = 0, nb = (int)batches.size(); b < nb; ++b)
+	{
+		batches[b].commandOffset = commandOffset;
+		commandOffset += batches[b].capacity;
+	}
+	for (int i = 0, ni = (int)draws.size(); i < ni; ++i)
+		draws[i].commandOffset = (GLuint)batches[draws[i].batch].commandOffset;
+
+	drawData.resize(draws.size());
+	for (int c = 0; c < componentCount; ++c)
+		UpdateComponent(c);
+
+	int drawCount = (int)draws.size();
+	int batchCount = (int)batches.size();
+	gGeometryArena.ReserveDrawIndices(drawCount);
+
+	// at least one element, empty buffers can't be bound
+	glBindBuffer(GL_COPY_WRITE_BUFFER, lodBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GPUCullLOD) * Max((int)lods.size(), 1), lods.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, drawBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GPUCullDraw) * Max(drawCount, 1), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, drawDataBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, sizeof(MultiDrawData) * Max(drawCount, 1), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, commandBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, sizeof(DrawElementsIndirectCommand) * Max(drawCount, 1), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, countBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GLuint) * Max(batchCount, 1), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void GPUCulling::UpdateComponent(int componentIndex)
+{
+	MeshComponent* meshComp = MeshComponent::gMeshComponentContainer[componentIndex];
+	const ComponentDraws& range = componentDraws[componentIndex];
+	const Matrix4& modelMat = meshComp->modelMat;
+	float maxScale = Max(modelMat.mScaledAxisX.Size3(), Max(modelMat.mScaledAxisY.Size3(), modelMat.mScaledAxisZ.Size3()));
+	for (int i = range.first, ni = range.first + range.count; i < ni; ++i)
+	{
+		BoxBounds bounds = drawMeshes[i]->meshData->bounds.GetTransformedBounds(modelMat);
+		draws[i].boundsMin = Vector4(bounds.min, maxScale);
+		draws[i].boundsMax = Vector4(bounds.max, 0.f);
+		drawData[i].modelMat = modelMat;
+		drawData[i].prevModelMat = meshComp->prevModelMat;
+	}
+}
+
+void GPUCulling::UploadAll()
+{
+	int drawCount = (int)draws.size();
+	glBindBuffer(GL_COPY_WRITE_BUFFER, drawBuffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(GPUCullDraw) * drawCount, draws.data());
+	glBindBuffer(GL_COPY_WRITE_BUFFER, drawDataBuffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(MultiDrawData) * drawCount, drawData.data());
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	uploadCount += drawCount;
+}
+
+void GPUCulling::ReleaseHiZ()
+{
+	for (int i = 0, ni = (int)hiZLevels.size(); i < ni; ++i)
+	{
+		gGLState.InvalidateTexture(hiZLevels[i].textureID);
+		glDeleteTextures(1, &hiZLevels[i].textureID);
+	}
+	hiZLevels.clear();
+	if (hiZTex.width > 0)
+	{
+		gGLState.InvalidateTexture(hiZTex.textureID);
+		glDeleteTextures(1, &hiZTex.textureID);
+	}
+	hiZTex = Texture2D();
+}
+
+void GPUCulling::BuildHiZ(RenderContext& renderContext, Material* reduceMaterial, int width, int height)
+{
+	// level 0 is half resolution, texel of level l covers 2^(l+1) pixels
+	int baseWidth = Max(width / 2, 1);
+	int baseHeight = Max(height / 2, 1);
+	if (baseWidth != hiZWidth || baseHeight != hiZHeight)
+	{
+		ReleaseHiZ();
+		hiZWidth = baseWidth;
+		hiZHeight = baseHeight;
+
+		int levelCount = 1;
+		while ((Max(hiZWidth, hiZHeight) >> levelCount) > 0)
+			++levelCount;
+
+		// immutable storage, so each level can have a view to bind as image
+		hiZTex.width = hiZWidth;
+		hiZTex.height = hiZHeight;
+		hiZTex.internalFormat = GL_R32F;
+		hiZTex.format = GL_RED;
+		hiZTex.type = GL_FLOAT;
+		glGenTextures(1, &hiZTex.textureID);
+		gGLState.BindTexture(GL_TEXTURE_2D, hiZTex.textureID);
+		glTexStorage2D(GL_TEXTURE_2D, levelCount, GL_R32F, hiZWidth, hiZHeight);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		hiZLevels.resize(levelCount);
+		for (int l = 0; l < levelCount; ++l)
+		{
+			Texture2D& level = hiZLevels[l];
+			level.width = Max(hiZWidth >> l, 1);
+			level.height = Max(hiZHeight >> l, 1);
+			level.internalFormat = GL_R32F;
+			level.format = GL_RED;
+			level.type = GL_FLOAT;
+			level.access = GL_READ_WRITE;
+			glGenTextures(1, &level.textureID);
+			glTextureView(level.textureID, GL_TEXTURE_2D, hiZTex.textureID, GL_R32F, l, 1, 0, 1);
+		}
+	}
+
+	// each level is the max of 2x2 texels of the level above, level 0 reads depth
+	for (int l = 0, nl = (int)hiZLevels.size(); l < nl; ++l)
+	{
+		Texture2D& level = hiZLevels[l];
+		reduceMaterial->SetParameter("bFromDepth", (GLint)(l == 0));
+		reduceMaterial->SetParameter("srcLevel", &hiZLevels[Max(l - 1, 0)], true);
+		reduceMaterial->SetParameter("dstLevel", &level, true);
+		reduceMaterial->DispatchCompute(renderContext,
+			(level.width + gHiZGroupSize - 1) / gHiZGroupSize, (level.height + gHiZGroupSize - 1) / gHiZGroupSize);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void GPUCulling::Cull(RenderContext& renderContext, Material* cullMaterial, float lodScale, bool bOcclusion)
+{
+	int drawCount = (int)draws.size();
+	renderContext.stats.gpuCullDrawCount = drawCount;
+	if (drawCount == 0)
+		return;
+
+	// counts restart at 0, without indirect count every slot is drawn, culled ones must have no instance
+	GLuint zero = 0;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, countBuffer);
+	glClearBufferData(GL_COPY_WRITE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	if (!bIndirectCount)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, commandBuffer);
+		glClearBufferData(GL_COPY_WRITE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	gGLState.BindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::GPUCullDrawInfo, drawBuffer);
+	gGLState.BindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::GPUCullLODInfo, lodBuffer);
+	gGLState.BindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::GPUCullCommandInfo, commandBuffer);
+	gGLState.BindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::GPUCullCountInfo, countBuffer);
+
+	bOcclusion = bOcclusion && hiZLevels.size() > 0;
+	cullMaterial->SetParameter("drawCount", (GLint)drawCount);
+	cullMaterial->SetParameter("lodScale", lodScale);
+	cullMaterial->SetParameter("bOcclusion", (GLint)bOcclusion);
+	if (bOcclusion)
+	{
+		cullMaterial->SetParameter("hiZTex", &hiZTex);
+		cullMaterial->SetParameter("hiZLevelCount", (GLint)hiZLevels.size());
+	}
+	cullMaterial->DispatchCompute(renderContext, (drawCount + gCullGroupSize - 1) / gCullGroupSize);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void GPUCulling::Draw(RenderContext& renderContext, Material* overrideMaterial)
+{
+	if (draws.size() == 0)
+		return;
+
+	gGLState.BindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::DrawDataInfo, drawDataBuffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	if (bIndirectCount)
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, countBuffer);
+
+	for (int b = 0, nb = (int)batches.size(); b < nb; ++b)
+	{
+		const Batch& batch = batches[b];
+		Material* material = overrideMaterial ? overrideMaterial : batch.material;
+		// shader may have been reloaded without draw data
+		GLint multiDrawLocation = material->shader->multiDrawLocation;
+		if (multiDrawLocation < 0)
+			continue;
+
+		material->Use(renderContext);
+		glUniform1i(multiDrawLocation, 1);
+
+		if (batch.VAO != renderContext.currentVAO)
+		{
+			renderContext.currentVAO = batch.VAO;
+			renderContext.bCompactVertex = MeshData::IsCompactVertexVAO(batch.VAO);
+			gGLState.BindVertexArray(batch.VAO);
+			++renderContext.stats.VAOChangeCount;
+		}
+		material->shader->SetCompactVertex(renderContext.bCompactVertex);
+		if (material->bBothSide && renderContext.currentRenderState->bCullFace)
+			gGLState.Disable(GL_CULL_FACE);
+		GLvoid* commandOffset = (GLvoid*)(batch.commandOffset * sizeof(DrawElementsIndirectCommand));
+		if (bIndirectCount)
+			glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, commandOffset, (GLintptr)(b * sizeof(GLuint)), batch.capacity, 0);
+		else
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, commandOffset, batch.capacity, 0);
+		++renderContext.stats.drawCount;
+		++renderContext.stats.multiDrawCount;
+		if (material->bBothSide && renderContext.currentRenderState->bCullFace)
+			gGLState.Enable(GL_CULL_FACE);
+
+		// single draws of this shader use uniforms
+		glUniform1i(multiDrawLocation, 0);
+	}
+
+	if (bIndirectCount)
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+// glew
+#include "gl/glew.h"
+
+// opengl
+#include "SDL_opengl.h"
+
+#include "Containers/Containers.h"
+#include "Math/REMath.h"
+
+#include "MultiDraw.h"
+#include "Texture2D.h"
+
+class Material;
+class Mesh;
+struct RenderContext;
+
+// per draw entry of the GPU scene, std430, must match Shader/Include/GPUCulling.incl
+struct GPUCullDraw
+{
+	Vector4 boundsMin; // xyz world bounds, w max scale of model matrix
+	Vector4 boundsMax;
+	GLuint batch;
+	// first slot of the batch in the command buffer
+	GLuint commandOffset;
+	// LODs of the mesh in the LOD buffer
+	GLuint lodFirst;
+	GLuint lodCount;
+};
+
+// per mesh data LOD, std430, must match Shader/Include/GPUCulling.incl
+struct GPUCullLOD
+{
+	GLuint count;
+	GLuint firstIndex;
+	GLint baseVertex;
+	float error;
+};
+
+// visibility and draw commands of opaque meshes computed on GPU.
+// every mesh of every component that IsGPUDriven() has a persistent draw entry with world bounds and draw data,
+// rebuilt when components are added, otherwise only entries of components moved this or last frame are uploaded.
+// Cull() runs a compute shader, one thread per draw, frustum culls and optionally occlusion culls against a Hi-Z pyramid
+// of last frame's depth (reprojected with last frame's view, one frame late for things coming into view behind occluders),
+// picks the LOD and appends a command to its batch, so commands of each batch are compacted at the batch's offset.
+// batches are draws of the same material and VAO, Draw() makes one glMultiDrawElementsIndirectCount call per batch,
+// with count read from the count buffer. without ARB_indirect_parameters (Mesa llvmpipe may not have it) the command
+// buffer is cleared before culling and every slot of the batch is drawn, unused ones have no instance.
+// command baseInstance is the draw index, draw data is read through the arena draw index attribute like MultiDrawList
+class GPUCulling
+{
+public:
+	GPUCulling();
+
+	// opaque arena mesh whose shader reads draw data
+	static bool IsGPUDriven(const Mesh* mesh);
+
+	bool HasIndirectCount() const { return bIndirectCount; }
+
+	// sync draw table with the scene and upload changed entries
+	void Update();
+
+	// max depth pyramid of depth bound at Shader::gDepthStencilTexUnit, before it is cleared for this frame.
+	// reduceMaterial runs Shader/hiZReduce.comp
+	void BuildHiZ(RenderContext& renderContext, Material* reduceMaterial, int width, int height);
+	// cullMaterial runs Shader/gpuCulling.comp. lodScale is pixels per world unit at distance 1 over max screen error, 0 for LOD0.
+	// bOcclusion tests against the pyramid of the last BuildHiZ(), only call it when depth has last frame's view
+	void Cull(RenderContext& renderContext, Material* cullMaterial, float lodScale, bool bOcclusion);
+
+	// draw culled commands of all batches, with each batch's material or overrideMaterial
+	void Draw(RenderContext& renderContext, Material* overrideMaterial = 0);
+
+	int GetDrawCount() const { return (int)draws.size(); }
+	int GetBatchCount() const { return (int)batches.size(); }
+
+	// ms, last Update()
+	double updateTime;
+	// entries uploaded by last Update()
+	int uploadCount;
+
+protected:
+	struct Batch
+	{
+		Material* material;
+		GLuint VAO;
+		int commandOffset;
+		int capacity;
+	};
+
+	// first draw and draw count of a component, by culling index
+	struct ComponentDraws
+	{
+		int first;
+		int count;
+	};
+
+	void Rebuild();
+	void UpdateComponent(int componentIndex);
+	void UploadAll();
+	void ReleaseHiZ();
+
+	REArray<GPUCullDraw, 16> draws;
+	REArray<Mesh*> drawMeshes;
+	REArray<MultiDrawData, 16> drawData;
+	REArray<GPUCullLOD> lods;
+	REArray<Batch> batches;
+	REArray<ComponentDraws> componentDraws;
+	// culling indices moved last frame
+	REArray<int> movedIndices;
+	int componentCount;
+	bool bIndirectCount;
+
+	GLuint drawBuffer;
+	GLuint drawDataBuffer;
+	GLuint lodBuffer;
+	GLuint commandBuffer;
+	GLuint countBuffer;
+
+	// max depth pyramid, and a view of each level to write it as image
+	Texture2D hiZTex;
+	REArray<Texture2D> hiZLevels;
+	int hiZWidth;
+	int hiZHeight;
+};
+
+extern GPUCulling gGPUCulling;
@@ -0,0 +1,173 @@
+
+#include "Mesh.h"
+#include "GLState.h"
+
+#include "GeometryArena.h"
+
+GeometryArena gGeometryArena;
+
+// initial capacity in elements
+static const int gArenaInitVertexCapacity = 64 * 1024;
+static const int gArenaInitIndexCapacity = 256 * 1024;
+static const int gArenaInitDrawIndexCapacity = 4096;
+
+GeometryArena::GeometryArena()
+	: drawIndexVBO(0)
+	, drawIndexCapacity(0)
+{
+	memset(pools, 0, sizeof(pools));
+}
+
+GeometryRange GeometryArena::Allocate(EVertexFormat format, const void* vertexData, int vertexCount, const GLuint* indexData, int indexCount)
+{
+	Pool& pool = pools[(int)format];
+	if (!pool.VAO)
+		InitPool(format);
+
+	// grow, VAO keeps its id, only attributes are pointed to the new buffers
+	if (pool.vertexCount + vertexCount > pool.vertexCapacity || pool.indexCount + indexCount > pool.indexCapacity)
+	{
+		int newVertexCapacity = pool.vertexCapacity;
+		while (pool.vertexCount + vertexCount > newVertexCapacity)
+			newVertexCapacity *= 2;
+		int newIndexCapacity = pool.indexCapacity;
+		while (pool.indexCount + indexCount > newIndexCapacity)
+			newIndexCapacity *= 2;
+
+		if (newVertexCapacity != pool.vertexCapacity)
+		{
+			GrowBuffer(pool.VBO, pool.vertexStride, pool.vertexCount, newVertexCapacity);
+			pool.vertexCapacity = newVertexCapacity;
+		}
+		if (newIndexCapacity != pool.indexCapacity)
+		{
+			GrowBuffer(pool.EBO, sizeof(GLuint), pool.indexCount, newIndexCapacity);
+			pool.indexCapacity = newIndexCapacity;
+		}
+		SetupPoolVAO(format);
+		gGLState.BindVertexArray(0);
+	}
+
+	GeometryRange range;
+	range.baseVertex = pool.vertexCount;
+	range.firstIndex = pool.indexCount;
+
+	glBindBuffer(GL_ARRAY_BUFFER, pool.VBO);
+	glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)pool.vertexCount * pool.vertexStride, (GLsizeiptr)vertexCount * pool.vertexStride, vertexData);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	// don't touch element buffer binding of whatever VAO is bound
+	glBindBuffer(GL_COPY_WRITE_BUFFER, pool.EBO);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)pool.indexCount * sizeof(GLuint), (GLsizeiptr)indexCount * sizeof(GLuint), indexData);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	pool.vertexCount += vertexCount;
+	pool.indexCount += indexCount;
+	++pool.meshCount;
+	return range;
+}
+
+bool GeometryArena::IsArenaVAO(GLuint VAO) const
+{
+	for (int i = 0; i < (int)EVertexFormat::Count; ++i)
+	{
+		if (pools[i].VAO && pools[i].VAO == VAO)
+			return true;
+	}
+	return false;
+}
+
+void GeometryArena::ReserveDrawIndices(int count)
+{
+	if (count <= drawIndexCapacity)
+		return;
+
+	int newCapacity = Max(drawIndexCapacity, gArenaInitDrawIndexCapacity);
+	while (newCapacity < count)
+		newCapacity *= 2;
+
+	REArray<GLuint> drawIndices;
+	drawIndices.resize(newCapacity);
+	for (int i = 0; i < newCapacity; ++i)
+		drawIndices[i] = (GLuint)i;
+
+	if (!drawIndexVBO)
+		glGenBuffers(1, &drawIndexVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, drawIndexVBO);
+	glBufferData(GL_ARRAY_BUFFER, newCapacity * sizeof(GLuint), drawIndices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	drawIndexCapacity = newCapacity;
+}
+
+GeometryArenaStats GeometryArena::GetStats() const
+{
+	GeometryArenaStats stats;
+	stats.meshCount = 0;
+	stats.usedBytes = 0;
+	stats.capacityBytes = 0;
+	for (int i = 0; i < (int)EVertexFormat::Count; ++i)
+	{
+		const Pool& pool = pools[i];
+		stats.meshCount += pool.meshCount;
+		stats.usedBytes += (size_t)pool.vertexCount * pool.vertexStride + (size_t)pool.indexCount * sizeof(GLuint);
+		stats.capacityBytes += (size_t)pool.vertexCapacity * pool.vertexStride + (size_t)pool.indexCapacity * sizeof(GLuint);
+	}
+	return stats;
+}
+
+void GeometryArena::InitPool(EVertexFormat format)
+{
+	Pool& pool = pools[(int)format];
+	pool.vertexStride = (format == EVertexFormat::Compact) ? sizeof(CompactVertex) : sizeof(Vertex);
+	pool.vertexCount = 0;
+	pool.vertexCapacity = gArenaInitVertexCapacity;
+	pool.indexCount = 0;
+	pool.indexCapacity = gArenaInitIndexCapacity;
+	pool.meshCount = 0;
+
+	ReserveDrawIndices(gArenaInitDrawIndexCapacity);
+
+	glGenVertexArrays(1, &pool.VAO);
+	glGenBuffers(1, &pool.VBO);
+	glGenBuffers(1, &pool.EBO);
+
+	glBindBuffer(GL_ARRAY_BUFFER, pool.VBO);
+	glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)pool.vertexCapacity * pool.vertexStride, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, pool.EBO);
+	glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)pool.indexCapacity * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	SetupPoolVAO(format);
+	gGLState.BindVertexArray(0);
+	MeshData::RegisterCompactVertexVAO(pool.VAO, format == EVertexFormat::Compact);
+}
+
+void GeometryArena::SetupPoolVAO(EVertexFormat format)
+{
+	Pool& pool = pools[(int)format];
+	gGLState.BindVertexArray(pool.VAO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.EBO);
+	glBindBuffer(GL_ARRAY_BUFFER, pool.VBO);
+	MeshData::SetupVertexAttributes(format == EVertexFormat::Compact);
+
+	// draw index
+	glBindBuffer(GL_ARRAY_BUFFER, drawIndexVBO);
+	glEnableVertexAttribArray(drawIndexIdx);
+	glVertexAttribIPointer(drawIndexIdx, 1, GL_UNSIGNED_INT, sizeof(GLuint), (GLvoid*)0);
+	glVertexAttribDivisor(drawIndexIdx, 1);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void GeometryArena::GrowBuffer(GLuint& buffer, int elementSize, int count, int newCapacity)
+{
+	GLuint newBuffer;
+	glGenBuffers(1, &newBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)newCapacity * elementSize, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (GLsizeiptr)count * elementSize);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glDeleteBuffers(1, &buffer);
+	buffer = newBuffer;
+}
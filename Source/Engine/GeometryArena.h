@@ -0,0 +1,83 @@
+#pragma once
+
+// glew
+#include "gl/glew.h"
+
+// opengl
+#include "SDL_opengl.h"
+
+#include "Containers/Containers.h"
+
+enum class EVertexFormat
+{
+	Full,		// Vertex
+	Compact,	// CompactVertex
+	Count,
+};
+
+// place of a mesh in the arena
+struct GeometryRange
+{
+	GLint baseVertex;
+	GLsizei firstIndex;
+};
+
+struct GeometryArenaStats
+{
+	int meshCount;
+	size_t usedBytes;
+	size_t capacityBytes;
+};
+
+// one vertex buffer and one index buffer per vertex format, meshes are sub allocated ranges of them.
+// all meshes of a format share one VAO, so their draws only differ in first index and base vertex,
+// and a render list can go out as glMultiDrawElementsIndirect batches, see MultiDraw.h.
+// buffers grow by doubling, old content is copied on GPU. ranges are never freed, meshes live for the whole run.
+// each VAO also has an instanced draw index attribute (drawIndexIdx, divisor 1) reading 0, 1, 2 ...,
+// so a multi draw command with baseInstance i and 1 instance reads draw index i,
+// which gives gl_DrawID like indexing without GL 4.6 or ARB_shader_draw_parameters
+class GeometryArena
+{
+public:
+	static const GLint drawIndexIdx = 5;
+
+	GeometryArena();
+
+	// copy vertices (of format) and indices into the arena, indices are relative to the mesh
+	GeometryRange Allocate(EVertexFormat format, const void* vertexData, int vertexCount, const GLuint* indexData, int indexCount);
+
+	GLuint GetVAO(EVertexFormat format) const { return pools[(int)format].VAO; }
+	bool IsArenaVAO(GLuint VAO) const;
+
+	// make draw index attribute cover draw indices [0, count)
+	void ReserveDrawIndices(int count);
+
+	GeometryArenaStats GetStats() const;
+
+protected:
+	struct Pool
+	{
+		GLuint VAO;
+		GLuint VBO;
+		GLuint EBO;
+		int vertexStride;
+		int vertexCount;
+		int vertexCapacity;
+		int indexCount;
+		int indexCapacity;
+		int meshCount;
+	};
+
+	void InitPool(EVertexFormat format);
+	// bind VAO and point its attributes to current buffers
+	void SetupPoolVAO(EVertexFormat format);
+	// grow buffer to newCapacity elements, keep first count elements
+	static void GrowBuffer(GLuint& buffer, int elementSize, int count, int newCapacity);
+
+	Pool pools[(int)EVertexFormat::Count];
+
+	GLuint drawIndexVBO;
+	int drawIndexCapacity;
+};
+
+extern GeometryArena gGeometryArena;
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// glew
+#include "gl/glew.h"
+
+#include "Headless.h"
+
+bool ParseHeadlessArgs(int argc, char** argv, HeadlessSettings& outSettings)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		bool bHasValue = i + 1 < argc;
+		if (strcmp(arg, "-headless") == 0)
+			outSettings.bEnabled = true;
+		else if (strcmp(arg, "-ui") == 0)
+			outSettings.bUI = true;
+		else if (strcmp(arg, "-frames") == 0 && bHasValue)
+			outSettings.frameCount = atoi(argv[++i]);
+		else if (strcmp(arg, "-warmup") == 0 && bHasValue)
+			outSettings.warmupFrameCount = atoi(argv[++i]);
+		else if (strcmp(arg, "-width") == 0 && bHasValue)
+			outSettings.width = atoi(argv[++i]);
+		else if (strcmp(arg, "-height") == 0 && bHasValue)
+			outSettings.height = atoi(argv[++i]);
+		else if (strcmp(arg, "-report") == 0 && bHasValue)
+			strcpy_s(outSettings.reportPath, argv[++i]);
+		else if (strcmp(arg, "-json") == 0 && bHasValue)
+			strcpy_s(outSettings.jsonPath, argv[++i]);
+		else if (strcmp(arg, "-benchmark") == 0 && bHasValue)
+			strcpy_s(outSettings.benchmarkPath, argv[++i]);
+		else
+		{
+			printf("Unknown argument: %s\n", arg);
+			printf("usage: -headless -frames N -warmup N -width W -height H -ui -report path -json path -benchmark path\n");
+			return false;
+		}
+	}
+	if (outSettings.frameCount < 1 || outSettings.warmupFrameCount < 0 || outSettings.width < 0 || outSettings.height < 0)
+	{
+		printf("Invalid headless frame count or size\n");
+		return false;
+	}
+	return true;
+}
+
+HeadlessContext::HeadlessContext()
+	: window(0)
+	, context(0)
+{
+}
+
+bool HeadlessContext::Create(int width, int height)
+{
+	// same context as the window one
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+
+	SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
+	SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
+	SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
+
+	window = SDL_CreateWindow("RE headless",
+		SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, width, height,
+		SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+	if (window == NULL)
+	{
+		printf("Headless window could not be created! SDL_Error: %s\n", SDL_GetError());
+		return false;
+	}
+
+	context = SDL_GL_CreateContext(window);
+	if (context == NULL)
+	{
+		printf("OpenGL context could not be created! SDL_Error: %s\n", SDL_GetError());
+		Destroy();
+		return false;
+	}
+
+	// timings shouldn't wait on vsync
+	SDL_GL_SetSwapInterval(0);
+	return true;
+}
+
+void HeadlessContext::Destroy()
+{
+	if (context)
+		SDL_GL_DeleteContext(context);
+	if (window)
+		SDL_DestroyWindow(window);
+	context = 0;
+	window = 0;
+}
+
+void HeadlessContext::Present()
+{
+	// nothing to show, submit the frame like a swap would
+	glFlush();
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "SDL.h"
+
+// command line settings of headless and benchmark runs
+struct HeadlessSettings
+{
+	bool bEnabled = false;
+	// draw imgui, input is always skipped
+	bool bUI = false;
+	// frames rendered before timings are recorded
+	int warmupFrameCount = 30;
+	// frames recorded, exits after them
+	int frameCount = 300;
+	// 0 keeps window size
+	int width = 0;
+	int height = 0;
+	char reportPath[256] = "benchmark.txt";
+	// also write report as JSON when set
+	char jsonPath[256] = "";
+	// BenchmarkConfig file, generated scene and camera path instead of the default scene
+	char benchmarkPath[256] = "";
+};
+
+// -headless -frames N -warmup N -width W -height H -ui -report path -json path -benchmark path,
+// false on unknown or incomplete argument
+bool ParseHeadlessArgs(int argc, char** argv, HeadlessSettings& outSettings);
+
+// offscreen OpenGL 4.3 core context for benchmark runs, on a hidden window that is never shown, swapped or given input.
+// it still needs a desktop session and a GL 4.3 driver. the engine is windows only (fibers, file watcher, MSVC CRT),
+// so hosts without GPU or display can't run it.
+// draws to framebuffer 0 may be dropped by the driver since the window owns no visible pixels, render targets are unaffected
+class HeadlessContext
+{
+public:
+	HeadlessContext();
+
+	bool Create(int width, int height);
+	void Destroy();
+
+	// end of frame, in place of swap
+	void Present();
+
+protected:
+	SDL_Window* window;
+	SDL_GLContext context;
+};
@@ -21,6 +21,7 @@ public:
 	float innerHalfAngle;
 
 	bool bCastShadow;
+	// moves every frame, shadow of static casters is not cached
 	bool bDynamic;
 	bool bVolumetricFog;
 
@@ -233,27 +234,23 @@ struct LightRenderData
 	{
 		// shadow caster before non shadow caster
 		// within shadow casters, large map size goes first
-		return !b.bActualCastShadow || (a.bActualCastShadow && a.shadowMapSize > b.shadowMapSize);
+		return a.bActualCastShadow && (!b.bActualCastShadow || a.shadowMapSize > b.shadowMapSize);
 	}
 
+	static const int renderRankCount = 5;
+
 	// spot shadow -> tetrahedron -> cube -> spot non-shadow -> point non-shadow
-	static bool CompareRender(const LightRenderData& a, const LightRenderData& b)
+	int GetRenderRank() const
 	{
-		// shadow caster first
-		if (a.bActualCastShadow != b.bActualCastShadow)
-		{
-			return a.bActualCastShadow;
-		}
-		// within non shadow caster, spot light first
-		else if (!a.bActualCastShadow)
-		{
-			return a.bSpot;
-		}
-		// within shadow caster, spot light first, then tetrahedron, then cube
+		if (bActualCastShadow)
+			return bSpot ? 0 : (bUseTetrahedronShadowMap ? 1 : 2);
 		else
-		{
-			return a.bSpot || (!b.bSpot && a.bUseTetrahedronShadowMap);
-		}
+			return bSpot ? 3 : 4;
+	}
+
+	static bool CompareRender(const LightRenderData& a, const LightRenderData& b)
+	{
+		return a.GetRenderRank() < b.GetRenderRank();
 	}
 
 };
\ No newline at end of file
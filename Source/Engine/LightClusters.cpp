@@ -0,0 +1,440 @@
+#include <immintrin.h>
+#include <string.h>
+#include <float.h>
+
+#include "SDL.h"
+
+#include "JobSystem/ParallelJobs.h"
+
+#include "Viewpoint.h"
+
+#include "LightClusters.h"
+
+LightClusterGrid gLightClusterGrid;
+
+inline unsigned int FloatAsUint(float f)
+{
+	unsigned int result;
+	memcpy(&result, &f, sizeof(result));
+	return result;
+}
+
+LightClusterGrid::LightClusterGrid()
+	: countX(0)
+	, countY(0)
+	, nearDepth(0.f)
+	, sliceScale(0.f)
+{
+	sliceClusters.resize(sliceCount);
+	sliceLights.resize(sliceCount);
+	memset(&stats, 0, sizeof(stats));
+}
+
+void LightClusterGrid::SetupGrid(const Viewpoint& viewpoint)
+{
+	countX = ((int)viewpoint.width + tileSize - 1) / tileSize;
+	countY = ((int)viewpoint.height + tileSize - 1) / tileSize;
+	// columns are processed 4 at a time
+	int paddedCountX = (countX + 3) & ~3;
+
+	nearDepth = viewpoint.nearPlane;
+	sliceScale = sliceCount / logf(viewpoint.farPlane / viewpoint.nearPlane);
+
+	sliceDepth.resize(sliceCount + 1);
+	for (int k = 0; k < sliceCount; ++k)
+		sliceDepth[k] = nearDepth * expf(k / sliceScale);
+	sliceDepth[sliceCount] = viewpoint.farPlane;
+
+	columnMin.resize(sliceCount * paddedCountX);
+	columnMax.resize(sliceCount * paddedCountX);
+	rowMin.resize(sliceCount * countY);
+	rowMax.resize(sliceCount * countY);
+
+	// grow tiles by one pixel to cover jitter
+	float invScaleX = 1.f / viewpoint.projMat.m[0][0];
+	float invScaleY = 1.f / viewpoint.projMat.m[1][1];
+	for (int k = 0; k < sliceCount; ++k)
+	{
+		float d0 = sliceDepth[k];
+		float d1 = sliceDepth[k + 1];
+		for (int x = 0; x < paddedCountX; ++x)
+		{
+			float* outMin = &columnMin[k * paddedCountX + x];
+			float* outMax = &columnMax[k * paddedCountX + x];
+			if (x >= countX)
+			{
+				// never hit
+				*outMin = 1e30f;
+				*outMax = -1e30f;
+				continue;
+			}
+			float ndc0 = (x * tileSize - 1) * 2.f / viewpoint.width - 1.f;
+			float ndc1 = Min(((x + 1) * tileSize + 1) * 2.f / viewpoint.width - 1.f, 1.f);
+			*outMin = Min(ndc0 * d0, ndc0 * d1) * invScaleX;
+			*outMax = Max(ndc1 * d0, ndc1 * d1) * invScaleX;
+		}
+		for (int y = 0; y < countY; ++y)
+		{
+			float ndc0 = (y * tileSize - 1) * 2.f / viewpoint.height - 1.f;
+			float ndc1 = Min(((y + 1) * tileSize + 1) * 2.f / viewpoint.height - 1.f, 1.f);
+			rowMin[k * countY + y] = Min(ndc0 * d0, ndc0 * d1) * invScaleY;
+			rowMax[k * countY + y] = Max(ndc1 * d0, ndc1 * d1) * invScaleY;
+		}
+	}
+
+	int clusterCount = GetClusterCount();
+	data.resize(headerSize + clusterCount * 2);
+	data[CountX] = countX;
+	data[CountY] = countY;
+	data[SliceCount] = sliceCount;
+	data[TileSize] = tileSize;
+	data[NearDepth] = FloatAsUint(nearDepth);
+	data[SliceScale] = FloatAsUint(sliceScale);
+	data[IndexCount] = 0;
+	data[Reserved] = 0;
+}
+
+void LightClusterGrid::GetClusterBounds(int x, int y, int slice, Vector4_3& outMin, Vector4_3& outMax) const
+{
+	int paddedCountX = (countX + 3) & ~3;
+	outMin = Vector4_3(columnMin[slice * paddedCountX + x], rowMin[slice * countY + y], -sliceDepth[slice + 1]);
+	outMax = Vector4_3(columnMax[slice * paddedCountX + x], rowMax[slice * countY + y], -sliceDepth[slice]);
+}
+
+void LightClusterGrid::Build(const Viewpoint& viewpoint, const ClusterLightBounds* lights, int lightCount, int jobCount)
+{
+	Uint64 start = SDL_GetPerformanceCounter();
+
+	SetupGrid(viewpoint);
+
+	ParallelForSlices(sliceCount, jobCount, [&](int slice)
+	{
+		BuildSlice(slice, lights, lightCount);
+	});
+
+	Compact(jobCount);
+
+	stats.lightCount = lightCount;
+	stats.buildTime = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+void LightClusterGrid::BuildSlice(int slice, const ClusterLightBounds* lights, int lightCount)
+{
+	REArray<unsigned int>& outClusters = sliceClusters[slice];
+	REArray<unsigned int>& outLights = sliceLights[slice];
+	outClusters.clear();
+	outLights.clear();
+
+	int paddedCountX = (countX + 3) & ~3;
+	const float* sliceColumnMin = &columnMin[slice * paddedCountX];
+	const float* sliceColumnMax = &columnMax[slice * paddedCountX];
+	const float* sliceRowMin = &rowMin[slice * countY];
+	const float* sliceRowMax = &rowMax[slice * countY];
+	float minZ = -sliceDepth[slice + 1];
+	float maxZ = -sliceDepth[slice];
+	float centerZ = (minZ + maxZ) * 0.5f;
+	float extentZ = (maxZ - minZ) * 0.5f;
+
+	const Vec128 zero = VecZero();
+	const Vec128 half = VecSet1(0.5f);
+	const Vec128 laneIndex = VecSet(0.f, 1.f, 2.f, 3.f);
+
+	for (int lightIdx = 0; lightIdx < lightCount; ++lightIdx)
+	{
+		const ClusterLightBounds& light = lights[lightIdx];
+		const Vector4& sphere = light.sphere;
+		float radius = sphere.w;
+
+		// slice depth range
+		if (sphere.z - radius > maxZ || sphere.z + radius < minZ)
+			continue;
+
+		// tile range, columns and rows are sorted
+		int x0 = 0;
+		while (x0 < countX && sliceColumnMax[x0] < sphere.x - radius)
+			++x0;
+		int x1 = countX - 1;
+		while (x1 >= x0 && sliceColumnMin[x1] > sphere.x + radius)
+			--x1;
+		int y0 = 0;
+		while (y0 < countY && sliceRowMax[y0] < sphere.y - radius)
+			++y0;
+		int y1 = countY - 1;
+		while (y1 >= y0 && sliceRowMin[y1] > sphere.y + radius)
+			--y1;
+		if (x0 > x1 || y0 > y1)
+			continue;
+
+		float dz = Max(Max(minZ - sphere.z, sphere.z - maxZ), 0.f);
+		float dzSqr = dz * dz;
+
+		Vec128 sphereX = VecSet1(sphere.x);
+		Vec128 radiusSqr = VecSet1(radius * radius);
+
+		Vec128 coneApexX, coneDirX, coneCos, coneSin, coneRange;
+		if (light.bCone)
+		{
+			coneApexX = VecSet1(light.coneApex.x);
+			coneDirX = VecSet1(light.coneDirection.x);
+			coneCos = VecSet1(light.coneDirection.w);
+			coneSin = VecSet1(light.coneSinHalfAngle);
+			coneRange = VecSet1(light.coneApex.w);
+		}
+
+		int startX = x0 & ~3;
+		for (int y = y0; y <= y1; ++y)
+		{
+			float dy = Max(Max(sliceRowMin[y] - sphere.y, sphere.y - sliceRowMax[y]), 0.f);
+			Vec128 dyzSqr = VecSet1(dy * dy + dzSqr);
+
+			float clusterCenterY = (sliceRowMin[y] + sliceRowMax[y]) * 0.5f;
+			float clusterExtentY = (sliceRowMax[y] - sliceRowMin[y]) * 0.5f;
+			float clusterExtentYZSqr = clusterExtentY * clusterExtentY + extentZ * extentZ;
+			float coneDYZ = 0.f;
+			float coneDYZSqr = 0.f;
+			if (light.bCone)
+			{
+				float vy = clusterCenterY - light.coneApex.y;
+				float vz = centerZ - light.coneApex.z;
+				coneDYZ = vy * light.coneDirection.y + vz * light.coneDirection.z;
+				coneDYZSqr = vy * vy + vz * vz;
+			}
+
+			for (int x = startX; x <= x1; x += 4)
+			{
+				Vec128 colMin = _mm_load_ps(sliceColumnMin + x);
+				Vec128 colMax = _mm_load_ps(sliceColumnMax + x);
+
+				// sphere against cluster AABB
+				Vec128 dx = VecMax(VecMax(VecSub(colMin, sphereX), VecSub(sphereX, colMax)), zero);
+				Vec128 distSqr = VecAdd(VecMul(dx, dx), dyzSqr);
+				Vec128 hit = VecCmpLE(distSqr, radiusSqr);
+
+				// only lanes in [x0, x1]
+				Vec128 laneX = VecAdd(VecSet1((float)x), laneIndex);
+				hit = VecAnd(hit, VecAnd(VecCmpGE(laneX, VecSet1((float)x0)), VecCmpLE(laneX, VecSet1((float)x1))));
+
+				int mask = VecMoveMask(hit);
+				if (mask == 0)
+					continue;
+
+				if (light.bCone)
+				{
+					// cone against cluster bounding sphere
+					Vec128 clusterCenterX = VecMul(VecAdd(colMin, colMax), half);
+					Vec128 clusterExtentX = VecMul(VecSub(colMax, colMin), half);
+					Vec128 clusterRadius = _mm_sqrt_ps(VecAdd(VecMul(clusterExtentX, clusterExtentX), VecSet1(clusterExtentYZSqr)));
+					Vec128 vx = VecSub(clusterCenterX, coneApexX);
+					Vec128 vLenSqr = VecAdd(VecMul(vx, vx), VecSet1(coneDYZSqr));
+					Vec128 v1Len = VecAdd(VecMul(vx, coneDirX), VecSet1(coneDYZ));
+					Vec128 distClosest = VecSub(
+						VecMul(coneCos, _mm_sqrt_ps(VecMax(VecSub(vLenSqr, VecMul(v1Len, v1Len)), zero))),
+						VecMul(v1Len, coneSin));
+					Vec128 inside = VecAnd(VecCmpLE(distClosest, clusterRadius),
+						VecAnd(VecCmpLE(v1Len, VecAdd(clusterRadius, coneRange)), VecCmpGE(v1Len, VecSub(zero, clusterRadius))));
+					mask &= VecMoveMask(inside);
+				}
+
+				while (mask)
+				{
+					unsigned long lane;
+					_BitScanForward(&lane, mask);
+					mask &= mask - 1;
+					outClusters.push_back(y * countX + x + lane);
+					outLights.push_back(lightIdx);
+				}
+			}
+		}
+	}
+}
+
+void LightClusterGrid::Compact(int jobCount)
+{
+	int clustersPerSlice = countX * countY;
+	int clusterCount = GetClusterCount();
+	int listStart = headerSize + clusterCount * 2;
+
+	// slice lists are appended in slice order
+	int sliceStart[sliceCount + 1];
+	sliceStart[0] = listStart;
+	for (int k = 0; k < sliceCount; ++k)
+		sliceStart[k + 1] = sliceStart[k] + (int)sliceLights[k].size();
+
+	int indexCount = sliceStart[sliceCount] - listStart;
+	data.resize(sliceStart[sliceCount]);
+	data[IndexCount] = indexCount;
+
+	int sliceMaxCount[sliceCount];
+	ParallelForSlices(sliceCount, jobCount, [&](int slice)
+	{
+		unsigned int* clusterInfo = &data[headerSize + slice * clustersPerSlice * 2];
+		const REArray<unsigned int>& clusters = sliceClusters[slice];
+		const REArray<unsigned int>& lights = sliceLights[slice];
+
+		// count
+		for (int i = 0; i < clustersPerSlice; ++i)
+			clusterInfo[i * 2 + 1] = 0;
+		for (int i = 0, ni = (int)clusters.size(); i < ni; ++i)
+			++clusterInfo[clusters[i] * 2 + 1];
+
+		// offsets
+		int offset = sliceStart[slice];
+		int maxCount = 0;
+		for (int i = 0; i < clustersPerSlice; ++i)
+		{
+			clusterInfo[i * 2] = offset;
+			offset += clusterInfo[i * 2 + 1];
+			maxCount = Max(maxCount, (int)clusterInfo[i * 2 + 1]);
+		}
+		sliceMaxCount[slice] = maxCount;
+
+		// scatter, stable so light indices stay ascending
+		for (int i = 0; i < clustersPerSlice; ++i)
+			clusterInfo[i * 2 + 1] = 0;
+		for (int i = 0, ni = (int)clusters.size(); i < ni; ++i)
+		{
+			unsigned int* info = &clusterInfo[clusters[i] * 2];
+			data[info[0] + info[1]] = lights[i];
+			++info[1];
+		}
+	});
+
+	stats.clusterCount = clusterCount;
+	stats.indexCount = indexCount;
+	stats.maxClusterLightCount = 0;
+	for (int k = 0; k < sliceCount; ++k)
+		stats.maxClusterLightCount = Max(stats.maxClusterLightCount, sliceMaxCount[k]);
+}
+
+void LightClusterGrid::BuildReference(const Viewpoint& viewpoint, const ClusterLightBounds* lights, int lightCount)
+{
+	SetupGrid(viewpoint);
+
+	for (int slice = 0; slice < sliceCount; ++slice)
+	{
+		REArray<unsigned int>& outClusters = sliceClusters[slice];
+		REArray<unsigned int>& outLights = sliceLights[slice];
+		outClusters.clear();
+		outLights.clear();
+
+		for (int lightIdx = 0; lightIdx < lightCount; ++lightIdx)
+		{
+			const ClusterLightBounds& light = lights[lightIdx];
+			const Vector4& sphere = light.sphere;
+			for (int y = 0; y < countY; ++y)
+			{
+				for (int x = 0; x < countX; ++x)
+				{
+					Vector4_3 clusterMin, clusterMax;
+					GetClusterBounds(x, y, slice, clusterMin, clusterMax);
+
+					float dx = Max(Max(clusterMin.x - sphere.x, sphere.x - clusterMax.x), 0.f);
+					float dy = Max(Max(clusterMin.y - sphere.y, sphere.y - clusterMax.y), 0.f);
+					float dz = Max(Max(clusterMin.z - sphere.z, sphere.z - clusterMax.z), 0.f);
+					if (dx * dx + (dy * dy + dz * dz) > sphere.w * sphere.w)
+						continue;
+
+					if (light.bCone)
+					{
+						float extentX = (clusterMax.x - clusterMin.x) * 0.5f;
+						float extentY = (clusterMax.y - clusterMin.y) * 0.5f;
+						float extentZ = (clusterMax.z - clusterMin.z) * 0.5f;
+						float clusterRadius = sqrtf(extentX * extentX + (extentY * extentY + extentZ * extentZ));
+						float vx = (clusterMin.x + clusterMax.x) * 0.5f - light.coneApex.x;
+						float vy = (clusterMin.y + clusterMax.y) * 0.5f - light.coneApex.y;
+						float vz = (clusterMin.z + clusterMax.z) * 0.5f - light.coneApex.z;
+						float vLenSqr = vx * vx + (vy * vy + vz * vz);
+						float v1Len = vx * light.coneDirection.x + (vy * light.coneDirection.y + vz * light.coneDirection.z);
+						float distClosest = light.coneDirection.w * sqrtf(Max(vLenSqr - v1Len * v1Len, 0.f)) - v1Len * light.coneSinHalfAngle;
+						if (distClosest > clusterRadius || v1Len > clusterRadius + light.coneApex.w || v1Len < -clusterRadius)
+							continue;
+					}
+
+					outClusters.push_back(y * countX + x);
+					outLights.push_back(lightIdx);
+				}
+			}
+		}
+	}
+
+	Compact(1);
+	stats.lightCount = lightCount;
+}
+
+void BenchmarkLightClusters(int lightCount)
+{
+	// camera at origin looking at +y
+	Viewpoint viewpoint;
+	viewpoint.position = Vector4_3(0.f, 0.f, 0.f);
+	viewpoint.rotation = Quat::Identity();
+	viewpoint.fov = 90.f * PI / 180.f;
+	viewpoint.width = 1920.f;
+	viewpoint.height = 1080.f;
+	viewpoint.nearPlane = 0.1f;
+	viewpoint.farPlane = 200.f;
+	viewpoint.jitterX = 0.f;
+	viewpoint.jitterY = 0.f;
+	viewpoint.CacheMatrices();
+
+	// random point and spot lights in front of camera, half of them spot
+	REArray<ClusterLightBounds, 16> lights(lightCount);
+	for (int i = 0; i < lightCount; ++i)
+	{
+		ClusterLightBounds& light = lights[i];
+		Vector4_3 position(RandRange(-60.f, 60.f), RandRange(-40.f, 40.f), -RandRange(0.f, 120.f));
+		float radius = RandRange(0.5f, 8.f);
+		light.bCone = (i & 1) != 0;
+		if (!light.bCone)
+		{
+			light.sphere = Vector4(position.x, position.y, position.z, radius);
+			continue;
+		}
+		float halfAngle = RandRange(10.f, 60.f) * PI / 180.f;
+		Vector4_3 direction = Vector4_3(RandRange(-1.f, 1.f), RandRange(-1.f, 1.f), RandRange(-1.f, 1.f)).GetNormalized3();
+		light.coneApex = Vector4(position.x, position.y, position.z, radius);
+		light.coneDirection = Vector4(direction.x, direction.y, direction.z, Cos(halfAngle));
+		light.coneSinHalfAngle = Sin(halfAngle);
+		// same as spot light sphere bounds
+		float sphereRadius = radius * 0.5f / (light.coneDirection.w * light.coneDirection.w);
+		if (halfAngle > PI * 0.25f)
+		{
+			Vector4_3 center = position + direction * (light.coneDirection.w * radius);
+			light.sphere = Vector4(center.x, center.y, center.z, light.coneSinHalfAngle * radius);
+		}
+		else
+		{
+			Vector4_3 center = position + direction * sphereRadius;
+			light.sphere = Vector4(center.x, center.y, center.z, sphereRadius);
+		}
+	}
+
+	LightClusterGrid grid;
+	LightClusterGrid reference;
+
+	const int loopCount = 10;
+	double buildTime = DBL_MAX;
+	for (int loop = 0; loop < loopCount; ++loop)
+	{
+		grid.Build(viewpoint, lights.data(), lightCount, 1);
+		if (grid.stats.buildTime < buildTime)
+			buildTime = grid.stats.buildTime;
+	}
+
+	Uint64 start = SDL_GetPerformanceCounter();
+	reference.BuildReference(viewpoint, lights.data(), lightCount);
+	double referenceTime = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+
+	int mismatchCount = 0;
+	for (int i = 0, ni = grid.GetClusterCount(); i < ni; ++i)
+	{
+		int count = grid.GetClusterLightCount(i);
+		if (count != reference.GetClusterLightCount(i) ||
+			memcmp(grid.GetClusterLights(i), reference.GetClusterLights(i), count * sizeof(unsigned int)) != 0)
+			++mismatchCount;
+	}
+
+	printf("BenchmarkLightClusters: %d lights, %d clusters\n", lightCount, grid.stats.clusterCount);
+	printf("  build:     %.3f ms, %d indices, max %d lights per cluster\n", buildTime, grid.stats.indexCount, grid.stats.maxClusterLightCount);
+	printf("  reference: %.3f ms\n", referenceTime);
+	printf("  %d mismatched clusters\n", mismatchCount);
+}
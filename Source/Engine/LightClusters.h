@@ -0,0 +1,104 @@
+#pragma once
+
+#include "Containers/Containers.h"
+#include "Math/REMath.h"
+
+class Viewpoint;
+
+// view space bounds of a local light
+struct ClusterLightBounds
+{
+	Vector4 sphere;			// xyz center, w radius
+	Vector4 coneApex;		// xyz apex, w range, only used if bCone
+	Vector4 coneDirection;	// xyz direction, w cos of half angle
+	float coneSinHalfAngle;
+	bool bCone;
+};
+
+struct LightClusterStats
+{
+	int clusterCount;
+	int lightCount;
+	int indexCount;
+	int maxClusterLightCount;
+	double buildTime; // ms
+};
+
+// CPU clustered light assignment
+// the view frustum is split into screen tiles x exponential depth slices (froxels),
+// depth slice k covers view depth [near * (far / near) ^ (k / sliceCount), near * (far / near) ^ ((k + 1) / sliceCount)].
+// tiles are in GL window coordinates, origin at bottom left.
+// each depth slice is built by one job, lights are tested against 4 clusters of a tile row at a time,
+// sphere bounds against cluster AABB, cone bounds against cluster bounding sphere.
+// there is no per cluster light limit, result is packed into one uint buffer:
+// [0, headerSize): header, see EHeader
+// [headerSize, headerSize + clusterCount * 2): light index offset (from buffer start) and light count per cluster
+// rest: light indices, ascending in each cluster
+// cluster index is (slice * countY + y) * countX + x
+// no GL dependency, can run headless
+class LightClusterGrid
+{
+public:
+	static const int tileSize = 64;
+	static const int sliceCount = 24;
+	static const int headerSize = 8;
+
+	enum EHeader
+	{
+		CountX,
+		CountY,
+		SliceCount,
+		TileSize,
+		NearDepth,		// float bits
+		SliceScale,		// float bits, sliceCount / log(far / near)
+		IndexCount,
+		Reserved,
+	};
+
+	LightClusterGrid();
+
+	// assign lights to clusters, jobCount <= 1 runs on calling thread
+	void Build(const Viewpoint& viewpoint, const ClusterLightBounds* lights, int lightCount, int jobCount);
+
+	// brute force, test every light against every cluster one by one, same result as Build()
+	void BuildReference(const Viewpoint& viewpoint, const ClusterLightBounds* lights, int lightCount);
+
+	const REArray<unsigned int>& GetData() const { return data; }
+	int GetClusterCount() const { return countX * countY * sliceCount; }
+	int GetClusterLightCount(int cluster) const { return (int)data[headerSize + cluster * 2 + 1]; }
+	const unsigned int* GetClusterLights(int cluster) const { return data.data() + data[headerSize + cluster * 2]; }
+
+	LightClusterStats stats;
+
+protected:
+	int countX;
+	int countY;
+	float nearDepth;
+	float sliceScale;
+
+	// view space x bounds of tile columns and y bounds of tile rows, per slice, SoA
+	REArray<float, 16> columnMin;
+	REArray<float, 16> columnMax;
+	REArray<float, 16> rowMin;
+	REArray<float, 16> rowMax;
+	// view depth range of slices, positive
+	REArray<float> sliceDepth;
+
+	// per slice (cluster in slice, light index) pairs before compaction
+	REArray<REArray<unsigned int>> sliceClusters;
+	REArray<REArray<unsigned int>> sliceLights;
+
+	REArray<unsigned int> data;
+
+	void SetupGrid(const Viewpoint& viewpoint);
+	void BuildSlice(int slice, const ClusterLightBounds* lights, int lightCount);
+	// counting sort slice pairs into data
+	void Compact(int jobCount);
+	// AABB of cluster
+	void GetClusterBounds(int x, int y, int slice, Vector4_3& outMin, Vector4_3& outMax) const;
+};
+
+extern LightClusterGrid gLightClusterGrid;
+
+// build random lights, compare with brute force, print timing
+void BenchmarkLightClusters(int lightCount);
@@ -1,9 +1,19 @@
 
 #include "Render.h"
 
+#include "MaterialBuffer.h"
+
 #include "Material.h"
 
 REArray<Material*> Material::gMaterialContainer;
+unsigned int Material::gNextSortId = 0;
+
+Material::~Material()
+{
+	if (shader)
+		shader->referenceMaterials.erase(this);
+	gMaterialBuffer.FreeSlot(blockSlot);
+}
 
 void Material::Reload(Shader* inNewShader)
 {
@@ -18,6 +28,58 @@ void Material::Reload(Shader* inNewShader)
 	{
 		parameterList[i].location = -1;
 	}
+	bindingVersion = 0;
+}
+
+void Material::ResolveBindings()
+{
+	// texture and image units are set as uniforms of the program in use
+	shader->Use();
+	for (int i = 0, ni = (int)parameterList.size(); i < ni; ++i)
+	{
+		MaterialParameter& param = parameterList[i];
+		param.SetLocation(shader);
+		// resend on next use
+		param.bDirty = true;
+	}
+	ResolveBlock();
+	bindingVersion = shader->version;
+}
+
+void Material::ResolveBlock()
+{
+	int blockSize = shader->materialBlockSize;
+	assert(blockSize <= MaterialBuffer::maxBlockSize);
+	if (blockSize == 0)
+	{
+		gMaterialBuffer.FreeSlot(blockSlot);
+		blockSlot = -1;
+		blockData.clear();
+		for (int i = 0, ni = (int)parameterList.size(); i < ni; ++i)
+			parameterList[i].blockOffset = -1;
+		return;
+	}
+
+	if (blockSlot < 0)
+		blockSlot = gMaterialBuffer.AllocateSlot();
+
+	// members without a parameter read 0, same as an unset uniform
+	blockData.clear();
+	blockData.resize(blockSize, 0);
+	for (int i = 0, ni = (int)parameterList.size(); i < ni; ++i)
+	{
+		MaterialParameter& param = parameterList[i];
+		param.blockOffset = -1;
+		if (param.type != EMaterialParameterType::INT && param.type != EMaterialParameterType::FLOAT &&
+			param.type != EMaterialParameterType::VEC2 && param.type != EMaterialParameterType::VEC3 &&
+			param.type != EMaterialParameterType::VEC4)
+			continue;
+		param.blockOffset = shader->GetMaterialBlockOffset(param.nameId, param.count);
+		if (param.blockOffset >= 0)
+			memcpy(blockData.data() + param.blockOffset, parameterData.data() + param.offset, param.count);
+	}
+	blockDirtyStart = 0;
+	blockDirtyEnd = blockSize;
 }
 
 void Material::Use(RenderContext& renderContext)
@@ -27,15 +89,44 @@ void Material::Use(RenderContext& renderContext)
 
 	// use shader
 	if (!renderContext.currentMaterial || renderContext.currentMaterial->shader != shader)
+	{
 		shader->Use();
+		++renderContext.stats.shaderChangeCount;
+	}
 
 	bool bNewMat = (renderContext.currentMaterial != this);
+	if (bNewMat)
+		++renderContext.stats.materialChangeCount;
+
+	// material block, upload changed range, bind slot on switch
+	bool bBindBlock = bNewMat;
+	if (bindingVersion != shader->version)
+	{
+		ResolveBindings();
+		bBindBlock = true;
+	}
+	if (blockSlot >= 0)
+	{
+		if (blockDirtyEnd > blockDirtyStart)
+		{
+			gMaterialBuffer.Upload(blockSlot, blockDirtyStart, blockData.data() + blockDirtyStart, blockDirtyEnd - blockDirtyStart);
+			renderContext.stats.materialUploadBytes += blockDirtyEnd - blockDirtyStart;
+			blockDirtyStart = blockDirtyEnd = 0;
+		}
+		if (bBindBlock)
+			gMaterialBuffer.Bind(blockSlot, (int)blockData.size());
+	}
 
-	// set parameters
+	// set parameters not in material block
 	char* paramDataPtr = parameterData.data();
 	for (int i = 0, ni = (int)parameterList.size(); i < ni; ++i)
 	{
 		MaterialParameter& param = parameterList[i];
+		if (param.blockOffset >= 0)
+		{
+			param.bDirty = false;
+			continue;
+		}
 		if (bNewMat || param.bDirty)
 		{
 			param.bDirty = false;
@@ -78,6 +169,7 @@ void Material::SetParameter(const char* name, const char* data, int bytes, EMate
 		parameterList.push_back(MaterialParameter());
 		params = &parameterList[paramListSize];
 		strcpy_s(params->name, name);
+		params->nameId = Shader::GetNameId(name);
 		params->offset = (int)parameterData.size();
 		params->count = bytes;
 		params->type = type;
@@ -86,6 +178,9 @@ void Material::SetParameter(const char* name, const char* data, int bytes, EMate
 		// add data
 		parameterData.resize(params->offset + bytes);
 		memcpy_s(parameterData.data() + params->offset, params->count, data, bytes);
+
+		// find its location and place in material block on next use
+		bindingVersion = 0;
 	}
 	else
 	{
@@ -93,6 +188,21 @@ void Material::SetParameter(const char* name, const char* data, int bytes, EMate
 		assert(params->type == type);
 		params->bDirty = true;
 		memcpy_s(parameterData.data() + params->offset, params->count, data, bytes);
+
+		if (params->blockOffset >= 0)
+		{
+			memcpy(blockData.data() + params->blockOffset, data, bytes);
+			if (blockDirtyEnd > blockDirtyStart)
+			{
+				blockDirtyStart = Min(blockDirtyStart, params->blockOffset);
+				blockDirtyEnd = Max(blockDirtyEnd, params->blockOffset + bytes);
+			}
+			else
+			{
+				blockDirtyStart = params->blockOffset;
+				blockDirtyEnd = params->blockOffset + bytes;
+			}
+		}
 	}
 }
 
@@ -126,7 +236,9 @@ void Material::CopyParameter(const Material* otherMaterial, const REArray<char*>
 		{
 			MaterialParameter* params = &parameterList[i];
 			params->location = -1;
+			params->blockOffset = -1;
 			params->bDirty = true;
 		}
+		bindingVersion = 0;
 	}
 }
\ No newline at end of file
@@ -23,9 +23,11 @@ class MaterialParameter
 {
 public:
 	char name[64];
+	int nameId = -1; // Shader::GetNameId(name)
 	int offset = 0;
 	int count = 0;
 	int location = -1; // uniform location for parameters, tex unit for textures
+	int blockOffset = -1; // offset in material block, -1 if sent as uniform
 	EMaterialParameterType type;
 	bool bDirty = false;
 
@@ -40,25 +42,21 @@ public:
 		case EMaterialParameterType::VEC4:
 		case EMaterialParameterType::MAT3:
 		case EMaterialParameterType::MAT4:
-			location = shader->GetUniformLocation(name);
+			location = shader->GetUniformLocation(nameId);
 			break;
 		case EMaterialParameterType::TEX:
-			location = shader->GetTextureUnit(name);
+			location = shader->GetTextureUnit(nameId);
 			break;
 		case EMaterialParameterType::IMG:
-			location = shader->GetImageUnit(name);
+			location = shader->GetImageUnit(nameId);
 			break;
 		}
 
 	}
 
+	// location set by Material::ResolveBindings()
 	inline void SendValue(Shader* shader, char* parameterValues)
 	{
-		if (location < 0)
-		{
-			SetLocation(shader);
-		}
-
 		if(location < 0)
 			return;
 
@@ -100,6 +98,7 @@ class Material
 public:
 
 	static REArray<Material*> gMaterialContainer;
+	static unsigned int gNextSortId;
 
 	static Material* Create(Shader* inShader)
 	{
@@ -122,29 +121,49 @@ public:
 	REArray<char> parameterData;
 	REArray<MaterialParameter> parameterList;
 
-	Material() {}
-	Material(Shader* inShader)
+	// std140 image of shader material block, kept in a slot of gMaterialBuffer, see MaterialBuffer.h
+	REArray<char> blockData;
+	int blockSlot = -1;
+	// byte range of blockData changed since last upload
+	int blockDirtyStart = 0;
+	int blockDirtyEnd = 0;
+
+	// shader version parameter locations and material block layout are resolved for, 0 resolves on next use
+	unsigned int bindingVersion = 0;
+
+	// small id for draw sort keys, unique per material
+	unsigned int sortId;
+
+	Material() { sortId = gNextSortId++; }
+	Material(Shader* inShader) : Material()
 	{
 		shader = inShader;
 		shader->referenceMaterials.insert(this);
 	}
-	Material(Material* otherMaterial)
+	Material(Material* otherMaterial) : Material()
 	{
 		shader = otherMaterial->shader;
 		shader->referenceMaterials.insert(this);
+		unsigned int newSortId = sortId;
 		*this = *otherMaterial;
+		sortId = newSortId;
+		// own block slot on first use
+		blockSlot = -1;
+		bindingVersion = 0;
 		//parameterData = otherMaterial->parameterData;
 		//parameterList = otherMaterial->parameterList;
 	}
-	~Material()
-	{
-		if (shader)
-			shader->referenceMaterials.erase(this);
-	}
+	~Material();
 
 	void Reload(Shader* inNewShader = 0);
 	void Use(struct RenderContext& renderContext);
 
+	// locations of all parameters and material block layout for current shader version, makes shader current.
+	// done by Use() when shader is reloaded or parameters are added
+	void ResolveBindings();
+	// map parameters to shader material block and fill blockData
+	void ResolveBlock();
+
 	void DispatchCompute(struct RenderContext& renderContext, unsigned int x, unsigned int y = 1, unsigned int z = 1);
 
 	void CopyParameter(const Material* otherMaterial, const REArray<char*>* names = 0);
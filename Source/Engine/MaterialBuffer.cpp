@@ -0,0 +1,81 @@
+// glew
+#include "gl/glew.h"
+
+#include "Shader.h"
+#include "GLState.h"
+
+#include "MaterialBuffer.h"
+
+MaterialBuffer gMaterialBuffer;
+
+static const int gMaterialBufferInitSlotCapacity = 256;
+
+MaterialBuffer::MaterialBuffer()
+	: buffer(0)
+	, slotStride(0)
+	, slotCount(0)
+	, slotCapacity(0)
+{
+}
+
+int MaterialBuffer::AllocateSlot()
+{
+	if (freeSlots.size() > 0)
+	{
+		int slot = freeSlots.back();
+		freeSlots.pop_back();
+		return slot;
+	}
+
+	if (!buffer)
+	{
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		slotStride = (maxBlockSize + alignment - 1) / alignment * alignment;
+		slotCapacity = gMaterialBufferInitSlotCapacity;
+
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)slotCapacity * slotStride, NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+	else if (slotCount == slotCapacity)
+	{
+		int newCapacity = slotCapacity * 2;
+		GLuint newBuffer;
+		glGenBuffers(1, &newBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)newCapacity * slotStride, NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (GLsizeiptr)slotCapacity * slotStride);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		gGLState.InvalidateBuffer(buffer);
+		glDeleteBuffers(1, &buffer);
+		buffer = newBuffer;
+		slotCapacity = newCapacity;
+		// bound range points to the deleted buffer, next material switch binds again
+		gGLState.BindBufferBase(GL_UNIFORM_BUFFER, (GLuint)EShaderBindingUBO::MaterialBlock, 0);
+	}
+
+	return slotCount++;
+}
+
+void MaterialBuffer::FreeSlot(int slot)
+{
+	if (slot >= 0)
+		freeSlots.push_back(slot);
+}
+
+void MaterialBuffer::Upload(int slot, int offset, const void* data, int size)
+{
+	assert(offset + size <= maxBlockSize);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)slot * slotStride + offset, size, data);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void MaterialBuffer::Bind(int slot, int size)
+{
+	gGLState.BindBufferRange(GL_UNIFORM_BUFFER, (GLuint)EShaderBindingUBO::MaterialBlock, buffer, (GLintptr)slot * slotStride, size);
+}
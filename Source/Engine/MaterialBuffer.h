@@ -0,0 +1,40 @@
+#pragma once
+
+// glew
+#include "gl/glew.h"
+
+// opengl
+#include "SDL_opengl.h"
+
+#include "Containers/Containers.h"
+
+// one uniform buffer holding the material blocks of all materials, one fixed size slot per material.
+// a material switch binds its slot with glBindBufferRange, values are only uploaded when changed.
+// the buffer grows by doubling, old content is copied on GPU.
+class MaterialBuffer
+{
+public:
+	// max material block size in bytes
+	static const int maxBlockSize = 256;
+
+	MaterialBuffer();
+
+	int AllocateSlot();
+	void FreeSlot(int slot);
+
+	// upload size bytes at offset of slot
+	void Upload(int slot, int offset, const void* data, int size);
+	void Bind(int slot, int size);
+
+	int GetSlotCount() const { return slotCount - (int)freeSlots.size(); }
+
+protected:
+	GLuint buffer;
+	// slot size rounded up to uniform buffer offset alignment
+	int slotStride;
+	int slotCount;
+	int slotCapacity;
+	REArray<int> freeSlots;
+};
+
+extern MaterialBuffer gMaterialBuffer;
@@ -5,59 +5,229 @@
 
 #include "Mesh.h"
 
+#include "Math/Quantization.h"
+
+#include "MeshSimplify.h"
+#include "GeometryArena.h"
+#include "GLState.h"
+
 REArray<MeshData*> MeshData::gMeshDataContainer;
+bool MeshData::gUseGeometryArena = false;
+RESet<GLuint> MeshData::gCompactVertexVAOs;
+
+static void PackCompactVertices(const Vertex* src, CompactVertex* dst, int count)
+{
+	for (int i = 0; i < count; i += 4)
+	{
+		// pad last batch with the last vertex
+		const Vertex& v0 = src[i];
+		const Vertex& v1 = src[Min(i + 1, count - 1)];
+		const Vertex& v2 = src[Min(i + 2, count - 1)];
+		const Vertex& v3 = src[Min(i + 3, count - 1)];
+
+		// tangent is 16 bytes, transpose to SoA
+		Vec128 tx = _mm_loadu_ps(v0.tangent.m);
+		Vec128 ty = _mm_loadu_ps(v1.tangent.m);
+		Vec128 tz = _mm_loadu_ps(v2.tangent.m);
+		Vec128 tw = _mm_loadu_ps(v3.tangent.m);
+		_MM_TRANSPOSE4_PS(tx, ty, tz, tw);
+
+		// normal is followed by tangent, safe to load 16 bytes
+		Vec128 nx = _mm_loadu_ps(v0.normal.m);
+		Vec128 ny = _mm_loadu_ps(v1.normal.m);
+		Vec128 nz = _mm_loadu_ps(v2.normal.m);
+		Vec128 nw = _mm_loadu_ps(v3.normal.m);
+		_MM_TRANSPOSE4_PS(nx, ny, nz, nw);
+
+		__declspec(align(16)) unsigned __int32 frame[4];
+		_mm_store_si128((Vec128i*)frame, VecPackTangentFrame(nx, ny, nz, tx, ty, tz, tw));
+
+		Vec128i u = VecFloatToHalf(VecSet(v0.texCoords.x, v1.texCoords.x, v2.texCoords.x, v3.texCoords.x));
+		Vec128i v = VecFloatToHalf(VecSet(v0.texCoords.y, v1.texCoords.y, v2.texCoords.y, v3.texCoords.y));
+		__declspec(align(16)) unsigned __int32 uv[4];
+		_mm_store_si128((Vec128i*)uv, _mm_or_si128(u, _mm_slli_epi32(v, 16)));
+
+		for (int j = 0, nj = Min(4, count - i); j < nj; ++j)
+		{
+			CompactVertex& cv = dst[i + j];
+			cv.position = src[i + j].position;
+			cv.tangentFrame = frame[j];
+			cv.texCoords[0] = (unsigned __int16)(uv[j] & 0xffff);
+			cv.texCoords[1] = (unsigned __int16)(uv[j] >> 16);
+		}
+	}
+}
+
+bool MeshData::CanUseCompactVertex() const
+{
+	// half float precision is 1/1024 in [1, 2), beyond that keep full vertex
+	const float maxTexCoord = 2.f;
+	for (int i = 0; i < vertCount; ++i)
+	{
+		const UVector2& uv = vertices[i].texCoords;
+		if (Abs(uv.x) > maxTexCoord || Abs(uv.y) > maxTexCoord)
+			return false;
+	}
+	return true;
+}
 
 void MeshData::InitResource()
 {
 	bHasResource = true;
 
 	// clear old buffer
-	if (VAO)
-		glDeleteBuffers(1, &VAO);
+	if (VAO && !bInGeometryArena)
+	{
+		gGLState.InvalidateVertexArray(VAO);
+		RegisterCompactVertexVAO(VAO, false);
+		glDeleteVertexArrays(1, &VAO);
+	}
 	if (VBO)
 		glDeleteBuffers(1, &VBO);
 	if (EBO)
 		glDeleteBuffers(1, &EBO);
+	VAO = VBO = EBO = 0;
+
+	if (bCompactVertex && !CanUseCompactVertex())
+		bCompactVertex = false;
 
-	// create buffer
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
-	glGenBuffers(1, &EBO);
-
-	glBindVertexArray(VAO);
-	// VBO data
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, vertCount * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
-	// EBO data
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, idxCount * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
-	
-	// position
+	REArray<CompactVertex> compactVertices;
+	if (bCompactVertex)
 	{
-		glEnableVertexAttribArray(Vertex::positionIdx);
-		glVertexAttribPointer(Vertex::positionIdx, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+		compactVertices.resize(vertCount);
+		PackCompactVertices(vertices.data(), compactVertices.data(), vertCount);
 	}
-	// normal
+	const void* vertexData = bCompactVertex ? (const void*)compactVertices.data() : (const void*)vertices.data();
+
+	bInGeometryArena = gUseGeometryArena;
+	if (bInGeometryArena)
+	{
+		EVertexFormat format = bCompactVertex ? EVertexFormat::Compact : EVertexFormat::Full;
+		GeometryRange range = gGeometryArena.Allocate(format, vertexData, vertCount, indices.data(), idxCount);
+		VAO = gGeometryArena.GetVAO(format);
+		baseVertex = range.baseVertex;
+		firstIndex = range.firstIndex;
+	}
+	else
 	{
-		glEnableVertexAttribArray(Vertex::normalIdx);
-		glVertexAttribPointer(Vertex::normalIdx, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, normal));
+		// create buffer
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glGenBuffers(1, &EBO);
+
+		gGLState.BindVertexArray(VAO);
+		// EBO data
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, idxCount * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+
+		// VBO data
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, GetVertexBufferSize(), vertexData, GL_STATIC_DRAW);
+		SetupVertexAttributes(bCompactVertex);
+		RegisterCompactVertexVAO(VAO, bCompactVertex);
+
+		gGLState.BindVertexArray(0);
+		baseVertex = 0;
+		firstIndex = 0;
 	}
-	// tangent
+
+	// calculate bounds
+	for (int i = 0; i < vertCount; ++i)
+		bounds += vertices[i].position.ToVector4();
+}
+
+void MeshData::RegisterCompactVertexVAO(GLuint VAO, bool bCompactVertex)
+{
+	if (bCompactVertex)
+		gCompactVertexVAOs.insert(VAO);
+	else
+		gCompactVertexVAOs.erase(VAO);
+}
+
+void MeshData::SetupVertexAttributes(bool bCompactVertex)
+{
+	if (bCompactVertex)
 	{
-		glEnableVertexAttribArray(Vertex::tangentIdx);
-		glVertexAttribPointer(Vertex::tangentIdx, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, tangent));
+		// position
+		{
+			glEnableVertexAttribArray(CompactVertex::positionIdx);
+			glVertexAttribPointer(CompactVertex::positionIdx, 3, GL_FLOAT, GL_FALSE, sizeof(CompactVertex), (GLvoid*)0);
+		}
+		// tangent frame
+		{
+			glEnableVertexAttribArray(CompactVertex::tangentFrameIdx);
+			glVertexAttribPointer(CompactVertex::tangentFrameIdx, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(CompactVertex), (GLvoid*)offsetof(CompactVertex, tangentFrame));
+		}
+		// texCoords
+		{
+			glEnableVertexAttribArray(CompactVertex::texCoordsIdx);
+			glVertexAttribPointer(CompactVertex::texCoordsIdx, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactVertex), (GLvoid*)offsetof(CompactVertex, texCoords));
+		}
 	}
-	// texCoordes
+	else
 	{
-		glEnableVertexAttribArray(Vertex::texCoordsIdx);
-		glVertexAttribPointer(Vertex::texCoordsIdx, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, texCoords));
+		// position
+		{
+			glEnableVertexAttribArray(Vertex::positionIdx);
+			glVertexAttribPointer(Vertex::positionIdx, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+		}
+		// normal
+		{
+			glEnableVertexAttribArray(Vertex::normalIdx);
+			glVertexAttribPointer(Vertex::normalIdx, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, normal));
+		}
+		// tangent
+		{
+			glEnableVertexAttribArray(Vertex::tangentIdx);
+			glVertexAttribPointer(Vertex::tangentIdx, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, tangent));
+		}
+		// texCoordes
+		{
+			glEnableVertexAttribArray(Vertex::texCoordsIdx);
+			glVertexAttribPointer(Vertex::texCoordsIdx, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, texCoords));
+		}
 	}
+}
 
-	glBindVertexArray(0);
+void MeshData::GenerateLODs(int inMaxLODCount)
+{
+	CacheCount();
+	if (vertCount == 0 || idxCount == 0)
+		return;
 
-	// calculate bounds
+	// error limit relative to mesh size, beyond that the LOD would never be selected anyway
+	BoxBounds meshBounds;
 	for (int i = 0; i < vertCount; ++i)
-		bounds += vertices[i].position.ToVector4();
+		meshBounds += vertices[i].position.ToVector4();
+	float maxError = (meshBounds.max - meshBounds.min).Size3() * 0.05f;
+
+	lods.resize(1);
+	REArray<GLuint> lodIndices;
+	while ((int)lods.size() < inMaxLODCount)
+	{
+		MeshLOD prevLOD = lods.back();
+		if (prevLOD.error >= maxError)
+			break;
+
+		lodIndices.resize(prevLOD.idxCount);
+		SimplifyResult result = SimplifyMesh(lodIndices.data(), &indices[prevLOD.idxOffset], prevLOD.idxCount,
+			vertices[0].position.m, sizeof(Vertex), vertCount,
+			prevLOD.idxCount / 2, maxError - prevLOD.error);
+
+		// stop when simplification stalls, a LOD must have at most 80% triangles of previous one
+		if (result.indexCount == 0 || result.indexCount * 5 > prevLOD.idxCount * 4)
+			break;
+
+		MeshLOD lod;
+		lod.idxOffset = (GLsizei)indices.size();
+		lod.idxCount = result.indexCount;
+		// each LOD is simplified from previous one, errors add up
+		lod.error = prevLOD.error + result.error;
+		indices.insert(indices.end(), lodIndices.begin(), lodIndices.begin() + result.indexCount);
+		lods.push_back(lod);
+	}
+
+	idxCount = (GLsizei)indices.size();
 }
 
 REArray<Mesh*> Mesh::gMeshContainer;
@@ -71,7 +241,7 @@ void Mesh::Init(MeshData* inMeshData, Material* inMaterial)
 		meshData->InitResource();
 }
 
-void Mesh::Draw(RenderContext& renderContext, Material* overrideMaterial) const
+void Mesh::Draw(RenderContext& renderContext, Material* overrideMaterial, int lod) const
 {
 	Material* drawMaterial = overrideMaterial ? overrideMaterial : material;
 
@@ -84,16 +254,42 @@ void Mesh::Draw(RenderContext& renderContext, Material* overrideMaterial) const
 	if (meshData->VAO != renderContext.currentVAO)
 	{
 		renderContext.currentVAO = meshData->VAO;
-		glBindVertexArray(meshData->VAO);
+		renderContext.bCompactVertex = MeshData::IsCompactVertexVAO(meshData->VAO);
+		gGLState.BindVertexArray(meshData->VAO);
+		++renderContext.stats.VAOChangeCount;
 	}
+	drawMaterial->shader->SetCompactVertex(renderContext.bCompactVertex);
 	if (drawMaterial->bBothSide && renderContext.currentRenderState->bCullFace)
-		glDisable(GL_CULL_FACE);
+		gGLState.Disable(GL_CULL_FACE);
 	//glDrawElements(GL_TRIANGLES, (GLsizei)meshData->indices.size(), GL_UNSIGNED_INT, 0);
-	glDrawElements(GL_TRIANGLES, meshData->idxCount, GL_UNSIGNED_INT, 0);
+	const MeshLOD& meshLOD = meshData->lods[lod];
+	glDrawElementsBaseVertex(GL_TRIANGLES, meshLOD.idxCount, GL_UNSIGNED_INT,
+		(GLvoid*)((meshData->firstIndex + meshLOD.idxOffset) * sizeof(GLuint)), meshData->baseVertex);
+	++renderContext.stats.drawCount;
+	renderContext.stats.triangleCount += meshLOD.idxCount / 3;
 	//glBindVertexArray(0);
 
 	if (drawMaterial->bBothSide && renderContext.currentRenderState->bCullFace)
-		glEnable(GL_CULL_FACE);
+		gGLState.Enable(GL_CULL_FACE);
+}
+
+void MeshRenderData::MakeSortKey(unsigned int pass, bool bBackToFront, float maxDist)
+{
+	const unsigned __int64 depthMask = (1ull << sortDepthBits) - 1;
+	unsigned __int64 depth = (unsigned __int64)(Clamp(distToCamera / maxDist, 0.f, 1.f) * (float)depthMask);
+	if (bBackToFront)
+		depth = depthMask - depth;
+
+	unsigned __int64 state = material->shader->sortId & ((1u << sortShaderBits) - 1);
+	state = (state << sortMaterialBits) | (material->sortId & ((1u << sortMaterialBits) - 1));
+	state = (state << sortVAOBits) | (VAO & ((1u << sortVAOBits) - 1));
+	state = (state << sortMeshBits) | ((unsigned)idxOffset & ((1u << sortMeshBits) - 1));
+
+	const int stateBits = sortShaderBits + sortMaterialBits + sortVAOBits + sortMeshBits;
+	if (bBackToFront)
+		sortKey = ((unsigned __int64)pass << (sortDepthBits + stateBits)) | (depth << stateBits) | state;
+	else
+		sortKey = ((unsigned __int64)pass << (sortDepthBits + stateBits)) | (state << sortDepthBits) | depth;
 }
 
 void MeshRenderData::Draw(RenderContext& renderContext, Material* overrideMaterial) const
@@ -112,14 +308,19 @@ void MeshRenderData::Draw(RenderContext& renderContext, Material* overrideMateri
 	if (VAO != renderContext.currentVAO)
 	{
 		renderContext.currentVAO = VAO;
-		glBindVertexArray(VAO);
+		renderContext.bCompactVertex = MeshData::IsCompactVertexVAO(VAO);
+		gGLState.BindVertexArray(VAO);
+		++renderContext.stats.VAOChangeCount;
 	}
+	drawMaterial->shader->SetCompactVertex(renderContext.bCompactVertex);
 	if (drawMaterial->bBothSide && renderContext.currentRenderState->bCullFace)
-		glDisable(GL_CULL_FACE);
+		gGLState.Disable(GL_CULL_FACE);
 	//glDrawElements(GL_TRIANGLES, (GLsizei)meshData->indices.size(), GL_UNSIGNED_INT, 0);
-	glDrawElements(GL_TRIANGLES, idxCount, GL_UNSIGNED_INT, 0);
+	glDrawElementsBaseVertex(GL_TRIANGLES, idxCount, GL_UNSIGNED_INT, (GLvoid*)(idxOffset * sizeof(GLuint)), baseVertex);
+	++renderContext.stats.drawCount;
+	renderContext.stats.triangleCount += idxCount / 3;
 	//glBindVertexArray(0);
 
 	if (drawMaterial->bBothSide && renderContext.currentRenderState->bCullFace)
-		glEnable(GL_CULL_FACE);
+		gGLState.Enable(GL_CULL_FACE);
 }
\ No newline at end of file
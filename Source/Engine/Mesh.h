@@ -43,11 +43,38 @@ struct Vertex
 	}
 };
 
+// 20 bytes vertex, see Math/Quantization.h
+// normal and tangent attributes are left disabled, shader decode them from tangentFrame
+struct CompactVertex
+{
+	UVector3 position;				// 12, float
+	unsigned __int32 tangentFrame;	// 4, octahedral normal + tangent angle + bitangent sign, GL_INT_2_10_10_10_REV
+	unsigned __int16 texCoords[2];	// 4, half
+
+	const static GLint positionIdx		= Vertex::positionIdx;
+	const static GLint texCoordsIdx		= Vertex::texCoordsIdx;
+	const static GLint tangentFrameIdx	= 4;
+};
+
+// index range of one level of detail, LODs share the vertex buffer
+struct MeshLOD
+{
+	GLsizei idxOffset;
+	GLsizei idxCount;
+	// max distance from LOD0 surface in mesh space, 0 for LOD0
+	float error;
+};
+
 class MeshData
 {
 public:
 	static REArray<MeshData*> gMeshDataContainer;
 
+	// InitResource puts vertices and indices in gGeometryArena instead of own buffers
+	static bool gUseGeometryArena;
+
+	static RESet<GLuint> gCompactVertexVAOs;
+
 	static MeshData* Create()
 	{
 		MeshData* md = new MeshData();
@@ -59,26 +86,73 @@ public:
 	VAO(0)
 	, VBO(0)
 	, EBO(0)
+	, baseVertex(0)
+	, firstIndex(0)
 	, bHasResource(0)
+	, bCompactVertex(0)
+	, bInGeometryArena(0)
 	{}
 
 	void CacheCount()
 	{
 		vertCount = (GLsizei)vertices.size();
 		idxCount = (GLsizei)indices.size();
+		if (lods.size() <= 1)
+		{
+			lods.resize(1);
+			lods[0].idxOffset = 0;
+			lods[0].idxCount = idxCount;
+			lods[0].error = 0.f;
+		}
+	}
+
+	static const int maxLODCount = 6;
+
+	// simplify LOD0 into coarser LODs appended to indices, before InitResource
+	// each LOD aims at half the triangles of the previous one
+	void GenerateLODs(int inMaxLODCount = maxLODCount);
+
+	int GetLODCount() const
+	{
+		return (int)lods.size();
 	}
 
 	void InitResource();
 
+	// attribute pointers of Vertex or CompactVertex layout, for bound VAO and array buffer
+	static void SetupVertexAttributes(bool bCompactVertex);
+
+	// VAOs with CompactVertex layout, draws tell shaders the format of the VAO they bind
+	static void RegisterCompactVertexVAO(GLuint VAO, bool bCompactVertex);
+	static bool IsCompactVertexVAO(GLuint VAO) { return gCompactVertexVAOs.find(VAO) != gCompactVertexVAOs.end(); }
+
+	// can texcoords be stored as half
+	bool CanUseCompactVertex() const;
+
+	// size of vertex data on gpu
+	size_t GetVertexBufferSize() const
+	{
+		return (size_t)vertCount * (bCompactVertex ? sizeof(CompactVertex) : sizeof(Vertex));
+	}
+
 	REArray<Vertex> vertices;
 	REArray<GLuint> indices;
+	// LOD0 is the original index list
+	REArray<MeshLOD> lods;
 	GLsizei vertCount;
 	GLsizei idxCount;
 
 	BoxBounds bounds;
 
 	bool bHasResource;
+	// request compact vertex before InitResource, will be reset if mesh data can't fit
+	bool bCompactVertex;
+	bool bInGeometryArena;
+	// VBO and EBO are 0 in geometry arena
 	GLuint VAO, VBO, EBO;
+	// place in the buffers, draws add them to vertex index and index offset
+	GLint baseVertex;
+	GLsizei firstIndex;
 };
 
 class Mesh
@@ -105,7 +179,7 @@ public:
 	Material* material;
 
 	void Init(MeshData* inMeshData, Material* inMaterial);
-	void Draw(struct RenderContext& renderContext, Material* overrideMaterial = 0) const;
+	void Draw(struct RenderContext& renderContext, Material* overrideMaterial = 0, int lod = 0) const;
 };
 
 struct MeshRenderData
@@ -113,19 +187,30 @@ struct MeshRenderData
 public:
 	Matrix4 prevModelMat;	// 16 x 4
 	Matrix4 modelMat;		// 16 x 4
+	Vector4_3 center;		// 16, world space bounds center
 	Material* material;		// 8
 	GLuint VAO;				// 4
+	GLsizei idxOffset;		// 4, first index of selected LOD in index buffer
 	GLsizei idxCount;		// 4
+	GLint baseVertex;		// 4
 	float distToCamera;		// 4
-
-	static bool CompareAlphaBlend(const MeshRenderData& a, const MeshRenderData& b)
-	{
-		return a.distToCamera > b.distToCamera;
-	}
-	static bool CompareOpaque(const MeshRenderData& a, const MeshRenderData& b)
-	{
-		return a.distToCamera < b.distToCamera;
-	}
+	int componentIndex;		// 4, cullingIndex of owner MeshComponent
+	int meshIndex;			// 4, index in mesh list of owner MeshComponent
+	unsigned __int64 sortKey;	// 8
+
+	// sort key layout, high to low bits
+	// opaque:		pass 2 | shader 10 | material 14 | VAO 8 | mesh 14 | depth 16, grouped by state, front to back in a group
+	// alpha blend:	pass 2 | inverted depth 16 | shader 10 | material 14 | VAO 8 | mesh 14, back to front
+	// mesh is idxOffset, same mesh and LOD in a group end up next to each other and can be drawn instanced.
+	// ids wrap around if they don't fit, which only costs extra state changes
+	static const int sortDepthBits = 16;
+	static const int sortMeshBits = 14;
+	static const int sortVAOBits = 8;
+	static const int sortMaterialBits = 14;
+	static const int sortShaderBits = 10;
+
+	// depth is distToCamera / maxDist quantized to sortDepthBits
+	void MakeSortKey(unsigned int pass, bool bBackToFront, float maxDist);
 
 	void Draw(struct RenderContext& renderContext, Material* overrideMaterial = 0) const;
 };
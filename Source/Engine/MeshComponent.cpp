@@ -6,47 +6,77 @@
 
 REArray<MeshComponent*> MeshComponent::gMeshComponentContainer;
 
-void MeshComponent::CacheRenderMatrices()
-{
-	bRenderTransformDirty = false;
-
-	prevModelMat = modelMat;
-	modelMat = QuatToMatrix4(EulerToQuat(rotation));
-	modelMat.SetTranslation(position);
-	modelMat.ApplyScale(scale);
-	//modelMat = MakeMatrix(position, EulerToQuat(rotation), scale);
-
-	OBB.SetBounds(bounds, modelMat, scale);
-
-	if (!bHasCachedRenderTransform)
-	{
-		bHasCachedRenderTransform = true;
-		prevModelMat = modelMat;
-	}
-}
-
-void MeshComponent::UpdateEndOfFrame(float deltaTime)
-{
-	if (bRenderTransformDirty)
-		CacheRenderMatrices();
-}
-
 void MeshComponent::SetMeshList(const REArray<Mesh*>& inMeshList)
 {
 	meshList = inMeshList;
+	meshLODs.clear();
+	meshLODs.resize(meshList.size(), 0);
 	for (int i = 0, ni = (int)inMeshList.size(); i < ni; ++i)
 	{
 		MeshData* meshData = inMeshList[i]->meshData;
 		if(meshData)
 			bounds += meshData->bounds;
 	}
+	// bounds changed, OBB needs update
+	gTransformSystem.MarkDirty(transformHandle);
 }
 
 void MeshComponent::AddMesh(Mesh* inMesh)
 {
 	meshList.push_back(inMesh);
+	meshLODs.push_back(0);
 	if(inMesh->meshData)
 		bounds += inMesh->meshData->bounds;
+	gTransformSystem.MarkDirty(transformHandle);
+}
+
+// relative margin around screen error threshold for LOD switch
+static const float gLODHysteresis = 0.25f;
+
+int MeshComponent::SelectLOD(int i, const Vector4_3& viewPosition, float screenScale, float maxScreenError)
+{
+	const MeshData* meshData = meshList[i]->meshData;
+	if (maxScreenError <= 0.f || !meshData || meshData->GetLODCount() <= 1)
+	{
+		meshLODs[i] = 0;
+		return 0;
+	}
+
+	// pixels per mesh space unit at the closest point of the bounds
+	float maxScale = Max(modelMat.mScaledAxisX.Size3(), Max(modelMat.mScaledAxisY.Size3(), modelMat.mScaledAxisZ.Size3()));
+	float dist = Max((OBB.center - viewPosition).Size3() - OBB.extent.Size3(), KINDA_SMALL_NUMBER);
+	float pixelPerUnit = maxScale * screenScale / dist;
+
+	// switch to a coarser LOD when its error is below lower threshold,
+	// to a finer LOD when current error is above upper threshold
+	float lowerError = maxScreenError * (1.f - gLODHysteresis) / pixelPerUnit;
+	float upperError = maxScreenError * (1.f + gLODHysteresis) / pixelPerUnit;
+
+	// errors increase with LOD
+	int lowerLOD = 0;
+	int upperLOD = 0;
+	for (int lod = 1, nlod = meshData->GetLODCount(); lod < nlod; ++lod)
+	{
+		float error = meshData->lods[lod].error;
+		if (error <= lowerError)
+			lowerLOD = lod;
+		if (error <= upperError)
+			upperLOD = lod;
+	}
+
+	int curLOD = meshLODs[i];
+	if (curLOD < lowerLOD)
+		curLOD = lowerLOD;
+	else if (curLOD > upperLOD)
+		curLOD = upperLOD;
+	meshLODs[i] = (unsigned char)curLOD;
+	return curLOD;
+}
+
+void MeshComponent::SelectLODs(const Vector4_3& viewPosition, float screenScale, float maxScreenError)
+{
+	for (int i = 0, ni = (int)meshList.size(); i < ni; ++i)
+		SelectLOD(i, viewPosition, screenScale, maxScreenError);
 }
 
 void MeshComponent::Draw(RenderContext& renderContext, Material* overrideMaterial)
@@ -67,6 +97,6 @@ void MeshComponent::Draw(RenderContext& renderContext, Material* overrideMateria
 			//meshListPtr[i]->material->SetParameter("normalMat", normalMat);
 		}
 
-		mesh->Draw(renderContext, overrideMaterial);
+		mesh->Draw(renderContext, overrideMaterial, meshLODs[i]);
 	}
 }
\ No newline at end of file
@@ -5,6 +5,9 @@
 #include "Math/REMath.h"
 
 #include "Component.h"
+#include "TransformSystem.h"
+#include "Culling.h"
+#include "BVH.h"
 
 class Mesh;
 
@@ -16,7 +19,10 @@ public:
 	static MeshComponent* Create()
 	{
 		MeshComponent* mc = new MeshComponent();
+		mc->cullingIndex = (int)gMeshComponentContainer.size();
 		gMeshComponentContainer.push_back(mc);
+		gMeshCullingBounds.Resize((int)gMeshComponentContainer.size());
+		gMeshBVH.Resize((int)gMeshComponentContainer.size());
 		return mc;
 	}
 
@@ -32,15 +38,17 @@ public:
 
 	OrientedBoxBounds OBB;
 
-	bool bRenderVisibile = true; // for shadow rendering
+	bool bOccluder = false; // rasterized into gOcclusionBuffer when large on screen
 
 	MeshComponent()
 	: position(Vector4_3::Zero())
 	, rotation(Vector4_3::Zero())
 	, scale(Vector4_3(1))
+	, cullingIndex(-1)
 	, bRenderTransformDirty(true)
-	, bHasCachedRenderTransform(false)
-	{}
+	{
+		transformHandle = gTransformSystem.CreateNode(this);
+	}
 
 	MeshComponent(const REArray<Mesh*>& inMeshList,
 		Vector4_3 inPosition = Vector4_3::Zero(),
@@ -49,45 +57,70 @@ public:
 		: position(inPosition)
 		, rotation(inRotation)
 		, scale(inScale)
+		, cullingIndex(-1)
 		, bRenderTransformDirty(true)
-		, bHasCachedRenderTransform(false)
 	{
+		transformHandle = gTransformSystem.CreateNode(this);
+		gTransformSystem.SetLocalPosition(transformHandle, position);
+		gTransformSystem.SetLocalRotation(transformHandle, EulerToQuat(rotation));
+		gTransformSystem.SetLocalScale(transformHandle, scale);
 		SetMeshList(inMeshList);
 	}
 
+	// local transform, relative to parent
 	inline void SetPosition(const Vector4_3& inPosition)
 	{
 		position = inPosition;
-		bRenderTransformDirty = true;
+		gTransformSystem.SetLocalPosition(transformHandle, position);
 	}
 
 	inline void SetRotation(const Vector4_3& inRotation)
 	{
 		rotation = inRotation;
-		bRenderTransformDirty = true;
+		gTransformSystem.SetLocalRotation(transformHandle, EulerToQuat(rotation));
 	}
 
 	inline void SetScale(const Vector4_3& inScale)
 	{
 		scale = inScale;
-		bRenderTransformDirty = true;
+		gTransformSystem.SetLocalScale(transformHandle, scale);
 	}
 
+	// parent is a transform system handle, -1 for root
+	inline void SetParent(int parentHandle)
+	{
+		gTransformSystem.SetParent(transformHandle, parentHandle);
+	}
 
-	virtual void UpdateEndOfFrame(float deltaTime) override;
+	inline int GetTransformHandle() const { return transformHandle; }
+	// index into gMeshCullingBounds, gMeshBVH and gMeshComponentContainer, -1 if not created by Create()
+	inline int GetCullingIndex() const { return cullingIndex; }
 
 	const REArray<Mesh*>& GetMeshList() { return meshList; }
 	void SetMeshList(const REArray<Mesh*>& inMeshList);
 	void AddMesh(Mesh* inMesh);
 
+	// selected LOD of mesh i in mesh list
+	inline int GetMeshLOD(int i) const { return meshLODs[i]; }
+	// pick the coarsest LOD of mesh i whose error projects to at most maxScreenError pixels,
+	// a LOD only changes once its error is a margin away from the threshold, so it doesn't flicker.
+	// maxScreenError 0 selects LOD0. returns the selected LOD
+	int SelectLOD(int i, const Vector4_3& viewPosition, float screenScale, float maxScreenError);
+	// SelectLOD for all meshes
+	void SelectLODs(const Vector4_3& viewPosition, float screenScale, float maxScreenError);
+
 	void Draw(struct RenderContext& renderContext, Material* overrideMaterial = 0);
 
 protected:
 
+	int transformHandle;
+	int cullingIndex;
+
+	// world transform changed this frame, set by transform system
 	bool bRenderTransformDirty;
-	bool bHasCachedRenderTransform;
 
 	REArray<Mesh*> meshList;
+	REArray<unsigned char> meshLODs;
 
-	void CacheRenderMatrices();
+	friend class TransformSystem;
 };
\ No newline at end of file
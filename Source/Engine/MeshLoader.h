@@ -7,6 +7,8 @@
 #include "Texture2D.h"
 #include "TextureCube.h"
 #include "Mesh.h"
+#include "MeshComponent.h"
+#include "TransformSystem.h"
 
 #include "Profiler.h"
 
@@ -16,7 +18,18 @@ enum class EMeshConversion
 	YUpToZUP,
 };
 
-void ProcessMesh(REArray<Mesh*>& output, aiMesh* mesh, const aiScene* scene, REArray<Material*>& materials, EMeshConversion conversion)
+// imported node hierarchy, parent is always before child
+struct MeshNode
+{
+	int parentIndex;
+	Vector4_3 position;
+	Quat rotation;
+	Vector4_3 scale;
+	// index into loaded mesh list
+	REArray<int> meshIndices;
+};
+
+void ProcessMesh(REArray<Mesh*>& output, aiMesh* mesh, const aiScene* scene, REArray<Material*>& materials, EMeshConversion conversion, bool bCompactVertex, bool bGenerateLODs)
 {
 	// add mesh
 	int idx = (int)output.size();
@@ -56,6 +69,9 @@ void ProcessMesh(REArray<Mesh*>& output, aiMesh* mesh, const aiScene* scene, REA
 	}
 
 	meshData->CacheCount();
+	if (bGenerateLODs)
+		meshData->GenerateLODs();
+	meshData->bCompactVertex = bCompactVertex;
 
 	if (mesh->mMaterialIndex >= 0)
 	{
@@ -65,22 +81,49 @@ void ProcessMesh(REArray<Mesh*>& output, aiMesh* mesh, const aiScene* scene, REA
 	}
 }
 
-void ProcessNode(REArray<Mesh*>& output, aiNode* node, const aiScene* scene, REArray<Material*>& materials, EMeshConversion conversion)
+void ProcessNode(REArray<Mesh*>& output, REArray<MeshNode>& nodes, int parentIndex, aiNode* node, const aiScene* scene, REArray<Material*>& materials, EMeshConversion conversion, bool bCompactVertex, bool bGenerateLODs)
 {
+	int nodeIndex = (int)nodes.size();
+	nodes.push_back(MeshNode());
+	{
+		aiVector3D s, t;
+		aiQuaternion q;
+		node->mTransformation.Decompose(s, q, t);
+
+		MeshNode& outNode = nodes[nodeIndex];
+		outNode.parentIndex = parentIndex;
+		if (conversion == EMeshConversion::YUpToZUP)
+		{
+			// same change of basis as vertices: (x, y, z) -> (x, -z, y)
+			outNode.position = Vector4_3(t.x, -t.z, t.y);
+			outNode.rotation = Quat(q.x, -q.z, q.y, q.w);
+			outNode.scale = Vector4_3(s.x, s.z, s.y);
+		}
+		else
+		{
+			outNode.position = Vector4_3(t.x, t.y, t.z);
+			outNode.rotation = Quat(q.x, q.y, q.z, q.w);
+			outNode.scale = Vector4_3(s.x, s.y, s.z);
+		}
+	}
+
 	for (unsigned int i = 0; i < node->mNumMeshes; ++i)
 	{
 		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		ProcessMesh(output, mesh, scene, materials, conversion);
+		nodes[nodeIndex].meshIndices.push_back((int)output.size());
+		ProcessMesh(output, mesh, scene, materials, conversion, bCompactVertex, bGenerateLODs);
 	}
 	for (unsigned int i = 0; i < node->mNumChildren; ++i)
 	{
-		ProcessNode(output, node->mChildren[i], scene, materials, conversion);
+		ProcessNode(output, nodes, nodeIndex, node->mChildren[i], scene, materials, conversion, bCompactVertex, bGenerateLODs);
 	}
 
 }
+
 void LoadMesh(REArray<Mesh*>& output, std::string path, 
 	Shader* defaultShader, Shader* defaultAlphaBlendShader, TextureCube* skyTex,
-	EMeshConversion conversion = EMeshConversion::None)
+	EMeshConversion conversion = EMeshConversion::None, bool bCompactVertex = false, REArray<MeshNode>* outNodes = 0,
+	bool bGenerateLODs = false)
 {
 	//CPU_SCOPED_PROFILE_PRINT("LoadMesh");
 
@@ -192,6 +235,80 @@ void LoadMesh(REArray<Mesh*>& output, std::string path,
 		materials.push_back(material);
 	}
 
-	ProcessNode(output, scene->mRootNode, scene, materials, conversion);
+	int startIdx = (int)output.size();
+	REArray<MeshNode> nodes;
+	Uint64 processStart = SDL_GetPerformanceCounter();
+	ProcessNode(output, outNodes ? *outNodes : nodes, -1, scene->mRootNode, scene, materials, conversion, bCompactVertex, bGenerateLODs);
+
+	// report triangles of each LOD level summed over meshes, meshes without a LOD count their coarsest one
+	if (bGenerateLODs)
+	{
+		double processTime = (double)(SDL_GetPerformanceCounter() - processStart) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+		int lodTriangleCount[MeshData::maxLODCount] = {};
+		for (int i = startIdx, ni = (int)output.size(); i < ni; ++i)
+		{
+			const MeshData* meshData = output[i]->meshData;
+			if (!meshData || meshData->GetLODCount() == 0)
+				continue;
+			for (int lod = 0; lod < MeshData::maxLODCount; ++lod)
+				lodTriangleCount[lod] += meshData->lods[Min(lod, meshData->GetLODCount() - 1)].idxCount / 3;
+		}
+		printf("LoadMesh %s: LOD triangles", path.c_str());
+		for (int lod = 0; lod < MeshData::maxLODCount; ++lod)
+			printf(" %d", lodTriangleCount[lod]);
+		printf(", import and simplify %.1f ms\n", processTime);
+	}
+
+	// report vertex memory, also the bytes fetched per vertex in passes reading all attributes
+	if (bCompactVertex)
+	{
+		int compactCount = 0;
+		size_t vertCount = 0;
+		size_t fullSize = 0;
+		size_t actualSize = 0;
+		for (int i = startIdx, ni = (int)output.size(); i < ni; ++i)
+		{
+			const MeshData* meshData = output[i]->meshData;
+			if (!meshData)
+				continue;
+			if (meshData->bCompactVertex)
+				++compactCount;
+			vertCount += meshData->vertCount;
+			fullSize += meshData->vertCount * sizeof(Vertex);
+			actualSize += meshData->GetVertexBufferSize();
+		}
+		if (vertCount > 0)
+		{
+			printf("LoadMesh %s: %d/%d meshes compact, %d verts, vertex buffer %.2f MB -> %.2f MB (%.1f%% saved), %.1f -> %.1f bytes per vertex\n",
+				path.c_str(), compactCount, (int)output.size() - startIdx, (int)vertCount,
+				(double)fullSize / (1024.0 * 1024.0), (double)actualSize / (1024.0 * 1024.0),
+				100.0 * (1.0 - (double)actualSize / (double)fullSize),
+				(double)fullSize / (double)vertCount, (double)actualSize / (double)vertCount);
+		}
+	}
 }
 
+// create transform nodes under rootHandle and one mesh component per mesh
+void CreateMeshComponents(const REArray<Mesh*>& meshes, const REArray<MeshNode>& nodes, int rootHandle, REArray<MeshComponent*>* outComponents = 0)
+{
+	REArray<int> nodeHandles(nodes.size());
+	for (int i = 0, ni = (int)nodes.size(); i < ni; ++i)
+	{
+		const MeshNode& node = nodes[i];
+		int parentHandle = node.parentIndex >= 0 ? nodeHandles[node.parentIndex] : rootHandle;
+		int handle = gTransformSystem.CreateNode(0, parentHandle);
+		gTransformSystem.SetLocalPosition(handle, node.position);
+		gTransformSystem.SetLocalRotation(handle, node.rotation);
+		gTransformSystem.SetLocalScale(handle, node.scale);
+		nodeHandles[i] = handle;
+
+		for (int j = 0, nj = (int)node.meshIndices.size(); j < nj; ++j)
+		{
+			MeshComponent* mc = MeshComponent::Create();
+			mc->AddMesh(meshes[node.meshIndices[j]]);
+			mc->SetParent(handle);
+			if (outComponents)
+				outComponents->push_back(mc);
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,346 @@
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include "Containers/Containers.h"
+
+#include "MeshSimplify.h"
+
+struct SimplifyPosition
+{
+	float x, y, z;
+};
+
+// sum of squared distances to planes, weighted by triangle area
+// x^T A x + 2 b^T x + c, A is symmetric
+struct Quadric
+{
+	double a00, a01, a02, a11, a12, a22;
+	double b0, b1, b2;
+	double c;
+	double weight;
+};
+
+// cosine of the largest normal change a collapse may cause on a remaining triangle
+static const double gSimplifyMinNormalDot = 0.25;
+
+// collapse vertex "from" onto vertex "to"
+struct SimplifyCollapse
+{
+	float cost;
+	unsigned int from;
+	unsigned int to;
+};
+
+static void MakePlaneQuadric(Quadric& q, double nx, double ny, double nz, double d, double weight)
+{
+	q.a00 = nx * nx * weight;
+	q.a01 = nx * ny * weight;
+	q.a02 = nx * nz * weight;
+	q.a11 = ny * ny * weight;
+	q.a12 = ny * nz * weight;
+	q.a22 = nz * nz * weight;
+	q.b0 = nx * d * weight;
+	q.b1 = ny * d * weight;
+	q.b2 = nz * d * weight;
+	q.c = d * d * weight;
+	q.weight = weight;
+}
+
+static void AddQuadric(Quadric& q, const Quadric& other)
+{
+	q.a00 += other.a00;
+	q.a01 += other.a01;
+	q.a02 += other.a02;
+	q.a11 += other.a11;
+	q.a12 += other.a12;
+	q.a22 += other.a22;
+	q.b0 += other.b0;
+	q.b1 += other.b1;
+	q.b2 += other.b2;
+	q.c += other.c;
+	q.weight += other.weight;
+}
+
+// mean squared distance of p to the planes in q
+static double GetQuadricError(const Quadric& q, const SimplifyPosition& p)
+{
+	if (q.weight <= 0)
+		return 0;
+
+	double x = p.x, y = p.y, z = p.z;
+	double r = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z
+		+ 2 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z)
+		+ 2 * (q.b0 * x + q.b1 * y + q.b2 * z)
+		+ q.c;
+	return fabs(r) / q.weight;
+}
+
+static void GetTriangleNormal(const SimplifyPosition& p0, const SimplifyPosition& p1, const SimplifyPosition& p2,
+	double& outX, double& outY, double& outZ)
+{
+	double e1x = p1.x - p0.x, e1y = p1.y - p0.y, e1z = p1.z - p0.z;
+	double e2x = p2.x - p0.x, e2y = p2.y - p0.y, e2z = p2.z - p0.z;
+	outX = e1y * e2z - e1z * e2y;
+	outY = e1z * e2x - e1x * e2z;
+	outZ = e1x * e2y - e1y * e2x;
+}
+
+SimplifyResult SimplifyMesh(unsigned int* outIndices, const unsigned int* indices, int indexCount,
+	const float* positions, int positionStride, int vertexCount,
+	int targetIndexCount, float maxError)
+{
+	SimplifyResult result;
+	result.indexCount = indexCount;
+	result.error = 0.f;
+
+	memcpy(outIndices, indices, indexCount * sizeof(unsigned int));
+	if (indexCount <= targetIndexCount || vertexCount == 0)
+		return result;
+
+	REArray<SimplifyPosition> pos(vertexCount);
+	for (int v = 0; v < vertexCount; ++v)
+	{
+		const float* p = (const float*)((const char*)positions + (size_t)v * positionStride);
+		pos[v].x = p[0];
+		pos[v].y = p[1];
+		pos[v].z = p[2];
+	}
+
+	// vertices at the same position map to the first of them, the canonical vertex.
+	// more than one vertex at a position is an attribute seam, lock it
+	REArray<unsigned int> remap(vertexCount);
+	REArray<unsigned char> bLocked(vertexCount, 0);
+	{
+		REArray<unsigned int> order(vertexCount);
+		for (int v = 0; v < vertexCount; ++v)
+			order[v] = v;
+		std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b)
+		{
+			const SimplifyPosition& pa = pos[a];
+			const SimplifyPosition& pb = pos[b];
+			if (pa.x != pb.x) return pa.x < pb.x;
+			if (pa.y != pb.y) return pa.y < pb.y;
+			if (pa.z != pb.z) return pa.z < pb.z;
+			return a < b;
+		});
+		for (int i = 0; i < vertexCount;)
+		{
+			unsigned int canonical = order[i];
+			int j = i;
+			while (j < vertexCount && memcmp(&pos[order[j]], &pos[canonical], sizeof(SimplifyPosition)) == 0)
+				remap[order[j++]] = canonical;
+			if (j - i > 1)
+				bLocked[canonical] = 1;
+			i = j;
+		}
+	}
+
+	// edges between canonical vertices, an edge not shared by exactly 2 triangles
+	// is on an open border or non-manifold, lock its vertices
+	int triCount = indexCount / 3;
+	{
+		REArray<unsigned __int64> edges;
+		edges.reserve(indexCount);
+		for (int t = 0; t < triCount; ++t)
+		{
+			for (int e = 0; e < 3; ++e)
+			{
+				unsigned int a = remap[indices[t * 3 + e]];
+				unsigned int b = remap[indices[t * 3 + (e + 1) % 3]];
+				if (a == b)
+					continue;
+				if (a > b)
+					std::swap(a, b);
+				edges.push_back(((unsigned __int64)a << 32) | b);
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		for (int i = 0, ni = (int)edges.size(); i < ni;)
+		{
+			int j = i;
+			while (j < ni && edges[j] == edges[i])
+				++j;
+			if (j - i != 2)
+			{
+				bLocked[(unsigned int)(edges[i] >> 32)] = 1;
+				bLocked[(unsigned int)(edges[i] & 0xFFFFFFFF)] = 1;
+			}
+			i = j;
+		}
+	}
+
+	// plane quadrics of canonical vertices
+	REArray<Quadric> quadrics(vertexCount);
+	memset(quadrics.data(), 0, vertexCount * sizeof(Quadric));
+	for (int t = 0; t < triCount; ++t)
+	{
+		unsigned int v0 = remap[indices[t * 3]];
+		unsigned int v1 = remap[indices[t * 3 + 1]];
+		unsigned int v2 = remap[indices[t * 3 + 2]];
+		double nx, ny, nz;
+		GetTriangleNormal(pos[v0], pos[v1], pos[v2], nx, ny, nz);
+		double len = sqrt(nx * nx + ny * ny + nz * nz);
+		if (len <= 0)
+			continue;
+		nx /= len;
+		ny /= len;
+		nz /= len;
+		double d = -(nx * pos[v0].x + ny * pos[v0].y + nz * pos[v0].z);
+		Quadric q;
+		MakePlaneQuadric(q, nx, ny, nz, d, len * 0.5);
+		AddQuadric(quadrics[v0], q);
+		AddQuadric(quadrics[v1], q);
+		AddQuadric(quadrics[v2], q);
+	}
+
+	double maxErrorSq = (double)maxError * maxError;
+	double resultErrorSq = 0;
+
+	REArray<unsigned int> collapseTarget(vertexCount);
+	REArray<unsigned char> bUsed(vertexCount);
+	REArray<unsigned int> triOffsets(vertexCount + 1);
+	REArray<unsigned int> triList(indexCount);
+	REArray<SimplifyCollapse> collapses;
+
+	// each pass collapses the cheapest edges whose neighborhoods don't overlap, then rebuilds adjacency
+	int curIndexCount = indexCount;
+	while (curIndexCount > targetIndexCount)
+	{
+		int curTriCount = curIndexCount / 3;
+
+		// vertex to triangles
+		memset(triOffsets.data(), 0, (vertexCount + 1) * sizeof(unsigned int));
+		for (int i = 0; i < curIndexCount; ++i)
+			++triOffsets[outIndices[i] + 1];
+		for (int v = 0; v < vertexCount; ++v)
+			triOffsets[v + 1] += triOffsets[v];
+		for (int i = 0; i < curIndexCount; ++i)
+			triList[triOffsets[outIndices[i]]++] = i / 3;
+		for (int v = vertexCount; v > 0; --v)
+			triOffsets[v] = triOffsets[v - 1];
+		triOffsets[0] = 0;
+
+		// candidates, both directions of each edge
+		collapses.clear();
+		for (int t = 0; t < curTriCount; ++t)
+		{
+			for (int e = 0; e < 3; ++e)
+			{
+				unsigned int a = outIndices[t * 3 + e];
+				unsigned int b = outIndices[t * 3 + (e + 1) % 3];
+				for (int dir = 0; dir < 2; ++dir)
+				{
+					unsigned int from = dir ? b : a;
+					unsigned int to = dir ? a : b;
+					unsigned int cFrom = remap[from];
+					unsigned int cTo = remap[to];
+					if (cFrom == cTo || bLocked[cFrom])
+						continue;
+					Quadric q = quadrics[cFrom];
+					AddQuadric(q, quadrics[cTo]);
+					SimplifyCollapse collapse;
+					collapse.cost = (float)GetQuadricError(q, pos[to]);
+					collapse.from = from;
+					collapse.to = to;
+					collapses.push_back(collapse);
+				}
+			}
+		}
+		if (collapses.size() == 0)
+			break;
+
+		std::sort(collapses.begin(), collapses.end(), [](const SimplifyCollapse& a, const SimplifyCollapse& b)
+		{
+			if (a.cost != b.cost) return a.cost < b.cost;
+			if (a.from != b.from) return a.from < b.from;
+			return a.to < b.to;
+		});
+
+		for (int v = 0; v < vertexCount; ++v)
+			collapseTarget[v] = v;
+		memset(bUsed.data(), 0, vertexCount);
+
+		int removedIndexCount = 0;
+		int collapseCount = 0;
+		for (int c = 0, nc = (int)collapses.size(); c < nc; ++c)
+		{
+			const SimplifyCollapse& collapse = collapses[c];
+			if (collapse.cost > maxErrorSq || curIndexCount - removedIndexCount <= targetIndexCount)
+				break;
+
+			unsigned int cFrom = remap[collapse.from];
+			unsigned int cTo = remap[collapse.to];
+			if (bUsed[cFrom] || bUsed[cTo])
+				continue;
+
+			// triangles around "from" either contain "to" and are removed,
+			// or move one corner onto "to", which must not flip them
+			bool bFlip = false;
+			int removedTriCount = 0;
+			const SimplifyPosition& newPos = pos[collapse.to];
+			for (unsigned int k = triOffsets[collapse.from]; k < triOffsets[collapse.from + 1] && !bFlip; ++k)
+			{
+				const unsigned int* tri = &outIndices[triList[k] * 3];
+				if (remap[tri[0]] == cTo || remap[tri[1]] == cTo || remap[tri[2]] == cTo)
+				{
+					++removedTriCount;
+					continue;
+				}
+				SimplifyPosition p[3] = { pos[tri[0]], pos[tri[1]], pos[tri[2]] };
+				double n0x, n0y, n0z;
+				GetTriangleNormal(p[0], p[1], p[2], n0x, n0y, n0z);
+				for (int i = 0; i < 3; ++i)
+				{
+					if (tri[i] == collapse.from)
+						p[i] = newPos;
+				}
+				double n1x, n1y, n1z;
+				GetTriangleNormal(p[0], p[1], p[2], n1x, n1y, n1z);
+				// reject large normal changes too, small ones add up over passes
+				double len0 = sqrt(n0x * n0x + n0y * n0y + n0z * n0z);
+				double len1 = sqrt(n1x * n1x + n1y * n1y + n1z * n1z);
+				bFlip = (n0x * n1x + n0y * n1y + n0z * n1z) <= gSimplifyMinNormalDot * len0 * len1;
+			}
+			if (bFlip)
+				continue;
+
+			// neighborhood is fixed for the rest of this pass, so flip tests above stay valid
+			for (unsigned int k = triOffsets[collapse.from]; k < triOffsets[collapse.from + 1]; ++k)
+			{
+				const unsigned int* tri = &outIndices[triList[k] * 3];
+				bUsed[remap[tri[0]]] = 1;
+				bUsed[remap[tri[1]]] = 1;
+				bUsed[remap[tri[2]]] = 1;
+			}
+
+			collapseTarget[collapse.from] = collapse.to;
+			AddQuadric(quadrics[cTo], quadrics[cFrom]);
+			resultErrorSq = std::max(resultErrorSq, (double)collapse.cost);
+			removedIndexCount += removedTriCount * 3;
+			++collapseCount;
+		}
+
+		if (collapseCount == 0)
+			break;
+
+		// apply, drop triangles with two corners at one position
+		int writeCount = 0;
+		for (int t = 0; t < curTriCount; ++t)
+		{
+			unsigned int v0 = collapseTarget[outIndices[t * 3]];
+			unsigned int v1 = collapseTarget[outIndices[t * 3 + 1]];
+			unsigned int v2 = collapseTarget[outIndices[t * 3 + 2]];
+			if (remap[v0] == remap[v1] || remap[v1] == remap[v2] || remap[v2] == remap[v0])
+				continue;
+			outIndices[writeCount++] = v0;
+			outIndices[writeCount++] = v1;
+			outIndices[writeCount++] = v2;
+		}
+		curIndexCount = writeCount;
+	}
+
+	result.indexCount = curIndexCount;
+	result.error = (float)sqrt(resultErrorSq);
+	return result;
+}
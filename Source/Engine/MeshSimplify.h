@@ -0,0 +1,22 @@
+#pragma once
+
+// quadric error edge collapse simplification (Garland & Heckbert), no GL dependency
+// the vertex buffer is kept as is, only a new index list is made, so LODs can share vertices.
+// a collapse moves a vertex onto a neighbor vertex, no attribute is interpolated.
+// vertices on attribute seams (several vertices at one position, e.g. UV or normal seams)
+// and on open or non-manifold edges are never moved, so seams and borders stay where they are.
+// collapses that flip a triangle are rejected.
+
+struct SimplifyResult
+{
+	int indexCount;
+	// largest collapse error, as distance in position units
+	float error;
+};
+
+// simplify triangle list indices into outIndices (indexCount elements) until targetIndexCount
+// or until the next collapse would exceed maxError (distance in position units)
+// positions are 3 floats, positionStride bytes apart
+SimplifyResult SimplifyMesh(unsigned int* outIndices, const unsigned int* indices, int indexCount,
+	const float* positions, int positionStride, int vertexCount,
+	int targetIndexCount, float maxError);
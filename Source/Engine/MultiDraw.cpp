@@ -0,0 +1,203 @@
+
+#include "Render.h"
+
+#include "Mesh.h"
+#include "MeshComponent.h"
+#include "GeometryArena.h"
+#include "RingBuffer.h"
+#include "GLState.h"
+
+#include "MultiDraw.h"
+
+MultiDrawList::MultiDrawList()
+	: indirectBuffer(0)
+	, drawDataBuffer(0)
+	, bufferCapacity(0)
+	, bInstancing(true)
+{
+}
+
+void MultiDrawList::Clear()
+{
+	commands.clear();
+	drawData.clear();
+	batches.clear();
+}
+
+void MultiDrawList::Add(Material* material, GLuint VAO, GLsizei idxCount, GLsizei firstIndex, GLint baseVertex,
+	const Matrix4& modelMat, const Matrix4& prevModelMat)
+{
+	if (!material || !material->shader)
+		return;
+
+	Batch* batch = batches.size() > 0 ? &batches.back() : 0;
+	if (!batch || batch->material != material || batch->VAO != VAO)
+	{
+		Batch newBatch;
+		newBatch.material = material;
+		newBatch.VAO = VAO;
+		newBatch.first = (int)commands.size();
+		newBatch.count = 0;
+		newBatch.multiDrawLocation = gGeometryArena.IsArenaVAO(VAO) ? material->shader->multiDrawLocation : -1;
+		batches.push_back(newBatch);
+		batch = &batches.back();
+	}
+
+	// same mesh as the last command of the batch, its draw data is the last one too
+	DrawElementsIndirectCommand* lastCommand = (batch->count > 0) ? &commands.back() : 0;
+	if (bInstancing && batch->multiDrawLocation >= 0 && lastCommand &&
+		lastCommand->count == (GLuint)idxCount && lastCommand->firstIndex == (GLuint)firstIndex && lastCommand->baseVertex == baseVertex)
+	{
+		++lastCommand->instanceCount;
+	}
+	else
+	{
+		++batch->count;
+
+		DrawElementsIndirectCommand command;
+		command.count = (GLuint)idxCount;
+		command.instanceCount = 1;
+		command.firstIndex = (GLuint)firstIndex;
+		command.baseVertex = baseVertex;
+		command.baseInstance = (GLuint)drawData.size();
+		commands.push_back(command);
+	}
+
+	MultiDrawData data;
+	data.modelMat = modelMat;
+	data.prevModelMat = prevModelMat;
+	drawData.push_back(data);
+}
+
+void MultiDrawList::Add(const MeshRenderData& renderData, Material* overrideMaterial)
+{
+	Add(overrideMaterial ? overrideMaterial : renderData.material, renderData.VAO,
+		renderData.idxCount, renderData.idxOffset, renderData.baseVertex,
+		renderData.modelMat, renderData.prevModelMat);
+}
+
+void MultiDrawList::Add(MeshComponent* meshComp, Material* material)
+{
+	const REArray<Mesh*>& meshList = meshComp->GetMeshList();
+	for (int i = 0, ni = (int)meshList.size(); i < ni; ++i)
+	{
+		const MeshData* meshData = meshList[i]->meshData;
+		if (!meshData)
+			continue;
+		const MeshLOD& meshLOD = meshData->lods[meshComp->GetMeshLOD(i)];
+		Add(material ? material : meshList[i]->material, meshData->VAO,
+			meshLOD.idxCount, meshData->firstIndex + meshLOD.idxOffset, meshData->baseVertex,
+			meshComp->modelMat, meshComp->prevModelMat);
+	}
+}
+
+void MultiDrawList::Submit(RenderContext& renderContext)
+{
+	int commandCount = (int)commands.size();
+	int drawCount = (int)drawData.size();
+	if (commandCount == 0)
+		return;
+
+	gGeometryArena.ReserveDrawIndices(drawCount);
+
+	// write into the frame ring buffer
+	GLsizeiptr commandSize = sizeof(DrawElementsIndirectCommand) * commandCount;
+	GLsizeiptr drawDataSize = sizeof(MultiDrawData) * drawCount;
+	GLintptr commandOffset = gFrameRingBuffer.Write(commands.data(), commandSize, sizeof(GLuint));
+	GLintptr drawDataOffset = (commandOffset >= 0) ?
+		gFrameRingBuffer.Write(drawData.data(), drawDataSize, gFrameRingBuffer.GetStorageAlignment()) : -1;
+	if (drawDataOffset >= 0)
+	{
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gFrameRingBuffer.GetBuffer());
+		gGLState.BindBufferRange(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::DrawDataInfo, gFrameRingBuffer.GetBuffer(), drawDataOffset, drawDataSize);
+	}
+	else
+	{
+		// section is full, orphan own buffers, earlier lists of this frame may still be in flight.
+		// there are never more commands than draws, capacity by draws fits both
+		if (!indirectBuffer)
+		{
+			glGenBuffers(1, &indirectBuffer);
+			glGenBuffers(1, &drawDataBuffer);
+		}
+		bufferCapacity = Max(bufferCapacity, drawCount);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawElementsIndirectCommand) * bufferCapacity, NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commandSize, commands.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawDataBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(MultiDrawData) * bufferCapacity, NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, drawDataSize, drawData.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		gGLState.BindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::DrawDataInfo, drawDataBuffer);
+		commandOffset = 0;
+	}
+
+	for (int b = 0, nb = (int)batches.size(); b < nb; ++b)
+	{
+		const Batch& batch = batches[b];
+		Material* material = batch.material;
+
+		if (batch.multiDrawLocation < 0)
+		{
+			// one by one, never instanced
+			for (int i = batch.first, ni = batch.first + batch.count; i < ni; ++i)
+			{
+				const DrawElementsIndirectCommand& command = commands[i];
+				const MultiDrawData& data = drawData[command.baseInstance];
+				material->SetParameter("prevModelMat", data.prevModelMat);
+				material->SetParameter("modelMat", data.modelMat);
+				material->Use(renderContext);
+
+				if (batch.VAO != renderContext.currentVAO)
+				{
+					renderContext.currentVAO = batch.VAO;
+					renderContext.bCompactVertex = MeshData::IsCompactVertexVAO(batch.VAO);
+					gGLState.BindVertexArray(batch.VAO);
+					++renderContext.stats.VAOChangeCount;
+				}
+				material->shader->SetCompactVertex(renderContext.bCompactVertex);
+				if (material->bBothSide && renderContext.currentRenderState->bCullFace)
+					gGLState.Disable(GL_CULL_FACE);
+				glDrawElementsBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+					(GLvoid*)(command.firstIndex * sizeof(GLuint)), command.baseVertex);
+				++renderContext.stats.drawCount;
+				renderContext.stats.triangleCount += command.count / 3;
+				if (material->bBothSide && renderContext.currentRenderState->bCullFace)
+					gGLState.Enable(GL_CULL_FACE);
+			}
+			continue;
+		}
+
+		material->Use(renderContext);
+		glUniform1i(batch.multiDrawLocation, 1);
+
+		if (batch.VAO != renderContext.currentVAO)
+		{
+			renderContext.currentVAO = batch.VAO;
+			renderContext.bCompactVertex = MeshData::IsCompactVertexVAO(batch.VAO);
+			gGLState.BindVertexArray(batch.VAO);
+			++renderContext.stats.VAOChangeCount;
+		}
+		material->shader->SetCompactVertex(renderContext.bCompactVertex);
+		if (material->bBothSide && renderContext.currentRenderState->bCullFace)
+			gGLState.Disable(GL_CULL_FACE);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+			(GLvoid*)(commandOffset + batch.first * sizeof(DrawElementsIndirectCommand)), batch.count, 0);
+		++renderContext.stats.drawCount;
+		++renderContext.stats.multiDrawCount;
+		for (int i = batch.first, ni = batch.first + batch.count; i < ni; ++i)
+		{
+			const DrawElementsIndirectCommand& command = commands[i];
+			renderContext.stats.multiDrawMeshCount += command.instanceCount;
+			renderContext.stats.instancedMeshCount += command.instanceCount - 1;
+			renderContext.stats.triangleCount += command.count / 3 * command.instanceCount;
+		}
+		if (material->bBothSide && renderContext.currentRenderState->bCullFace)
+			gGLState.Enable(GL_CULL_FACE);
+
+		// single draws of this shader use uniforms
+		glUniform1i(batch.multiDrawLocation, 0);
+	}
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
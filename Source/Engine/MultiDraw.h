@@ -0,0 +1,86 @@
+#pragma once
+
+// glew
+#include "gl/glew.h"
+
+// opengl
+#include "SDL_opengl.h"
+
+#include "Containers/Containers.h"
+#include "Math/REMath.h"
+
+class Material;
+class MeshComponent;
+struct MeshRenderData;
+struct RenderContext;
+
+// glMultiDrawElementsIndirect command
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// per draw data, std430, must match Shader/Include/DrawData.incl
+struct MultiDrawData
+{
+	Matrix4 modelMat;
+	Matrix4 prevModelMat;
+};
+
+// batches draws of geometry arena meshes into glMultiDrawElementsIndirect calls.
+// consecutive draws with the same material and VAO make one batch, so a sorted render list gives few batches.
+// commands and per draw data of the whole list are written once in Submit(), into the frame ring buffer (RingBuffer.h),
+// a command's baseInstance is the index of its first draw data, instance k reads draw data baseInstance + k
+// through the arena draw index attribute, see GeometryArena.h.
+// with instancing on, a draw of the same mesh (index range and base vertex) right after another in a batch
+// only adds an instance to the previous command, so sorted lists of repeated meshes become instanced draws.
+// shaders support it by including Include/DrawData.incl, draws with other shaders or meshes outside the arena
+// are drawn one by one in list order, with modelMat and prevModelMat material parameters as before.
+// Add() makes no GL calls, lists can be filled on any thread, see CommandList.h
+class MultiDrawList
+{
+public:
+	MultiDrawList();
+
+	void Clear();
+	// merge consecutive draws of the same mesh into instances, on by default, kept by Clear()
+	void SetInstancing(bool bInInstancing) { bInstancing = bInInstancing; }
+
+	void Add(Material* material, GLuint VAO, GLsizei idxCount, GLsizei firstIndex, GLint baseVertex,
+		const Matrix4& modelMat, const Matrix4& prevModelMat);
+	void Add(const MeshRenderData& renderData, Material* overrideMaterial = 0);
+	// all meshes of a component at their selected LOD
+	void Add(MeshComponent* meshComp, Material* material);
+
+	// upload and draw everything added since Clear()
+	void Submit(RenderContext& renderContext);
+
+	// meshes added, and indirect commands they make
+	int GetDrawCount() const { return (int)drawData.size(); }
+	int GetCommandCount() const { return (int)commands.size(); }
+
+protected:
+	struct Batch
+	{
+		Material* material;
+		GLuint VAO;
+		int first;
+		int count;
+		// uniform location of bMultiDraw, -1 draws one by one
+		GLint multiDrawLocation;
+	};
+
+	REArray<DrawElementsIndirectCommand> commands;
+	REArray<MultiDrawData, 16> drawData;
+	REArray<Batch> batches;
+	bool bInstancing;
+
+	// own buffers, only used when the frame ring buffer is full
+	GLuint indirectBuffer;
+	GLuint drawDataBuffer;
+	int bufferCapacity;
+};
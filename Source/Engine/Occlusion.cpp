@@ -0,0 +1,415 @@
+#include <immintrin.h>
+#include <string.h>
+
+#include "SDL.h"
+
+#include "JobSystem/ParallelJobs.h"
+
+#include "Bounds.h"
+#include "Viewpoint.h"
+
+#include "Occlusion.h"
+
+OcclusionBuffer gOcclusionBuffer;
+
+OcclusionBuffer::OcclusionBuffer()
+	: maxTriangleCount(64 * 1024)
+{
+	int size = 0;
+	for (int level = 0; level < levelCount; ++level)
+	{
+		levelOffset[level] = size;
+		// keep each level 16 byte aligned
+		size += (((width >> level) * (height >> level)) + 3) & ~3;
+	}
+	hiZ.resize(size, 1.f);
+	memset(&stats, 0, sizeof(stats));
+}
+
+void OcclusionBuffer::BeginFrame(const Matrix4& inViewProj)
+{
+	viewProj = inViewProj;
+	triangles.clear();
+	for (int bin = 0; bin < binCount; ++bin)
+		binTriangles[bin].clear();
+	memset(&stats, 0, sizeof(stats));
+}
+
+bool OcclusionBuffer::AddOccluder(const float* positions, int positionStride, int vertexCount,
+	const unsigned int* indices, int indexCount, const Matrix4& modelMat)
+{
+	if ((int)triangles.size() >= maxTriangleCount)
+		return false;
+
+	++stats.occluderCount;
+
+	Matrix4 modelViewProj = viewProj * modelMat;
+	clipPositions.resize(vertexCount);
+	const char* src = (const char*)positions;
+	for (int i = 0; i < vertexCount; ++i)
+	{
+		const float* p = (const float*)(src + i * positionStride);
+		clipPositions[i] = modelViewProj.TransformPoint(Vector4_3(p[0], p[1], p[2]));
+	}
+
+	for (int t = 0; t + 2 < indexCount; t += 3)
+	{
+		if ((int)triangles.size() >= maxTriangleCount)
+		{
+			stats.triangleCount = (int)triangles.size();
+			return false;
+		}
+
+		float x[3], y[3], z[3];
+		bool bClipped = false;
+		for (int v = 0; v < 3; ++v)
+		{
+			const Vector4& c = clipPositions[indices[t + v]];
+			// part in front of near plane is not drawn, so it can't occlude anything, no clipping here
+			if (c.w <= 0.f || c.z < -c.w)
+			{
+				bClipped = true;
+				break;
+			}
+			float invW = 1.f / c.w;
+			x[v] = (c.x * invW * 0.5f + 0.5f) * width;
+			y[v] = (c.y * invW * 0.5f + 0.5f) * height;
+			z[v] = c.z * invW;
+		}
+		if (bClipped)
+			continue;
+
+		float det = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+		if (fabsf(det) < 1e-6f)
+			continue;
+
+		// pixel x is covered if center x + 0.5 is inside
+		OcclusionTriangle tri;
+		tri.minX = Max((int)ceilf(Min(Min(x[0], x[1]), x[2]) - 0.5f), 0);
+		tri.minY = Max((int)ceilf(Min(Min(y[0], y[1]), y[2]) - 0.5f), 0);
+		tri.maxX = Min((int)floorf(Max(Max(x[0], x[1]), x[2]) - 0.5f), width - 1);
+		tri.maxY = Min((int)floorf(Max(Max(y[0], y[1]), y[2]) - 0.5f), height - 1);
+		if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+			continue;
+
+		// edge i goes from vertex i to i + 1, positive inside
+		float sign = det > 0.f ? 1.f : -1.f;
+		for (int e = 0; e < 3; ++e)
+		{
+			int i = e;
+			int j = (e + 1) % 3;
+			tri.edgeA[e] = (y[i] - y[j]) * sign;
+			tri.edgeB[e] = (x[j] - x[i]) * sign;
+			tri.edgeC[e] = (x[i] * y[j] - x[j] * y[i]) * sign;
+		}
+
+		// NDC z is linear in screen space
+		float invDet = 1.f / det;
+		tri.depthA = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) * invDet;
+		tri.depthB = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) * invDet;
+		// push back to the farthest depth within the one pixel test margin
+		tri.depthC = z[0] - tri.depthA * x[0] - tri.depthB * y[0] + 1.5f * (fabsf(tri.depthA) + fabsf(tri.depthB));
+
+		int index = (int)triangles.size();
+		triangles.push_back(tri);
+		for (int by = tri.minY / binHeight, nby = tri.maxY / binHeight; by <= nby; ++by)
+		{
+			for (int bx = tri.minX / binWidth, nbx = tri.maxX / binWidth; bx <= nbx; ++bx)
+				binTriangles[by * binCountX + bx].push_back(index);
+		}
+	}
+
+	stats.triangleCount = (int)triangles.size();
+	return true;
+}
+
+void OcclusionBuffer::Rasterize(int jobCount)
+{
+	Uint64 start = SDL_GetPerformanceCounter();
+
+	if (triangles.size() > 0)
+	{
+		ParallelForSlices(binCount, jobCount, [this](int bin)
+		{
+			RasterizeBin(bin);
+		});
+
+		// upper levels are tiny
+		for (int level = binLevelCount; level < levelCount; ++level)
+			DownsampleHiZ(level, 0, 0, width >> level, height >> level);
+	}
+
+	stats.rasterTime = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+void OcclusionBuffer::RasterizeBin(int bin)
+{
+	int binX0 = (bin % binCountX) * binWidth;
+	int binY0 = (bin / binCountX) * binHeight;
+	int binX1 = binX0 + binWidth;
+	int binY1 = binY0 + binHeight;
+
+	float* depth = hiZ.data();
+
+	const __m128 farDepth = _mm_set1_ps(1.f);
+	for (int y = binY0; y < binY1; ++y)
+	{
+		for (int x = binX0; x < binX1; x += 4)
+			_mm_store_ps(depth + y * width + x, farDepth);
+	}
+
+	const Vec128 pixelOffset = VecSet(0.5f, 1.5f, 2.5f, 3.5f);
+	const Vec128 zero = VecZero();
+
+	const REArray<int>& triangleList = binTriangles[bin];
+	for (int k = 0, nk = (int)triangleList.size(); k < nk; ++k)
+	{
+		const OcclusionTriangle& tri = triangles[triangleList[k]];
+
+		// bin x is a multiple of 4, so 4 wide rows never leave the bin
+		int startX = Max(tri.minX, binX0) & ~3;
+		int endX = Min(tri.maxX, binX1 - 1);
+		int startY = Max(tri.minY, binY0);
+		int endY = Min(tri.maxY, binY1 - 1);
+
+		Vec128 edgeA0 = VecSet1(tri.edgeA[0]);
+		Vec128 edgeA1 = VecSet1(tri.edgeA[1]);
+		Vec128 edgeA2 = VecSet1(tri.edgeA[2]);
+		Vec128 depthA = VecSet1(tri.depthA);
+		Vec128 edgeStep0 = VecSet1(tri.edgeA[0] * 4.f);
+		Vec128 edgeStep1 = VecSet1(tri.edgeA[1] * 4.f);
+		Vec128 edgeStep2 = VecSet1(tri.edgeA[2] * 4.f);
+		Vec128 depthStep = VecSet1(tri.depthA * 4.f);
+
+		Vec128 pixelX = VecAdd(VecSet1((float)startX), pixelOffset);
+		for (int y = startY; y <= endY; ++y)
+		{
+			float pixelY = y + 0.5f;
+			Vec128 edge0 = VecAdd(VecMul(edgeA0, pixelX), VecSet1(tri.edgeB[0] * pixelY + tri.edgeC[0]));
+			Vec128 edge1 = VecAdd(VecMul(edgeA1, pixelX), VecSet1(tri.edgeB[1] * pixelY + tri.edgeC[1]));
+			Vec128 edge2 = VecAdd(VecMul(edgeA2, pixelX), VecSet1(tri.edgeB[2] * pixelY + tri.edgeC[2]));
+			Vec128 z = VecAdd(VecMul(depthA, pixelX), VecSet1(tri.depthB * pixelY + tri.depthC));
+
+			float* row = depth + y * width;
+			for (int x = startX; x <= endX; x += 4)
+			{
+				Vec128 inside = VecAnd(VecAnd(VecCmpGE(edge0, zero), VecCmpGE(edge1, zero)), VecCmpGE(edge2, zero));
+				if (VecMoveMask(inside))
+				{
+					Vec128 current = _mm_load_ps(row + x);
+					_mm_store_ps(row + x, VecBlendVar(current, VecMin(current, z), inside));
+				}
+				edge0 = VecAdd(edge0, edgeStep0);
+				edge1 = VecAdd(edge1, edgeStep1);
+				edge2 = VecAdd(edge2, edgeStep2);
+				z = VecAdd(z, depthStep);
+			}
+		}
+	}
+
+	for (int level = 1; level < binLevelCount; ++level)
+		DownsampleHiZ(level, binX0 >> level, binY0 >> level, binX1 >> level, binY1 >> level);
+}
+
+void OcclusionBuffer::DownsampleHiZ(int level, int x0, int y0, int x1, int y1)
+{
+	const float* src = hiZ.data() + levelOffset[level - 1];
+	float* dst = hiZ.data() + levelOffset[level];
+	int srcWidth = width >> (level - 1);
+	int dstWidth = width >> level;
+	for (int y = y0; y < y1; ++y)
+	{
+		for (int x = x0; x < x1; ++x)
+		{
+			const float* s = src + y * 2 * srcWidth + x * 2;
+			dst[y * dstWidth + x] = Max(Max(s[0], s[1]), Max(s[srcWidth], s[srcWidth + 1]));
+		}
+	}
+}
+
+bool OcclusionBuffer::IsOBBOccluded(const OrientedBoxBounds& OBB) const
+{
+	if (triangles.size() == 0)
+		return false;
+
+	// corners are center +- half axes, transform center and axes once
+	const Vector4* pac = OBB.permutedAxisCenter;
+	Vector4 clipCenter = viewProj.TransformPoint(OBB.center);
+	Vector4 clipAxis[3] = {
+		viewProj.TransformVector(Vector4_3(pac[0].x, pac[1].x, pac[2].x) * OBB.extent.x),
+		viewProj.TransformVector(Vector4_3(pac[0].y, pac[1].y, pac[2].y) * OBB.extent.y),
+		viewProj.TransformVector(Vector4_3(pac[0].z, pac[1].z, pac[2].z) * OBB.extent.z),
+	};
+
+	float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX;
+	float maxX = -FLT_MAX, maxY = -FLT_MAX;
+	for (int i = 0; i < 8; ++i)
+	{
+		Vector4 c = clipCenter;
+		c += (i & 1) ? clipAxis[0] : -clipAxis[0];
+		c += (i & 2) ? clipAxis[1] : -clipAxis[1];
+		c += (i & 4) ? clipAxis[2] : -clipAxis[2];
+		// crossing near plane, treat as visible
+		if (c.w <= 0.f || c.z < -c.w)
+			return false;
+		float invW = 1.f / c.w;
+		float x = (c.x * invW * 0.5f + 0.5f) * width;
+		float y = (c.y * invW * 0.5f + 0.5f) * height;
+		minX = Min(minX, x);
+		maxX = Max(maxX, x);
+		minY = Min(minY, y);
+		maxY = Max(maxY, y);
+		minZ = Min(minZ, c.z * invW);
+	}
+
+	// pixels touched by the rect, grown by one
+	int x0 = Max((int)floorf(Max(minX, -1.f)) - 1, 0);
+	int y0 = Max((int)floorf(Max(minY, -1.f)) - 1, 0);
+	int x1 = Min((int)floorf(Min(maxX, (float)width)) + 1, width - 1);
+	int y1 = Min((int)floorf(Min(maxY, (float)height)) + 1, height - 1);
+	if (x0 > x1 || y0 > y1)
+		return false;
+
+	// coarsest level where the rect is at most 4 x 4 texels
+	int level = 0;
+	while (level < levelCount - 1 &&
+		((x1 >> level) - (x0 >> level) >= 4 || (y1 >> level) - (y0 >> level) >= 4))
+		++level;
+
+	const float* depth = GetDepth(level);
+	int levelWidth = width >> level;
+	float maxDepth = -FLT_MAX;
+	for (int y = y0 >> level, ny = y1 >> level; y <= ny; ++y)
+	{
+		for (int x = x0 >> level, nx = x1 >> level; x <= nx; ++x)
+			maxDepth = Max(maxDepth, depth[y * levelWidth + x]);
+	}
+
+	return minZ > maxDepth;
+}
+
+void BenchmarkOcclusion(int objectCount)
+{
+	// camera at origin looking at +y, wall at y = 20 covers the middle of the screen
+	Viewpoint viewpoint;
+	viewpoint.position = Vector4_3(0.f, 0.f, 0.f);
+	viewpoint.rotation = Quat::Identity();
+	viewpoint.fov = 90.f * PI / 180.f;
+	viewpoint.width = 1920.f;
+	viewpoint.height = 1080.f;
+	viewpoint.nearPlane = 0.1f;
+	viewpoint.farPlane = 500.f;
+	viewpoint.jitterX = 0.f;
+	viewpoint.jitterY = 0.f;
+	viewpoint.CacheMatrices();
+
+	const float wallY = 20.f;
+	const float wallHalfX = 15.f;
+	const float wallHalfZ = 10.f;
+
+	// tessellated so shared edges are tested
+	const int gridSize = 32;
+	REArray<Vector4_3, 16> wallPositions;
+	REArray<unsigned int> wallIndices;
+	for (int j = 0; j <= gridSize; ++j)
+	{
+		for (int i = 0; i <= gridSize; ++i)
+		{
+			wallPositions.push_back(Vector4_3(
+				-wallHalfX + 2.f * wallHalfX * i / gridSize, wallY, -wallHalfZ + 2.f * wallHalfZ * j / gridSize));
+		}
+	}
+	for (int j = 0; j < gridSize; ++j)
+	{
+		for (int i = 0; i < gridSize; ++i)
+		{
+			unsigned int v = j * (gridSize + 1) + i;
+			unsigned int quad[6] = { v, v + 1, v + gridSize + 2, v, v + gridSize + 2, v + gridSize + 1 };
+			wallIndices.insert(wallIndices.end(), quad, quad + 6);
+		}
+	}
+
+	OcclusionBuffer buffer;
+	Plane* planes = viewpoint.frustumPlanes;
+
+	const int loopCount = 20;
+	double rasterTime = DBL_MAX;
+	for (int loop = 0; loop < loopCount; ++loop)
+	{
+		buffer.BeginFrame(viewpoint.viewProjMat);
+		buffer.AddOccluder(&wallPositions[0].x, sizeof(Vector4_3), (int)wallPositions.size(),
+			wallIndices.data(), (int)wallIndices.size(), Matrix4::Identity());
+		buffer.Rasterize(1);
+		if (buffer.stats.rasterTime < rasterTime)
+			rasterTime = buffer.stats.rasterTime;
+	}
+
+	// random boxes, some behind the wall
+	REArray<OrientedBoxBounds, 16> OBBList;
+	BoxBounds unitBox;
+	unitBox.min = Vector4_3(-1.f);
+	unitBox.max = Vector4_3(1.f);
+	for (int i = 0; i < objectCount; ++i)
+	{
+		Vector4_3 position(RandRange(-40.f, 40.f), RandRange(5.f, 80.f), RandRange(-25.f, 25.f));
+		Vector4_3 rotation(RandRange(-180.f, 180.f), RandRange(-180.f, 180.f), RandRange(-180.f, 180.f));
+		Vector4_3 scale(RandRange(0.2f, 2.f), RandRange(0.2f, 2.f), RandRange(0.2f, 2.f));
+		Matrix4 modelMat = QuatToMatrix4(EulerToQuat(rotation));
+		modelMat.SetTranslation(position);
+		modelMat.ApplyScale(scale);
+		OrientedBoxBounds OBB;
+		OBB.SetBounds(unitBox, modelMat, scale);
+		if (IsOBBIntersectFrustum(OBB.permutedAxisCenter, OBB.extent, planes, 6))
+			OBBList.push_back(OBB);
+	}
+	int testedCount = (int)OBBList.size();
+
+	// exact answer, hidden if all corners are behind the wall and project inside it
+	REArray<char> expected(testedCount);
+	int expectedCount = 0;
+	for (int i = 0; i < testedCount; ++i)
+	{
+		const OrientedBoxBounds& OBB = OBBList[i];
+		const Vector4* pac = OBB.permutedAxisCenter;
+		bool bHidden = true;
+		for (int c = 0; c < 8 && bHidden; ++c)
+		{
+			Vector4_3 corner = OBB.center;
+			for (int a = 0; a < 3; ++a)
+			{
+				Vector4_3 halfAxis = Vector4_3(pac[0].m[a], pac[1].m[a], pac[2].m[a]) * OBB.extent.m[a];
+				corner += (c & (1 << a)) ? halfAxis : -halfAxis;
+			}
+			float t = wallY / corner.y;
+			bHidden = corner.y > wallY && fabsf(corner.x * t) <= wallHalfX && fabsf(corner.z * t) <= wallHalfZ;
+		}
+		expected[i] = bHidden;
+		expectedCount += bHidden;
+	}
+
+	REArray<char> occluded(testedCount);
+	double invFreq = 1000.0 / (double)SDL_GetPerformanceFrequency();
+	double testTime = DBL_MAX;
+	for (int loop = 0; loop < loopCount; ++loop)
+	{
+		Uint64 start = SDL_GetPerformanceCounter();
+		for (int i = 0; i < testedCount; ++i)
+			occluded[i] = buffer.IsOBBOccluded(OBBList[i]);
+		double time = (SDL_GetPerformanceCounter() - start) * invFreq;
+		if (time < testTime)
+			testTime = time;
+	}
+
+	int occludedCount = 0;
+	int wrongCount = 0;
+	for (int i = 0; i < testedCount; ++i)
+	{
+		occludedCount += occluded[i];
+		wrongCount += (occluded[i] && !expected[i]);
+	}
+
+	printf("BenchmarkOcclusion: %d triangles, %dx%d buffer\n", buffer.stats.triangleCount, OcclusionBuffer::width, OcclusionBuffer::height);
+	printf("  raster:  %.3f ms\n", rasterTime);
+	printf("  test:    %.3f ms for %d objects (%.2f M tests/ms)\n", testTime, testedCount, testedCount / testTime * 1e-6);
+	printf("  occluded %d of %d hidden, %d visible objects reported occluded\n", occludedCount, expectedCount, wrongCount);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "Containers/Containers.h"
+#include "Math/REMath.h"
+
+class OrientedBoxBounds;
+
+struct OcclusionStats
+{
+	int occluderCount;
+	int triangleCount;
+	int testedCount;
+	int occludedCount;
+	double rasterTime; // ms
+};
+
+// triangle set up once in AddOccluder, shared by all bins it touches
+// edge and depth functions are in pixel space, evaluated at pixel centers
+struct OcclusionTriangle
+{
+	float edgeA[3];
+	float edgeB[3];
+	float edgeC[3];
+	// depth plane, already pushed back by the slope
+	float depthA;
+	float depthB;
+	float depthC;
+	// inclusive pixel range
+	int minX, minY, maxX, maxY;
+};
+
+// CPU occlusion culling
+// occluder triangles are rasterized into a low resolution depth buffer, depth is GL NDC z, larger is farther.
+// the screen is split into bins rasterized by different jobs, each bin also builds its part of a max depth pyramid (Hi-Z).
+// an object is occluded if the nearest point of its bounds is behind the farthest occluder depth over its screen rect.
+// to stay conservative, the test rect is grown by one pixel and occluder depth is pushed back by its slope.
+// no GL dependency, can run headless
+class OcclusionBuffer
+{
+public:
+	static const int width = 256;
+	static const int height = 128;
+	static const int binWidth = 64;
+	static const int binHeight = 32;
+	static const int binCountX = width / binWidth;
+	static const int binCountY = height / binHeight;
+	static const int binCount = binCountX * binCountY;
+	// level 0 is full resolution, last level is 2 x 1
+	static const int levelCount = 8;
+	// levels built inside bin jobs, the rest is built after
+	static const int binLevelCount = 6;
+
+	OcclusionBuffer();
+
+	// clear occluders, viewProj maps world to clip space
+	void BeginFrame(const Matrix4& inViewProj);
+
+	// add occluder triangles, positions are in model space with positionStride bytes between them
+	// triangles crossing near plane are skipped, return false if triangle budget is used up
+	bool AddOccluder(const float* positions, int positionStride, int vertexCount,
+		const unsigned int* indices, int indexCount, const Matrix4& modelMat);
+
+	// rasterize occluders and build Hi-Z, jobCount <= 1 runs on calling thread
+	void Rasterize(int jobCount);
+
+	// thread safe after Rasterize()
+	bool IsOBBOccluded(const OrientedBoxBounds& OBB) const;
+
+	// depth of level, (width >> level) x (height >> level)
+	const float* GetDepth(int level) const { return hiZ.data() + levelOffset[level]; }
+
+	// max triangles per frame
+	int maxTriangleCount;
+
+	// occluder and raster stats are filled here, caller fills test stats
+	OcclusionStats stats;
+
+protected:
+	Matrix4 viewProj;
+
+	REArray<OcclusionTriangle, 16> triangles;
+	REArray<int> binTriangles[binCount];
+	REArray<float, 16> hiZ;
+	int levelOffset[levelCount];
+
+	REArray<Vector4, 16> clipPositions;
+
+	void RasterizeBin(int bin);
+	// build level from level - 1 in level pixel rect [x0, x1) x [y0, y1)
+	void DownsampleHiZ(int level, int x0, int y0, int x1, int y1);
+};
+
+extern OcclusionBuffer gOcclusionBuffer;
+
+// rasterize a tessellated wall, test random boxes against it and compare with an exact answer, print timing
+void BenchmarkOcclusion(int objectCount);
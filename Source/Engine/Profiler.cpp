@@ -1,13 +1,518 @@
+#include <algorithm>
+
 #include "Profiler.h"
 
+#include "Windows.h"
+#include "JobSystem/Locks.h"
+
+// node of the scope tree, a scope under a parent node
+struct ProfileNode
+{
+	int parent;
+	int scopeId;
+	std::string path;
+};
+
+struct ProfileNodeTable
+{
+	REArray<ProfileScopeDesc*> scopes;
+	REArray<ProfileNode> nodes;
+	// (parent node, scope id) to node
+	REMap<Uint64, int> nodeMap;
+};
+
+static ThreadProtected<ProfileNodeTable, SpinLock> gProfileNodeTable;
+static ThreadProtected<REArray<ProfileThreadBuffer*>, SpinLock> gProfileThreadBuffers;
+
+// innermost open scope, fiber local so it moves with jobs resumed on another thread
+static DWORD gProfileScopeFlsIndex = FlsAlloc(NULL);
+
+static thread_local ProfileThreadBuffer* tProfileThreadBuffer = 0;
 
 RESortedMap<std::string, double> ScopedProfileTimerCPU::timerMap;
-REMap<std::string, double> ScopedProfileTimerCPU::timeStampMap[2];
-int ScopedProfileTimerCPU::MapWriteIdx = 0;
-char ScopedProfileTimerCPU::fullName[1024];
+REArray<RESortedMap<std::string, double>> ScopedProfileTimerCPU::threadTimerMaps;
+int ScopedProfileTimerCPU::droppedEventCount = 0;
+
+ProfileScopeDesc::ProfileScopeDesc(const char* inName, const char* inFile, int inLine)
+	: name(inName)
+	, file(inFile)
+	, line(inLine)
+{
+	// no parent is -1, never -2
+	cachedNode.store((Uint64)0xFFFFFFFE << 32, std::memory_order_relaxed);
+
+	SCOPED_READ_WRITE_REF(gProfileNodeTable, tableRef);
+	id = (int)tableRef.scopes.size();
+	tableRef.scopes.push_back(this);
+}
+
+ProfileThreadBuffer& ProfileThreadBuffer::Get()
+{
+	if (!tProfileThreadBuffer)
+	{
+		ProfileThreadBuffer* buffer = new ProfileThreadBuffer();
+		buffer->writeIndex.store(0, std::memory_order_relaxed);
+		buffer->readIndex.store(0, std::memory_order_relaxed);
+		buffer->droppedCount.store(0, std::memory_order_relaxed);
+
+		SCOPED_READ_WRITE_REF(gProfileThreadBuffers, buffersRef);
+		buffer->threadIndex = (int)buffersRef.size();
+		buffersRef.push_back(buffer);
+		tProfileThreadBuffer = buffer;
+	}
+	return *tProfileThreadBuffer;
+}
+
+ScopedProfileTimerCPU* ScopedProfileTimerCPU::GetCurrentScope()
+{
+	return (ScopedProfileTimerCPU*)FlsGetValue(gProfileScopeFlsIndex);
+}
+
+void ScopedProfileTimerCPU::SetCurrentScope(ScopedProfileTimerCPU* scope)
+{
+	FlsSetValue(gProfileScopeFlsIndex, scope);
+}
+
+int ScopedProfileTimerCPU::FindOrAddNode(ProfileScopeDesc& desc, int parentNode)
+{
+	Uint64 key = ((Uint64)(Uint32)parentNode << 32) | (Uint32)desc.id;
+	int node = -1;
+	{
+		SCOPED_READ_WRITE_REF(gProfileNodeTable, tableRef);
+		auto it = tableRef.nodeMap.find(key);
+		if (it != tableRef.nodeMap.end())
+		{
+			node = it->second;
+		}
+		else
+		{
+			node = (int)tableRef.nodes.size();
+			ProfileNode newNode;
+			newNode.parent = parentNode;
+			newNode.scopeId = desc.id;
+			if (parentNode >= 0)
+				newNode.path = tableRef.nodes[parentNode].path;
+			newNode.path.append("/");
+			newNode.path.append(desc.name);
+			tableRef.nodes.push_back(newNode);
+			tableRef.nodeMap[key] = node;
+		}
+	}
+	desc.cachedNode.store(((Uint64)(Uint32)parentNode << 32) | (Uint32)node, std::memory_order_release);
+	return node;
+}
 
+void ScopedProfileTimerCPU::Swap()
+{
+	for (auto it = timerMap.begin(); it != timerMap.end(); ++it)
+		it->second = 0;
+	for (int i = 0, ni = (int)threadTimerMaps.size(); i < ni; ++i)
+	{
+		for (auto it = threadTimerMaps[i].begin(); it != threadTimerMaps[i].end(); ++it)
+			it->second = 0;
+	}
+	droppedEventCount = 0;
+
+	// counter ticks by node
+	static REArray<double> nodeTimes;
+
+	SCOPED_READ_WRITE_REF(gProfileThreadBuffers, buffersRef);
+	threadTimerMaps.resize(buffersRef.size());
+	for (int t = 0, nt = (int)buffersRef.size(); t < nt; ++t)
+	{
+		ProfileThreadBuffer& buffer = *buffersRef[t];
+		Uint32 write = buffer.writeIndex.load(std::memory_order_acquire);
+		Uint32 read = buffer.readIndex.load(std::memory_order_relaxed);
+		nodeTimes.clear();
+		for (; read != write; ++read)
+		{
+			const ProfileEvent& event = buffer.events[read & (ProfileThreadBuffer::capacity - 1)];
+			if (event.node >= (int)nodeTimes.size())
+				nodeTimes.resize(event.node + 1, 0);
+			nodeTimes[event.node] += (double)(event.end - event.begin);
+		}
+		// slots can be written again
+		buffer.readIndex.store(write, std::memory_order_release);
+		droppedEventCount += buffer.droppedCount.exchange(0, std::memory_order_relaxed);
+
+		RESortedMap<std::string, double>& threadMap = threadTimerMaps[t];
+		SCOPED_READ_WRITE_REF(gProfileNodeTable, tableRef);
+		for (int n = 0, nn = (int)nodeTimes.size(); n < nn; ++n)
+		{
+			if (nodeTimes[n] <= 0)
+				continue;
+			double time = nodeTimes[n] * 1000.0 * gInvPerformanceFreq;
+			const std::string& path = tableRef.nodes[n].path;
+			threadMap[path] += time;
+			timerMap[path] += time;
+		}
+	}
+}
+
+
+// GPU scope of a frame, queries are back in the pool after the frame is resolved
+struct GPUProfileEntry
+{
+	int path;
+	// elapsed query uses query[0] only
+	GLuint query[2];
+	bool bElapsed;
+	bool bHasChild;
+};
+
+struct GPUProfileFrame
+{
+	REArray<GPUProfileEntry> entries;
+};
+
+// queries created in batches, never deleted
+static const int gGPUQueryBatchSize = 64;
+static REArray<GLuint> gGPUQueryPool;
+
+static REArray<std::string> gGPUProfilePaths;
+static REMap<std::string, int> gGPUProfilePathMap;
+// had child scope when last closed, by path
+static REArray<bool> gGPUProfilePathHasChild;
+
+// ring of frames, write frame and frames still waiting on the GPU before it
+static GPUProfileFrame gGPUProfileFrames[ScopedProfileTimerGPU::maxPendingFrames + 1];
+static int gGPUProfileWriteFrame = 0;
+static int gGPUProfilePendingFrameCount = 0;
+
+static ScopedProfileTimerGPU* gGPUProfileCurrentScope = 0;
+static bool gGPUProfileElapsedActive = false;
 
 RESortedMap<std::string, double> ScopedProfileTimerGPU::timerMap;
-REMap<std::string, REArray<TimestampPair>> ScopedProfileTimerGPU::timeStampPairMap[2];
-int ScopedProfileTimerGPU::MapWriteIdx = 0;
-char ScopedProfileTimerGPU::fullName[1024];
\ No newline at end of file
+RESortedMap<std::string, double> ScopedProfileTimerGPU::frameTimerMap;
+int ScopedProfileTimerGPU::resolvedFrameCount = 0;
+char ScopedProfileTimerGPU::fullName[1024];
+
+static GLuint AllocGPUQuery()
+{
+	if (gGPUQueryPool.size() == 0)
+	{
+		gGPUQueryPool.resize(gGPUQueryBatchSize);
+		glGenQueries(gGPUQueryBatchSize, gGPUQueryPool.data());
+	}
+	GLuint query = gGPUQueryPool.back();
+	gGPUQueryPool.pop_back();
+	return query;
+}
+
+static bool IsGPUProfileFrameAvailable(const GPUProfileFrame& frame)
+{
+	// later queries are most likely not done yet, check them first
+	for (int i = (int)frame.entries.size() - 1; i >= 0; --i)
+	{
+		const GPUProfileEntry& entry = frame.entries[i];
+		for (int q = 0, nq = entry.bElapsed ? 1 : 2; q < nq; ++q)
+		{
+			GLuint available = 0;
+			glGetQueryObjectuiv(entry.query[q], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				return false;
+		}
+	}
+	return true;
+}
+
+static void ResolveGPUProfileFrame(GPUProfileFrame& frame)
+{
+	for (auto it = ScopedProfileTimerGPU::frameTimerMap.begin(); it != ScopedProfileTimerGPU::frameTimerMap.end(); ++it)
+		it->second = 0;
+
+	for (int i = 0, ni = (int)frame.entries.size(); i < ni; ++i)
+	{
+		GPUProfileEntry& entry = frame.entries[i];
+		GLuint64 elapsed = 0;
+		if (entry.bElapsed)
+		{
+			glGetQueryObjectui64v(entry.query[0], GL_QUERY_RESULT, &elapsed);
+			gGPUQueryPool.push_back(entry.query[0]);
+		}
+		else
+		{
+			GLuint64 elapsedStart = 0, elapsedEnd = 0;
+			glGetQueryObjectui64v(entry.query[0], GL_QUERY_RESULT, &elapsedStart);
+			glGetQueryObjectui64v(entry.query[1], GL_QUERY_RESULT, &elapsedEnd);
+			elapsed = elapsedEnd - elapsedStart;
+			gGPUQueryPool.push_back(entry.query[0]);
+			gGPUQueryPool.push_back(entry.query[1]);
+		}
+		ScopedProfileTimerGPU::frameTimerMap[gGPUProfilePaths[entry.path]] += (double)elapsed / (double)1000000;
+	}
+	frame.entries.clear();
+
+	for (auto it = ScopedProfileTimerGPU::frameTimerMap.begin(); it != ScopedProfileTimerGPU::frameTimerMap.end(); ++it)
+	{
+		double& time = ScopedProfileTimerGPU::timerMap[it->first];
+		if (time > 0)
+			time = Lerp(time, it->second, 0.2);
+		else
+			time = it->second;
+	}
+	++ScopedProfileTimerGPU::resolvedFrameCount;
+}
+
+void ScopedProfileTimerGPU::Swap()
+{
+	const int ringSize = maxPendingFrames + 1;
+	++gGPUProfilePendingFrameCount;
+
+	// one frame at most so frameTimerMap sees every frame.
+	// ring is full only when the GPU is more than maxPendingFrames behind, then wait
+	int oldest = (gGPUProfileWriteFrame - gGPUProfilePendingFrameCount + 1 + ringSize) % ringSize;
+	if (gGPUProfilePendingFrameCount > maxPendingFrames || IsGPUProfileFrameAvailable(gGPUProfileFrames[oldest]))
+	{
+		ResolveGPUProfileFrame(gGPUProfileFrames[oldest]);
+		--gGPUProfilePendingFrameCount;
+	}
+
+	gGPUProfileWriteFrame = (gGPUProfileWriteFrame + 1) % ringSize;
+}
+
+ScopedProfileTimerGPU::ScopedProfileTimerGPU(const char* inName)
+{
+	nameSize = strlen(inName);
+	// add to prefix
+	strcat_s(fullName, "/");
+	strcat_s(fullName, inName);
+
+	int path;
+	auto it = gGPUProfilePathMap.find(fullName);
+	if (it != gGPUProfilePathMap.end())
+	{
+		path = it->second;
+	}
+	else
+	{
+		path = (int)gGPUProfilePaths.size();
+		gGPUProfilePaths.push_back(fullName);
+		gGPUProfilePathHasChild.push_back(false);
+		gGPUProfilePathMap[fullName] = path;
+	}
+
+	REArray<GPUProfileEntry>& entries = gGPUProfileFrames[gGPUProfileWriteFrame].entries;
+	parent = gGPUProfileCurrentScope;
+	if (parent)
+		entries[parent->entry].bHasChild = true;
+	gGPUProfileCurrentScope = this;
+
+	entry = (int)entries.size();
+	entries.push_back(GPUProfileEntry());
+	GPUProfileEntry& newEntry = entries.back();
+	newEntry.path = path;
+	newEntry.bHasChild = false;
+	newEntry.bElapsed = !gGPUProfileElapsedActive && !gGPUProfilePathHasChild[path];
+	newEntry.query[0] = AllocGPUQuery();
+	if (newEntry.bElapsed)
+	{
+		newEntry.query[1] = 0;
+		glBeginQuery(GL_TIME_ELAPSED, newEntry.query[0]);
+		gGPUProfileElapsedActive = true;
+	}
+	else
+	{
+		newEntry.query[1] = AllocGPUQuery();
+		glQueryCounter(newEntry.query[0], GL_TIMESTAMP);
+	}
+}
+
+ScopedProfileTimerGPU::~ScopedProfileTimerGPU()
+{
+	GPUProfileEntry& thisEntry = gGPUProfileFrames[gGPUProfileWriteFrame].entries[entry];
+	if (thisEntry.bElapsed)
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		gGPUProfileElapsedActive = false;
+	}
+	else
+	{
+		glQueryCounter(thisEntry.query[1], GL_TIMESTAMP);
+	}
+	gGPUProfilePathHasChild[thisEntry.path] = thisEntry.bHasChild;
+	gGPUProfileCurrentScope = parent;
+
+	// remove from full name
+	size_t len = strlen(fullName);
+	fullName[len - nameSize - 1] = 0;
+}
+
+
+void ProfileReport::AddTime(Entry& entry, double time)
+{
+	if (entry.count == 0 || time < entry.min)
+		entry.min = time;
+	if (entry.count == 0 || time > entry.max)
+		entry.max = time;
+	entry.total += time;
+	++entry.count;
+}
+
+void ProfileReport::AddFrame(double frameTime)
+{
+	AddTime(frameEntry, frameTime);
+	frameTimes.push_back(frameTime);
+	sortedFrameTimes.clear();
+	// timers not hit this frame stay in the map with 0
+	for (auto it = ScopedProfileTimerCPU::timerMap.begin(); it != ScopedProfileTimerCPU::timerMap.end(); ++it)
+	{
+		if (it->second > 0)
+			AddTime(cpuEntries[it->first], it->second);
+	}
+	if (ScopedProfileTimerGPU::resolvedFrameCount == lastGPUFrame)
+		return;
+	lastGPUFrame = ScopedProfileTimerGPU::resolvedFrameCount;
+	++gpuFrameCount;
+	for (auto it = ScopedProfileTimerGPU::frameTimerMap.begin(); it != ScopedProfileTimerGPU::frameTimerMap.end(); ++it)
+	{
+		if (it->second > 0)
+			AddTime(gpuEntries[it->first], it->second);
+	}
+}
+
+void ProfileReport::AddInfo(const char* name, const char* value)
+{
+	Info info;
+	info.name = name;
+	info.value = value ? value : "";
+	info.bNumber = false;
+	infos.push_back(info);
+}
+
+void ProfileReport::AddInfo(const char* name, int value)
+{
+	Info info;
+	info.name = name;
+	info.value = std::to_string(value);
+	info.bNumber = true;
+	infos.push_back(info);
+}
+
+double ProfileReport::GetFramePercentile(double percentile) const
+{
+	if (frameTimes.size() == 0)
+		return 0;
+	if (sortedFrameTimes.size() != frameTimes.size())
+	{
+		sortedFrameTimes = frameTimes;
+		std::sort(sortedFrameTimes.begin(), sortedFrameTimes.end());
+	}
+	int count = (int)sortedFrameTimes.size();
+	int rank = (int)ceil(percentile / 100.0 * count);
+	return sortedFrameTimes[Min(Max(rank - 1, 0), count - 1)];
+}
+
+void ProfileReport::WriteEntries(FILE* file, const RESortedMap<std::string, Entry>& entries, int frameCount)
+{
+	// average is over all frames, frames column is how many the timer was hit
+	fprintf(file, "%-48s %10s %10s %10s %8s\n", "name", "avg ms", "min ms", "max ms", "frames");
+	for (auto it = entries.begin(); it != entries.end(); ++it)
+	{
+		const Entry& entry = it->second;
+		fprintf(file, "%-48s %10.3f %10.3f %10.3f %8d\n",
+			it->first.c_str(), entry.total / frameCount, entry.min, entry.max, entry.count);
+	}
+}
+
+bool ProfileReport::Write(const char* path) const
+{
+	FILE* file = 0;
+	fopen_s(&file, path, "w");
+	if (!file)
+	{
+		printf("Profile report could not be written: %s\n", path);
+		return false;
+	}
+
+	for (int i = 0, ni = (int)infos.size(); i < ni; ++i)
+		fprintf(file, "%s %s\n", infos[i].name.c_str(), infos[i].value.c_str());
+
+	int frameCount = GetFrameCount();
+	if (frameCount > 0)
+	{
+		fprintf(file, "frames %d\n", frameCount);
+		fprintf(file, "frame ms avg %.3f min %.3f max %.3f\n", frameEntry.total / frameCount, frameEntry.min, frameEntry.max);
+		fprintf(file, "frame ms p50 %.3f p90 %.3f p95 %.3f p99 %.3f\n",
+			GetFramePercentile(50), GetFramePercentile(90), GetFramePercentile(95), GetFramePercentile(99));
+		fprintf(file, "\nCPU\n");
+		WriteEntries(file, cpuEntries, frameCount);
+		fprintf(file, "\nGPU, %d frames\n", gpuFrameCount);
+		WriteEntries(file, gpuEntries, gpuFrameCount);
+	}
+	fclose(file);
+	return true;
+}
+
+static void WriteJSONString(FILE* file, const char* str)
+{
+	fputc('"', file);
+	for (const char* c = str; *c; ++c)
+	{
+		if (*c == '"' || *c == '\\')
+			fprintf(file, "\\%c", *c);
+		else if ((unsigned char)*c < 0x20)
+			fprintf(file, "\\u%04x", (unsigned char)*c);
+		else
+			fputc(*c, file);
+	}
+	fputc('"', file);
+}
+
+void ProfileReport::WriteJSONEntries(FILE* file, const RESortedMap<std::string, Entry>& entries, int frameCount)
+{
+	fprintf(file, "{");
+	bool bFirst = true;
+	for (auto it = entries.begin(); it != entries.end(); ++it)
+	{
+		const Entry& entry = it->second;
+		fprintf(file, bFirst ? "\n\t\t" : ",\n\t\t");
+		bFirst = false;
+		WriteJSONString(file, it->first.c_str());
+		fprintf(file, ": { \"avg\": %.4f, \"min\": %.4f, \"max\": %.4f, \"frames\": %d }",
+			entry.total / frameCount, entry.min, entry.max, entry.count);
+	}
+	fprintf(file, bFirst ? "}" : "\n\t}");
+}
+
+bool ProfileReport::WriteJSON(const char* path) const
+{
+	FILE* file = 0;
+	fopen_s(&file, path, "w");
+	if (!file)
+	{
+		printf("Profile report could not be written: %s\n", path);
+		return false;
+	}
+
+	// times in ms
+	fprintf(file, "{\n\t\"info\": {");
+	for (int i = 0, ni = (int)infos.size(); i < ni; ++i)
+	{
+		fprintf(file, i == 0 ? "\n\t\t" : ",\n\t\t");
+		WriteJSONString(file, infos[i].name.c_str());
+		fprintf(file, ": ");
+		if (infos[i].bNumber)
+			fputs(infos[i].value.c_str(), file);
+		else
+			WriteJSONString(file, infos[i].value.c_str());
+	}
+	fprintf(file, infos.size() > 0 ? "\n\t},\n" : "},\n");
+
+	int frameCount = GetFrameCount();
+	fprintf(file, "\t\"frames\": %d", frameCount);
+	if (frameCount > 0)
+	{
+		fprintf(file, ",\n\t\"frameTime\": { \"avg\": %.4f, \"min\": %.4f, \"max\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p95\": %.4f, \"p99\": %.4f }",
+			frameEntry.total / frameCount, frameEntry.min, frameEntry.max,
+			GetFramePercentile(50), GetFramePercentile(90), GetFramePercentile(95), GetFramePercentile(99));
+		fprintf(file, ",\n\t\"cpu\": ");
+		WriteJSONEntries(file, cpuEntries, frameCount);
+		fprintf(file, ",\n\t\"gpuFrames\": %d", gpuFrameCount);
+		fprintf(file, ",\n\t\"gpu\": ");
+		WriteJSONEntries(file, gpuEntries, gpuFrameCount);
+	}
+	fprintf(file, "\n}\n");
+	fclose(file);
+	return true;
+}
\ No newline at end of file
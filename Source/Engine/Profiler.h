@@ -2,6 +2,7 @@
 
 
 #include <string>
+#include <atomic>
 
 #include "gl/glew.h"
 
@@ -14,9 +15,11 @@
 
 #define PROFILE 1
 #if PROFILE
-#define CPU_SCOPED_PROFILE(name) ScopedProfileTimerCPU _cpu_macro_profiler(name)
+#define CPU_SCOPED_PROFILE(name) static ProfileScopeDesc _cpu_macro_desc(name, __FILE__, __LINE__); \
+	ScopedProfileTimerCPU _cpu_macro_profiler(_cpu_macro_desc)
 #define GPU_SCOPED_PROFILE(name) ScopedProfileTimerGPU _gpu_macro_profiler(name)
-#define CPU_SCOPED_PROFILE_SUB(name, vname) ScopedProfileTimerCPU _cpu_macro_profiler_##vname(name)
+#define CPU_SCOPED_PROFILE_SUB(name, vname) static ProfileScopeDesc _cpu_macro_desc_##vname(name, __FILE__, __LINE__); \
+	ScopedProfileTimerCPU _cpu_macro_profiler_##vname(_cpu_macro_desc_##vname)
 #define GPU_SCOPED_PROFILE_SUB(name, vname) ScopedProfileTimerGPU _gpu_macro_profiler_##vname(name)
 
 #define CPU_SCOPED_PROFILE_PRINT(name) ScopedProfilePrintTimerCPU _cpu_macro_profiler_print(name)
@@ -31,11 +34,6 @@
 
 extern double gInvPerformanceFreq;
 
-struct TimestampPair
-{
-	GLuint m[2];
-};
-
 class ScopedProfilePrintTimerCPU
 {
 	Uint64 start;
@@ -58,36 +56,85 @@ public:
 	}
 };
 
-class ScopedProfileTimerCPU
+// static descriptor of a CPU profile scope, one per CPU_SCOPED_PROFILE in code, registered on first use.
+// name must live as long as the program, a literal
+struct ProfileScopeDesc
 {
-	Uint64 start;
-	size_t nameSize;
+	const char* name;
+	const char* file;
+	int line;
+	int id;
+	// parent node in high bits and node of this scope under it, last used pair, skips node lookup when parent didn't change
+	std::atomic<Uint64> cachedNode;
+
+	ProfileScopeDesc(const char* inName, const char* inFile, int inLine);
+};
 
-public:
-	static RESortedMap<std::string, double> timerMap;
-	static REMap<std::string, double> timeStampMap[2];
-	static int MapWriteIdx;
-	static char fullName[1024];
+struct ProfileEvent
+{
+	Uint64 begin;
+	Uint64 end;
+	int node;
+};
+
+// ring of finished scopes of one thread, written only by its thread and read only by ScopedProfileTimerCPU::Swap(),
+// so neither side locks. full buffer drops events until the next Swap()
+struct ProfileThreadBuffer
+{
+	static const Uint32 capacity = 4096;
+
+	ProfileEvent events[capacity];
+	std::atomic<Uint32> writeIndex;
+	std::atomic<Uint32> readIndex;
+	std::atomic<int> droppedCount;
+	// registration order, index into ScopedProfileTimerCPU::threadTimerMaps
+	int threadIndex;
 
-	static void Swap()
+	// buffer of calling thread, created on first use
+	static ProfileThreadBuffer& Get();
+
+	__forceinline void Add(int node, Uint64 begin, Uint64 end)
 	{
-		int MapReadIdx = 1 - MapWriteIdx;
-		MapWriteIdx = MapReadIdx;
-		for (auto it = timeStampMap[MapReadIdx].begin(); it != timeStampMap[MapReadIdx].end(); ++it)
+		Uint32 write = writeIndex.load(std::memory_order_relaxed);
+		if (write - readIndex.load(std::memory_order_acquire) >= capacity)
 		{
-			// update
-			timerMap[it->first] = it->second;
-			// clear
-			it->second = 0;
+			droppedCount.fetch_add(1, std::memory_order_relaxed);
+			return;
 		}
+		ProfileEvent& event = events[write & (capacity - 1)];
+		event.begin = begin;
+		event.end = end;
+		event.node = node;
+		writeIndex.store(write + 1, std::memory_order_release);
 	}
+};
 
-	ScopedProfileTimerCPU(const char* inName)
+// CPU scope timer, safe in jobs. nesting follows the fiber, not the thread, so a scope waiting on jobs keeps its parent
+// when its fiber resumes on another thread. scopes in a job are roots, they don't know the scope that started the job.
+// a scope is a node in a tree of (parent node, scope) pairs with a cached "/parent/name" path,
+// so the scope only looks up its node, and writes (node, begin, end) to its thread's buffer on exit.
+// Swap() turns events of all threads into ms per path once per frame
+class ScopedProfileTimerCPU
+{
+	Uint64 start;
+	int node;
+	ScopedProfileTimerCPU* parent;
+
+public:
+	// last frame ms by path, summed over threads. paths not hit stay with 0
+	static RESortedMap<std::string, double> timerMap;
+	// same by thread, thread of the scope's exit
+	static REArray<RESortedMap<std::string, double>> threadTimerMaps;
+	// events lost last frame to full thread buffers
+	static int droppedEventCount;
+
+	static void Swap();
+
+	ScopedProfileTimerCPU(ProfileScopeDesc& desc)
 	{
-		nameSize = strlen(inName);
-		// add to prefix
-		strcat_s(fullName, "/");
-		strcat_s(fullName, inName);
+		parent = GetCurrentScope();
+		node = GetNode(desc, parent ? parent->node : -1);
+		SetCurrentScope(this);
 
 		start = SDL_GetPerformanceCounter();
 	}
@@ -95,84 +142,108 @@ public:
 	~ScopedProfileTimerCPU()
 	{
 		Uint64 end = SDL_GetPerformanceCounter();
-		double deltaTime = (double)((end - start) * 1000) * gInvPerformanceFreq;
-		auto it = timeStampMap[MapWriteIdx].find(fullName);
-		if (it != timeStampMap[MapWriteIdx].end())
-		{
-			// find it
-			it->second += deltaTime;
-		}
-		else
-		{
-			timeStampMap[MapWriteIdx][fullName] = deltaTime;
-		}
-		// remove from full name
-		size_t len = strlen(fullName);
-		fullName[len - nameSize - 1] = 0;
+		SetCurrentScope(parent);
+		ProfileThreadBuffer::Get().Add(node, start, end);
 	}
+
+protected:
+	// innermost open scope of the calling fiber
+	static ScopedProfileTimerCPU* GetCurrentScope();
+	static void SetCurrentScope(ScopedProfileTimerCPU* scope);
+
+	static __forceinline int GetNode(ProfileScopeDesc& desc, int parentNode)
+	{
+		Uint64 cached = desc.cachedNode.load(std::memory_order_acquire);
+		if ((int)(cached >> 32) == parentNode)
+			return (int)(cached & 0xFFFFFFFF);
+		return FindOrAddNode(desc, parentNode);
+	}
+
+	static int FindOrAddNode(ProfileScopeDesc& desc, int parentNode);
 };
 
+// GPU scope timer, main thread only. queries come from a pool and are read a few frames later,
+// once GL_QUERY_RESULT_AVAILABLE says the frame is done, so the profiler doesn't wait on the GPU.
+// a scope that had no child scope last time is timed with one GL_TIME_ELAPSED query, if no other one is running,
+// others with a GL_TIMESTAMP pair since elapsed queries can't nest
 class ScopedProfileTimerGPU
 {
-	TimestampPair query;
+	// in current frame's entries
+	int entry;
 	size_t nameSize;
+	ScopedProfileTimerGPU* parent;
 
 public:
+	// frames with queries in flight before Swap() waits for the oldest
+	static const int maxPendingFrames = 4;
+
+	// smoothed ms by path
 	static RESortedMap<std::string, double> timerMap;
-	static REMap<std::string, REArray<TimestampPair>> timeStampPairMap[2];
-	static int MapWriteIdx;
+	// last resolved frame, not smoothed, a few frames behind
+	static RESortedMap<std::string, double> frameTimerMap;
+	// frames put in frameTimerMap so far, at most one per Swap()
+	static int resolvedFrameCount;
 	static char fullName[1024];
 
-	static void Swap()
-	{
-		int MapReadIdx = 1 - MapWriteIdx;
-		MapWriteIdx = MapReadIdx;
-		for (auto &it = timeStampPairMap[MapReadIdx].begin(); it != timeStampPairMap[MapReadIdx].end(); ++it)
-		{
-			double elapsed = 0;
-			for (int pairIdx = 0; pairIdx < it->second.size(); ++pairIdx)
-			{
-				GLuint64 elapsedStart = 0, elapsedEnd = 0;
-				glGetQueryObjectui64v(it->second[pairIdx].m[0], GL_QUERY_RESULT, &elapsedStart);
-				glGetQueryObjectui64v(it->second[pairIdx].m[1], GL_QUERY_RESULT, &elapsedEnd);
-				glDeleteQueries(2, it->second[pairIdx].m);
-				elapsed += (double)(elapsedEnd - elapsedStart) / (double)1000000;
-			}
-			//if (elapsed > 0)
-			{
-				// update
-				if (timerMap[it->first] > 0)
-					timerMap[it->first] = Lerp(timerMap[it->first], elapsed, 0.2);
-				else
-					timerMap[it->first] = elapsed;
-			}
-			// clear
-			it->second.clear();
-		}
-	}
+	// end of frame, resolves the oldest pending frame if its queries are available
+	static void Swap();
 
-	ScopedProfileTimerGPU(const char* inName)
-	{
-		nameSize = strlen(inName);
-		// add to prefix
-		strcat_s(fullName, "/");
-		strcat_s(fullName, inName);
+	ScopedProfileTimerGPU(const char* inName);
+	~ScopedProfileTimerGPU();
+};
 
-		glGenQueries(2, query.m);
-		glQueryCounter(query.m[0], GL_TIMESTAMP);
-	}
+// frame time percentiles and average, min and max of every profiler timer over the recorded frames, for benchmark runs
+class ProfileReport
+{
+public:
+	// add last frame's CPU timers and last resolved GPU timers if there is a new one, after their Swap(), frameTime in ms
+	void AddFrame(double frameTime);
 
-	~ScopedProfileTimerGPU()
+	// written before timings, run settings, renderer etc.
+	void AddInfo(const char* name, const char* value);
+	void AddInfo(const char* name, int value);
+
+	// text table, false if file can't be opened
+	bool Write(const char* path) const;
+	// same as JSON, for comparing runs with scripts
+	bool WriteJSON(const char* path) const;
+
+	int GetFrameCount() const { return (int)frameTimes.size(); }
+	// GPU timers lag behind, counts frames they were resolved for
+	int GetGPUFrameCount() const { return gpuFrameCount; }
+
+	// frame time in ms at percentile in [0, 100], nearest rank
+	double GetFramePercentile(double percentile) const;
+
+protected:
+	struct Entry
 	{
-		glQueryCounter(query.m[1], GL_TIMESTAMP);
-		timeStampPairMap[MapWriteIdx][fullName].push_back(query);
-		//auto it = timerMap.find(fullName);
-		//if (it == timerMap.end())
-		//{
-		//	timerMap[fullName] = 0;
-		//}
-		// remove from full name
-		size_t len = strlen(fullName);
-		fullName[len - nameSize - 1] = 0;
-	}
+		double total = 0;
+		double min = 0;
+		double max = 0;
+		// frames the timer was hit
+		int count = 0;
+	};
+
+	struct Info
+	{
+		std::string name;
+		std::string value;
+		bool bNumber;
+	};
+
+	static void AddTime(Entry& entry, double time);
+	static void WriteEntries(FILE* file, const RESortedMap<std::string, Entry>& entries, int frameCount);
+	static void WriteJSONEntries(FILE* file, const RESortedMap<std::string, Entry>& entries, int frameCount);
+
+	REArray<Info> infos;
+	RESortedMap<std::string, Entry> cpuEntries;
+	RESortedMap<std::string, Entry> gpuEntries;
+	Entry frameEntry;
+	int gpuFrameCount = 0;
+	// ScopedProfileTimerGPU::resolvedFrameCount of last added GPU frame
+	int lastGPUFrame = 0;
+	REArray<double> frameTimes;
+	// frameTimes sorted, for percentiles
+	mutable REArray<double> sortedFrameTimes;
 };
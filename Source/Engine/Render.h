@@ -14,16 +14,50 @@
 
 // engine
 #include "Material.h"
+#include "GLState.h"
 #include "Viewpoint.h"
 
 struct RenderState;
 
+// per frame draw counters
+struct RenderStats
+{
+	int drawCount = 0;
+	int shaderChangeCount = 0;
+	int materialChangeCount = 0;
+	int VAOChangeCount = 0;
+	int triangleCount = 0;
+	int materialUploadBytes = 0; // changed material block data sent this frame
+	double sortTime = 0; // ms, render list sorting
+	// objects and lights tested by culling, and the ones that reused last frame's result
+	int cullTestedCount = 0;
+	int cullSkippedCount = 0;
+	// local light shadows reusing their static casters, and the ones drawing them again
+	int shadowCacheHitCount = 0;
+	int shadowCacheRebuildCount = 0;
+	// local light shadows drawn this frame, and the ones keeping last drawn content
+	int shadowUpdateCount = 0;
+	int shadowSkipCount = 0;
+	// glMultiDrawElementsIndirect calls and the meshes drawn by them (also counted in drawCount as one draw per call)
+	int multiDrawCount = 0;
+	int multiDrawMeshCount = 0;
+	// meshes of multiDrawMeshCount drawn as extra instances of the previous command
+	int instancedMeshCount = 0;
+	double submitTime = 0; // ms, draw list submission of geometry and shadow passes, command list replay
+	double recordTime = 0; // ms, command list recording, wall time of parallel jobs
+	double shadowReplayTime = 0; // ms, part of submitTime replaying shadow views
+	int gpuCullDrawCount = 0; // draws tested by GPU culling, visible ones are only known on GPU
+};
+
 struct RenderContext
 {
 	const Material* currentMaterial = 0;
 	const RenderState* currentRenderState = 0;
 	GLint currentVAO = -1;
+	// vertex format of currentVAO
+	bool bCompactVertex = false;
 	Viewpoint viewPoint;
+	RenderStats stats;
 };
 
 struct RenderState
@@ -59,41 +93,42 @@ struct RenderState
 			initFunc(*this);
 	}
 
+	// goes through gGLState, only changed state is sent to GL
 	void Apply(RenderContext& renderContext) const
 	{
 		renderContext.currentRenderState = this;
 
 		if (bColorWrite)
-			glColorMask(bColorWriteR, bColorWriteG, bColorWriteB, bColorWriteA);
+			gGLState.ColorMask(bColorWriteR, bColorWriteG, bColorWriteB, bColorWriteA);
 		else
-			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			gGLState.ColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
 
 		if (bDepthTest)
 		{
-			glEnable(GL_DEPTH_TEST);
-			glDepthFunc(depthTestFunc);
-			glDepthMask(bDepthWrite);
+			gGLState.Enable(GL_DEPTH_TEST);
+			gGLState.DepthFunc(depthTestFunc);
+			gGLState.DepthMask(bDepthWrite);
 		}
 		else
-			glDisable(GL_DEPTH_TEST);
+			gGLState.Disable(GL_DEPTH_TEST);
 
 		if (bStencilTest)
 		{
-			glEnable(GL_STENCIL_TEST);
-			glStencilFunc(stencilTestFunc, stencilTestRef, stencilTestMask);
-			glStencilOp(stencilWriteSFail, stencilWriteDFail, stencilWriteDPass);
-			glStencilMask(stencilWriteMask);
+			gGLState.Enable(GL_STENCIL_TEST);
+			gGLState.StencilFunc(stencilTestFunc, stencilTestRef, stencilTestMask);
+			gGLState.StencilOp(stencilWriteSFail, stencilWriteDFail, stencilWriteDPass);
+			gGLState.StencilMask(stencilWriteMask);
 		}
 		else
-			glDisable(GL_STENCIL_TEST);
+			gGLState.Disable(GL_STENCIL_TEST);
 
 		if (bCullFace)
 		{
-			glEnable(GL_CULL_FACE);
-			glCullFace(cullFaceMode);
+			gGLState.Enable(GL_CULL_FACE);
+			gGLState.CullFace(cullFaceMode);
 		}
 		else
-			glDisable(GL_CULL_FACE);
+			gGLState.Disable(GL_CULL_FACE);
 	}
 };
 
@@ -103,7 +138,16 @@ struct RenderSettings
 	bool bDrawShadowCSM			= true;
 	bool bDrawShadowSpot		= true;
 	bool bDrawShadowPoint		= true;
+	bool bShadowCache			= true;
+	bool bShadowUpdateBudget	= true;
 	bool bDrawBounds			= false;
+	bool bOcclusionCulling		= true;
+	bool bTemporalCulling		= true;
+	bool bMeshLOD				= true;
+	bool bMultiDraw				= true;
+	bool bInstancing			= true;
+	bool bGPUCulling			= false;
+	bool bGPUOcclusion			= true;
 	bool bDrawLightVolume		= false;
 	bool bUseTAA				= true;
 	bool bUseJitter				= true;
@@ -114,6 +158,7 @@ struct RenderSettings
 	bool bTileBasedDeferred		= true;
 	bool bTileOnePass			= false;
 	bool bTileCullingCombined	= false;
+	bool bCPULightClusters		= false;
 
 	//RenderSettings() {};
 };
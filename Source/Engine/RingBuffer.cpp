@@ -0,0 +1,175 @@
+
+#include <stdio.h>
+#include <string.h>
+
+#include "GLState.h"
+
+#include "RingBuffer.h"
+
+RingBuffer gFrameRingBuffer;
+
+RingBuffer::RingBuffer()
+	: buffer(0)
+	, mappedData(0)
+	, bPersistent(false)
+	, sectionSize(0)
+	, sectionCount(0)
+	, section(0)
+	, sectionOffset(0)
+	, uniformAlignment(256)
+	, storageAlignment(256)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+void RingBuffer::Init(GLsizeiptr inSectionSize, int inSectionCount)
+{
+	Release();
+
+	sectionSize = inSectionSize;
+	sectionCount = inSectionCount;
+	section = 0;
+	sectionOffset = 0;
+	fences.clear();
+	fences.resize(sectionCount, (GLsync)0);
+
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+
+	bPersistent = GLEW_ARB_buffer_storage != 0;
+	CreateBuffer();
+
+	memset(&stats, 0, sizeof(stats));
+	stats.sectionBytes = sectionSize;
+	stats.bPersistent = bPersistent;
+}
+
+void RingBuffer::Release()
+{
+	for (int i = 0; i < (int)fences.size(); ++i)
+	{
+		if (fences[i])
+		{
+			glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			glDeleteSync(fences[i]);
+			fences[i] = 0;
+		}
+	}
+
+	if (buffer)
+	{
+		if (mappedData)
+		{
+			glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+		gGLState.InvalidateBuffer(buffer);
+		glDeleteBuffers(1, &buffer);
+	}
+	buffer = 0;
+	mappedData = 0;
+}
+
+void RingBuffer::CreateBuffer()
+{
+	GLsizeiptr size = sectionSize * sectionCount;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	if (bPersistent)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, flags);
+		mappedData = (char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+		if (!mappedData)
+		{
+			printf("Warning: ring buffer persistent mapping failed, map per write instead.\n");
+			bPersistent = false;
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			glDeleteBuffers(1, &buffer);
+			glGenBuffers(1, &buffer);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		}
+	}
+	if (!bPersistent)
+		glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void RingBuffer::BeginFrame()
+{
+	if (!buffer)
+		return;
+
+	// grow after overflow, whole buffer is recreated, wait for all sections
+	if (stats.overflowCount > 0)
+	{
+		int waitCount = stats.waitCount;
+		Init(sectionSize * 2, sectionCount);
+		stats.waitCount = waitCount;
+		printf("Ring buffer grows to %d KB per frame.\n", (int)(sectionSize / 1024));
+	}
+
+	GLsync& fence = fences[section];
+	if (fence)
+	{
+		if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+		{
+			++stats.waitCount;
+			while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {}
+		}
+		glDeleteSync(fence);
+		fence = 0;
+	}
+
+	sectionOffset = 0;
+	stats.usedBytes = 0;
+	stats.overflowCount = 0;
+}
+
+void RingBuffer::EndFrame()
+{
+	if (!buffer)
+		return;
+
+	fences[section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	section = (section + 1) % sectionCount;
+}
+
+GLintptr RingBuffer::Write(const void* data, GLsizeiptr size, GLint alignment)
+{
+	if (!buffer)
+		return -1;
+
+	GLsizeiptr alignedOffset = (sectionOffset + alignment - 1) / alignment * alignment;
+	if (alignedOffset + size > sectionSize)
+	{
+		++stats.overflowCount;
+		return -1;
+	}
+
+	GLintptr offset = section * sectionSize + alignedOffset;
+	if (bPersistent)
+	{
+		memcpy(mappedData + offset, data, size);
+	}
+	else
+	{
+		// the fence of this section guarantees GPU is done with the range
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		void* dst = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if (dst)
+		{
+			memcpy(dst, data, size);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		if (!dst)
+			return -1;
+	}
+
+	sectionOffset = alignedOffset + size;
+	stats.usedBytes = sectionOffset;
+	return offset;
+}
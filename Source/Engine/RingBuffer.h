@@ -0,0 +1,66 @@
+#pragma once
+
+// glew
+#include "gl/glew.h"
+
+// opengl
+#include "SDL_opengl.h"
+
+#include "Containers/Containers.h"
+
+struct RingBufferStats
+{
+	// bytes written this frame
+	GLsizeiptr usedBytes;
+	GLsizeiptr sectionBytes;
+	// writes this frame that didn't fit, the section doubles next frame
+	int overflowCount;
+	// frames the CPU waited on the GPU for a section, since init
+	int waitCount;
+	bool bPersistent;
+};
+
+// one buffer split into sectionCount per frame sections, for constants written by the CPU and read by the GPU in the same frame.
+// with ARB_buffer_storage (core in 4.4, not in our 4.3 context) the buffer is mapped once, persistent and coherent,
+// and writes are plain copies into mapped memory. otherwise each write maps its range unsynchronized.
+// a fence is placed on the section at EndFrame(), BeginFrame() waits for it before the section is written again,
+// sectionCount - 1 frames later, so writes never stall on draws still reading the buffer.
+// data is bound from the buffer with glBindBufferRange (or as indirect buffer) at the returned offset.
+class RingBuffer
+{
+public:
+	RingBuffer();
+
+	void Init(GLsizeiptr inSectionSize, int inSectionCount = 3);
+	void Release();
+
+	void BeginFrame();
+	void EndFrame();
+
+	// copy data into current section at alignment, returns offset in buffer, -1 if it doesn't fit
+	GLintptr Write(const void* data, GLsizeiptr size, GLint alignment);
+
+	GLuint GetBuffer() const { return buffer; }
+	GLint GetUniformAlignment() const { return uniformAlignment; }
+	GLint GetStorageAlignment() const { return storageAlignment; }
+
+	RingBufferStats stats;
+
+protected:
+	void CreateBuffer();
+
+	GLuint buffer;
+	char* mappedData;
+	bool bPersistent;
+
+	GLsizeiptr sectionSize;
+	int sectionCount;
+	int section;
+	GLsizeiptr sectionOffset;
+	REArray<GLsync> fences;
+
+	GLint uniformAlignment;
+	GLint storageAlignment;
+};
+
+extern RingBuffer gFrameRingBuffer;
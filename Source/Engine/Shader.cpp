@@ -2,9 +2,17 @@
 #include "gl/glew.h"
 
 #include "ShaderLoader.h"
+#include "GLState.h"
 
 #include "Shader.h"
 
+unsigned int Shader::gNextSortId = 0;
+unsigned int Shader::gNextVersion = 1;
+
+// uniform name ids, shared by all shaders
+static REMap<std::string, int> gShaderNameIds;
+static REArray<std::string> gShaderNames;
+
 bool LoadSingleShader(GLenum type, const GLchar* path, GLuint programID, ShaderInfo& outShaderInfo, GLuint& outShaderID, bool bAssert)
 {
 	if (!LoadShader(outShaderInfo, path))
@@ -151,12 +159,16 @@ void Shader::Load(const GLchar* vertexPath, const GLchar* geometryPath, const GL
 
 	// delete old program
 	if (programID)
+	{
+		gGLState.InvalidateProgram(programID);
 		glDeleteProgram(programID);
+	}
 	programID = newProgramID;
 
 	// uniform block index
 	BindUniformBlock("RenderInfo", (GLuint)EShaderBindingUBO::RenderInfo);
 	BindUniformBlock("GlobalLightsRenderInfo", (GLuint)EShaderBindingUBO::GlobalLightsRenderInfo);
+	BindUniformBlock("MaterialBlock", (GLuint)EShaderBindingUBO::MaterialBlock);
 
 	// shader storage buffer index
 	BindShaderStorageBlock("LocalLightsRenderInfo", (GLuint)EShaderBindingSSBO::LocalLightsRenderInfo);
@@ -165,6 +177,12 @@ void Shader::Load(const GLchar* vertexPath, const GLchar* geometryPath, const GL
 	BindShaderStorageBlock("LightTileInfo", (GLuint)EShaderBindingSSBO::LightTileInfo);
 	BindShaderStorageBlock("LightTileCullingResultInfo", (GLuint)EShaderBindingSSBO::LightTileCullingResultInfo);
 	BindShaderStorageBlock("TempLightTileCullingResultInfo", (GLuint)EShaderBindingSSBO::TempLightTileCullingResultInfo);
+	BindShaderStorageBlock("LightClusterInfo", (GLuint)EShaderBindingSSBO::LightClusterInfo);
+	BindShaderStorageBlock("DrawDataInfo", (GLuint)EShaderBindingSSBO::DrawDataInfo);
+	BindShaderStorageBlock("GPUCullDrawInfo", (GLuint)EShaderBindingSSBO::GPUCullDrawInfo);
+	BindShaderStorageBlock("GPUCullLODInfo", (GLuint)EShaderBindingSSBO::GPUCullLODInfo);
+	BindShaderStorageBlock("GPUCullCommandInfo", (GLuint)EShaderBindingSSBO::GPUCullCommandInfo);
+	BindShaderStorageBlock("GPUCullCountInfo", (GLuint)EShaderBindingSSBO::GPUCullCountInfo);
 
 	// process uniforms
 	nextTexUnit = 0;
@@ -219,12 +237,21 @@ void Shader::Load(const GLchar* vertexPath, const GLchar* geometryPath, const GL
 	TexUnitList.clear();
 	ImgUnitList.clear();
 	UniformLocationList.clear();
+	materialBlockMembers.clear();
+	materialBlockSize = 0;
 	for (int shaderInfoIdx = 0; shaderInfoIdx < shaderInfoCount; ++shaderInfoIdx)
 	{
 		ShaderInfo& shaderInfo = shaderInfoList[shaderInfoIdx];
 		// add dependent
 		dependentFileNames.insert(shaderInfo.involvedFiles.begin(), shaderInfo.involvedFiles.end());
 
+		// material block, stages share it
+		if (materialBlockSize == 0 && shaderInfo.materialBlockSize > 0)
+		{
+			materialBlockMembers = shaderInfo.materialBlockMembers;
+			materialBlockSize = shaderInfo.materialBlockSize;
+		}
+
 		// process uniforms
 		for (auto it = shaderInfo.shaderUniforms.typeMap.begin(); it != shaderInfo.shaderUniforms.typeMap.end(); ++it)
 		{
@@ -266,6 +293,41 @@ void Shader::Load(const GLchar* vertexPath, const GLchar* geometryPath, const GL
 		}
 	}
 
+	// name id to list index
+	nameTable.clear();
+	for (int i = 0, ni = (int)UniformLocationList.size(); i < ni; ++i)
+		AddNameEntry(GetNameId(UniformLocationList[i].key)).uniformIdx = i;
+	for (int i = 0, ni = (int)TexUnitList.size(); i < ni; ++i)
+		AddNameEntry(GetNameId(TexUnitList[i].key)).texIdx = i;
+	for (int i = 0, ni = (int)ImgUnitList.size(); i < ni; ++i)
+		AddNameEntry(GetNameId(ImgUnitList[i].key)).imgIdx = i;
+	for (int i = 0, ni = (int)materialBlockMembers.size(); i < ni; ++i)
+		AddNameEntry(GetNameId(materialBlockMembers[i].name)).blockMemberIdx = i;
+	version = gNextVersion++;
+
+	multiDrawLocation = GetUniformLocation_Internal("bMultiDraw", true);
+	compactVertexLocation = GetUniformLocation_Internal("bCompactVertex", true);
+	compactVertexValue = -1;
+
+	// check generated std140 layout against the linked program
+	for (int i = 0, ni = (int)materialBlockMembers.size(); i < ni; ++i)
+	{
+		MaterialBlockMember& member = materialBlockMembers[i];
+		const GLchar* memberName = member.name;
+		GLuint uniformIdx = GL_INVALID_INDEX;
+		glGetUniformIndices(programID, 1, &memberName, &uniformIdx);
+		if (uniformIdx == GL_INVALID_INDEX)
+			continue;
+		GLint offset = -1;
+		glGetActiveUniformsiv(programID, 1, &uniformIdx, GL_UNIFORM_OFFSET, &offset);
+		if (offset != member.offset)
+		{
+			printf("Error: material block member %s offset %d, expected %d (vert: %s frag: %s)\n",
+				member.name, offset, member.offset, vertexFilePath, fragmentFilePath);
+			member.offset = offset;
+		}
+	}
+
 	// register shader
 	for (auto& dependent : dependentFileNames)
 	{
@@ -304,7 +366,7 @@ void Shader::Load(const GLchar* vertexPath, const GLchar* geometryPath, const GL
 
 void Shader::Use()
 {
-	glUseProgram(programID);
+	gGLState.UseProgram(programID);
 }
 
 GLint Shader::GetAttribuleLocation(const GLchar* name, bool bSilent)
@@ -336,19 +398,20 @@ GLint Shader::GetUniformLocation_Internal(const GLchar* name, bool bSilent)
 }
 
 GLint Shader::GetUniformLocation(const GLchar* name, bool bSilent)
+{
+	return GetUniformLocation(GetNameId(name), bSilent);
+}
+
+GLint Shader::GetUniformLocation(int nameId, bool bSilent)
 {
 	//return GetUniformLocation_Internal(name);
-	for (int i = 0, ni = (int)UniformLocationList.size(); i < ni; ++i)
-	{
-		ValuePair& pair = UniformLocationList[i];
-		if (strcmp(pair.key, name) == 0)
-		{
-			if (pair.value < 0)
-				pair.value = GetUniformLocation_Internal(name, bSilent);
-			return pair.value;
-		}
-	}
-	return -1;
+	int idx = (nameId >= 0 && nameId < (int)nameTable.size()) ? nameTable[nameId].uniformIdx : -1;
+	if (idx < 0)
+		return -1;
+	ValuePair& pair = UniformLocationList[idx];
+	if (pair.value < 0)
+		pair.value = GetUniformLocation_Internal(pair.key, bSilent);
+	return pair.value;
 }
 
 void Shader::BindUniformBlock(const GLchar* name, GLuint bindingPoint)
@@ -375,46 +438,89 @@ void Shader::SetTextureUnit(const GLchar* name, GLuint texUnit, bool bSilent)
 
 GLint Shader::GetTextureUnit(const GLchar* name)
 {
-	for (int i = 0, ni = (int)TexUnitList.size(); i < ni; ++i)
+	return GetTextureUnit(GetNameId(name));
+}
+
+GLint Shader::GetTextureUnit(int nameId)
+{
+	int idx = (nameId >= 0 && nameId < (int)nameTable.size()) ? nameTable[nameId].texIdx : -1;
+	if (idx >= 0)
 	{
-		ValuePair& pair = TexUnitList[i];
-		if (strcmp(pair.key, name) == 0)
+		ValuePair& pair = TexUnitList[idx];
+		if (pair.value < 0)
 		{
-			if (pair.value < 0)
-			{
-				pair.value = nextTexUnit;
-				SetTextureUnit(pair.key, pair.value);
-				++nextTexUnit;
-			}
-			return pair.value;
+			pair.value = nextTexUnit;
+			SetTextureUnit(pair.key, pair.value);
+			++nextTexUnit;
 		}
+		return pair.value;
 	}
 	if(computeFilePath[0])
-		printf("%s is not a valid texture name! (comp: %s)\n", name, computeFilePath);
+		printf("%s is not a valid texture name! (comp: %s)\n", GetName(nameId), computeFilePath);
 	else
-		printf("%s is not a valid texture name! (vert: %s frag: %s)\n", name, vertexFilePath, fragmentFilePath);
+		printf("%s is not a valid texture name! (vert: %s frag: %s)\n", GetName(nameId), vertexFilePath, fragmentFilePath);
 	return -1;
 }
 
 GLint Shader::GetImageUnit(const GLchar* name)
 {
-	for (int i = 0, ni = (int)ImgUnitList.size(); i < ni; ++i)
+	return GetImageUnit(GetNameId(name));
+}
+
+GLint Shader::GetImageUnit(int nameId)
+{
+	int idx = (nameId >= 0 && nameId < (int)nameTable.size()) ? nameTable[nameId].imgIdx : -1;
+	if (idx >= 0)
 	{
-		ValuePair& pair = ImgUnitList[i];
-		if (strcmp(pair.key, name) == 0)
+		ValuePair& pair = ImgUnitList[idx];
+		if (pair.value < 0)
 		{
-			if (pair.value < 0)
-			{
-				pair.value = nextImgUnit;
-				SetTextureUnit(pair.key, pair.value);
-				++nextImgUnit;
-			}
-			return pair.value;
+			pair.value = nextImgUnit;
+			SetTextureUnit(pair.key, pair.value);
+			++nextImgUnit;
 		}
+		return pair.value;
 	}
 	if (computeFilePath[0])
-		printf("%s is not a valid image name! (comp: %s)\n", name, computeFilePath);
+		printf("%s is not a valid image name! (comp: %s)\n", GetName(nameId), computeFilePath);
 	else
-		printf("%s is not a valid image name! (vert: %s frag: %s)\n", name, vertexFilePath, fragmentFilePath);
+		printf("%s is not a valid image name! (vert: %s frag: %s)\n", GetName(nameId), vertexFilePath, fragmentFilePath);
 	return -1;
+}
+
+int Shader::GetNameId(const GLchar* name)
+{
+	auto it = gShaderNameIds.find(name);
+	if (it != gShaderNameIds.end())
+		return it->second;
+	int nameId = (int)gShaderNames.size();
+	gShaderNames.push_back(name);
+	gShaderNameIds.emplace(name, nameId);
+	return nameId;
+}
+
+const char* Shader::GetName(int nameId)
+{
+	return (nameId >= 0 && nameId < (int)gShaderNames.size()) ? gShaderNames[nameId].c_str() : "";
+}
+
+ShaderNameEntry& Shader::AddNameEntry(int nameId)
+{
+	if (nameId >= (int)nameTable.size())
+		nameTable.resize(nameId + 1);
+	return nameTable[nameId];
+}
+
+int Shader::GetMaterialBlockOffset(const GLchar* name, int size) const
+{
+	return GetMaterialBlockOffset(GetNameId(name), size);
+}
+
+int Shader::GetMaterialBlockOffset(int nameId, int size) const
+{
+	int idx = (nameId >= 0 && nameId < (int)nameTable.size()) ? nameTable[nameId].blockMemberIdx : -1;
+	if (idx < 0)
+		return -1;
+	const MaterialBlockMember& member = materialBlockMembers[idx];
+	return (member.size == size) ? member.offset : -1;
 }
\ No newline at end of file
@@ -61,10 +61,28 @@ struct ValuePair
 	}
 };
 
+// where a name is in each list of a shader, -1 if shader has none
+struct ShaderNameEntry
+{
+	int uniformIdx = -1;
+	int texIdx = -1;
+	int imgIdx = -1;
+	int blockMemberIdx = -1;
+};
+
 enum class EShaderBindingUBO : GLuint
 {
 	RenderInfo,
 	GlobalLightsRenderInfo,
+	MaterialBlock,
+};
+
+// scalar or vector uniform packed into the material block, std140 offset and size in bytes
+struct MaterialBlockMember
+{
+	char name[64];
+	int offset;
+	int size;
 };
 
 enum class EShaderBindingSSBO : GLuint
@@ -75,6 +93,12 @@ enum class EShaderBindingSSBO : GLuint
 	LightTileInfo,
 	LightTileCullingResultInfo,
 	TempLightTileCullingResultInfo,
+	LightClusterInfo,
+	DrawDataInfo,
+	GPUCullDrawInfo,
+	GPUCullLODInfo,
+	GPUCullCommandInfo,
+	GPUCullCountInfo,
 };
 
 class Shader
@@ -100,6 +124,9 @@ public:
 
 	GLuint programID;
 
+	// small id for draw sort keys, unique per shader
+	unsigned int sortId;
+
 	EVertexType vertexType;
 
 	GLuint nextTexUnit;
@@ -118,8 +145,30 @@ public:
 	REArray<ValuePair> ImgUnitList;
 	REArray<ValuePair> UniformLocationList;
 
+	// indexed by name id, built at link so lookups don't compare strings, see GetNameId()
+	REArray<ShaderNameEntry> nameTable;
+
+	// new on every successful link, unique over all shaders, materials resolve their bindings once per version
+	unsigned int version = 0;
+
+	// location of bMultiDraw uniform from Include/DrawData.incl, -1 if shader has none
+	GLint multiDrawLocation = -1;
+
+	// location of bCompactVertex uniform from Include/CommonVertexInput.incl, -1 if shader has none
+	GLint compactVertexLocation = -1;
+	// last value sent, -1 unknown
+	int compactVertexValue = -1;
+
+	// layout of MaterialBlock uniform block, size 0 if shader has none
+	REArray<MaterialBlockMember> materialBlockMembers;
+	int materialBlockSize = 0;
+
+	static unsigned int gNextSortId;
+	static unsigned int gNextVersion;
+
 	Shader()
 	{
+		sortId = gNextSortId++;
 		memset(vertexFilePath, 0, _countof(vertexFilePath) * sizeof(GLchar));
 		memset(fragmentFilePath, 0, _countof(fragmentFilePath) * sizeof(GLchar));
 		memset(geometryFilePath, 0, _countof(geometryFilePath) * sizeof(GLchar));
@@ -160,11 +209,23 @@ public:
 	void Load(const GLchar* vertexPath, const GLchar* geometryPath, const GLchar* fragmentPath, const GLchar* computePath, bool bAssert = true);
 	void Use();
 
+	// vertex format of the draw, shader must be in use. uniform is only sent when it changes
+	inline void SetCompactVertex(bool bCompactVertex)
+	{
+		int value = bCompactVertex ? 1 : 0;
+		if (compactVertexLocation >= 0 && compactVertexValue != value)
+		{
+			glUniform1i(compactVertexLocation, value);
+			compactVertexValue = value;
+		}
+	}
+
 	GLint GetAttribuleLocation(const GLchar* name, bool bSilent = false);
 
 	GLint GetUniformLocation_Internal(const GLchar* name, bool bSilent = false);
 
 	GLint GetUniformLocation(const GLchar* name, bool bSilent = false);
+	GLint GetUniformLocation(int nameId, bool bSilent = false);
 
 	void BindUniformBlock(const GLchar* name, GLuint bindingPoint);
 	void BindShaderStorageBlock(const GLchar* name, GLuint bindingPoint);
@@ -174,4 +235,18 @@ public:
 
 	GLint GetTextureUnit(const GLchar* name);
 	GLint GetImageUnit(const GLchar* name);
+	GLint GetTextureUnit(int nameId);
+	GLint GetImageUnit(int nameId);
+
+	// small id of a uniform name, the same in all shaders, ids are never freed. not thread safe
+	static int GetNameId(const GLchar* name);
+	static const char* GetName(int nameId);
+
+	// offset of a material block member of size bytes, -1 if there is none
+	int GetMaterialBlockOffset(const GLchar* name, int size) const;
+	int GetMaterialBlockOffset(int nameId, int size) const;
+
+protected:
+	// entry of nameId, table grows to fit it
+	ShaderNameEntry& AddNameEntry(int nameId);
 };
@@ -84,6 +84,10 @@ public:
 	ShaderDefines shaderDefines;
 	RESet<std::string> involvedFiles;
 
+	// generated material uniform block, from uniforms between MaterialBlockBegin and MaterialBlockEnd hints
+	REArray<MaterialBlockMember> materialBlockMembers;
+	int materialBlockSize = 0;
+
 	EVertexType vertexType = EVertexType::None;
 
 	bool bUseDeferredPassTex = false;
@@ -99,6 +103,12 @@ public:
 		shaderDefines.Append(other.shaderDefines);
 		bUseDeferredPassTex |= other.bUseDeferredPassTex;
 		bUsePostProcessPassTex |= other.bUsePostProcessPassTex;
+		// one material block per stage, same include appended again keeps the first
+		if (materialBlockSize == 0 && other.materialBlockSize > 0)
+		{
+			materialBlockMembers = other.materialBlockMembers;
+			materialBlockSize = other.materialBlockSize;
+		}
 		if (other.vertexType != EVertexType::None)
 		{
 			assert(vertexType == EVertexType::None);
@@ -357,6 +367,56 @@ static bool ParseVariable(ShaderInfo& shaderInfo, ShaderUniforms& outputUniforms
 	return false;
 }
 
+// add "uniform type name;" to the material block with std140 layout, returns false for types not packed into the block
+// (samplers, matrices, arrays), those stay regular uniforms
+static bool AddMaterialBlockMember(ShaderInfo& shaderInfo, REArray<std::string>& outDeclarations, std::string line, size_t offset)
+{
+	// std140 size and base alignment in bytes
+	struct BlockType { const char* name; int size; int align; };
+	static const BlockType blockTypes[] =
+	{
+		{ "int", 4, 4 },
+		{ "uint", 4, 4 },
+		{ "float", 4, 4 },
+		{ "vec2", 8, 8 },
+		{ "ivec2", 8, 8 },
+		{ "vec3", 12, 16 },
+		{ "ivec3", 12, 16 },
+		{ "vec4", 16, 16 },
+		{ "ivec4", 16, 16 },
+	};
+
+	size_t nameEnd = line.find(';');
+	if (nameEnd == std::string::npos)
+		return false;
+	std::string typeName = line.substr(offset, nameEnd - offset);
+	trim(typeName);
+	if (typeName.find('[') != std::string::npos)
+		return false;
+	size_t typeEnd = typeName.find_first_of(" \t");
+	size_t nameStart = typeName.find_last_of(" \t");
+	if (typeEnd == std::string::npos || nameStart == std::string::npos)
+		return false;
+	std::string type = typeName.substr(0, typeEnd);
+	std::string name = typeName.substr(nameStart + 1);
+
+	for (int i = 0; i < _countof(blockTypes); ++i)
+	{
+		if (type.compare(blockTypes[i].name) != 0)
+			continue;
+
+		MaterialBlockMember member;
+		strcpy_s(member.name, name.c_str());
+		member.size = blockTypes[i].size;
+		member.offset = (shaderInfo.materialBlockSize + blockTypes[i].align - 1) / blockTypes[i].align * blockTypes[i].align;
+		shaderInfo.materialBlockMembers.push_back(member);
+		shaderInfo.materialBlockSize = member.offset + member.size;
+		outDeclarations.push_back(type + " " + name + ";");
+		return true;
+	}
+	return false;
+}
+
 static bool LoadShader(ShaderInfo& output, std::string path, int includeDepth = 0)
 {
 	if (includeDepth > MAX_INCLUDE_DEPTH)
@@ -443,6 +503,8 @@ static bool LoadShader(ShaderInfo& output, std::string path, int includeDepth =
 	bool bShouldProcessUniform = true;
 	bool bInsideStruct = false;
 	ShaderUniforms* activeStructUniforms = 0;
+	bool bInsideMaterialBlock = false;
+	REArray<std::string> materialBlockDeclarations;
 
 	const char* tokenInclude = "#include \"";
 	size_t tokenLenInclude = strlen(tokenInclude);
@@ -521,6 +583,26 @@ static bool LoadShader(ShaderInfo& output, std::string path, int includeDepth =
 				{
 					localOutput.vertexType = EVertexType::Common;
 				}
+				// material block hint
+				else if (hint.compare("MaterialBlockBegin") == 0)
+				{
+					assert(localOutput.materialBlockSize == 0);
+					bInsideMaterialBlock = true;
+				}
+				else if (hint.compare("MaterialBlockEnd") == 0)
+				{
+					// declare the block with members in the order they were packed, see Material::Use()
+					bInsideMaterialBlock = false;
+					localOutput.materialBlockSize = (localOutput.materialBlockSize + 15) / 16 * 16;
+					localOutput.shaderCode.append("layout(std140) uniform MaterialBlock\n{\n");
+					for (int i = 0; i < (int)materialBlockDeclarations.size(); ++i)
+					{
+						localOutput.shaderCode.append("\t");
+						localOutput.shaderCode.append(materialBlockDeclarations[i]);
+						localOutput.shaderCode.append("\n");
+					}
+					localOutput.shaderCode.append("};\n");
+				}
 			}
 		}
 		// define token
@@ -554,7 +636,10 @@ static bool LoadShader(ShaderInfo& output, std::string path, int includeDepth =
 			if (tokenStart != std::string::npos)
 			{
 				size_t typeStart = tokenStart + tokenLenUniform;
-				ParseVariable(localOutput, localOutput.shaderUniforms, line, typeStart);
+				if (bInsideMaterialBlock && AddMaterialBlockMember(localOutput, materialBlockDeclarations, line, typeStart))
+					bShouldCopy = false;
+				else
+					ParseVariable(localOutput, localOutput.shaderUniforms, line, typeStart);
 			}
 		}
 		// struct token
@@ -0,0 +1,241 @@
+#include <string.h>
+
+#include "Math/REMath.h"
+
+#include "ShadowAtlas.h"
+
+inline int GetNodeLevel(int node)
+{
+	int level = 0;
+	while (node > 0)
+	{
+		node = (node - 1) >> 2;
+		++level;
+	}
+	return level;
+}
+
+ShadowAtlas::ShadowAtlas()
+	: resizeHysteresis(0.25f)
+	, keepFrames(120)
+	, atlasSize(0)
+	, minTileSize(0)
+	, maxTileSize(0)
+	, minLevel(0)
+	, maxLevel(0)
+	, frame(0)
+	, bExhausted(false)
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+void ShadowAtlas::Init(int inAtlasSize, int inMinTileSize, int inMaxTileSize)
+{
+	if (inAtlasSize == atlasSize && inMinTileSize == minTileSize && inMaxTileSize == maxTileSize)
+		return;
+
+	atlasSize = inAtlasSize;
+	minTileSize = Min(inMinTileSize, inAtlasSize);
+	maxTileSize = Clamp(inMaxTileSize, minTileSize, inAtlasSize);
+
+	minLevel = 0;
+	while ((atlasSize >> minLevel) > maxTileSize)
+		++minLevel;
+	maxLevel = minLevel;
+	while ((atlasSize >> (maxLevel + 1)) >= minTileSize && maxLevel < 15)
+		++maxLevel;
+
+	// node count of levels [0, maxLevel]
+	int nodeCount = ((1 << (2 * (maxLevel + 1))) - 1) / 3;
+	nodeStates.clear();
+	nodeStates.resize(nodeCount, Free);
+	for (int i = 0, ni = (int)owners.size(); i < ni; ++i)
+		owners[i].tileIndex = -1;
+	bExhausted = false;
+}
+
+void ShadowAtlas::BeginFrame(int inFrame)
+{
+	frame = inFrame;
+	stats.allocCount = 0;
+	stats.evictCount = 0;
+	stats.failCount = 0;
+}
+
+int ShadowAtlas::Request(int owner, float desiredSize)
+{
+	if (owner >= (int)owners.size())
+	{
+		OwnerTile emptyTile = { -1, -1 };
+		owners.resize(owner + 1, emptyTile);
+	}
+
+	OwnerTile& ownerTile = owners[owner];
+	float size = Clamp(desiredSize, (float)minTileSize, (float)maxTileSize);
+
+	if (ownerTile.tileIndex >= 0)
+	{
+		ownerTile.lastFrame = frame;
+		float tileSize = (float)GetTileSize(ownerTile.tileIndex);
+		if (size <= tileSize * (1.f + resizeHysteresis) && size > tileSize * 0.5f * (1.f - resizeHysteresis))
+			return ownerTile.tileIndex;
+
+		FreeNode(ownerTile.tileIndex);
+		ownerTile.tileIndex = -1;
+	}
+
+	// evict stale tiles before falling back to smaller tiles
+	int node = -1;
+	for (int level = GetLevelForSize(size); level <= maxLevel && node < 0 && !bExhausted; ++level)
+	{
+		node = AllocateNode(level);
+		while (node < 0 && EvictOne())
+			node = AllocateNode(level);
+	}
+
+	if (node < 0)
+	{
+		bExhausted = true;
+		++stats.failCount;
+		return -1;
+	}
+
+	ownerTile.tileIndex = node;
+	ownerTile.lastFrame = frame;
+	++stats.allocCount;
+	return node;
+}
+
+void ShadowAtlas::Release(int owner)
+{
+	if (owner < (int)owners.size() && owners[owner].tileIndex >= 0)
+	{
+		FreeNode(owners[owner].tileIndex);
+		owners[owner].tileIndex = -1;
+	}
+}
+
+void ShadowAtlas::EndFrame()
+{
+	stats.tileCount = 0;
+	double usedArea = 0;
+	for (int i = 0, ni = (int)owners.size(); i < ni; ++i)
+	{
+		OwnerTile& ownerTile = owners[i];
+		if (ownerTile.tileIndex < 0)
+			continue;
+
+		if (frame - ownerTile.lastFrame > keepFrames)
+		{
+			FreeNode(ownerTile.tileIndex);
+			ownerTile.tileIndex = -1;
+			continue;
+		}
+
+		double tileSize = GetTileSize(ownerTile.tileIndex);
+		usedArea += tileSize * tileSize;
+		++stats.tileCount;
+	}
+	stats.occupancy = atlasSize > 0 ? (float)(usedArea / ((double)atlasSize * atlasSize)) : 0.f;
+}
+
+int ShadowAtlas::GetTileSize(int tileIndex) const
+{
+	return atlasSize >> GetNodeLevel(tileIndex);
+}
+
+int ShadowAtlas::GetLevelForSize(float size) const
+{
+	// smallest tile not smaller than size
+	int level = maxLevel;
+	while (level > minLevel && (float)(atlasSize >> level) < size)
+		--level;
+	return level;
+}
+
+int ShadowAtlas::AllocateNode(int level)
+{
+	int node = -1;
+	int nodeLevel = -1;
+	FindFreeNode(0, 0, level, node, nodeLevel);
+	if (node < 0)
+		return -1;
+
+	// split down to level, keep the first child each time
+	for (; nodeLevel < level; ++nodeLevel)
+	{
+		nodeStates[node] = Split;
+		int firstChild = (node << 2) + 1;
+		for (int i = 0; i < 4; ++i)
+			nodeStates[firstChild + i] = Free;
+		node = firstChild;
+	}
+	nodeStates[node] = Used;
+	return node;
+}
+
+void ShadowAtlas::FindFreeNode(int node, int nodeLevel, int level, int& bestNode, int& bestLevel) const
+{
+	unsigned char state = nodeStates[node];
+	if (state == Used)
+		return;
+
+	// deepest free node is the best fit
+	if (state == Free)
+	{
+		if (nodeLevel > bestLevel)
+		{
+			bestNode = node;
+			bestLevel = nodeLevel;
+		}
+		return;
+	}
+
+	// split node at level has no room for a whole tile
+	if (nodeLevel == level)
+		return;
+
+	int firstChild = (node << 2) + 1;
+	for (int i = 0; i < 4 && bestLevel < level; ++i)
+		FindFreeNode(firstChild + i, nodeLevel + 1, level, bestNode, bestLevel);
+}
+
+void ShadowAtlas::FreeNode(int node)
+{
+	nodeStates[node] = Free;
+	bExhausted = false;
+
+	// merge with siblings
+	while (node > 0)
+	{
+		int parent = (node - 1) >> 2;
+		int firstChild = (parent << 2) + 1;
+		for (int i = 0; i < 4; ++i)
+		{
+			if (nodeStates[firstChild + i] != Free)
+				return;
+		}
+		nodeStates[parent] = Free;
+		node = parent;
+	}
+}
+
+bool ShadowAtlas::EvictOne()
+{
+	int evictOwner = -1;
+	for (int i = 0, ni = (int)owners.size(); i < ni; ++i)
+	{
+		const OwnerTile& ownerTile = owners[i];
+		if (ownerTile.tileIndex >= 0 && ownerTile.lastFrame < frame &&
+			(evictOwner < 0 || ownerTile.lastFrame < owners[evictOwner].lastFrame))
+			evictOwner = i;
+	}
+
+	if (evictOwner < 0)
+		return false;
+
+	FreeNode(owners[evictOwner].tileIndex);
+	owners[evictOwner].tileIndex = -1;
+	++stats.evictCount;
+	return true;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "Containers/Containers.h"
+
+struct ShadowAtlasStats
+{
+	// tiles in use, including tiles kept for owners out of view
+	int tileCount;
+	// used texels / atlas texels
+	float occupancy;
+	// new tiles this frame, from new owners or resizes
+	int allocCount;
+	// tiles taken from owners out of view this frame
+	int evictCount;
+	// requests that got no tile this frame
+	int failCount;
+};
+
+// persistent quadtree shadow atlas.
+// tile index is the quadtree node index: 0 is the whole atlas, children of node i are 4i+1 .. 4i+4,
+// a node at level l is (atlasSize >> l) texels wide.
+// an owner keeps its tile across frames, and only moves to another tile when its desired size
+// leaves the hysteresis band around the tile size, so the tile content can be reused.
+// tiles are buddy allocated: a request takes the smallest free node that fits, reached through
+// already split nodes where possible, a freed node merges with its 3 siblings when they are all free.
+// tiles of owners not requested this frame are kept for keepFrames frames so the owner gets the same tile back,
+// least recently requested ones are evicted first when a request doesn't fit.
+// no GL dependency
+class ShadowAtlas
+{
+public:
+	ShadowAtlas();
+
+	// resets all tiles if any size changed
+	void Init(int inAtlasSize, int inMinTileSize, int inMaxTileSize);
+
+	void BeginFrame(int inFrame);
+	// tile of owner for desired size in texels, owner is a small non negative id.
+	// returns -1 if nothing fits, even at min tile size
+	int Request(int owner, float desiredSize);
+	// free owner's tile now
+	void Release(int owner);
+	// free tiles kept longer than keepFrames, update stats
+	void EndFrame();
+
+	int GetTileSize(int tileIndex) const;
+	int GetAtlasSize() const { return atlasSize; }
+
+	// desired size can grow this much over tile size before moving to a larger tile,
+	// and has to drop this much under half tile size before moving to a smaller tile
+	float resizeHysteresis;
+	int keepFrames;
+
+	ShadowAtlasStats stats;
+
+protected:
+	enum ENodeState : unsigned char
+	{
+		Free,
+		Split,
+		Used,
+	};
+
+	struct OwnerTile
+	{
+		int tileIndex;
+		int lastFrame;
+	};
+
+	int GetLevelForSize(float size) const;
+	// free node at level, splitting a larger free node if needed, -1 if none
+	int AllocateNode(int level);
+	void FindFreeNode(int node, int nodeLevel, int level, int& bestNode, int& bestLevel) const;
+	void FreeNode(int node);
+	// free tile of the least recently requested owner not requested this frame, false if none
+	bool EvictOne();
+
+	int atlasSize;
+	int minTileSize;
+	int maxTileSize;
+	// levels of max and min tile size
+	int minLevel;
+	int maxLevel;
+	int frame;
+	// nothing fits until a node is freed
+	bool bExhausted;
+
+	REArray<unsigned char> nodeStates;
+	REArray<OwnerTile> owners;
+};
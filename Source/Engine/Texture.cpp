@@ -1,6 +1,8 @@
 // glew
 #include "gl/glew.h"
 
+#include "GLState.h"
+
 #include "Texture.h"
 
 void Texture::AttachToFrameBuffer(GLenum attachment, GLint layer)
@@ -13,13 +15,12 @@ void Texture::AttachToFrameBuffer(GLenum attachment, GLint layer)
 
 void Texture::Bind(GLuint textureUnitOffset)
 {
-	glActiveTexture(GL_TEXTURE0 + textureUnitOffset);
-	glBindTexture(textureType, textureID);
+	gGLState.BindTexture(textureUnitOffset, textureType, textureID);
 }
 
 void Texture::BindImage(GLuint imageUnit)
 {
-	glBindImageTexture(imageUnit, textureID, 0, GL_FALSE, 0, access, internalFormat);
+	gGLState.BindImageTexture(imageUnit, textureID, 0, GL_FALSE, 0, access, internalFormat);
 }
 
 bool Texture::HasAlpha()
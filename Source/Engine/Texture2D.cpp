@@ -7,6 +7,7 @@
 #include <string>
 
 #include "JobSystem/JobSystem.h"
+#include "GLState.h"
 #include "Texture2D.h"
 
 REArray<Texture2D*> Texture2D::gContainer;
@@ -78,14 +79,14 @@ void Texture2D::Load(const char* name, bool bSRGB, GLint wrapS, GLint wrapT, GLi
 	RUN_INLINE_RENDER_JOB_BLOCK({
 		if (textureID == GL_INVALID_VALUE)
 			glGenTextures(1, &textureID);
-		glBindTexture(textureType, textureID);
+		gGLState.BindTexture(textureType, textureID);
 		glTexImage2D(textureType, 0, internalFormat, image->w, image->h, 0, format, type, image->pixels);
 		glGenerateMipmap(textureType);
 		glTexParameteri(textureType, GL_TEXTURE_WRAP_S, wrapS);
 		glTexParameteri(textureType, GL_TEXTURE_WRAP_T, wrapT);
 		glTexParameteri(textureType, GL_TEXTURE_MIN_FILTER, minFilter);
 		glTexParameteri(textureType, GL_TEXTURE_MAG_FILTER, magFilter);
-		glBindTexture(textureType, 0);
+		gGLState.BindTexture(textureType, 0);
 	});
 
 	SDL_FreeSurface(image);
@@ -101,7 +102,7 @@ void Texture2D::AllocateForFrameBuffer(int width, int height, GLint internalForm
 
 	if (textureID == GL_INVALID_VALUE)
 		glGenTextures(1, &textureID);
-	glBindTexture(textureType, textureID);
+	gGLState.BindTexture(textureType, textureID);
 	if(width > 0 && height > 0)
 		glTexImage2D(textureType, 0, internalFormat, width, height, 0, format, type, NULL);
 	glTexParameteri(textureType, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -121,7 +122,7 @@ void Texture2D::Reallocate(int width, int height)
 	{
 		this->width = width;
 		this->height = height;
-		glBindTexture(textureType, textureID);
+		gGLState.BindTexture(textureType, textureID);
 		glTexImage2D(textureType, 0, internalFormat, width, height, 0, format, type, NULL);
 	}
 }
\ No newline at end of file
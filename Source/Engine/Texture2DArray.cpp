@@ -6,6 +6,7 @@
 
 #include <string>
 
+#include "GLState.h"
 #include "Texture2DArray.h"
 
 REArray<Texture2DArray*> Texture2DArray::gContainer;
@@ -21,7 +22,7 @@ void Texture2DArray::AllocateForFrameBuffer(int width, int height, int count, GL
 
 	if (textureID == GL_INVALID_VALUE)
 		glGenTextures(1, &textureID);
-	glBindTexture(textureType, textureID);
+	gGLState.BindTexture(textureType, textureID);
 	if (width > 0 && height > 0 && count > 0)
 	{
 		glTexImage3D(textureType, 0, internalFormat, width, height, count, 0, format, type, NULL);
@@ -40,7 +41,7 @@ void Texture2DArray::Reallocate(int width, int height, int count)
 		this->width = width;
 		this->height = height;
 		this->count = count;
-		glBindTexture(textureType, textureID);
+		gGLState.BindTexture(textureType, textureID);
 		glTexImage3D(textureType, 0, internalFormat, width, height, count, 0, format, type, NULL);
 	}
 }
\ No newline at end of file
@@ -6,6 +6,7 @@
 
 #include <string>
 
+#include "GLState.h"
 #include "TextureCube.h"
 
 REArray<TextureCube*> TextureCube::gContainer;
@@ -61,7 +62,7 @@ void TextureCube::Load(REArray<const char*> name, bool bSRGB, GLint wrapS, GLint
 
 	if (textureID == GL_INVALID_VALUE)
 		glGenTextures(1, &textureID);
-	glBindTexture(textureType, textureID);
+	gGLState.BindTexture(textureType, textureID);
 	for (int i = 0; i < images.size(); ++i)
 	{
 		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, internalFormat, images[i]->w, images[i]->h, 0, format, type, images[i]->pixels);
@@ -72,7 +73,7 @@ void TextureCube::Load(REArray<const char*> name, bool bSRGB, GLint wrapS, GLint
 	glTexParameteri(textureType, GL_TEXTURE_WRAP_R, wrapR);
 	glTexParameteri(textureType, GL_TEXTURE_MIN_FILTER, minFilter);
 	glTexParameteri(textureType, GL_TEXTURE_MAG_FILTER, magFilter);
-	glBindTexture(textureType, 0);
+	gGLState.BindTexture(textureType, 0);
 
 	for (int i = 0; i < images.size(); ++i)
 	{
@@ -90,7 +91,7 @@ void TextureCube::AllocateForFrameBuffer(int width, int height, GLint internalFo
 
 	if (textureID == GL_INVALID_VALUE)
 		glGenTextures(1, &textureID);
-	glBindTexture(textureType, textureID);
+	gGLState.BindTexture(textureType, textureID);
 	if (width > 0 && height > 0)
 	{
 		for (int i = 0; i < 6; ++i)
@@ -109,7 +110,7 @@ void TextureCube::Reallocate(int width, int height)
 	{
 		this->width = width;
 		this->height = height;
-		glBindTexture(textureType, textureID);
+		gGLState.BindTexture(textureType, textureID);
 		for (int i = 0; i < 6; ++i)
 			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, internalFormat, width, height, 0, format, type, NULL);
 	}
@@ -6,6 +6,7 @@
 
 #include <string>
 
+#include "GLState.h"
 #include "TextureCubeArray.h"
 
 REArray<TextureCubeArray*> TextureCubeArray::gContainer;
@@ -21,7 +22,7 @@ void TextureCubeArray::AllocateForFrameBuffer(int width, int height, int count,
 
 	if (textureID == GL_INVALID_VALUE)
 		glGenTextures(1, &textureID);
-	glBindTexture(textureType, textureID);
+	gGLState.BindTexture(textureType, textureID);
 	if (width > 0 && height > 0 && count > 0)
 	{
 		glTexImage3D(textureType, 0, internalFormat, width, height, count * 6, 0, format, type, NULL);
@@ -40,7 +41,7 @@ void TextureCubeArray::Reallocate(int width, int height, int count)
 		this->width = width;
 		this->height = height;
 		this->count = count;
-		glBindTexture(textureType, textureID);
+		gGLState.BindTexture(textureType, textureID);
 		glTexImage3D(textureType, 0, internalFormat, width, height, count * 6, 0, format, type, NULL);
 	}
 }
\ No newline at end of file
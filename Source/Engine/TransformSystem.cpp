@@ -0,0 +1,362 @@
+#include "JobSystem/JobSystem.h"
+
+#include "Profiler.h"
+
+#include "MeshComponent.h"
+
+#include "TransformSystem.h"
+
+TransformSystem gTransformSystem;
+
+struct TransformUpdateJobData
+{
+	TransformSystem* system;
+	const int* indices;
+	int count;
+
+	JOB_METHOD_ENTRY_POINT(UpdateBatch)
+	{
+		TransformUpdateJobData* data = (TransformUpdateJobData*)customDataPtr;
+		data->system->UpdateNodes(data->indices, data->count);
+	}
+};
+
+int TransformSystem::CreateNode(MeshComponent* inOwner, int parentHandle)
+{
+	int handle = (int)handleToIndex.size();
+	int index = (int)parentIndex.size();
+	int parent = parentHandle >= 0 ? handleToIndex[parentHandle] : -1;
+
+	localPosition.push_back(Vector4_3::Zero());
+	localRotation.push_back(Quat::Identity());
+	localScale.push_back(Vector4_3(1));
+	worldMat.push_back(Matrix4::Identity());
+	prevWorldMat.push_back(Matrix4::Identity());
+	parentIndex.push_back(parent);
+	firstChild.push_back(0);
+	childCount.push_back(0);
+	depth.push_back(parent >= 0 ? depth[parent] + 1 : 0);
+	owner.push_back(inOwner);
+	updatedFrame.push_back(0);
+	bLocalDirty.push_back(0);
+	bHasWorld.push_back(0);
+
+	handleToIndex.push_back(index);
+	indexToHandle.push_back(handle);
+
+	// new node breaks depth order, sort before next update
+	bNeedSort = true;
+	AddToDirtyList(index);
+
+	return handle;
+}
+
+void TransformSystem::SetParent(int handle, int parentHandle)
+{
+	int index = handleToIndex[handle];
+	int parent = parentHandle >= 0 ? handleToIndex[parentHandle] : -1;
+	if (parentIndex[index] == parent)
+		return;
+
+	// no cycle
+	for (int p = parent; p >= 0; p = parentIndex[p])
+	{
+		if (p == index)
+		{
+			printf("TransformSystem: SetParent would create a cycle\n");
+			return;
+		}
+	}
+
+	parentIndex[index] = parent;
+	bNeedSort = true;
+	AddToDirtyList(index);
+}
+
+int TransformSystem::GetParent(int handle) const
+{
+	int parent = parentIndex[handleToIndex[handle]];
+	return parent >= 0 ? indexToHandle[parent] : -1;
+}
+
+void TransformSystem::SetLocalPosition(int handle, const Vector4_3& position)
+{
+	int index = handleToIndex[handle];
+	localPosition[index] = position;
+	AddToDirtyList(index);
+}
+
+void TransformSystem::SetLocalRotation(int handle, const Quat& rotation)
+{
+	int index = handleToIndex[handle];
+	localRotation[index] = rotation;
+	AddToDirtyList(index);
+}
+
+void TransformSystem::SetLocalScale(int handle, const Vector4_3& scale)
+{
+	int index = handleToIndex[handle];
+	localScale[index] = scale;
+	AddToDirtyList(index);
+}
+
+void TransformSystem::MarkDirty(int handle)
+{
+	AddToDirtyList(handleToIndex[handle]);
+}
+
+void TransformSystem::AddToDirtyList(int index)
+{
+	if (bLocalDirty[index])
+		return;
+
+	bLocalDirty[index] = 1;
+	// sort will rebuild dirty list from flags
+	if (bNeedSort)
+		return;
+
+	dirtyList[depth[index]].push_back(index);
+}
+
+void TransformSystem::Sort()
+{
+	bNeedSort = false;
+
+	int nodeCount = (int)parentIndex.size();
+
+	// children of each node in current order
+	REArray<int> childStart(nodeCount + 1, 0);
+	REArray<int> children(nodeCount);
+	for (int i = 0; i < nodeCount; ++i)
+	{
+		if (parentIndex[i] >= 0)
+			++childStart[parentIndex[i] + 1];
+	}
+	for (int i = 0; i < nodeCount; ++i)
+		childStart[i + 1] += childStart[i];
+	{
+		REArray<int> fill(childStart.begin(), childStart.end() - 1);
+		for (int i = 0; i < nodeCount; ++i)
+		{
+			if (parentIndex[i] >= 0)
+				children[fill[parentIndex[i]]++] = i;
+		}
+	}
+
+	// breadth first, roots first
+	REArray<int> order;
+	order.reserve(nodeCount);
+	for (int i = 0; i < nodeCount; ++i)
+	{
+		if (parentIndex[i] < 0)
+			order.push_back(i);
+	}
+	for (int k = 0; k < (int)order.size(); ++k)
+	{
+		int i = order[k];
+		for (int c = childStart[i]; c < childStart[i + 1]; ++c)
+			order.push_back(children[c]);
+	}
+	assert((int)order.size() == nodeCount);
+
+	REArray<int> newIndex(nodeCount);
+	for (int k = 0; k < nodeCount; ++k)
+		newIndex[order[k]] = k;
+
+	// permute
+	{
+		REArray<Vector4_3, 16> oldPosition; oldPosition.swap(localPosition);
+		REArray<Quat, 16> oldRotation; oldRotation.swap(localRotation);
+		REArray<Vector4_3, 16> oldScale; oldScale.swap(localScale);
+		REArray<Matrix4, 16> oldWorldMat; oldWorldMat.swap(worldMat);
+		REArray<Matrix4, 16> oldPrevWorldMat; oldPrevWorldMat.swap(prevWorldMat);
+		REArray<int> oldParentIndex; oldParentIndex.swap(parentIndex);
+		REArray<MeshComponent*> oldOwner; oldOwner.swap(owner);
+		REArray<unsigned int> oldUpdatedFrame; oldUpdatedFrame.swap(updatedFrame);
+		REArray<char> oldLocalDirty; oldLocalDirty.swap(bLocalDirty);
+		REArray<char> oldHasWorld; oldHasWorld.swap(bHasWorld);
+
+		localPosition.resize(nodeCount);
+		localRotation.resize(nodeCount);
+		localScale.resize(nodeCount);
+		worldMat.resize(nodeCount);
+		prevWorldMat.resize(nodeCount);
+		parentIndex.resize(nodeCount);
+		owner.resize(nodeCount);
+		updatedFrame.resize(nodeCount);
+		bLocalDirty.resize(nodeCount);
+		bHasWorld.resize(nodeCount);
+		depth.resize(nodeCount);
+		firstChild.resize(nodeCount);
+		childCount.resize(nodeCount);
+
+		for (int k = 0; k < nodeCount; ++k)
+		{
+			int i = order[k];
+			int p = oldParentIndex[i];
+			localPosition[k] = oldPosition[i];
+			localRotation[k] = oldRotation[i];
+			localScale[k] = oldScale[i];
+			worldMat[k] = oldWorldMat[i];
+			prevWorldMat[k] = oldPrevWorldMat[i];
+			parentIndex[k] = p >= 0 ? newIndex[p] : -1;
+			owner[k] = oldOwner[i];
+			updatedFrame[k] = oldUpdatedFrame[i];
+			bLocalDirty[k] = oldLocalDirty[i];
+			bHasWorld[k] = oldHasWorld[i];
+			depth[k] = p >= 0 ? depth[parentIndex[k]] + 1 : 0;
+			// children are pushed together, first one gives the range start
+			childCount[k] = childStart[i + 1] - childStart[i];
+			firstChild[k] = childCount[k] > 0 ? newIndex[children[childStart[i]]] : 0;
+		}
+	}
+
+	for (int h = 0, nh = (int)handleToIndex.size(); h < nh; ++h)
+	{
+		handleToIndex[h] = newIndex[handleToIndex[h]];
+		indexToHandle[handleToIndex[h]] = h;
+	}
+
+	for (int k = 0, nk = (int)updatedList.size(); k < nk; ++k)
+		updatedList[k] = newIndex[updatedList[k]];
+
+	// levels
+	int levelCount = nodeCount > 0 ? depth[nodeCount - 1] + 1 : 0;
+	levelStart.resize(levelCount + 1);
+	for (int l = 0, k = 0; l <= levelCount; ++l)
+	{
+		while (k < nodeCount && depth[k] < l)
+			++k;
+		levelStart[l] = k;
+	}
+
+	dirtyList.resize(levelCount);
+	for (int l = 0; l < levelCount; ++l)
+		dirtyList[l].clear();
+	for (int k = 0; k < nodeCount; ++k)
+	{
+		if (bLocalDirty[k])
+			dirtyList[depth[k]].push_back(k);
+	}
+}
+
+void TransformSystem::Update()
+{
+	CPU_SCOPED_PROFILE("transform");
+
+	if (bNeedSort)
+		Sort();
+
+	++frameIndex;
+
+	// nodes moved last frame stop moving unless updated again
+	for (int k = 0, nk = (int)updatedList.size(); k < nk; ++k)
+	{
+		int i = updatedList[k];
+		prevWorldMat[i] = worldMat[i];
+		if (owner[i])
+		{
+			owner[i]->prevModelMat = worldMat[i];
+			owner[i]->bRenderTransformDirty = false;
+		}
+	}
+	updatedList.clear();
+
+	static REArray<TransformUpdateJobData> jobData;
+	static REArray<JobDescriptor> jobDescs;
+
+	// updatedList holds updated nodes level by level,
+	// [prevLevelBegin, levelBegin) are the ones updated in the level above
+	int prevLevelBegin = 0;
+	for (int l = 0, nl = GetLevelCount(); l < nl; ++l)
+	{
+		int levelBegin = (int)updatedList.size();
+
+		// whole subtree of an updated node is updated
+		for (int k = prevLevelBegin; k < levelBegin; ++k)
+		{
+			int i = updatedList[k];
+			for (int c = firstChild[i], nc = firstChild[i] + childCount[i]; c < nc; ++c)
+				updatedList.push_back(c);
+		}
+
+		// dirty nodes, skip if already added by parent
+		REArray<int>& levelDirtyList = dirtyList[l];
+		for (int k = 0, nk = (int)levelDirtyList.size(); k < nk; ++k)
+		{
+			int i = levelDirtyList[k];
+			int p = parentIndex[i];
+			if (p >= 0 && updatedFrame[p] == frameIndex)
+				continue;
+			updatedList.push_back(i);
+		}
+		levelDirtyList.clear();
+
+		prevLevelBegin = levelBegin;
+
+		int count = (int)updatedList.size() - levelBegin;
+		if (count == 0)
+			continue;
+
+		const int* indices = &updatedList[levelBegin];
+		int jobCount = (count + updateBatchSize - 1) / updateBatchSize;
+		if (jobCount == 1)
+		{
+			UpdateNodes(indices, count);
+			continue;
+		}
+
+		jobData.resize(jobCount);
+		jobDescs.resize(jobCount);
+		for (int j = 0; j < jobCount; ++j)
+		{
+			int start = j * updateBatchSize;
+			jobData[j].system = this;
+			jobData[j].indices = indices + start;
+			jobData[j].count = Min(updateBatchSize, count - start);
+			jobDescs[j] = JobDescriptor(&TransformUpdateJobData::UpdateBatch, &jobData[j]);
+		}
+
+		// next level reads world matrices written here
+		JobWaitingCounter counter;
+		RunJobs(jobDescs.data(), jobCount, &counter);
+		WaitOnCounter(&counter, 0);
+	}
+}
+
+void TransformSystem::UpdateNodes(const int* indices, int count)
+{
+	for (int k = 0; k < count; ++k)
+	{
+		int i = indices[k];
+
+		Matrix4 local = QuatToMatrix4(localRotation[i]);
+		local.SetTranslation(localPosition[i]);
+		local.ApplyScale(localScale[i]);
+
+		int p = parentIndex[i];
+		Matrix4 world = p >= 0 ? worldMat[p] * local : local;
+
+		// first update has no motion
+		prevWorldMat[i] = bHasWorld[i] ? worldMat[i] : world;
+		worldMat[i] = world;
+		bHasWorld[i] = 1;
+		bLocalDirty[i] = 0;
+		updatedFrame[i] = frameIndex;
+
+		MeshComponent* mc = owner[i];
+		if (mc)
+		{
+			mc->prevModelMat = prevWorldMat[i];
+			mc->modelMat = world;
+			Vector4_3 worldScale(world.mLine[0].Size3(), world.mLine[1].Size3(), world.mLine[2].Size3());
+			mc->OBB.SetBounds(mc->bounds, world, worldScale);
+			if (mc->cullingIndex >= 0)
+			{
+				gMeshCullingBounds.SetOBB(mc->cullingIndex, mc->OBB);
+				gMeshBVH.SetBounds(mc->cullingIndex, mc->OBB.GetAABB());
+			}
+			mc->bRenderTransformDirty = true;
+		}
+	}
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Containers/Containers.h"
+#include "Math/REMath.h"
+
+class MeshComponent;
+
+// transform hierarchy
+// nodes are addressed by handle, data is stored in SoA arrays sorted by depth (breadth first),
+// so children of a node are contiguous and all parents are updated before their children.
+// world matrices are updated level by level in jobs, only dirty nodes and their subtrees are touched.
+class TransformSystem
+{
+public:
+
+	// nodes per job
+	static const int updateBatchSize = 256;
+
+	int CreateNode(MeshComponent* owner = 0, int parentHandle = -1);
+
+	void SetParent(int handle, int parentHandle);
+	int GetParent(int handle) const;
+
+	void SetLocalPosition(int handle, const Vector4_3& position);
+	void SetLocalRotation(int handle, const Quat& rotation);
+	void SetLocalScale(int handle, const Vector4_3& scale);
+
+	// force world matrix (and owner bounds) update
+	void MarkDirty(int handle);
+
+	const Matrix4& GetWorldMatrix(int handle) const
+	{
+		return worldMat[handleToIndex[handle]];
+	}
+
+	// call once per frame before culling
+	void Update();
+
+	int GetNodeCount() const { return (int)parentIndex.size(); }
+	int GetLevelCount() const { return (int)levelStart.size() - 1; }
+	int GetLastUpdateCount() const { return (int)updatedList.size(); }
+	// owner of k-th node updated in last Update(), can be null
+	MeshComponent* GetLastUpdatedOwner(int k) const { return owner[updatedList[k]]; }
+
+protected:
+
+	// local
+	REArray<Vector4_3, 16> localPosition;
+	REArray<Quat, 16> localRotation;
+	REArray<Vector4_3, 16> localScale;
+	// world
+	REArray<Matrix4, 16> worldMat;
+	REArray<Matrix4, 16> prevWorldMat;
+	// hierarchy, index into sorted arrays
+	REArray<int> parentIndex;
+	REArray<int> firstChild;
+	REArray<int> childCount;
+	REArray<int> depth;
+	REArray<MeshComponent*> owner;
+	// frame index when world matrix is updated
+	REArray<unsigned int> updatedFrame;
+	REArray<char> bLocalDirty;
+	REArray<char> bHasWorld;
+
+	REArray<int> handleToIndex;
+	REArray<int> indexToHandle;
+
+	// sorted node index range of each level, size is level count + 1
+	REArray<int> levelStart;
+	// nodes set dirty this frame per level
+	REArray<REArray<int>> dirtyList;
+	// nodes updated last frame, need prev matrix settled
+	REArray<int> updatedList;
+
+	unsigned int frameIndex = 0;
+	bool bNeedSort = false;
+
+	void Sort();
+	void AddToDirtyList(int index);
+	void UpdateNodes(const int* indices, int count);
+
+	friend struct TransformUpdateJobData;
+};
+
+extern TransformSystem gTransformSystem;
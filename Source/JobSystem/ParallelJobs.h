@@ -0,0 +1,57 @@
+#pragma once
+
+#include "Containers/Containers.h"
+#include "JobSystem.h"
+
+// work is split into fixed size slices so results never depend on how many jobs run them,
+// jobCount only changes how slices are distributed
+
+template<class TFunc>
+struct ParallelForJobData
+{
+	TFunc* funcPtr;
+	int first;
+	int stride;
+	int count;
+
+	JOB_METHOD_ENTRY_POINT(Run)
+	{
+		ParallelForJobData* data = (ParallelForJobData*)customDataPtr;
+		for (int i = data->first; i < data->count; i += data->stride)
+			(*data->funcPtr)(i);
+	}
+};
+
+// call func(sliceIndex) for all slices, using at most jobCount jobs and block until done
+// jobCount <= 1 runs inline on calling thread
+template<class TFunc>
+void ParallelForSlices(int sliceCount, int jobCount, TFunc func)
+{
+	if (sliceCount <= 0)
+		return;
+
+	if (jobCount > sliceCount)
+		jobCount = sliceCount;
+	if (jobCount <= 1)
+	{
+		for (int i = 0; i < sliceCount; ++i)
+			func(i);
+		return;
+	}
+
+	REArray<ParallelForJobData<TFunc>> jobData(jobCount);
+	REArray<JobDescriptor> jobDescs(jobCount);
+	for (int j = 0; j < jobCount; ++j)
+	{
+		// interleaved, neighbour slices usually cost about the same
+		jobData[j].funcPtr = &func;
+		jobData[j].first = j;
+		jobData[j].stride = jobCount;
+		jobData[j].count = sliceCount;
+		jobDescs[j] = JobDescriptor(&ParallelForJobData<TFunc>::Run, &jobData[j]);
+	}
+
+	JobWaitingCounter counter;
+	RunJobs(jobDescs.data(), jobCount, &counter);
+	WaitOnCounter(&counter, 0);
+}
@@ -0,0 +1,415 @@
+#pragma once
+
+#include "REMath.h"
+
+// vertex attribute quantization
+// scalar version for single value, Vec version for 4 values in SoA layout
+
+// ------------------------------------------------------------------------
+// half float
+
+// round to nearest even, based on https://gist.github.com/rygorous/2156668
+inline unsigned __int16 FloatToHalf(float f)
+{
+	IntFloatUnion u;
+	u.f = f;
+	const unsigned __int32 f32Infty = 255 << 23;
+	const unsigned __int32 f16Max = (127 + 16) << 23;
+	IntFloatUnion denormMagic;
+	denormMagic.u = ((127 - 15) + (23 - 10) + 1) << 23;
+
+	unsigned __int32 sign = u.u & 0x80000000u;
+	u.u ^= sign;
+
+	unsigned __int32 o;
+	if (u.u >= f16Max)
+	{
+		// inf or nan, nan -> qnan
+		o = (u.u > f32Infty) ? 0x7e00 : 0x7c00;
+	}
+	else if (u.u < (113 << 23))
+	{
+		// subnormal or zero
+		u.f += denormMagic.f;
+		o = u.u - denormMagic.u;
+	}
+	else
+	{
+		unsigned __int32 mantOdd = (u.u >> 13) & 1;
+		u.u += ((unsigned __int32)(15 - 127) << 23) + 0xfff;
+		u.u += mantOdd;
+		o = u.u >> 13;
+	}
+	return (unsigned __int16)(o | (sign >> 16));
+}
+
+inline float HalfToFloat(unsigned __int16 h)
+{
+	const unsigned __int32 shiftedExp = 0x7c00 << 13;
+	IntFloatUnion magic;
+	magic.u = 113 << 23;
+
+	IntFloatUnion o;
+	o.u = (h & 0x7fff) << 13;
+	unsigned __int32 exp = shiftedExp & o.u;
+	o.u += (127 - 15) << 23;
+
+	if (exp == shiftedExp)
+	{
+		// inf or nan
+		o.u += (128 - 16) << 23;
+	}
+	else if (exp == 0)
+	{
+		// zero or subnormal
+		o.u += 1 << 23;
+		o.f -= magic.f;
+	}
+
+	o.u |= (h & 0x8000) << 16;
+	return o.f;
+}
+
+// 4 halfs in lower 16 bits of each lane
+__forceinline Vec128i VecFloatToHalf(Vec128 f)
+{
+	Vec128 justSign = VecAnd(f, VecConst::SignMask);
+	Vec128 absF = VecXor(f, justSign);
+	Vec128i absFi = CastVecToVeci(absF);
+
+	Vec128i isRegular = _mm_cmpgt_epi32(VeciSet1((127 + 16) << 23), absFi);
+	Vec128i nanBit = _mm_and_si128(CastVecToVeci(_mm_cmpunord_ps(absF, absF)), VeciSet1(0x200));
+	Vec128i infOrNan = _mm_or_si128(nanBit, VeciSet1(0x7c00));
+
+	// subnormal path
+	const Vec128i subnormMagic = VeciSet1(((127 - 15) + (23 - 10) + 1) << 23);
+	Vec128i isSub = _mm_cmpgt_epi32(VeciSet1((127 - 14) << 23), absFi);
+	Vec128i subnorm = _mm_sub_epi32(CastVecToVeci(VecAdd(absF, CastVeciToVec(subnormMagic))), subnormMagic);
+
+	// normal path, bias towards rounding up if mantissa lsb is odd
+	Vec128i mantOdd = _mm_srai_epi32(_mm_slli_epi32(absFi, 31 - 13), 31);
+	Vec128i normal = _mm_add_epi32(absFi, VeciSet1(0xfff - ((127 - 15) << 23)));
+	normal = _mm_srli_epi32(_mm_sub_epi32(normal, mantOdd), 13);
+
+	Vec128i nonSpecial = _mm_or_si128(_mm_and_si128(subnorm, isSub), _mm_andnot_si128(isSub, normal));
+	Vec128i joined = _mm_or_si128(_mm_and_si128(nonSpecial, isRegular), _mm_andnot_si128(isRegular, infOrNan));
+
+	return _mm_or_si128(joined, _mm_srli_epi32(CastVecToVeci(justSign), 16));
+}
+
+// count does not need to be multiple of 4
+inline void FloatToHalfBatch(const float* src, unsigned __int16* dst, int count)
+{
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		Vec128i h = VecFloatToHalf(_mm_loadu_ps(src + i));
+		// pack to 16 bits, values are already in [0, 0xffff], use signed pack on shifted value to avoid saturation
+		h = _mm_srai_epi32(_mm_slli_epi32(h, 16), 16);
+		_mm_storel_epi64((Vec128i*)(dst + i), _mm_packs_epi32(h, h));
+	}
+	for (; i < count; ++i)
+		dst[i] = FloatToHalf(src[i]);
+}
+
+inline void HalfToFloatBatch(const unsigned __int16* src, float* dst, int count)
+{
+	for (int i = 0; i < count; ++i)
+		dst[i] = HalfToFloat(src[i]);
+}
+
+// ------------------------------------------------------------------------
+// snorm / unorm, follow GL 4.2+ conversion rule
+
+// round half to even like VecRound, so scalar and Vec encoders give the same result
+__forceinline float RoundHalfEven(float f)
+{
+	return _mm_cvtss_f32(_mm_round_ss(_mm_setzero_ps(), _mm_set_ss(f), _MM_FROUND_NINT));
+}
+
+// [-1, 1] -> [-(2^(bits-1)-1), 2^(bits-1)-1]
+__forceinline __int32 FloatToSnorm(float f, int bits)
+{
+	float scale = (float)((1 << (bits - 1)) - 1);
+	return (__int32)RoundHalfEven(Clamp(f, -1.f, 1.f) * scale);
+}
+
+__forceinline float SnormToFloat(__int32 i, int bits)
+{
+	float scale = (float)((1 << (bits - 1)) - 1);
+	return Max((float)i / scale, -1.f);
+}
+
+// [0, 1] -> [0, 2^bits-1]
+__forceinline unsigned __int32 FloatToUnorm(float f, int bits)
+{
+	float scale = (float)((1u << bits) - 1);
+	return (unsigned __int32)RoundHalfEven(Clamp(f, 0.f, 1.f) * scale);
+}
+
+__forceinline float UnormToFloat(unsigned __int32 i, int bits)
+{
+	float scale = (float)((1u << bits) - 1);
+	return (float)i / scale;
+}
+
+__forceinline Vec128i VecFloatToSnorm(Vec128 f, int bits)
+{
+	Vec128 scale = VecSet1((float)((1 << (bits - 1)) - 1));
+	f = VecMin(VecMax(f, VecConst::Vec_Neg_One), VecConst::Vec_One);
+	return _mm_cvtps_epi32(VecRound(VecMul(f, scale)));
+}
+
+__forceinline Vec128 VecSnormToFloat(Vec128i i, int bits)
+{
+	Vec128 invScale = VecSet1(1.f / (float)((1 << (bits - 1)) - 1));
+	return VecMax(VecMul(_mm_cvtepi32_ps(i), invScale), VecConst::Vec_Neg_One);
+}
+
+__forceinline Vec128i VecFloatToUnorm(Vec128 f, int bits)
+{
+	Vec128 scale = VecSet1((float)((1u << bits) - 1));
+	f = VecMin(VecMax(f, VecZero()), VecConst::Vec_One);
+	return _mm_cvtps_epi32(VecRound(VecMul(f, scale)));
+}
+
+// ------------------------------------------------------------------------
+// octahedral normal encoding
+// http://jcgt.org/published/0003/02/01/
+
+// input normalized vector, output in [-1, 1]
+inline Vector4_2 OctEncode(const Vector4_3& n)
+{
+	float invL1 = 1.f / (Abs(n.x) + Abs(n.y) + Abs(n.z));
+	float x = n.x * invL1;
+	float y = n.y * invL1;
+	if (n.z < 0)
+	{
+		float tx = (1.f - Abs(y)) * (x >= 0 ? 1.f : -1.f);
+		float ty = (1.f - Abs(x)) * (y >= 0 ? 1.f : -1.f);
+		x = tx;
+		y = ty;
+	}
+	return Vector4_2(x, y);
+}
+
+inline Vector4_3 OctDecode(const Vector4_2& e)
+{
+	Vector4_3 n(e.x, e.y, 1.f - Abs(e.x) - Abs(e.y));
+	float t = Max(-n.z, 0.f);
+	n.x += (n.x >= 0) ? -t : t;
+	n.y += (n.y >= 0) ? -t : t;
+	return n.GetNormalized3();
+}
+
+__forceinline void VecOctEncode(Vec128 nx, Vec128 ny, Vec128 nz, Vec128& outX, Vec128& outY)
+{
+	Vec128 invL1 = VecDiv(VecConst::Vec_One, VecAdd(VecAdd(VecAbs(nx), VecAbs(ny)), VecAbs(nz)));
+	Vec128 x = VecMul(nx, invL1);
+	Vec128 y = VecMul(ny, invL1);
+	// sign without 0 (+0 and -0 both treated as positive)
+	Vec128 signX = VecBlendVar(VecConst::Vec_One, VecConst::Vec_Neg_One, VecCmpLT(x, VecZero()));
+	Vec128 signY = VecBlendVar(VecConst::Vec_One, VecConst::Vec_Neg_One, VecCmpLT(y, VecZero()));
+	Vec128 foldX = VecMul(VecSub(VecConst::Vec_One, VecAbs(y)), signX);
+	Vec128 foldY = VecMul(VecSub(VecConst::Vec_One, VecAbs(x)), signY);
+	Vec128 mask = VecCmpLT(nz, VecZero());
+	outX = VecBlendVar(x, foldX, mask);
+	outY = VecBlendVar(y, foldY, mask);
+}
+
+__forceinline void VecOctDecode(Vec128 ex, Vec128 ey, Vec128& outX, Vec128& outY, Vec128& outZ)
+{
+	Vec128 z = VecSub(VecSub(VecConst::Vec_One, VecAbs(ex)), VecAbs(ey));
+	Vec128 t = VecMax(VecNegate(z), VecZero());
+	Vec128 x = VecAdd(ex, VecBlendVar(VecNegate(t), t, VecCmpLT(ex, VecZero())));
+	Vec128 y = VecAdd(ey, VecBlendVar(VecNegate(t), t, VecCmpLT(ey, VecZero())));
+	Vec128 invLen = VecDiv(VecConst::Vec_One, VecSqrt(VecAdd(VecAdd(VecMul(x, x), VecMul(y, y)), VecMul(z, z))));
+	outX = VecMul(x, invLen);
+	outY = VecMul(y, invLen);
+	outZ = VecMul(z, invLen);
+}
+
+// ------------------------------------------------------------------------
+// orthonormal basis from a normal, the same function must be used on gpu side
+// http://jcgt.org/published/0006/01/01/
+
+inline void GetOrthonormalBasis(const Vector4_3& n, Vector4_3& outB1, Vector4_3& outB2)
+{
+	float sign = (n.z >= 0) ? 1.f : -1.f;
+	float a = -1.f / (sign + n.z);
+	float b = n.x * n.y * a;
+	outB1 = Vector4_3(1.f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+	outB2 = Vector4_3(b, sign + n.y * n.y * a, -n.y);
+}
+
+// ------------------------------------------------------------------------
+// packed tangent frame, 32 bits, GL_INT_2_10_10_10_REV layout
+// x, y: octahedral normal, snorm 10 bits
+// z: tangent angle around normal relative to GetOrthonormalBasis, snorm 10 bits, [-PI, PI] -> [-1, 1]
+// w: bitangent sign, snorm 2 bits
+
+const int TangentFrameNormalBits = 10;
+const int TangentFrameAngleBits = 10;
+
+// normal exactly on the octahedron equator (|x| + |y| == 1) can decode to z = +0 or -0 depending on rounding,
+// which flips the basis and breaks the tangent angle, so move it 1 step into upper hemisphere
+__forceinline void NudgeOctEquator(__int32& ix, __int32& iy, int bits)
+{
+	__int32 absX = ix >= 0 ? ix : -ix;
+	__int32 absY = iy >= 0 ? iy : -iy;
+	if (absX + absY == (1 << (bits - 1)) - 1)
+	{
+		if (absX > absY)
+			ix -= (ix > 0) ? 1 : -1;
+		else
+			iy -= (iy > 0) ? 1 : -1;
+	}
+}
+
+__forceinline void VecNudgeOctEquator(Vec128i& ix, Vec128i& iy, int bits)
+{
+	Vec128i absX = _mm_abs_epi32(ix);
+	Vec128i absY = _mm_abs_epi32(iy);
+	Vec128i onEquator = _mm_cmpeq_epi32(_mm_add_epi32(absX, absY), VeciSet1((1 << (bits - 1)) - 1));
+	Vec128i pickX = _mm_cmpgt_epi32(absX, absY);
+	const Vec128i one = VeciSet1(1);
+	ix = _mm_sub_epi32(ix, _mm_and_si128(_mm_and_si128(onEquator, pickX), _mm_sign_epi32(one, ix)));
+	iy = _mm_sub_epi32(iy, _mm_and_si128(_mm_andnot_si128(pickX, onEquator), _mm_sign_epi32(one, iy)));
+}
+
+// tangent.w is bitangent sign
+inline unsigned __int32 PackTangentFrame(const Vector4_3& normal, const Vector4& tangent)
+{
+	Vector4_2 oct = OctEncode(normal);
+	__int32 ix = FloatToSnorm(oct.x, TangentFrameNormalBits);
+	__int32 iy = FloatToSnorm(oct.y, TangentFrameNormalBits);
+	NudgeOctEquator(ix, iy, TangentFrameNormalBits);
+
+	// build basis from the normal gpu will see
+	Vector4_3 decodedNormal = OctDecode(Vector4_2(
+		SnormToFloat(ix, TangentFrameNormalBits),
+		SnormToFloat(iy, TangentFrameNormalBits)));
+	Vector4_3 b1, b2;
+	GetOrthonormalBasis(decodedNormal, b1, b2);
+	float angle = Atan2(tangent.Dot3(b2), tangent.Dot3(b1)) * (1.f / PI);
+	__int32 iz = FloatToSnorm(angle, TangentFrameAngleBits);
+	__int32 iw = tangent.w < 0 ? -1 : 1;
+
+	return ((unsigned __int32)ix & 0x3ff)
+		| (((unsigned __int32)iy & 0x3ff) << 10)
+		| (((unsigned __int32)iz & 0x3ff) << 20)
+		| (((unsigned __int32)iw & 0x3) << 30);
+}
+
+inline void UnpackTangentFrame(unsigned __int32 packed, Vector4_3& outNormal, Vector4& outTangent)
+{
+	// sign extend each field
+	__int32 ix = ((__int32)(packed << 22)) >> 22;
+	__int32 iy = ((__int32)(packed << 12)) >> 22;
+	__int32 iz = ((__int32)(packed << 2)) >> 22;
+	__int32 iw = ((__int32)packed) >> 30;
+
+	outNormal = OctDecode(Vector4_2(
+		SnormToFloat(ix, TangentFrameNormalBits),
+		SnormToFloat(iy, TangentFrameNormalBits)));
+	Vector4_3 b1, b2;
+	GetOrthonormalBasis(outNormal, b1, b2);
+	float angle = SnormToFloat(iz, TangentFrameAngleBits) * PI;
+	outTangent = Vector4(b1 * Cos(angle) + b2 * Sin(angle), SnormToFloat(iw, 2));
+}
+
+// 4 tangent frames at once
+__forceinline Vec128i VecPackTangentFrame(Vec128 nx, Vec128 ny, Vec128 nz, Vec128 tx, Vec128 ty, Vec128 tz, Vec128 tw)
+{
+	Vec128 ex, ey;
+	VecOctEncode(nx, ny, nz, ex, ey);
+	Vec128i ix = VecFloatToSnorm(ex, TangentFrameNormalBits);
+	Vec128i iy = VecFloatToSnorm(ey, TangentFrameNormalBits);
+	VecNudgeOctEquator(ix, iy, TangentFrameNormalBits);
+
+	// build basis from the normal gpu will see
+	Vec128 dx, dy, dz;
+	VecOctDecode(VecSnormToFloat(ix, TangentFrameNormalBits), VecSnormToFloat(iy, TangentFrameNormalBits), dx, dy, dz);
+	Vec128 negMask = VecCmpLT(dz, VecZero());
+	Vec128 sign = VecBlendVar(VecConst::Vec_One, VecConst::Vec_Neg_One, negMask);
+	Vec128 a = VecDiv(VecConst::Vec_Neg_One, VecAdd(sign, dz));
+	Vec128 b = VecMul(VecMul(dx, dy), a);
+	Vec128 signDx = VecMul(sign, dx);
+	Vec128 b1x = VecAdd(VecConst::Vec_One, VecMul(VecMul(signDx, dx), a));
+	Vec128 b1y = VecMul(sign, b);
+	Vec128 b1z = VecNegate(signDx);
+	Vec128 b2y = VecAdd(sign, VecMul(VecMul(dy, dy), a));
+	Vec128 b2z = VecNegate(dy);
+	Vec128 cosPart = VecAdd(VecAdd(VecMul(tx, b1x), VecMul(ty, b1y)), VecMul(tz, b1z));
+	Vec128 sinPart = VecAdd(VecAdd(VecMul(tx, b), VecMul(ty, b2y)), VecMul(tz, b2z));
+	Vec128 angle = VecMul(VecAtan2(sinPart, cosPart), VecSet1(1.f / PI));
+	Vec128i iz = VecFloatToSnorm(angle, TangentFrameAngleBits);
+	// -1 (0x3) or 1 (0x1)
+	Vec128i iw = _mm_or_si128(_mm_srli_epi32(CastVecToVeci(VecCmpLT(tw, VecZero())), 30), VeciSet1(1));
+
+	const Vec128i mask10 = VeciSet1(0x3ff);
+	Vec128i r = _mm_and_si128(ix, mask10);
+	r = _mm_or_si128(r, _mm_slli_epi32(_mm_and_si128(iy, mask10), 10));
+	r = _mm_or_si128(r, _mm_slli_epi32(_mm_and_si128(iz, mask10), 20));
+	r = _mm_or_si128(r, _mm_slli_epi32(iw, 30));
+	return r;
+}
+
+// ------------------------------------------------------------------------
+// quaternion tangent frame (QTangent)
+// http://crytek.com/download/izfrey_siggraph2011.pdf
+// rotation from tangent space, bitangent sign is stored in sign of w
+
+// bits: storage precision of the quaternion, used to keep w away from 0 so the sign survives quantization
+inline Quat EncodeQTangent(const Vector4_3& normal, const Vector4& tangent, int bits = 16)
+{
+	Vector4_3 n = normal.GetNormalized3();
+	// orthogonalize tangent
+	Vector4_3 t = (Vector4_3(tangent.x, tangent.y, tangent.z) - n * n.Dot3(tangent)).GetNormalized3();
+	Vector4_3 b = n.Cross3(t);
+	Matrix4 m(t, b, n, Vector4(0, 0, 0, 1));
+	Quat q = Matrix4ToQuat(m).GetNormalized();
+
+	// make w positive so we can use the sign
+	if (q.w < 0)
+		q = q * -1.f;
+
+	// make sure w is not quantized to 0
+	float bias = 1.f / (float)((1 << (bits - 1)) - 1);
+	if (q.w < bias)
+	{
+		float normFactor = Sqrt(1.f - bias * bias);
+		q.x *= normFactor;
+		q.y *= normFactor;
+		q.z *= normFactor;
+		q.w = bias;
+	}
+
+	if (tangent.w < 0)
+		q = q * -1.f;
+
+	return q;
+}
+
+inline void DecodeQTangent(const Quat& q, Vector4_3& outNormal, Vector4& outTangent)
+{
+	Quat nq = q.GetNormalized();
+	outNormal = nq.Rotate(Vector4_3(0, 0, 1));
+	outTangent = Vector4(nq.Rotate(Vector4_3(1, 0, 0)), q.w < 0 ? -1.f : 1.f);
+}
+
+// snorm 16 x 4
+inline void PackQTangent(const Quat& q, __int16 outPacked[4])
+{
+	for (int i = 0; i < 4; ++i)
+		outPacked[i] = (__int16)FloatToSnorm(q.m[i], 16);
+}
+
+inline Quat UnpackQTangent(const __int16 packed[4])
+{
+	return Quat(
+		SnormToFloat(packed[0], 16),
+		SnormToFloat(packed[1], 16),
+		SnormToFloat(packed[2], 16),
+		SnormToFloat(packed[3], 16));
+}
@@ -419,6 +419,45 @@ __forceinline float RandRange(float minR, float maxR)
 	return minR + RandF() * (maxR - minR);
 }
 
+// seeded random sequence (xorshift32), same on every platform and run unlike rand()
+struct RandomStream
+{
+	unsigned int state;
+
+	RandomStream(unsigned int seed = 1)
+	{
+		// spread close seeds, state must not be 0
+		state = seed * 0x9E3779B9u;
+		if (state == 0)
+			state = 1;
+	}
+
+	__forceinline unsigned int Next()
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+	// [0.f, 1.f)
+	__forceinline float NextF()
+	{
+		return (Next() >> 8) * (1.f / 16777216.f);
+	}
+
+	__forceinline float Range(float minR, float maxR)
+	{
+		return minR + NextF() * (maxR - minR);
+	}
+
+	// [0, count)
+	__forceinline int RangeInt(int count)
+	{
+		return (int)(Next() % (unsigned int)count);
+	}
+};
+
 
 // =================================================================
 // Coordinates and Matrices specifics
@@ -332,8 +332,8 @@ bool    ImGui_Impl_Init(SDL_Window* window)
 #ifdef _WIN32
     SDL_SysWMinfo wmInfo;
     SDL_VERSION(&wmInfo.version);
-    SDL_GetWindowWMInfo(window, &wmInfo);
-    io.ImeWindowHandle = wmInfo.info.win.window;
+    if (window && SDL_GetWindowWMInfo(window, &wmInfo))
+        io.ImeWindowHandle = wmInfo.info.win.window;
 #else
     (void)window;
 #endif
@@ -355,12 +355,20 @@ void ImGui_Impl_NewFrame(SDL_Window* window)
     ImGuiIO& io = ImGui::GetIO();
 
     // Setup display size (every frame to accommodate for window resizing)
-    int w, h;
-    int display_w, display_h;
-    SDL_GetWindowSize(window, &w, &h);
-    SDL_GL_GetDrawableSize(window, &display_w, &display_h);
-    io.DisplaySize = ImVec2((float)w, (float)h);
-    io.DisplayFramebufferScale = ImVec2(w > 0 ? ((float)display_w / w) : 0, h > 0 ? ((float)display_h / h) : 0);
+    // Without window (headless) the caller sets io.DisplaySize and there is no mouse
+    if (window)
+    {
+        int w, h;
+        int display_w, display_h;
+        SDL_GetWindowSize(window, &w, &h);
+        SDL_GL_GetDrawableSize(window, &display_w, &display_h);
+        io.DisplaySize = ImVec2((float)w, (float)h);
+        io.DisplayFramebufferScale = ImVec2(w > 0 ? ((float)display_w / w) : 0, h > 0 ? ((float)display_h / h) : 0);
+    }
+    else
+    {
+        io.DisplayFramebufferScale = ImVec2(1.0f, 1.0f);
+    }
 
     // Setup time step
     Uint32	time = SDL_GetTicks();
@@ -372,7 +380,7 @@ void ImGui_Impl_NewFrame(SDL_Window* window)
     // (we already got mouse wheel, keyboard keys & characters from SDL_PollEvent())
     int mx, my;
     Uint32 mouseMask = SDL_GetMouseState(&mx, &my);
-    if (SDL_GetWindowFlags(window) & SDL_WINDOW_MOUSE_FOCUS)
+    if (window && (SDL_GetWindowFlags(window) & SDL_WINDOW_MOUSE_FOCUS))
         io.MousePos = ImVec2((float)mx, (float)my);   // Mouse position, in pixels (set to -1,-1 if no mouse / on another screen, etc.)
     else
         io.MousePos = ImVec2(-1, -1);
@@ -386,7 +394,8 @@ void ImGui_Impl_NewFrame(SDL_Window* window)
     g_MouseWheel = 0.0f;
 
     // Hide OS mouse cursor if ImGui is drawing it
-    SDL_ShowCursor(io.MouseDrawCursor ? 0 : 1);
+    if (window)
+        SDL_ShowCursor(io.MouseDrawCursor ? 0 : 1);
 
     // Start the frame
     ImGui::NewFrame();
@@ -15,8 +15,10 @@
 
 // containers
 #include "Containers/Containers.h"
+#include "Containers/RadixSort.h"
 
 #include "JobSystem/JobSystem.h"
+#include "JobSystem/ParallelJobs.h"
 
 // std
 #include <stdlib.h>
@@ -29,8 +31,19 @@
 #include "Engine/ShaderLoader.h"
 #include "Engine/Material.h"
 #include "Engine/Mesh.h"
+#include "Engine/GeometryArena.h"
+#include "Engine/MultiDraw.h"
+#include "Engine/CommandList.h"
+#include "Engine/GPUCulling.h"
+#include "Engine/RingBuffer.h"
+#include "Engine/GLState.h"
 #include "Engine/MeshComponent.h"
 #include "Engine/MeshLoader.h"
+#include "Engine/Culling.h"
+#include "Engine/BVH.h"
+#include "Engine/Occlusion.h"
+#include "Engine/LightClusters.h"
+#include "Engine/ShadowAtlas.h"
 #include "Engine/Texture2D.h"
 #include "Engine/Texture2DArray.h"
 #include "Engine/TextureCube.h"
@@ -39,6 +52,8 @@
 #include "Engine/Viewpoint.h"
 #include "Engine/Camera.h"
 #include "Engine/Profiler.h"
+#include "Engine/Headless.h"
+#include "Engine/Benchmark.h"
 #include "Engine/Render.h"
 #include "Engine/Bounds.h"
 #include "Engine/FrameBuffer.h"
@@ -54,6 +69,17 @@
 #define SHADER_DEBUG_BUFFER 0
 #define VISUALIZE_TEXTURE 0
 #define LOAD_SCENE_MESH 1
+// use 20 bytes quantized vertex for loaded meshes
+#define COMPACT_MESH_VERTEX 1
+// simplify loaded meshes into LODs, selected by projected error on screen
+#define GENERATE_MESH_LODS 1
+// sub allocate all meshes from shared buffers, so render lists can go out as multi draw indirect batches
+#define USE_GEOMETRY_ARENA 1
+// add 90k boxes, print per object vs SoA frustum culling timing on startup,
+// and culling + render list building time for 1 to N jobs on first frame
+#define CULLING_BENCHMARK 0
+// add 100k props sharing two meshes and one material, to stress automatic instancing
+#define INSTANCING_STRESS_TEST 0
 
 #define DEBUG_SINGLE_LIGHT 0
 
@@ -68,6 +94,28 @@ SDL_Window* gWindow = NULL;
 // opengl context
 SDL_GLContext gContext;
 
+// benchmark on a hidden window, from command line
+HeadlessSettings gHeadlessSettings;
+HeadlessContext gHeadlessContext;
+// generated scene and camera path, from -benchmark
+BenchmarkConfig gBenchmarkConfig;
+ProfileReport gBenchmarkReport;
+bool gBenchmarkReportWritten = false;
+// frames since start of a benchmark run, warmup included
+int gBenchmarkFrameIndex = 0;
+// benchmark frames step time by this, so every run animates the same
+const float gBenchmarkDeltaTime = 1.f / 60.f;
+
+// camera keys for benchmark config, K starts and stops recording in window mode
+CameraPath gRecordedCameraPath;
+bool gRecordingCameraPath = false;
+
+// headless or generated scene, fixed frame count and time step, no input
+inline bool IsBenchmarkRun()
+{
+	return gHeadlessSettings.bEnabled || gBenchmarkConfig.bEnabled;
+}
+
 // shader file cache
 std::unordered_map<std::string, ShaderFileInfo> gShaderFileCache;
 FileWatcher fileWatcher;
@@ -83,6 +131,8 @@ bool gHasResetFrame;
 double gInvPerformanceFreq;
 Uint64 gPerformanceCounter;
 double gTime;
+// incremented at the start of each rendered frame
+int gRenderFrameIndex = 0;
 float gLastDeltaTime;
 float gAverageDeltaTime;
 float gDeltaTimeAccum;
@@ -93,6 +143,9 @@ int gDeltaTimeBufferIdx;
 // settings
 RenderSettings gRenderSettings;
 
+// draw counters of last frame
+RenderStats gRenderStats;
+
 // ubo
 GLuint gUBO_Matrices = 0;
 GLuint gUBO_GlobalLights = 0;
@@ -104,8 +157,10 @@ GLuint gSSBO_LocalLightsShadowMatrices = 0;
 GLuint gSSBO_LightTileInfoData = 0;
 GLuint gSSBO_LightTileCullingResultInfoData = 0;
 GLuint gSSBO_TempLightTileCullingResultInfoData = 0;
+GLuint gSSBO_LightClusterData = 0;
 
 int gPrevLocalLightCapacity = 0;
+int gPrevLightClusterDataCapacity = 0;
 int gPrevLocalLightShadowMatCapacity = 0;
 int gCurLocalLightShadowMatCount = 0;
 
@@ -133,6 +188,9 @@ FrameBuffer gDepthOnlyBuffer;
 Texture2DArray gCSMTexArray;
 TextureCubeArray gShadowCubeTexArray;
 Texture2D gShadowTiledTex;
+// static casters of cached local light shadows, same layout as above
+TextureCubeArray gShadowCubeStaticTexArray;
+Texture2D gShadowTiledStaticTex;
 
 #if SHADER_DEBUG_BUFFER
 Texture2D gDebugTex;
@@ -145,7 +203,31 @@ REArray<MeshRenderData, 16> gMaskedMeshRenderList;
 REArray<MeshRenderData, 16> gAlphaBlendMeshRenderList;
 REArray<LightRenderData> gVisibleLightList;
 
+// jobs used by culling, render processor only waits on them so it's not counted
+int gCullJobCount = 1;
+
 int gShadowCubeMapCount;
+// tiles of gShadowTiledTex, owned by local light id
+ShadowAtlas gShadowAtlas;
+
+// command lists of mesh passes, recorded by jobs after culling, replayed by their passes
+enum class EPassCommandList
+{
+	PrepassOpaque,
+	PrepassMasked,
+	Opaque,
+	Masked,
+	AlphaBlend,
+	Count,
+};
+const char* gPassCommandListNames[] = {
+	"prepass opaque",
+	"prepass masked",
+	"opaque",
+	"masked",
+	"alpha blend",
+};
+CommandList gPassCommandLists[(int)EPassCommandList::Count];
 
 // light const
 Matrix4 gLightTetrahedronViewMat[4];
@@ -178,6 +260,7 @@ Shader gPrepassTiledShader;
 Shader gPrepassCubeShader;
 Shader gPrepassTetrahedronShader;
 Shader gTiledDeferredLightShader;
+Shader gClusteredDeferredLightShader;
 Shader gDirectionalLightShader;
 Shader gLightVolumePointCubeShader;
 Shader gLightVolumePointTetrahedronShader;
@@ -197,6 +280,8 @@ Shader gLightTileReductionCompShader;
 Shader gLightTileCullingCompShader;
 Shader gLightTileReductionAndCullingCompShader;
 Shader gLightTileOnePassCompShader;
+Shader gHiZReduceCompShader;
+Shader gGPUCullingCompShader;
 
 // material
 Material* gGBufferMaterial;
@@ -208,6 +293,7 @@ Material* gPrepassTiledMaterial;
 Material* gPrepassCubeMaterial;
 Material* gPrepassTetrahedronMaterial;
 Material* gTiledDeferredLightMaterial;
+Material* gClusteredDeferredLightMaterial;
 Material* gDirectionalLightMaterial;
 Material* gLightVolumePointCubeMaterial;
 Material* gLightVolumePointTetrahedronMaterial;
@@ -226,6 +312,8 @@ Material* gLightTileReductionCompMaterial;
 Material* gLightTileCullingCompMaterial;
 Material* gLightTileReductionAndCullingCompMaterial;
 Material* gLightTileOnePassCompMaterial;
+Material* gHiZReduceCompMaterial;
+Material* gGPUCullingCompMaterial;
 
 // mesh data
 MeshData gCubeMeshData;
@@ -242,6 +330,8 @@ Mesh* gIcosahedronMesh;
 Mesh* gConeMesh;
 REArray<Mesh*> gNanosuitMeshes;
 REArray<Mesh*> gSceneMeshes;
+REArray<MeshNode> gNanosuitNodes;
+REArray<MeshNode> gSceneNodes;
 
 // texture
 Texture2D* gDiffuseMap;
@@ -291,6 +381,36 @@ bool Init()
 	}
 
 	// use opengl 4.3 core
+	if (gHeadlessSettings.bEnabled)
+	{
+		if (gHeadlessSettings.width > 0 && gHeadlessSettings.height > 0)
+		{
+			gWindowWidth = gHeadlessSettings.width;
+			gWindowHeight = gHeadlessSettings.height;
+		}
+		if (!gHeadlessContext.Create(gWindowWidth, gWindowHeight))
+			return false;
+
+		// init GLEW
+		glewExperimental = GL_TRUE;
+		GLenum glewError = glewInit();
+		if (glewError != GLEW_OK)
+		{
+			printf("Error initializing GLEW! %s\n", glewGetErrorString(glewError));
+		}
+
+		if (gHeadlessSettings.bUI)
+		{
+			ImGui_Impl_Init(NULL);
+			ImGuiIO& io = ImGui::GetIO();
+			io.Fonts->AddFontFromFileTTF("Content/Fonts/DroidSans.ttf", 20.0f);
+		}
+
+		printf("Headless %dx%d: %s\n", gWindowWidth, gWindowHeight, glGetString(GL_RENDERER));
+
+		return InitEngine();
+	}
+
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
@@ -480,6 +600,7 @@ void MakeLights()
 			/*int=*/	20
 		);
 		gPointLights[plIdx].bCastShadow = true;
+		gPointLights[plIdx].bDynamic = true;
 	}
 
 
@@ -496,6 +617,7 @@ void MakeLights()
 			/*int=*/	20
 		);
 		//gPointLights[plIdx].bCastShadow = true;
+		gPointLights[plIdx].bDynamic = true;
 	}
 
 	// spot lights
@@ -517,6 +639,112 @@ void MakeLights()
 #endif
 }
 
+Vector4_3 RandomBenchmarkPosition(RandomStream& random, const Vector4_3& extent)
+{
+	// one call per line, argument evaluation order would change the sequence between compilers
+	float x = random.Range(-extent.x, extent.x);
+	float y = random.Range(-extent.y, extent.y);
+	float z = random.Range(0.f, extent.z);
+	return Vector4_3(x, y, z);
+}
+
+Vector4_3 RandomBenchmarkColor(RandomStream& random)
+{
+	float hue = random.Range(0.f, 360.f);
+	float saturation = random.Range(0.5f, 1.f);
+	return Vector4_3(HSVToRGB(Vector4_3(hue, saturation, 1.f)));
+}
+
+// generated scene of a benchmark config, in place of MakeLights() and MakeMeshComponents(), same scene for the same seed
+void MakeBenchmarkScene(const BenchmarkConfig& config, Material* defaultMaterial)
+{
+	RandomStream random(config.seed);
+
+	// directional light, same as default scene
+	gDirectionalLights.push_back(Light(0));
+	gDirectionalLights.back().SetDirectionLight(
+		/*dir=*/	Vector4_3(-0.8f, 2.f, -5.f),
+		/*color=*/	Vector4_3(1.f, 1.f, 1.f),
+		/*int=*/	1
+	);
+	gDirectionalLights.back().bCastShadow = true;
+
+	for (int i = 0; i < config.pointLightCount; ++i)
+	{
+		Vector4_3 pos = RandomBenchmarkPosition(random, config.extent);
+		float radius = random.Range(4.f, 10.f);
+		Vector4_3 color = RandomBenchmarkColor(random);
+		gPointLights.push_back(Light(gIcosahedronMesh));
+		Light& light = gPointLights.back();
+		light.SetPointLight(pos, radius, color, 20);
+		light.bCastShadow = i < config.shadowLightCount;
+		light.bDynamic = true;
+	}
+
+	for (int i = 0; i < config.spotLightCount; ++i)
+	{
+		Vector4_3 pos = RandomBenchmarkPosition(random, config.extent);
+		float dirX = random.Range(-1.f, 1.f);
+		float dirY = random.Range(-1.f, 1.f);
+		Vector4_3 dir = Vector4_3(dirX, dirY, -1.f).GetNormalized3();
+		float outerAngle = random.Range(20.f, 45.f);
+		Vector4_3 color = RandomBenchmarkColor(random);
+		gSpotLights.push_back(Light(gConeMesh));
+		Light& light = gSpotLights.back();
+		light.SetSpotLight(pos, dir, 20.f, outerAngle, outerAngle * 0.5f, color, 500);
+		light.bCastShadow = i < config.shadowLightCount;
+	}
+
+	// shapes at increasing tessellation, every mesh data is kept for the whole run
+	static REArray<MeshData*> meshDataList;
+	for (int i = 0; i < config.meshCount; ++i)
+	{
+		MeshData* meshData = new MeshData();
+		int level = i / 4;
+		switch (i % 4)
+		{
+		case 0: MakeCube(*meshData); break;
+		case 1: MakeSphere(*meshData, 16 + level * 16); break;
+		case 2: MakeIcosahedron(*meshData, Min(1 + level, 4)); break;
+		case 3: MakeCone(*meshData, 8 + level * 8, 2); break;
+		}
+		meshDataList.push_back(meshData);
+	}
+
+	REArray<Material*> materials;
+	for (int i = 0; i < config.materialCount; ++i)
+	{
+		float metallic = random.Range(0.f, 1.f);
+		float roughness = random.Range(0.1f, 1.f);
+		Material* material = Material::Create(defaultMaterial);
+		material->SetParameter("metallic", metallic);
+		material->SetParameter("roughness", roughness);
+		materials.push_back(material);
+	}
+
+	// a mesh for each used mesh data and material pair
+	REArray<Mesh*> meshes;
+	meshes.resize(config.meshCount * config.materialCount, 0);
+	for (int i = 0; i < config.componentCount; ++i)
+	{
+		int meshIdx = random.RangeInt(config.meshCount);
+		int materialIdx = random.RangeInt(config.materialCount);
+		Vector4_3 pos = RandomBenchmarkPosition(random, config.extent);
+		float yaw = random.Range(0.f, 360.f);
+		float scale = random.Range(config.minScale, config.maxScale);
+
+		Mesh*& mesh = meshes[meshIdx * config.materialCount + materialIdx];
+		if (!mesh)
+			mesh = Mesh::Create(meshDataList[meshIdx], materials[materialIdx]);
+
+		MeshComponent* meshComp = MeshComponent::Create();
+		meshComp->AddMesh(mesh);
+		meshComp->SetPosition(pos);
+		meshComp->SetRotation(Vector4_3(0.f, 0.f, yaw));
+		meshComp->SetScale(Vector4_3(scale, scale, scale));
+	}
+}
+
 void MakeMeshComponents(Material* defaultMaterial)
 {
 
@@ -532,6 +760,7 @@ void MakeMeshComponents(Material* defaultMaterial)
 		meshComp->SetPosition(Vector4_3(-10.f + i * 10.f, 0.f, 0.f));
 		meshComp->SetRotation(Vector4_3(0.f, 0.f, 45.f));
 		meshComp->SetScale(Vector4_3(1.5f, 1.2f, 1.f));
+		meshComp->bOccluder = true;
 	}
 
 	for (int i = 0; i < 10000; ++i)
@@ -542,6 +771,37 @@ void MakeMeshComponents(Material* defaultMaterial)
 		meshComp->SetScale(Vector4_3(0.3f, 0.3f, 0.3f));
 	}
 
+#if CULLING_BENCHMARK
+	// large scene for culling benchmark, 100k boxes in total
+	for (int i = 0; i < 90000; ++i)
+	{
+		MeshComponent* meshComp = MeshComponent::Create();
+		meshComp->AddMesh(boxMesh);
+		meshComp->SetPosition(Vector4_3(RandRange(-250.f, 250.f), RandRange(-250.f, 250.f), RandRange(0.f, 50.f)));
+		meshComp->SetScale(Vector4_3(0.3f, 0.3f, 0.3f));
+	}
+#endif
+
+#if INSTANCING_STRESS_TEST
+	// repeated props, same mesh and material runs are drawn instanced in every pass
+	{
+		Material* propMaterial = Material::Create(defaultMaterial);
+		propMaterial->SetParameter("metallic", 0.2f);
+		propMaterial->SetParameter("roughness", 0.6f);
+		Mesh* propMeshes[2] = {
+			Mesh::Create(&gCubeMeshData, propMaterial),
+			Mesh::Create(&gSphereMeshData, propMaterial),
+		};
+		for (int i = 0; i < 100000; ++i)
+		{
+			MeshComponent* meshComp = MeshComponent::Create();
+			meshComp->AddMesh(propMeshes[i & 1]);
+			meshComp->SetPosition(Vector4_3(RandRange(-250.f, 250.f), RandRange(-250.f, 250.f), RandRange(0.f, 20.f)));
+			meshComp->SetScale(Vector4_3(0.2f, 0.2f, 0.2f));
+		}
+	}
+#endif
+
 	// sphere
 	for (int i = 0; i < 20; ++i)
 	{
@@ -565,15 +825,14 @@ void MakeMeshComponents(Material* defaultMaterial)
 
 	// nanosuit
 	{
-		MeshComponent* meshComp = MeshComponent::Create();
-		meshComp->SetMeshList(gNanosuitMeshes);
-		meshComp->SetPosition(Vector4_3(5, -5, -1));
-		meshComp->SetScale(Vector4_3(0.3f, 0.3f, 0.3f));
+		int root = gTransformSystem.CreateNode();
+		gTransformSystem.SetLocalPosition(root, Vector4_3(5, -5, -1));
+		gTransformSystem.SetLocalScale(root, Vector4_3(0.3f, 0.3f, 0.3f));
+		CreateMeshComponents(gNanosuitMeshes, gNanosuitNodes, root);
 
-		const REArray<Mesh*>& meshList = meshComp->GetMeshList();
-		for (int i = 0; i < meshList.size(); ++i)
+		for (int i = 0; i < gNanosuitMeshes.size(); ++i)
 		{
-			Material* material = meshList[i]->material;
+			Material* material = gNanosuitMeshes[i]->material;
 			if (!material)
 				continue;
 
@@ -616,13 +875,18 @@ void MakeMeshComponents(Material* defaultMaterial)
 		//	material->SetParameter("roughness", 1.f);
 		//}
 
+		int root = gTransformSystem.CreateNode();
+		gTransformSystem.SetLocalPosition(root, Vector4_3(0, -6, -1));
+		gTransformSystem.SetLocalScale(root, Vector4_3(1.f, 1.f, 1.f) * 0.07f);
+		REArray<MeshComponent*> sceneComponents;
+		CreateMeshComponents(gSceneMeshes, gSceneNodes, root, &sceneComponents);
+
+		// walls and floors, only the ones large on screen are used each frame
+		for (int i = 0; i < sceneComponents.size(); ++i)
+			sceneComponents[i]->bOccluder = true;
+
 		for (int i = 0; i < gSceneMeshes.size(); ++i)
 		{
-			MeshComponent* meshComp = MeshComponent::Create();
-			meshComp->AddMesh(gSceneMeshes[i]);
-			meshComp->SetPosition(Vector4_3(0, -6, -1));
-			meshComp->SetScale(Vector4_3(1.f, 1.f, 1.f) * 0.07f);
-
 			Material* material = gSceneMeshes[i]->material;
 			if (!material)
 				continue;
@@ -646,6 +910,7 @@ void MakeMeshComponents(Material* defaultMaterial)
 		meshComp->AddMesh(floorMesh);
 		meshComp->SetPosition(Vector4_3(0.f, 0.f, -1.2f));
 		meshComp->SetScale(Vector4_3(32.f, 32.f, 0.2f));
+		meshComp->bOccluder = true;
 	}
 
 	//{
@@ -817,7 +1082,7 @@ void SetupFrameBuffers()
 		gShadowTiledTex.AllocateForFrameBuffer(4096, 4096, GL_DEPTH_COMPONENT16, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, true);
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	gGLState.BindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 void LoadShaders(bool bReload)
@@ -834,6 +1099,7 @@ void LoadShaders(bool bReload)
 	gPrepassCubeShader.Load("Shader/prepass.vert", "Shader/prepassCube.geom", "Shader/prepass.frag", !bReload);
 	gPrepassTetrahedronShader.Load("Shader/prepass.vert", "Shader/prepassTetrahedron.geom", "Shader/prepass.frag", !bReload);
 	gTiledDeferredLightShader.Load("Shader/fsQuad.vert", "Shader/fsQuadTiledLight.frag", !bReload);
+	gClusteredDeferredLightShader.Load("Shader/fsQuad.vert", "Shader/fsQuadClusteredLight.frag", !bReload);
 	gDirectionalLightShader.Load("Shader/fsQuad.vert", "Shader/fsQuadLight.frag", !bReload);
 	gLightVolumePointCubeShader.Load("Shader/lightVolume.vert", "Shader/lightVolumePointCube.frag", !bReload);
 	gLightVolumePointTetrahedronShader.Load("Shader/lightVolume.vert", "Shader/lightVolumePointTetrahedron.frag", !bReload);
@@ -853,6 +1119,8 @@ void LoadShaders(bool bReload)
 	gLightTileCullingCompShader.Load("Shader/lightTileCulling.comp", !bReload);
 	gLightTileReductionAndCullingCompShader.Load("Shader/lightTileReductionAndCulling.comp", !bReload);
 	gLightTileOnePassCompShader.Load("Shader/lightTileOnePass.comp", !bReload);
+	gHiZReduceCompShader.Load("Shader/hiZReduce.comp", !bReload);
+	gGPUCullingCompShader.Load("Shader/gpuCulling.comp", !bReload);
 }
 
 float HaltonSeq(int prime, int index = 1)
@@ -933,6 +1201,9 @@ bool InitEngine()
 	memset(gDeltaTimeBuffer, 0, sizeof(float) * gDeltaTimeBufferCount);
 	gDeltaTimeBufferIdx = 0;
 
+	// job system is running at this point
+	gCullJobCount = Max(gJobSystemWorkerThreadCount - 1, 1);
+
 	gHasResetFrame = true;
 
 #if JITTER_HALTON
@@ -956,39 +1227,46 @@ bool InitEngine()
 	glGenBuffers(1, &gUBO_Matrices);
 	glBindBuffer(GL_UNIFORM_BUFFER, gUBO_Matrices);
 	glBufferData(GL_UNIFORM_BUFFER, sizeof(RenderInfo), NULL, GL_DYNAMIC_DRAW);
-	glBindBufferBase(GL_UNIFORM_BUFFER, (GLuint)EShaderBindingUBO::RenderInfo, gUBO_Matrices);
+	gGLState.BindBufferBase(GL_UNIFORM_BUFFER, (GLuint)EShaderBindingUBO::RenderInfo, gUBO_Matrices);
 	// global lights
 	glGenBuffers(1, &gUBO_GlobalLights);
 	glBindBuffer(GL_UNIFORM_BUFFER, gUBO_GlobalLights);
 	glBufferData(GL_UNIFORM_BUFFER, sizeof(GlobalLightsRenderInfo), NULL, GL_DYNAMIC_DRAW);
-	glBindBufferBase(GL_UNIFORM_BUFFER, (GLuint)EShaderBindingUBO::GlobalLightsRenderInfo, gUBO_GlobalLights);
+	gGLState.BindBufferBase(GL_UNIFORM_BUFFER, (GLuint)EShaderBindingUBO::GlobalLightsRenderInfo, gUBO_GlobalLights);
 
 	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
+	// per frame constants, render info of every pass and shadow view, and multi draw data
+	gFrameRingBuffer.Init(4 * 1024 * 1024);
+
 	// ssbo
 	glGenBuffers(1, &gSSBO_LocalLights);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gSSBO_LocalLights);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::LocalLightsRenderInfo, gSSBO_LocalLights);
+	gGLState.BindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::LocalLightsRenderInfo, gSSBO_LocalLights);
 
 	glGenBuffers(1, &gSSBO_LocalLightsBounds);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gSSBO_LocalLightsBounds);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::LocalLightsCullingInfo, gSSBO_LocalLightsBounds);
+	gGLState.BindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::LocalLightsCullingInfo, gSSBO_LocalLightsBounds);
 
 	glGenBuffers(1, &gSSBO_LocalLightsShadowMatrices);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gSSBO_LocalLightsShadowMatrices);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::LocalLightsShadowMatrixInfo, gSSBO_LocalLightsShadowMatrices);
+	gGLState.BindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::LocalLightsShadowMatrixInfo, gSSBO_LocalLightsShadowMatrices);
 
 	glGenBuffers(1, &gSSBO_LightTileInfoData);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gSSBO_LightTileInfoData);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::LightTileInfo, gSSBO_LightTileInfoData);
+	gGLState.BindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::LightTileInfo, gSSBO_LightTileInfoData);
 
 	glGenBuffers(1, &gSSBO_LightTileCullingResultInfoData);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gSSBO_LightTileCullingResultInfoData);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::LightTileCullingResultInfo, gSSBO_LightTileCullingResultInfoData);
+	gGLState.BindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::LightTileCullingResultInfo, gSSBO_LightTileCullingResultInfoData);
 
 	glGenBuffers(1, &gSSBO_TempLightTileCullingResultInfoData);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gSSBO_TempLightTileCullingResultInfoData);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::TempLightTileCullingResultInfo, gSSBO_TempLightTileCullingResultInfoData);
+	gGLState.BindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::TempLightTileCullingResultInfo, gSSBO_TempLightTileCullingResultInfoData);
+
+	glGenBuffers(1, &gSSBO_LightClusterData);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gSSBO_LightClusterData);
+	gGLState.BindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)EShaderBindingSSBO::LightClusterInfo, gSSBO_LightClusterData);
 
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 	
@@ -1007,6 +1285,7 @@ bool InitEngine()
 	gPrepassCubeMaterial = Material::Create(&gPrepassCubeShader);
 	gPrepassTetrahedronMaterial = Material::Create(&gPrepassTetrahedronShader);
 	gTiledDeferredLightMaterial = Material::Create(&gTiledDeferredLightShader);
+	gClusteredDeferredLightMaterial = Material::Create(&gClusteredDeferredLightShader);
 	gDirectionalLightMaterial = Material::Create(&gDirectionalLightShader);
 	gLightVolumePointCubeMaterial = Material::Create(&gLightVolumePointCubeShader);
 	gLightVolumePointTetrahedronMaterial = Material::Create(&gLightVolumePointTetrahedronShader);
@@ -1025,6 +1304,8 @@ bool InitEngine()
 	gLightTileCullingCompMaterial = Material::Create(&gLightTileCullingCompShader);
 	gLightTileReductionAndCullingCompMaterial = Material::Create(&gLightTileReductionAndCullingCompShader);
 	gLightTileOnePassCompMaterial = Material::Create(&gLightTileOnePassCompShader);
+	gHiZReduceCompMaterial = Material::Create(&gHiZReduceCompShader);
+	gGPUCullingCompMaterial = Material::Create(&gGPUCullingCompShader);
 
 	Material* defaultOpaqueMaterial = 0;
 	Shader* defaultOpaqueShaderPtr = 0;
@@ -1087,6 +1368,7 @@ bool InitEngine()
 	gAlphaBlendBasicMaterial->bAlphaBlend = true;
 	
 	// mesh
+	MeshData::gUseGeometryArena = USE_GEOMETRY_ARENA;
 	gCubeMesh = Mesh::Create(&gCubeMeshData, defaultOpaqueMaterial);
 	gSphereMesh = Mesh::Create(&gSphereMeshData, defaultOpaqueMaterial);
 
@@ -1094,22 +1376,44 @@ bool InitEngine()
 	gIcosahedronMesh = Mesh::Create(&gIcosahedronMeshData);
 	gConeMesh = Mesh::Create(&gConeMeshData);
 
-	LoadMesh(gNanosuitMeshes, "Content/Model/nanosuit/nanosuit.obj", defaultOpaqueShaderPtr, &gAlphaBlendBasicShader, gSkyboxMap, EMeshConversion::YUpToZUP);
+	LoadMesh(gNanosuitMeshes, "Content/Model/nanosuit/nanosuit.obj", defaultOpaqueShaderPtr, &gAlphaBlendBasicShader, gSkyboxMap, EMeshConversion::YUpToZUP, COMPACT_MESH_VERTEX, &gNanosuitNodes, GENERATE_MESH_LODS);
 	//LoadMesh(gNanosuitMeshes, "Content/Model/Lakecity/Lakecity.obj", defaultOpaqueShaderPtr, &gAlphaBlendBasicShader, gSkyboxMap, EMeshConversion::YUpToZUP);
 #if LOAD_SCENE_MESH
-	LoadMesh(gSceneMeshes, "Content/Model/sponza/sponza.obj", defaultOpaqueShaderPtr, &gAlphaBlendBasicShader, gSkyboxMap, EMeshConversion::YUpToZUP);
+	LoadMesh(gSceneMeshes, "Content/Model/sponza/sponza.obj", defaultOpaqueShaderPtr, &gAlphaBlendBasicShader, gSkyboxMap, EMeshConversion::YUpToZUP, COMPACT_MESH_VERTEX, &gSceneNodes, GENERATE_MESH_LODS);
 #endif
 
-	// light
-	MakeLights();
+	if (gBenchmarkConfig.bEnabled)
+	{
+		MakeBenchmarkScene(gBenchmarkConfig, defaultOpaqueMaterial);
+	}
+	else
+	{
+		// light
+		MakeLights();
+
+		// mesh components
+		MakeMeshComponents(defaultOpaqueMaterial);
+	}
 
-	// mesh components
-	MakeMeshComponents(defaultOpaqueMaterial);
+#if CULLING_BENCHMARK
+	BenchmarkCulling(100000);
+	BenchmarkBVH(10000);
+	BenchmarkBVH(100000);
+	BenchmarkBVH(1000000);
+	BenchmarkOcclusion(100000);
+	BenchmarkLightClusters(1000);
+	BenchmarkLightClusters(10000);
+#endif
 	
 	// camera
 	gCamera.fov = 90.f;
 	gCamera.position = Vector4_3(0.f, -20.f, 5.f);
 	gCamera.euler = Vector4_3(-10.f, 0.f, 0.f);
+	if (gBenchmarkConfig.bEnabled)
+	{
+		gCamera.fov = gBenchmarkConfig.fov;
+		gBenchmarkConfig.cameraPath.Evaluate(0.f, gCamera.position, gCamera.euler);
+	}
 
 	return true;
 }
@@ -1128,12 +1432,20 @@ void Close()
 	fileWatcher.Stop();
 
 	// shut down imgui
-	ImGui_Impl_Shutdown();
+	if (!gHeadlessSettings.bEnabled || gHeadlessSettings.bUI)
+		ImGui_Impl_Shutdown();
 
-	SDL_GL_DeleteContext(gContext);
+	if (gHeadlessSettings.bEnabled)
+	{
+		gHeadlessContext.Destroy();
+	}
+	else
+	{
+		SDL_GL_DeleteContext(gContext);
 
-	//Destroy window
-	SDL_DestroyWindow(gWindow);
+		//Destroy window
+		SDL_DestroyWindow(gWindow);
+	}
 
 	//Quit SDL_Image
 	IMG_Quit();
@@ -1270,6 +1582,8 @@ void UpdatePointLights(float deltaTime)
 
 			int index = *(int *)&moveData->basePos_index.w;
 			Light& light = gPointLights[index];
+			if (!light.bDynamic)
+				return;
 			for (int j = 0; j < 1000; ++j)
 			{
 				Vector4_3 newPos = moveData->basePos_index + moveData->dir_phase *
@@ -1284,12 +1598,17 @@ void UpdatePointLights(float deltaTime)
 	static REArray<LightMoveData, 16> lightMoveData;
 	if (lightMoveData.size() == 0)
 	{
+		// same movement on every benchmark run of a seed
+		RandomStream random(gBenchmarkConfig.seed);
 		lightMoveData.resize(gPointLights.size());
 		for (int i = 0, ni = (int)gPointLights.size(); i < ni; ++i)
 		{
+			float dirX = random.NextF();
+			float dirY = random.NextF();
+			float dirZ = random.NextF();
 			lightMoveData[i].basePos_index = gPointLights[i].position;
-			lightMoveData[i].dir_phase = Vector4_3(RandF(), RandF(), RandF()).GetNormalized3();
-			lightMoveData[i].dir_phase.w = RandF();
+			lightMoveData[i].dir_phase = Vector4_3(dirX, dirY, dirZ).GetNormalized3();
+			lightMoveData[i].dir_phase.w = random.NextF();
 			lightMoveData[i].basePos_index.w = *(float*)&i;
 		}
 	}
@@ -1324,8 +1643,18 @@ void Update(float deltaTime)
 
 	float smoothDeltaTime = Min(0.03f, deltaTime);
 
-	updateMouseInput(smoothDeltaTime);
-	updateKeyboardInput(smoothDeltaTime);
+	if (gBenchmarkConfig.bEnabled)
+	{
+		// camera path spans warmup and recorded frames
+		int lastFrame = gHeadlessSettings.warmupFrameCount + gHeadlessSettings.frameCount - 1;
+		float t = lastFrame > 0 ? (float)gBenchmarkFrameIndex / lastFrame : 0.f;
+		gBenchmarkConfig.cameraPath.Evaluate(t, gCamera.position, gCamera.euler);
+	}
+	else if (!IsBenchmarkRun())
+	{
+		updateMouseInput(smoothDeltaTime);
+		updateKeyboardInput(smoothDeltaTime);
+	}
 	UpdatePointLights(smoothDeltaTime);
 
 	// update spot light
@@ -1352,14 +1681,32 @@ void Update(float deltaTime)
 		gSpotLights[0].SetDirection(Lerp(startDir, endDir, ratio).GetNormalized3());
 	}
 
-	// end of frame
-	for (int i = 0, ni = (int)MeshComponent::gMeshComponentContainer.size(); i < ni; ++i)
+	// world transforms, prev transforms and bounds, only dirty subtrees
+	gTransformSystem.Update();
+
+	// refit culling hierarchy above moved components, first call builds it
 	{
-		MeshComponent::gMeshComponentContainer[i]->UpdateEndOfFrame(deltaTime);
+		CPU_SCOPED_PROFILE("bvh refit");
+		static REArray<int> movedIndices;
+		movedIndices.clear();
+		for (int k = 0, nk = gTransformSystem.GetLastUpdateCount(); k < nk; ++k)
+		{
+			MeshComponent* meshComp = gTransformSystem.GetLastUpdatedOwner(k);
+			if (meshComp && meshComp->GetCullingIndex() >= 0)
+				movedIndices.push_back(meshComp->GetCullingIndex());
+		}
+		gMeshBVH.Refit(movedIndices.data(), (int)movedIndices.size());
 	}
 
 	// update imgui
-	ImGui_Impl_NewFrame(gWindow);
+	if (!gHeadlessSettings.bEnabled || gHeadlessSettings.bUI)
+	{
+		if (gHeadlessSettings.bEnabled)
+			ImGui::GetIO().DisplaySize = ImVec2((float)gWindowWidth, (float)gWindowHeight);
+		ImGui_Impl_NewFrame(gWindow);
+		// creates its device objects on first frame, bypassing gGLState
+		gGLState.Invalidate();
+	}
 }
 
 void GetTiledShadowMapValue(int index, int totalSize, int& outOffsetX, int& outOffsetY, int& outSize)
@@ -1402,7 +1749,21 @@ void GetNormalizedTiledShadowMapValue(int index, int totalSize, float desiredTil
 	outNormSize = (float)tileSize / totalSize;
 }
 
-void CullLights(RenderContext& renderContext)
+// index of a local light, point lights then spot lights
+inline int GetLocalLightId(const LightRenderData& lightData)
+{
+	return lightData.bSpot ?
+		(int)gPointLights.size() + (int)(lightData.light - gSpotLights.data()) :
+		(int)(lightData.light - gPointLights.data());
+}
+
+// exact compare of the components in mask, bit 0 is x
+inline bool IsSameVector(const Vector4& a, const Vector4& b, int mask)
+{
+	return (VecMoveMask(VecCmpEQ(a.m128, b.m128)) & mask) == mask;
+}
+
+void CullLights(RenderContext& renderContext, int jobCount)
 {
 	CPU_SCOPED_PROFILE("cull lights");
 
@@ -1410,58 +1771,196 @@ void CullLights(RenderContext& renderContext)
 	
 	// local lights
 	{
-		gVisibleLightList.clear();
-
-		LightRenderData lightDataTmpl;
+		// lights are tested in slices of fixed size in parallel, then appended in slice order
+		const int lightSliceSize = 256;
+		int pointCount = (int)gPointLights.size();
+		int lightCount = pointCount + (int)gSpotLights.size();
+		int pointSliceCount = (pointCount + lightSliceSize - 1) / lightSliceSize;
+		int spotSliceCount = ((int)gSpotLights.size() + lightSliceSize - 1) / lightSliceSize;
+		static REArray<REArray<LightRenderData>> lightSlices;
+		static REArray<int> sliceTestedCounts;
+		lightSlices.resize(pointSliceCount + spotSliceCount);
+		sliceTestedCounts.resize(pointSliceCount + spotSliceCount);
+
+		// temporal culling, a light keeps last frame's result if neither the light nor the view planes changed.
+		// light id is index for point lights, pointCount + index for spot lights
+		// cached state is (position, radius) and (direction, outer tan half angle)
+		static REArray<Vector4> cachedLightBounds;
+		static REArray<Vector4> cachedLightDirection;
+		static REArray<char> cachedLightVisible;
+		static Plane cachedViewPlanes[6];
+		bool bReuse = gRenderSettings.bTemporalCulling && (int)cachedLightVisible.size() == lightCount;
+		for (int i = 0; i < 6 && bReuse; ++i)
+			bReuse = IsSameVector(cachedViewPlanes[i], viewPoint.frustumPlanes[i], 0xF);
+		for (int i = 0; i < 6; ++i)
+			cachedViewPlanes[i] = viewPoint.frustumPlanes[i];
+		cachedLightBounds.resize(lightCount);
+		cachedLightDirection.resize(lightCount);
+		cachedLightVisible.resize(lightCount);
 
-		// point lights
-		lightDataTmpl.bSpot = false;
-		lightDataTmpl.bUseTetrahedronShadowMap = true;
-		for (int lightIdx = 0, nlightIdx = (int)gPointLights.size(); lightIdx < nlightIdx; ++lightIdx)
+		ParallelForSlices(pointSliceCount + spotSliceCount, jobCount, [&](int s)
 		{
-			Light& light = gPointLights[lightIdx];
-			if (IsSphereIntersectFrustum(light.position, light.radius, viewPoint.frustumPlanes, 6))
+			REArray<LightRenderData>& sliceList = lightSlices[s];
+			sliceList.clear();
+			int testedCount = 0;
+
+			LightRenderData lightDataTmpl;
+			if (s < pointSliceCount)
 			{
-				lightDataTmpl.light = &light;
-				lightDataTmpl.bActualCastShadow = light.bCastShadow && gRenderSettings.bDrawShadow && gRenderSettings.bDrawShadowPoint;
-				float lightDist = (light.position - viewPoint.position).Size3();
-				lightDataTmpl.shadowMapSize = light.sphereBounds.centerRadius.w * viewPoint.screenScale / Max(lightDist, 1.f) * 1.25f;
-				gVisibleLightList.push_back(lightDataTmpl);
+				// point lights
+				lightDataTmpl.bSpot = false;
+				lightDataTmpl.bUseTetrahedronShadowMap = true;
+				for (int lightIdx = s * lightSliceSize, nlightIdx = Min(lightIdx + lightSliceSize, (int)gPointLights.size()); lightIdx < nlightIdx; ++lightIdx)
+				{
+					Light& light = gPointLights[lightIdx];
+					Vector4 bounds(light.position, light.radius);
+					bool bVisible;
+					if (bReuse && IsSameVector(bounds, cachedLightBounds[lightIdx], 0xF))
+					{
+						bVisible = cachedLightVisible[lightIdx] != 0;
+					}
+					else
+					{
+						bVisible = IsSphereIntersectFrustum(light.position, light.radius, viewPoint.frustumPlanes, 6);
+						cachedLightBounds[lightIdx] = bounds;
+						cachedLightVisible[lightIdx] = bVisible;
+						++testedCount;
+					}
+					if (bVisible)
+					{
+						lightDataTmpl.light = &light;
+						lightDataTmpl.bActualCastShadow = light.bCastShadow && gRenderSettings.bDrawShadow && gRenderSettings.bDrawShadowPoint;
+						float lightDist = (light.position - viewPoint.position).Size3();
+						lightDataTmpl.shadowMapSize = light.sphereBounds.centerRadius.w * viewPoint.screenScale / Max(lightDist, 1.f) * 1.25f;
+						sliceList.push_back(lightDataTmpl);
+					}
+				}
 			}
-		}
-
-		// spot lights
-		lightDataTmpl.bSpot = true;
-		lightDataTmpl.bUseTetrahedronShadowMap = false;
-		Vector4 packedFrustumVerts[6];
-		for (int lightIdx = 0, nlightIdx = (int)gSpotLights.size(); lightIdx < nlightIdx; ++lightIdx)
-		{
-			Light& light = gSpotLights[lightIdx];
-			MakeFrustumPackedVerts(light.lightInvViewMat, 0, light.radius, light.outerTanHalfAngle, 1.f, packedFrustumVerts);
-			if (IsFrustumIntersectFrustum(packedFrustumVerts, viewPoint.frustumPlanes, 6))
+			else
 			{
-				lightDataTmpl.light = &light;
-				lightDataTmpl.bActualCastShadow = light.bCastShadow && gRenderSettings.bDrawShadow && gRenderSettings.bDrawShadowSpot;
-				float lightDist = (light.position - viewPoint.position).Size3();
-				lightDataTmpl.shadowMapSize = light.sphereBounds.centerRadius.w * viewPoint.screenScale / Max(lightDist, 1.f) * 0.5f;
-				gVisibleLightList.push_back(lightDataTmpl);
+				// spot lights
+				lightDataTmpl.bSpot = true;
+				lightDataTmpl.bUseTetrahedronShadowMap = false;
+				Vector4 packedFrustumVerts[6];
+				int spotSlice = s - pointSliceCount;
+				for (int lightIdx = spotSlice * lightSliceSize, nlightIdx = Min(lightIdx + lightSliceSize, (int)gSpotLights.size()); lightIdx < nlightIdx; ++lightIdx)
+				{
+					Light& light = gSpotLights[lightIdx];
+					int lightId = pointCount + lightIdx;
+					Vector4 bounds(light.position, light.radius);
+					Vector4 direction(light.direction, light.outerTanHalfAngle);
+					bool bVisible;
+					if (bReuse && IsSameVector(bounds, cachedLightBounds[lightId], 0xF) &&
+						IsSameVector(direction, cachedLightDirection[lightId], 0xF))
+					{
+						bVisible = cachedLightVisible[lightId] != 0;
+					}
+					else
+					{
+						MakeFrustumPackedVerts(light.lightInvViewMat, 0, light.radius, light.outerTanHalfAngle, 1.f, packedFrustumVerts);
+						bVisible = IsFrustumIntersectFrustum(packedFrustumVerts, viewPoint.frustumPlanes, 6);
+						cachedLightBounds[lightId] = bounds;
+						cachedLightDirection[lightId] = direction;
+						cachedLightVisible[lightId] = bVisible;
+						++testedCount;
+					}
+					if (bVisible)
+					{
+						lightDataTmpl.light = &light;
+						lightDataTmpl.bActualCastShadow = light.bCastShadow && gRenderSettings.bDrawShadow && gRenderSettings.bDrawShadowSpot;
+						float lightDist = (light.position - viewPoint.position).Size3();
+						lightDataTmpl.shadowMapSize = light.sphereBounds.centerRadius.w * viewPoint.screenScale / Max(lightDist, 1.f) * 0.5f;
+						sliceList.push_back(lightDataTmpl);
+					}
+				}
 			}
+			sliceTestedCounts[s] = testedCount;
+		});
+
+		gVisibleLightList.clear();
+		int testedCount = 0;
+		for (int s = 0, ns = (int)lightSlices.size(); s < ns; ++s)
+		{
+			gVisibleLightList.insert(gVisibleLightList.end(), lightSlices[s].begin(), lightSlices[s].end());
+			testedCount += sliceTestedCounts[s];
 		}
+		renderContext.stats.cullTestedCount += testedCount;
+		renderContext.stats.cullSkippedCount += lightCount - testedCount;
 
 		// sort
-		std::sort(gVisibleLightList.begin(), gVisibleLightList.end(), LightRenderData::CompareShadowIndex);
+		static REArray<LightRenderData> orderedLightList;
+		int visibleCount = (int)gVisibleLightList.size();
+		if (gRenderSettings.bTemporalCulling)
+		{
+			// start from last frame's order, then shadow map sizes only changed a little,
+			// so insertion sort repairs it in about linear time
+			static REArray<int> lastLightOrder;
+			static REArray<int> lightSlot;
+			lightSlot.resize(lightCount);
+			std::fill(lightSlot.begin(), lightSlot.end(), -1);
+			for (int i = 0; i < visibleCount; ++i)
+				lightSlot[GetLocalLightId(gVisibleLightList[i])] = i;
+
+			orderedLightList.clear();
+			for (int i = 0, ni = (int)lastLightOrder.size(); i < ni; ++i)
+			{
+				int lightId = lastLightOrder[i];
+				if (lightId < lightCount && lightSlot[lightId] >= 0)
+				{
+					orderedLightList.push_back(gVisibleLightList[lightSlot[lightId]]);
+					lightSlot[lightId] = -1;
+				}
+			}
+			// newly visible lights
+			for (int i = 0; i < visibleCount; ++i)
+			{
+				if (lightSlot[GetLocalLightId(gVisibleLightList[i])] >= 0)
+					orderedLightList.push_back(gVisibleLightList[i]);
+			}
+			gVisibleLightList.swap(orderedLightList);
+
+			if (!InsertionSort(gVisibleLightList.data(), visibleCount, visibleCount * 4, LightRenderData::CompareShadowIndex))
+				std::sort(gVisibleLightList.begin(), gVisibleLightList.end(), LightRenderData::CompareShadowIndex);
+
+			lastLightOrder.resize(visibleCount);
+			for (int i = 0; i < visibleCount; ++i)
+				lastLightOrder[i] = GetLocalLightId(gVisibleLightList[i]);
+		}
+		else
+		{
+			std::sort(gVisibleLightList.begin(), gVisibleLightList.end(), LightRenderData::CompareShadowIndex);
+		}
 
 		gCurLocalLightShadowMatCount = 0;
 		const float minCubeMapScreenSize = 400.f;
+		// a light keeps its cube map until it gets smaller than this
+		const float keepCubeMapScreenSize = 300.f;
 		const int maxCubeMapCount = 4;
-		const float minTileSize = 128;
-		const float maxTileSize = 1024;
-		int cubeMapIdx = 0;
-		int currentTileIndex = 0;
-		int currentTileMaxIndex = 0;
-		int totalSize = gShadowTiledTex.width;
-		int nextTileSize = totalSize >> 1;
-		// assign shadow index
+		const int minTileSize = 128;
+		const int maxTileSize = 1024;
+
+		// cube maps, light id of each slot, a light keeps its slot while it stays visible and large enough
+		static int cubeMapOwners[maxCubeMapCount] = { -1, -1, -1, -1 };
+		int newCubeMapOwners[maxCubeMapCount] = { -1, -1, -1, -1 };
+		for (int lightIdx = 0, nlightIdx = (int)gVisibleLightList.size(); lightIdx < nlightIdx; ++lightIdx)
+		{
+			LightRenderData& lightData = gVisibleLightList[lightIdx];
+			if (!lightData.bActualCastShadow)
+				break;
+			if (lightData.bSpot || lightData.shadowMapSize <= keepCubeMapScreenSize)
+				continue;
+			int lightId = GetLocalLightId(lightData);
+			for (int i = 0; i < maxCubeMapCount; ++i)
+			{
+				if (cubeMapOwners[i] == lightId)
+					newCubeMapOwners[i] = lightId;
+			}
+		}
+
+		// assign shadow index, large lights first so they get space when the atlas is full.
+		// tiles are kept across frames, see ShadowAtlas
+		gShadowAtlas.Init(gShadowTiledTex.width, minTileSize, maxTileSize);
+		gShadowAtlas.BeginFrame(gRenderFrameIndex);
 		for (int lightIdx = 0, nlightIdx = (int)gVisibleLightList.size(); lightIdx < nlightIdx; ++lightIdx)
 		{
 			LightRenderData& lightData = gVisibleLightList[lightIdx];
@@ -1470,43 +1969,69 @@ void CullLights(RenderContext& renderContext)
 			if (!lightData.bActualCastShadow)
 				break;
 
-			// tmp assign shadow index
-			if (!lightData.bSpot && lightData.shadowMapSize > minCubeMapScreenSize && cubeMapIdx < maxCubeMapCount)
+			int lightId = GetLocalLightId(lightData);
+			if (!lightData.bSpot)
 			{
-				lightData.bUseTetrahedronShadowMap = false;
-				lightData.shadowMapIndex = cubeMapIdx;
-				++cubeMapIdx;
-				gCurLocalLightShadowMatCount += 2; // 2 shadow mat for cube map
-				continue;
+				int cubeMapIdx = -1;
+				for (int i = 0; i < maxCubeMapCount && cubeMapIdx < 0; ++i)
+				{
+					if (newCubeMapOwners[i] == lightId)
+						cubeMapIdx = i;
+				}
+				if (cubeMapIdx < 0 && lightData.shadowMapSize > minCubeMapScreenSize)
+				{
+					for (int i = 0; i < maxCubeMapCount && cubeMapIdx < 0; ++i)
+					{
+						if (newCubeMapOwners[i] < 0)
+						{
+							newCubeMapOwners[i] = lightId;
+							cubeMapIdx = i;
+						}
+					}
+				}
+				if (cubeMapIdx >= 0)
+				{
+					gShadowAtlas.Release(lightId);
+					lightData.bUseTetrahedronShadowMap = false;
+					lightData.shadowMapIndex = cubeMapIdx;
+					gCurLocalLightShadowMatCount += 2; // 2 shadow mat for cube map
+					continue;
+				}
 			}
 
+			int tileIndex = gShadowAtlas.Request(lightId, lightData.shadowMapSize);
+
 			// if we used up all tiles, no more shadow
-			if (currentTileIndex > currentTileMaxIndex)
+			if (tileIndex < 0)
 			{
 				lightData.bActualCastShadow = false;
 				continue;
 			}
 
 			gCurLocalLightShadowMatCount += (lightData.bSpot ? 1 : 5); // 1 shadow mat for spot light, 5 for tetrahedron
-			lightData.shadowMapSize = Clamp(lightData.shadowMapSize, minTileSize, maxTileSize);
-			// find the right level
-			while (lightData.shadowMapSize <= (float)nextTileSize)
-			{
-				// to next level
-				nextTileSize = nextTileSize >> 1;
-				currentTileIndex = (currentTileIndex << 2) + 1;
-				currentTileMaxIndex = (currentTileMaxIndex + 1) << 2;
-			}
-			lightData.shadowMapIndex = currentTileIndex;
-			//GetTiledShadowMapValue(lightData.shadowMapIndex, totalSize,
-			//	lightData.offsetX, lightData.offsetY, lightData.size);
+			lightData.shadowMapIndex = tileIndex;
+			lightData.shadowMapSize = (float)gShadowAtlas.GetTileSize(tileIndex);
+		}
+		gShadowAtlas.EndFrame();
 
-			++currentTileIndex;
+		gShadowCubeMapCount = 0;
+		for (int i = 0; i < maxCubeMapCount; ++i)
+		{
+			cubeMapOwners[i] = newCubeMapOwners[i];
+			if (cubeMapOwners[i] >= 0)
+				gShadowCubeMapCount = i + 1;
 		}
-		gShadowCubeMapCount = cubeMapIdx;
 
-		// sort
-		std::sort(gVisibleLightList.begin(), gVisibleLightList.end(), LightRenderData::CompareRender);
+		// sort by render rank, stable counting sort keeps shadow map size order in a rank
+		int rankStarts[LightRenderData::renderRankCount + 1] = {};
+		for (int i = 0; i < visibleCount; ++i)
+			++rankStarts[gVisibleLightList[i].GetRenderRank() + 1];
+		for (int r = 0; r < LightRenderData::renderRankCount; ++r)
+			rankStarts[r + 1] += rankStarts[r];
+		orderedLightList.resize(visibleCount);
+		for (int i = 0; i < visibleCount; ++i)
+			orderedLightList[rankStarts[gVisibleLightList[i].GetRenderRank()]++] = gVisibleLightList[i];
+		gVisibleLightList.swap(orderedLightList);
 	}
 }
 
@@ -1527,124 +2052,817 @@ void SetupLightTileBuffer(int tileCount)
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
-void DrawMeshList(RenderContext& renderContext, const REArray<MeshRenderData, 16>& meshList, Material* overrideMaterial = 0, const REArray<char*>* copyParamNames = 0)
+// assign visible local lights to view clusters on CPU and upload the result, used instead of tile culling compute
+// light index matches the local light buffer, which follows gVisibleLightList order
+void BuildLightClusters(RenderContext& renderContext, int jobCount)
 {
-	for (int i = 0, ni = (int)meshList.size(); i < ni; ++i)
+	CPU_SCOPED_PROFILE("light clusters");
+
+	Viewpoint& viewPoint = renderContext.viewPoint;
+
+	static REArray<ClusterLightBounds, 16> clusterLights;
+	int visibleLightCount = (int)gVisibleLightList.size();
+	clusterLights.resize(visibleLightCount);
+	for (int i = 0; i < visibleLightCount; ++i)
 	{
-		if (overrideMaterial && copyParamNames)
+		const LightRenderData& lightData = gVisibleLightList[i];
+		const Light& light = *lightData.light;
+		ClusterLightBounds& bounds = clusterLights[i];
+		bounds.sphere = light.GetSphereBoundVS(viewPoint.viewMat);
+		bounds.bCone = lightData.bSpot;
+		if (bounds.bCone)
 		{
-			overrideMaterial->CopyParameter(meshList[i].material, copyParamNames);
+			bounds.coneApex = light.GetPositionVSInvR(viewPoint.viewMat);
+			bounds.coneApex.w = light.radius;
+			bounds.coneDirection = light.GetDirectionVSRAB(viewPoint.viewMat);
+			bounds.coneDirection.w = light.outerCosHalfAngle;
+			bounds.coneSinHalfAngle = Sqrt(Max(1.f - light.outerCosHalfAngle * light.outerCosHalfAngle, 0.f));
 		}
-		meshList[i].Draw(renderContext, overrideMaterial);
 	}
+
+	gLightClusterGrid.Build(viewPoint, clusterLights.data(), visibleLightCount, jobCount);
+
+	// header, cluster info and light indices in one buffer
+	const REArray<unsigned int>& clusterData = gLightClusterGrid.GetData();
+	int clusterDataSize = (int)clusterData.size();
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gSSBO_LightClusterData);
+	if (clusterDataSize > gPrevLightClusterDataCapacity)
+	{
+		gPrevLightClusterDataCapacity = clusterDataSize;
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * clusterDataSize, NULL, GL_DYNAMIC_DRAW);
+	}
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * clusterDataSize, clusterData.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
-void CullMeshes(RenderContext& renderContext)
+// write ubo data into the frame ring buffer and bind that range,
+// the ubo of the binding is only written when the ring buffer section is full
+void UpdateUniformBlock(EShaderBindingUBO binding, GLuint ubo, const void* data, GLsizeiptr size)
 {
-	// visibility
-	// clear list
-	gOpaqueMeshRenderList.clear();
-	gMaskedMeshRenderList.clear();
-	gAlphaBlendMeshRenderList.clear();
-	for (int i = 0, ni = (int)MeshComponent::gMeshComponentContainer.size(); i < ni; ++i)
+	GLintptr offset = gFrameRingBuffer.Write(data, size, gFrameRingBuffer.GetUniformAlignment());
+	if (offset >= 0)
 	{
-		MeshComponent* meshComp = MeshComponent::gMeshComponentContainer[i];
-		if (IsOBBIntersectFrustum(meshComp->OBB.permutedAxisCenter, meshComp->OBB.extent, renderContext.viewPoint.frustumPlanes, 6))
-		{
-			//meshComp->Draw(renderContext);
-			// add mesh to render list
-			MeshRenderData renderDataTmpl;
-			renderDataTmpl.prevModelMat = meshComp->prevModelMat;
-			renderDataTmpl.modelMat = meshComp->modelMat;
-			const REArray<Mesh*>& meshList = meshComp->GetMeshList();
-			for (int mi = 0, nmi = (int)meshList.size(); mi < nmi; ++mi)
-			{
-				Mesh* mesh = meshList[mi];
-
-				REArray<MeshRenderData, 16>* listPtr = 0;
-				if (mesh->material->bAlphaBlend)
-					listPtr = &gAlphaBlendMeshRenderList;
-				else if(mesh->material->bMasked)
-					listPtr = &gMaskedMeshRenderList;
-				else
-					listPtr = &gOpaqueMeshRenderList;
+		gGLState.BindBufferRange(GL_UNIFORM_BUFFER, (GLuint)binding, gFrameRingBuffer.GetBuffer(), offset, size);
+		return;
+	}
 
-				renderDataTmpl.material = mesh->material;
-				renderDataTmpl.VAO = mesh->meshData->VAO;
-				renderDataTmpl.idxCount = mesh->meshData->idxCount;
+	glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	gGLState.BindBufferBase(GL_UNIFORM_BUFFER, (GLuint)binding, ubo);
+}
 
-				renderDataTmpl.distToCamera =
-					(renderDataTmpl.modelMat.TransformPoint(mesh->meshData->bounds.GetCenter()) - renderContext.viewPoint.position).Size3();
+// safe to call from jobs, meshList must stay unchanged until replay
+void RecordMeshList(CommandList& commandList, const REArray<MeshRenderData, 16>& meshList, Material* overrideMaterial = 0, const REArray<char*>* copyParamNames = 0)
+{
+	Uint64 recordStart = SDL_GetPerformanceCounter();
 
-				listPtr->push_back(renderDataTmpl);
+	// copied parameters are per draw, those go one by one
+	if (gRenderSettings.bMultiDraw && !copyParamNames)
+	{
+		MultiDrawList& multiDrawList = commandList.MultiDraw();
+		multiDrawList.SetInstancing(gRenderSettings.bInstancing);
+		for (int i = 0, ni = (int)meshList.size(); i < ni; ++i)
+			multiDrawList.Add(meshList[i], overrideMaterial);
+	}
+	else
+	{
+		for (int i = 0, ni = (int)meshList.size(); i < ni; ++i)
+		{
+			if (overrideMaterial && copyParamNames)
+			{
+				commandList.CopyParameter(overrideMaterial, meshList[i].material, *copyParamNames);
 			}
+			commandList.Draw(&meshList[i], overrideMaterial);
 		}
 	}
-	// sort
-	std::sort(gOpaqueMeshRenderList.begin(), gOpaqueMeshRenderList.end(), MeshRenderData::CompareOpaque);
-	std::sort(gMaskedMeshRenderList.begin(), gMaskedMeshRenderList.end(), MeshRenderData::CompareOpaque);
-	std::sort(gAlphaBlendMeshRenderList.begin(), gAlphaBlendMeshRenderList.end(), MeshRenderData::CompareAlphaBlend);
+	commandList.recordTime += (double)(SDL_GetPerformanceCounter() - recordStart) * gInvPerformanceFreq * 1000.0;
+}
 
+void ReplayPassCommandList(RenderContext& renderContext, EPassCommandList pass)
+{
+	CommandList& commandList = gPassCommandLists[(int)pass];
+	commandList.Replay(renderContext);
+	renderContext.stats.submitTime += commandList.replayTime;
 }
 
-void PreZPass(RenderContext& renderContext)
+// mesh culling and render list building work on slices of fixed size, each slice fills its own lists,
+// then lists are joined in slice order and radix sorted by key, so the result is the same for any job count
+struct MeshCullSlice
 {
-	GPU_SCOPED_PROFILE("pre Z");
+	REArray<MeshRenderData, 16> renderList[3]; // opaque, masked, alpha blend
+	REArray<MeshComponent*> occluders;
+	int testedCount;
+	int occludedCount;
+};
 
-	const static RenderState renderState([](RenderState& s) {
-		// only color write
-		s.bColorWrite = false;
-	});
+// 256 components per slice, must be a multiple of CullingBounds::blocksPerMaskWord
+const int gCullSliceBlockCount = 32;
 
-	renderState.Apply(renderContext);
+REArray<MeshCullSlice> gMeshCullSlices;
 
-	// clear frame buffer
-	glClearDepth(1);
-	glClearStencil(0);
-	glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-	
-	// draw mesh
-	DrawMeshList(renderContext, gOpaqueMeshRenderList, gPrepassMaterial);
+REArray<MeshRenderData, 16>* const gMeshRenderLists[3] = { &gOpaqueMeshRenderList, &gMaskedMeshRenderList, &gAlphaBlendMeshRenderList };
 
-	const REArray<char*> copyParamNames = {
-		"maskTex",
-		"tile"
-	};
+// (key, index) pairs and sorted copy of each render list
+REArray<SortKeyIndex> gMeshSortKeys[3];
+REArray<SortKeyIndex> gMeshSortKeyScratch[3];
+REArray<MeshRenderData, 16> gMeshRenderListScratch[3];
 
-	DrawMeshList(renderContext, gMaskedMeshRenderList, gPrepassMaskedMaterial, &copyParamNames);
-}
+// occluder candidates are used when bounds radius / distance to camera is above this
+const float gOccluderMinScreenRatio = 0.1f;
 
-void GeometryPass(RenderContext& renderContext)
+// temporal culling keeps last frame's visibility and render lists while the camera only moves
+// (no rotation or projection change) within guardBand of the view of the last full cull.
+// each moved frustum plane is then within guardBand of the reference plane, so objects visible with
+// reference planes pulled in by guardBand stay visible and objects culled with reference planes pushed out
+// by guardBand stay culled. only objects between the two, near a plane, and moved objects are tested again
+struct TemporalCullState
 {
-	GPU_SCOPED_PROFILE("geometry");
+	bool bValid = false;
+	int componentCount = 0;
+	bool bOcclusion = false;
+	bool bMeshLOD = false;
+	bool bGPUCulling = false;
+	float nearPlane = 0;
+	float farPlane = 0;
+
+	// view of last full cull
+	Plane refPlanes[6];
+	Vector4_3 refPosition;
+	// 0 if inner and outer masks are not built, then only an unchanged view is reused
+	float guardBand = 0;
+	Plane innerPlanes[6];
+	Plane outerPlanes[6];
+	REArray<unsigned __int32> innerMask;
+	REArray<unsigned __int32> outerMask;
+
+	// last frame
+	Plane lastPlanes[6];
+	Vector4_3 lastPosition;
+	REArray<unsigned __int32> visibleMask;
+	REArray<int> movedIndices;
+};
 
-	//const static RenderState renderState;
-	const static RenderState renderState([](RenderState& s) {
-		// no depth test, no depth write
-		s.depthTestFunc = GL_LEQUAL;
-	});
+TemporalCullState gMeshCullState;
 
-	renderState.Apply(renderContext);
+// how far the camera can move from the last full cull before everything is culled again
+const float gTemporalCullGuardBand = 1.f;
 
-	// clear frame buffer
-	glClearColor(0, 0, 0, 0);
-	//glClearDepth(1);
-	//glClearStencil(0);
-	//glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-	glClear(GL_COLOR_BUFFER_BIT);
-	
-	// draw mesh
-	DrawMeshList(renderContext, gOpaqueMeshRenderList);
-	DrawMeshList(renderContext, gMaskedMeshRenderList);
+// mesh LOD error allowed on screen, in pixels
+const float gLODMaxScreenError = 1.f;
+
+inline float GetLODMaxScreenError()
+{
+	return gRenderSettings.bMeshLOD ? gLODMaxScreenError : 0.f;
 }
 
-void ForwardPass(RenderContext& renderContext)
+// opaque meshes of GPUCulling::IsGPUDriven() are culled and drawn by gGPUCulling instead of render lists
+inline bool IsGPUCullingActive()
 {
-	GPU_SCOPED_PROFILE("forward");
+	return gRenderSettings.bGPUCulling && gPrepassMaterial->shader->multiDrawLocation >= 0;
+}
 
-	//const static RenderState renderState;
-	const static RenderState renderState([](RenderState& s) {
-		s.bDepthTest = true;
+// add render data of all meshes of meshComp to opaque, masked or alpha blend list
+void AddMeshRenderData(MeshComponent* meshComp, const Viewpoint& viewPoint, REArray<MeshRenderData, 16>* const* lists)
+{
+	MeshRenderData renderDataTmpl;
+	renderDataTmpl.prevModelMat = meshComp->prevModelMat;
+	renderDataTmpl.modelMat = meshComp->modelMat;
+	renderDataTmpl.componentIndex = meshComp->GetCullingIndex();
+	float maxScreenError = GetLODMaxScreenError();
+	bool bGPUCulling = IsGPUCullingActive();
+	const REArray<Mesh*>& meshList = meshComp->GetMeshList();
+	for (int mi = 0, nmi = (int)meshList.size(); mi < nmi; ++mi)
+	{
+		Mesh* mesh = meshList[mi];
+		if (bGPUCulling && GPUCulling::IsGPUDriven(mesh))
+			continue;
+
+		int listIdx = 0;
+		if (mesh->material->bAlphaBlend)
+			listIdx = 2;
+		else if (mesh->material->bMasked)
+			listIdx = 1;
+
+		renderDataTmpl.material = mesh->material;
+		renderDataTmpl.VAO = mesh->meshData->VAO;
+		renderDataTmpl.meshIndex = mi;
+		const MeshLOD& meshLOD = mesh->meshData->lods[meshComp->SelectLOD(mi, viewPoint.position, viewPoint.screenScale, maxScreenError)];
+		renderDataTmpl.idxOffset = mesh->meshData->firstIndex + meshLOD.idxOffset;
+		renderDataTmpl.idxCount = meshLOD.idxCount;
+		renderDataTmpl.baseVertex = mesh->meshData->baseVertex;
+
+		renderDataTmpl.center = renderDataTmpl.modelMat.TransformPoint(mesh->meshData->bounds.GetCenter());
+		renderDataTmpl.distToCamera = (renderDataTmpl.center - viewPoint.position).Size3();
+		// alpha blend back to front, others by state
+		renderDataTmpl.MakeSortKey(listIdx, listIdx == 2, viewPoint.farPlane);
+
+		lists[listIdx]->push_back(renderDataTmpl);
+	}
+}
+
+// sort (key, index) pairs of a render list, then move render data once.
+// bAdaptive tries insertion sort first, for lists mostly in order from last frame
+void SortMeshRenderList(int listIdx, bool bAdaptive)
+{
+	REArray<MeshRenderData, 16>& list = *gMeshRenderLists[listIdx];
+	int count = (int)list.size();
+	REArray<SortKeyIndex>& keys = gMeshSortKeys[listIdx];
+	keys.resize(count);
+	for (int i = 0; i < count; ++i)
+	{
+		keys[i].key = list[i].sortKey;
+		keys[i].index = i;
+	}
+
+	auto compareKey = [](const SortKeyIndex& a, const SortKeyIndex& b) { return a.key < b.key; };
+	if (!bAdaptive || !InsertionSort(keys.data(), count, count, compareKey))
+	{
+		gMeshSortKeyScratch[listIdx].resize(count);
+		RadixSort(keys.data(), gMeshSortKeyScratch[listIdx].data(), count);
+	}
+
+	bool bInOrder = true;
+	for (int i = 0; i < count && bInOrder; ++i)
+		bInOrder = (keys[i].index == (unsigned int)i);
+	if (bInOrder)
+		return;
+
+	REArray<MeshRenderData, 16>& sortedList = gMeshRenderListScratch[listIdx];
+	sortedList.resize(count);
+	for (int i = 0; i < count; ++i)
+		sortedList[i] = list[keys[i].index];
+	list.swap(sortedList);
+}
+
+// rasterize opaque meshes of the occluders found by first sliceCount slices into gOcclusionBuffer
+void RasterizeOccluders(RenderContext& renderContext, int sliceCount, int jobCount)
+{
+	CPU_SCOPED_PROFILE("occlusion raster");
+
+	gOcclusionBuffer.BeginFrame(renderContext.viewPoint.viewProjMat);
+	for (int s = 0; s < sliceCount; ++s)
+	{
+		const REArray<MeshComponent*>& occluders = gMeshCullSlices[s].occluders;
+		for (int i = 0, ni = (int)occluders.size(); i < ni; ++i)
+		{
+			MeshComponent* meshComp = occluders[i];
+			const REArray<Mesh*>& meshList = meshComp->GetMeshList();
+			for (int mi = 0, nmi = (int)meshList.size(); mi < nmi; ++mi)
+			{
+				Mesh* mesh = meshList[mi];
+				const MeshData* meshData = mesh->meshData;
+				if (mesh->material->bAlphaBlend || mesh->material->bMasked || meshData->vertices.size() == 0)
+					continue;
+				// LOD0, coarser LODs may cover more than the mesh
+				gOcclusionBuffer.AddOccluder(&meshData->vertices[0].position.x, sizeof(Vertex), (int)meshData->vertices.size(),
+					meshData->indices.data(), (int)meshData->lods[0].idxCount, meshComp->modelMat);
+			}
+		}
+	}
+	gOcclusionBuffer.Rasterize(jobCount);
+}
+
+// update last frame's render lists with temporal culling, returns false if a full cull is needed.
+// dirtyIndices are components moved this or last frame, the ones moved last frame get new prevModelMat
+bool CullMeshesTemporal(RenderContext& renderContext, const REArray<int>& dirtyIndices, int jobCount)
+{
+	TemporalCullState& state = gMeshCullState;
+	const Viewpoint& viewPoint = renderContext.viewPoint;
+	bool bOcclusion = gRenderSettings.bOcclusionCulling;
+	int count = gMeshCullingBounds.GetCount();
+
+	if (!state.bValid || state.componentCount != count || state.bOcclusion != bOcclusion ||
+		state.bMeshLOD != gRenderSettings.bMeshLOD || state.bGPUCulling != IsGPUCullingActive() || state.nearPlane != viewPoint.nearPlane || state.farPlane != viewPoint.farPlane)
+		return false;
+
+	// rotation or projection changed
+	for (int i = 0; i < 6; ++i)
+	{
+		if (!IsSameVector(state.refPlanes[i], viewPoint.frustumPlanes[i], 0x7))
+			return false;
+	}
+
+	float moveDist = (viewPoint.position - state.refPosition).Size3();
+	if (moveDist > state.guardBand)
+		return false;
+
+	// occlusion depends on view and all occluder transforms, only a static frame is reused
+	if (bOcclusion && (moveDist > 0 || dirtyIndices.size() > 0))
+		return false;
+
+	int wordCount = gMeshCullingBounds.GetMaskWordCount();
+	int blockCount = gMeshCullingBounds.GetBlockCount();
+	REArray<unsigned __int32>& visibleMask = state.visibleMask;
+
+	// moved objects, then objects with visibility changed
+	static REArray<unsigned __int32> changedMask;
+	changedMask.resize(wordCount);
+	std::fill(changedMask.begin(), changedMask.end(), 0);
+	for (int i = 0, ni = (int)dirtyIndices.size(); i < ni; ++i)
+		changedMask[dirtyIndices[i] >> 5] |= 1u << (dirtyIndices[i] & 31);
+
+	// mask words to test again, with moved objects or objects near planes
+	static REArray<int> retestWords;
+	retestWords.clear();
+	bool bNearPlanes = moveDist > 0;
+	int testedCount = 0;
+	for (int w = 0; w < wordCount; ++w)
+	{
+		if (changedMask[w] || (bNearPlanes && (state.outerMask[w] & ~state.innerMask[w])))
+		{
+			retestWords.push_back(w);
+			testedCount += Min(32, count - w * 32);
+		}
+	}
+	renderContext.stats.cullTestedCount += testedCount;
+	renderContext.stats.cullSkippedCount += count - testedCount;
+
+	const int wordsPerSlice = 64;
+	int retestWordCount = (int)retestWords.size();
+	ParallelForSlices((retestWordCount + wordsPerSlice - 1) / wordsPerSlice, jobCount, [&](int s)
+	{
+		for (int k = s * wordsPerSlice, nk = Min(k + wordsPerSlice, retestWordCount); k < nk; ++k)
+		{
+			int w = retestWords[k];
+			int startBlock = w * CullingBounds::blocksPerMaskWord;
+			int endBlock = Min(startBlock + CullingBounds::blocksPerMaskWord, blockCount);
+			unsigned __int32 lastVisible = visibleMask[w];
+			gMeshCullingBounds.CullFrustum(viewPoint.frustumPlanes, 6, startBlock, endBlock, visibleMask.data());
+			// moved objects need new guard band bits
+			if (changedMask[w] && state.guardBand > 0)
+			{
+				gMeshCullingBounds.CullFrustum(state.innerPlanes, 6, startBlock, endBlock, state.innerMask.data());
+				gMeshCullingBounds.CullFrustum(state.outerPlanes, 6, startBlock, endBlock, state.outerMask.data());
+			}
+			changedMask[w] |= lastVisible ^ visibleMask[w];
+		}
+	});
+
+	bool bChanged = false;
+	for (int k = 0; k < retestWordCount && !bChanged; ++k)
+		bChanged = changedMask[retestWords[k]] != 0;
+	bool bMoved = !IsSameVector(viewPoint.position, state.lastPosition, 0x7);
+	state.lastPosition = viewPoint.position;
+	if (!bChanged && !bMoved)
+	{
+		renderContext.stats.sortTime = 0;
+		return true;
+	}
+
+	Uint64 sortStart = SDL_GetPerformanceCounter();
+
+	// drop render data of changed objects, new depth and LOD for the rest if camera moved
+	float maxScreenError = GetLODMaxScreenError();
+	ParallelForSlices(3, Min(jobCount, 3), [&](int l)
+	{
+		REArray<MeshRenderData, 16>& list = *gMeshRenderLists[l];
+		int keepCount = 0;
+		for (int i = 0, ni = (int)list.size(); i < ni; ++i)
+		{
+			MeshRenderData& renderData = list[i];
+			int c = renderData.componentIndex;
+			if (changedMask[c >> 5] & (1u << (c & 31)))
+				continue;
+			if (bMoved)
+			{
+				renderData.distToCamera = (renderData.center - viewPoint.position).Size3();
+				renderData.MakeSortKey(l, l == 2, viewPoint.farPlane);
+
+				// each mesh is in one list, lists don't write the same LOD
+				MeshComponent* meshComp = MeshComponent::gMeshComponentContainer[c];
+				int lod = meshComp->SelectLOD(renderData.meshIndex, viewPoint.position, viewPoint.screenScale, maxScreenError);
+				const MeshData* meshData = meshComp->GetMeshList()[renderData.meshIndex]->meshData;
+				const MeshLOD& meshLOD = meshData->lods[lod];
+				renderData.idxOffset = meshData->firstIndex + meshLOD.idxOffset;
+				renderData.idxCount = meshLOD.idxCount;
+			}
+			if (keepCount != i)
+				list[keepCount] = renderData;
+			++keepCount;
+		}
+		list.resize(keepCount);
+	});
+
+	// add changed objects that are visible
+	for (int k = 0; k < retestWordCount; ++k)
+	{
+		int w = retestWords[k];
+		unsigned __int32 bits = changedMask[w] & visibleMask[w];
+		ForEachVisible(&bits, 1, [&](int i)
+		{
+			AddMeshRenderData(MeshComponent::gMeshComponentContainer[w * 32 + i], viewPoint, gMeshRenderLists);
+		});
+	}
+
+	// repair order
+	ParallelForSlices(3, Min(jobCount, 3), [&](int l)
+	{
+		SortMeshRenderList(l, true);
+	});
+	renderContext.stats.sortTime = (double)(SDL_GetPerformanceCounter() - sortStart) * gInvPerformanceFreq * 1000.0;
+
+	return true;
+}
+
+void CullMeshesFull(RenderContext& renderContext, int jobCount)
+{
+	REArray<MeshRenderData, 16>* const* renderLists = gMeshRenderLists;
+
+	// visibility, one bit per component
+	REArray<unsigned __int32>& visibleMask = gMeshCullState.visibleMask;
+	visibleMask.resize(gMeshCullingBounds.GetMaskWordCount());
+
+	int blockCount = gMeshCullingBounds.GetBlockCount();
+	int sliceCount = (blockCount + gCullSliceBlockCount - 1) / gCullSliceBlockCount;
+	if ((int)gMeshCullSlices.size() < sliceCount)
+		gMeshCullSlices.resize(sliceCount);
+
+	const Viewpoint& viewPoint = renderContext.viewPoint;
+
+	// BVH rejects whole subtrees by AABB, exact test only runs on mask words with candidates left
+	static REArray<unsigned __int32> candidateMask;
+	bool bUseBVH = !gMeshBVH.NeedBuild() && gMeshBVH.GetCount() == gMeshCullingBounds.GetCount();
+	if (bUseBVH)
+	{
+		candidateMask.resize(gMeshBVH.GetMaskWordCount());
+		gMeshBVH.QueryFrustum(viewPoint.frustumPlanes, 6, candidateMask.data());
+	}
+
+	bool bOcclusion = gRenderSettings.bOcclusionCulling;
+
+	// frustum culling and occluder candidates
+	ParallelForSlices(sliceCount, jobCount, [&](int s)
+	{
+		MeshCullSlice& slice = gMeshCullSlices[s];
+		slice.occluders.clear();
+
+		int startBlock = s * gCullSliceBlockCount;
+		int endBlock = Min(startBlock + gCullSliceBlockCount, blockCount);
+		int startWord = startBlock / CullingBounds::blocksPerMaskWord;
+		int endWord = (endBlock + CullingBounds::blocksPerMaskWord - 1) / CullingBounds::blocksPerMaskWord;
+
+		if (bUseBVH)
+		{
+			for (int w = startWord; w < endWord; ++w)
+			{
+				if (candidateMask[w] == 0)
+				{
+					visibleMask[w] = 0;
+					continue;
+				}
+				int wordStartBlock = w * CullingBounds::blocksPerMaskWord;
+				int wordEndBlock = Min(wordStartBlock + CullingBounds::blocksPerMaskWord, endBlock);
+				gMeshCullingBounds.CullFrustum(viewPoint.frustumPlanes, 6, wordStartBlock, wordEndBlock, visibleMask.data());
+			}
+		}
+		else
+		{
+			gMeshCullingBounds.CullFrustum(viewPoint.frustumPlanes, 6, startBlock, endBlock, visibleMask.data());
+		}
+
+		if (!bOcclusion)
+			return;
+
+		ForEachVisible(visibleMask.data() + startWord, endWord - startWord, [&](int i)
+		{
+			MeshComponent* meshComp = MeshComponent::gMeshComponentContainer[startWord * 32 + i];
+			if (!meshComp->bOccluder)
+				return;
+			float dist = (meshComp->OBB.center - viewPoint.position).Size3();
+			if (meshComp->OBB.extent.Size3() >= dist * gOccluderMinScreenRatio)
+				slice.occluders.push_back(meshComp);
+		});
+	});
+
+	if (bOcclusion)
+		RasterizeOccluders(renderContext, sliceCount, jobCount);
+
+	// occlusion test and render lists
+	ParallelForSlices(sliceCount, jobCount, [&](int s)
+	{
+		MeshCullSlice& slice = gMeshCullSlices[s];
+		REArray<MeshRenderData, 16>* sliceLists[3] = { &slice.renderList[0], &slice.renderList[1], &slice.renderList[2] };
+		for (int l = 0; l < 3; ++l)
+			slice.renderList[l].clear();
+		slice.testedCount = 0;
+		slice.occludedCount = 0;
+
+		int startBlock = s * gCullSliceBlockCount;
+		int endBlock = Min(startBlock + gCullSliceBlockCount, blockCount);
+		int startWord = startBlock / CullingBounds::blocksPerMaskWord;
+		int endWord = (endBlock + CullingBounds::blocksPerMaskWord - 1) / CullingBounds::blocksPerMaskWord;
+
+		ForEachVisible(visibleMask.data() + startWord, endWord - startWord, [&](int i)
+		{
+			MeshComponent* meshComp = MeshComponent::gMeshComponentContainer[startWord * 32 + i];
+			if (bOcclusion)
+			{
+				++slice.testedCount;
+				if (gOcclusionBuffer.IsOBBOccluded(meshComp->OBB))
+				{
+					++slice.occludedCount;
+					return;
+				}
+			}
+
+			// add mesh to render list
+			AddMeshRenderData(meshComp, viewPoint, sliceLists);
+		});
+	});
+
+	if (bOcclusion)
+	{
+		for (int s = 0; s < sliceCount; ++s)
+		{
+			gOcclusionBuffer.stats.testedCount += gMeshCullSlices[s].testedCount;
+			gOcclusionBuffer.stats.occludedCount += gMeshCullSlices[s].occludedCount;
+		}
+	}
+	else
+	{
+		memset(&gOcclusionBuffer.stats, 0, sizeof(gOcclusionBuffer.stats));
+	}
+
+	// join slice lists in slice order
+	static REArray<int> runStarts[3];
+	for (int l = 0; l < 3; ++l)
+	{
+		runStarts[l].resize(sliceCount + 1);
+		int size = 0;
+		for (int s = 0; s < sliceCount; ++s)
+		{
+			runStarts[l][s] = size;
+			size += (int)gMeshCullSlices[s].renderList[l].size();
+		}
+		runStarts[l][sliceCount] = size;
+		renderLists[l]->resize(size);
+	}
+
+	ParallelForSlices(sliceCount, jobCount, [&](int s)
+	{
+		for (int l = 0; l < 3; ++l)
+		{
+			const REArray<MeshRenderData, 16>& sliceList = gMeshCullSlices[s].renderList[l];
+			std::copy(sliceList.begin(), sliceList.end(), renderLists[l]->begin() + runStarts[l][s]);
+		}
+	});
+
+	// sort
+	Uint64 sortStart = SDL_GetPerformanceCounter();
+	ParallelForSlices(3, Min(jobCount, 3), [&](int l)
+	{
+		SortMeshRenderList(l, false);
+	});
+	renderContext.stats.sortTime = (double)(SDL_GetPerformanceCounter() - sortStart) * gInvPerformanceFreq * 1000.0;
+
+	int count = gMeshCullingBounds.GetCount();
+	renderContext.stats.cullTestedCount += count;
+
+	// temporal culling reference
+	TemporalCullState& state = gMeshCullState;
+	bool bSameNormals = state.bValid;
+	for (int i = 0; i < 6 && bSameNormals; ++i)
+		bSameNormals = IsSameVector(state.lastPlanes[i], viewPoint.frustumPlanes[i], 0x7);
+
+	state.bValid = gRenderSettings.bTemporalCulling;
+	state.componentCount = count;
+	state.bOcclusion = bOcclusion;
+	state.bMeshLOD = gRenderSettings.bMeshLOD;
+	state.bGPUCulling = IsGPUCullingActive();
+	state.nearPlane = viewPoint.nearPlane;
+	state.farPlane = viewPoint.farPlane;
+	state.refPosition = viewPoint.position;
+	state.lastPosition = viewPoint.position;
+	for (int i = 0; i < 6; ++i)
+		state.refPlanes[i] = viewPoint.frustumPlanes[i];
+
+	// guard band masks are only built while the camera is not rotating, a rotating camera can't reuse them.
+	// with occlusion only an unchanged view is reused
+	state.guardBand = (state.bValid && bSameNormals && !bOcclusion) ? gTemporalCullGuardBand : 0;
+	if (state.guardBand > 0)
+	{
+		for (int i = 0; i < 6; ++i)
+		{
+			state.innerPlanes[i] = state.refPlanes[i];
+			state.innerPlanes[i].w -= state.guardBand;
+			state.outerPlanes[i] = state.refPlanes[i];
+			state.outerPlanes[i].w += state.guardBand;
+		}
+		state.innerMask.resize(visibleMask.size());
+		state.outerMask.resize(visibleMask.size());
+		ParallelForSlices(sliceCount, jobCount, [&](int s)
+		{
+			int startBlock = s * gCullSliceBlockCount;
+			int endBlock = Min(startBlock + gCullSliceBlockCount, blockCount);
+			gMeshCullingBounds.CullFrustum(state.innerPlanes, 6, startBlock, endBlock, state.innerMask.data());
+			gMeshCullingBounds.CullFrustum(state.outerPlanes, 6, startBlock, endBlock, state.outerMask.data());
+		});
+	}
+}
+
+void CullMeshes(RenderContext& renderContext, int jobCount)
+{
+	CPU_SCOPED_PROFILE("cull meshes");
+
+	// components moved this and last frame
+	TemporalCullState& state = gMeshCullState;
+	static REArray<int> dirtyIndices;
+	dirtyIndices = state.movedIndices;
+	state.movedIndices.clear();
+	for (int k = 0, nk = gTransformSystem.GetLastUpdateCount(); k < nk; ++k)
+	{
+		MeshComponent* meshComp = gTransformSystem.GetLastUpdatedOwner(k);
+		if (meshComp && meshComp->GetCullingIndex() >= 0)
+		{
+			state.movedIndices.push_back(meshComp->GetCullingIndex());
+			dirtyIndices.push_back(meshComp->GetCullingIndex());
+		}
+	}
+
+	if (!gRenderSettings.bTemporalCulling || !CullMeshesTemporal(renderContext, dirtyIndices, jobCount))
+		CullMeshesFull(renderContext, jobCount);
+
+	for (int i = 0; i < 6; ++i)
+		state.lastPlanes[i] = renderContext.viewPoint.frustumPlanes[i];
+}
+
+#if CULLING_BENCHMARK
+// time culling and render list building with 1 to N jobs, results must match the single job one
+void BenchmarkCullMeshes(RenderContext& renderContext)
+{
+	REArray<MeshRenderData, 16>* renderLists[3] = { &gOpaqueMeshRenderList, &gMaskedMeshRenderList, &gAlphaBlendMeshRenderList };
+	REArray<MeshRenderData, 16> referenceLists[3];
+
+	// every loop runs a full cull
+	bool bTemporalCulling = gRenderSettings.bTemporalCulling;
+	gRenderSettings.bTemporalCulling = false;
+
+	const int loopCount = 20;
+	double singleJobTime = 0;
+	printf("BenchmarkCullMeshes: %d components\n", (int)MeshComponent::gMeshComponentContainer.size());
+	for (int jobCount = 1; jobCount <= gCullJobCount; ++jobCount)
+	{
+		double bestTime = DBL_MAX;
+		for (int loop = 0; loop < loopCount; ++loop)
+		{
+			Uint64 start = SDL_GetPerformanceCounter();
+			CullMeshes(renderContext, jobCount);
+			double time = (double)(SDL_GetPerformanceCounter() - start) * gInvPerformanceFreq * 1000.0;
+			if (time < bestTime)
+				bestTime = time;
+		}
+
+		bool bMatch = true;
+		for (int l = 0; l < 3; ++l)
+		{
+			if (jobCount == 1)
+			{
+				referenceLists[l] = *renderLists[l];
+				continue;
+			}
+			const REArray<MeshRenderData, 16>& list = *renderLists[l];
+			const REArray<MeshRenderData, 16>& reference = referenceLists[l];
+			bMatch &= (list.size() == reference.size());
+			for (int i = 0, ni = Min((int)list.size(), (int)reference.size()); i < ni && bMatch; ++i)
+			{
+				bMatch &= list[i].material == reference[i].material && list[i].VAO == reference[i].VAO &&
+					list[i].distToCamera == reference[i].distToCamera && list[i].sortKey == reference[i].sortKey;
+			}
+		}
+
+		if (jobCount == 1)
+			singleJobTime = bestTime;
+		printf("  %d jobs: %.3f ms, speedup %.2fx, sort %.3f ms, %d draws%s\n", jobCount, bestTime, singleJobTime / bestTime,
+			renderContext.stats.sortTime,
+			(int)(gOpaqueMeshRenderList.size() + gMaskedMeshRenderList.size() + gAlphaBlendMeshRenderList.size()),
+			bMatch ? "" : ", MISMATCH");
+	}
+
+	gRenderSettings.bTemporalCulling = bTemporalCulling;
+}
+#endif
+
+// record all mesh pass lists in parallel, one job per list
+void RecordPassCommandLists(RenderContext& renderContext, int jobCount)
+{
+	CPU_SCOPED_PROFILE("record passes");
+
+	const static REArray<char*> maskedCopyParamNames = {
+		"maskTex",
+		"tile"
+	};
+
+	Uint64 recordStart = SDL_GetPerformanceCounter();
+	const int listCount = (int)EPassCommandList::Count;
+	ParallelForSlices(listCount, Min(jobCount, listCount), [&](int l)
+	{
+		CPU_SCOPED_PROFILE("record pass list");
+		CommandList& commandList = gPassCommandLists[l];
+		commandList.Reset();
+		commandList.recordTime = 0;
+		switch ((EPassCommandList)l)
+		{
+		case EPassCommandList::PrepassOpaque:
+			RecordMeshList(commandList, gOpaqueMeshRenderList, gPrepassMaterial);
+			break;
+		case EPassCommandList::PrepassMasked:
+			RecordMeshList(commandList, gMaskedMeshRenderList, gPrepassMaskedMaterial, &maskedCopyParamNames);
+			break;
+		case EPassCommandList::Opaque:
+			RecordMeshList(commandList, gOpaqueMeshRenderList);
+			break;
+		case EPassCommandList::Masked:
+			RecordMeshList(commandList, gMaskedMeshRenderList);
+			break;
+		case EPassCommandList::AlphaBlend:
+			RecordMeshList(commandList, gAlphaBlendMeshRenderList);
+			break;
+		}
+	});
+	renderContext.stats.recordTime += (double)(SDL_GetPerformanceCounter() - recordStart) * gInvPerformanceFreq * 1000.0;
+}
+
+// cull opaque meshes on GPU, before pre Z clears last frame's depth for occlusion
+void GPUCullPass(RenderContext& renderContext)
+{
+	GPU_SCOPED_PROFILE("GPU culling");
+	GL_STATE_SCOPED_PASS("GPU culling");
+
+	gGPUCulling.Update();
+
+	// after a reset depth is not from last frame's view
+	bool bOcclusion = gRenderSettings.bGPUOcclusion && !gHasResetFrame;
+	if (bOcclusion)
+	{
+		gDepthStencilTex.Bind(Shader::gDepthStencilTexUnit);
+		gGPUCulling.BuildHiZ(renderContext, gHiZReduceCompMaterial, gWindowWidth, gWindowHeight);
+	}
+
+	float maxScreenError = GetLODMaxScreenError();
+	float lodScale = maxScreenError > 0.f ? renderContext.viewPoint.screenScale / maxScreenError : 0.f;
+	gGPUCulling.Cull(renderContext, gGPUCullingCompMaterial, lodScale, bOcclusion);
+}
+
+void PreZPass(RenderContext& renderContext)
+{
+	GPU_SCOPED_PROFILE("pre Z");
+	GL_STATE_SCOPED_PASS("pre Z");
+
+	const static RenderState renderState([](RenderState& s) {
+		// only color write
+		s.bColorWrite = false;
+	});
+
+	renderState.Apply(renderContext);
+
+	// clear frame buffer
+	glClearDepth(1);
+	glClearStencil(0);
+	glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	
+	// draw mesh
+	ReplayPassCommandList(renderContext, EPassCommandList::PrepassOpaque);
+	if (IsGPUCullingActive())
+		gGPUCulling.Draw(renderContext, gPrepassMaterial);
+	ReplayPassCommandList(renderContext, EPassCommandList::PrepassMasked);
+}
+
+void GeometryPass(RenderContext& renderContext)
+{
+	GPU_SCOPED_PROFILE("geometry");
+	GL_STATE_SCOPED_PASS("geometry");
+
+	//const static RenderState renderState;
+	const static RenderState renderState([](RenderState& s) {
+		// no depth test, no depth write
+		s.depthTestFunc = GL_LEQUAL;
+	});
+
+	renderState.Apply(renderContext);
+
+	// clear frame buffer
+	glClearColor(0, 0, 0, 0);
+	//glClearDepth(1);
+	//glClearStencil(0);
+	//glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	glClear(GL_COLOR_BUFFER_BIT);
+	
+	// draw mesh
+	ReplayPassCommandList(renderContext, EPassCommandList::Opaque);
+	if (IsGPUCullingActive())
+		gGPUCulling.Draw(renderContext);
+	ReplayPassCommandList(renderContext, EPassCommandList::Masked);
+}
+
+void ForwardPass(RenderContext& renderContext)
+{
+	GPU_SCOPED_PROFILE("forward");
+	GL_STATE_SCOPED_PASS("forward");
+
+	//const static RenderState renderState;
+	const static RenderState renderState([](RenderState& s) {
+		s.bDepthTest = true;
 		s.depthTestFunc = GL_LEQUAL;
 		s.bDepthWrite = false;
 	});
@@ -1656,13 +2874,16 @@ void ForwardPass(RenderContext& renderContext)
 	glClear(GL_COLOR_BUFFER_BIT);
 
 	// draw mesh
-	DrawMeshList(renderContext, gOpaqueMeshRenderList);
-	DrawMeshList(renderContext, gMaskedMeshRenderList);
+	ReplayPassCommandList(renderContext, EPassCommandList::Opaque);
+	if (IsGPUCullingActive())
+		gGPUCulling.Draw(renderContext);
+	ReplayPassCommandList(renderContext, EPassCommandList::Masked);
 }
 
 void SSAOPass(RenderContext& renderContext)
 {
 	GPU_SCOPED_PROFILE("SSAO");
+	GL_STATE_SCOPED_PASS("SSAO");
 
 	const static RenderState renderState([](RenderState& s) {
 		// no depth test, no depth write
@@ -1873,8 +3094,8 @@ void LightVolumePass(RenderContext& renderContext)
 			}
 
 			// set mask
-			glStencilFunc(prepassRenderState.stencilTestFunc, mask, mask);
-			glStencilMask(mask);
+			gGLState.StencilFunc(prepassRenderState.stencilTestFunc, mask, mask);
+			gGLState.StencilMask(mask);
 
 			gPrepassMaterial->SetParameter("modelMat", light.modelMat);
 			light.LightMesh->Draw(renderContext, gPrepassMaterial);
@@ -1894,7 +3115,7 @@ void LightVolumePass(RenderContext& renderContext)
 				continue;
 
 			// set mask
-			glStencilFunc(lightingRenderState.stencilTestFunc, mask, mask);
+			gGLState.StencilFunc(lightingRenderState.stencilTestFunc, mask, mask);
 
 			Material* lightVolumeMaterial = SetupLightVolumeMaterial(renderContext, lightData, lightIdx);
 			lightData.light->LightMesh->Draw(renderContext, lightVolumeMaterial);
@@ -1924,95 +3145,703 @@ void LightVolumePass(RenderContext& renderContext)
 void LightPass(RenderContext& renderContext)
 {
 	GPU_SCOPED_PROFILE("light");
+	GL_STATE_SCOPED_PASS("light");
 
 	// must have directional light pass, it put down base color (also clears color if no skybox)
 	DirectionalLightPass(renderContext);
 
-	// enable blend for light additive
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_ONE, GL_ONE);
+	// enable blend for light additive
+	gGLState.Enable(GL_BLEND);
+	gGLState.BlendFunc(GL_ONE, GL_ONE);
+
+	LightVolumePass(renderContext);
+
+	// disable blend
+	gGLState.Disable(GL_BLEND);
+}
+
+void TileInfoPass(RenderContext& renderContext)
+{
+	GPU_SCOPED_PROFILE("light");
+	GL_STATE_SCOPED_PASS("light");
+	GPU_SCOPED_PROFILE_SUB("tile based culling", tileBasedCulling);
+
+	if (!gRenderSettings.bTileCullingCombined)
+	{
+		gLightTileReductionCompMaterial->DispatchCompute(renderContext, gRenderInfo.TileCountX, gRenderInfo.TileCountY);
+
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		// 32 for NVidia, 64 for AMD
+		const unsigned int threadPerGroup = 128;
+		unsigned int cullingGroupCount = (gRenderInfo.TileCountX * gRenderInfo.TileCountY + threadPerGroup - 1) / threadPerGroup;
+		// for culling, 1 thread per tile, use max thread per warp/wavefront in a group
+		gLightTileCullingCompMaterial->DispatchCompute(renderContext, cullingGroupCount);
+
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+	else
+	{
+		gLightTileReductionAndCullingCompMaterial->DispatchCompute(renderContext, gRenderInfo.TileCountX, gRenderInfo.TileCountY);
+
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+}
+
+void TileBasedDeferredLightPass(RenderContext& renderContext)
+{
+	GPU_SCOPED_PROFILE("light");
+	GL_STATE_SCOPED_PASS("light");
+	GPU_SCOPED_PROFILE_SUB("tile based render", tileBasedRender);
+	
+	if (!gRenderSettings.bTileOnePass || gRenderSettings.bCPULightClusters)
+	{
+		// now render light
+		const static RenderState renderState([](RenderState& s) {
+			// depth test to skip sky box (depth == 1)
+			s.bDepthTest = true;
+			s.depthTestFunc = GL_GREATER;
+			s.bDepthWrite = false;
+		});
+
+		// directional light
+		renderState.Apply(renderContext);
+
+		if (!gRenderSettings.bSkybox)
+		{
+			glClearColor(0, 0, 0, 0);
+			glClear(GL_COLOR_BUFFER_BIT);
+		}
+
+		// draw quad
+		gFSQuadMesh->Draw(renderContext, gRenderSettings.bCPULightClusters ? gClusteredDeferredLightMaterial : gTiledDeferredLightMaterial);
+	}
+	else
+	{
+		Texture2D& curSceneColorTex = gSceneColorTex[gSceneColorWriteIdx];
+		curSceneColorTex.access = GL_WRITE_ONLY;
+#if 0
+		gTileBasedDeferredLightCompMaterial->SetParameter("outColor", &curSceneColorTex, true);
+		gTileBasedDeferredLightCompMaterial->DispatchCompute(renderContext, gRenderInfo.TileCountX, gRenderInfo.TileCountY);
+
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+#else
+		gLightTileOnePassCompMaterial->SetParameter("outColor", &curSceneColorTex, true);
+		gLightTileOnePassCompMaterial->DispatchCompute(renderContext, gRenderInfo.TileCountX, gRenderInfo.TileCountY);
+
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+#endif
+
+	}
+}
+
+// a shadow map render of one cascade, spot light or point light
+enum class EShadowViewType
+{
+	Cascade,
+	Spot,
+	Point,
+};
+
+struct ShadowView
+{
+	EShadowViewType type;
+	// directional light index for cascade, visible light index for spot and point
+	int lightIndex;
+	// used to skip candidates before exact test
+	BoxBounds worldBounds;
+	// cascade only, light space bounds of cascade and of its casters
+	BoxBounds frustumBounds;
+	BoxBounds sceneBounds;
+	// spot only
+	Plane frustumPlanes[6];
+	// casters are gShadowCasterList[casterStart, casterStart + casterCount)
+	int casterStart;
+	int casterCount;
+	// spot and point only, static casters are cached, and the cache can be reused this frame
+	bool bCached;
+	bool bCacheValid;
+	// spot and point only, distant light under the update budget, and its shadow map is drawn this frame
+	bool bBudgeted;
+	bool bUpdate;
+};
+
+// shadow views of the frame in render order, culled together in CullShadowCasters()
+REArray<ShadowView, 16> gShadowViews;
+// BVH candidates of all shadow views
+REArray<int> gShadowCasterCandidates;
+// view bits of each candidate, gShadowViewMaskWordCount words per candidate
+REArray<unsigned __int32> gShadowCasterMask;
+int gShadowViewMaskWordCount = 0;
+// casters of all shadow views, grouped by view
+REArray<MeshComponent*> gShadowCasterList;
+
+// candidates per slice of shadow caster culling
+const int gShadowCullSliceSize = 256;
+
+const float gCascadeRatio[RenderConsts::MAX_CSM_COUNT] = {
+	0.12f, 0.36f, 1.f
+};
+
+// spot and point light shadow near plane
+const float gLocalLightShadowNearPlane = 0.01f;
+
+// local light shadow caching.
+// static casters of a light are drawn once into the same region of a static shadow map,
+// each frame the region is copied to the shadow map and only dynamic casters are drawn on top.
+// a caster is dynamic from the frame it moves until it stays still for gShadowCacheSettleFrames frames,
+// each change between static and dynamic rebuilds the caches of lights it overlaps.
+// cached shadows are rendered without jitter, lights with bDynamic set are never cached
+//
+// local light shadow update budget.
+// tiles of distant lights (tile size up to gShadowBudgetMaxTileSize) keep their content between draws,
+// gShadowUpdateBudget of them are drawn per frame, least recently drawn first,
+// and none goes without a draw for more than gShadowMaxUpdateInterval frames.
+// a light is always drawn when its tile changed or it had no shadow view last frame.
+// budgeted shadows are rendered without jitter
+struct LocalShadowState
+{
+	// static shadow map region is valid
+	bool bCacheValid = false;
+	// last frame the light had a shadow view, a light missing a frame misses invalidations
+	// and its tile may have been used by another light
+	int lastFrame = -1;
+	// last frame the shadow map was drawn, and what it was drawn with
+	int lastUpdateFrame = -1;
+	Matrix4 lightViewMat;
+	float radius = 0;
+	float outerHalfAngle = 0;
+	int shadowMapIndex = -1;
+	bool bSpot = false;
+	bool bUseTetrahedronShadowMap = false;
+	// world to shadow map for spot light, world to light view for tetrahedron
+	Matrix4 shadowViewMat;
+};
+
+// by GetLocalLightId()
+REArray<LocalShadowState, 16> gLocalShadowStates;
+
+const int gShadowUpdateBudget = 4;
+const float gShadowBudgetMaxTileSize = 256.f;
+const int gShadowMaxUpdateInterval = 8;
+
+// by mesh component culling index
+REArray<int> gMeshLastMovedFrame;
+REArray<unsigned char> gMeshDynamicFlags;
+// components now dynamic, and components changed between static and dynamic this frame
+REArray<int> gDynamicMeshIndices;
+REArray<int> gMobilityChangedMeshIndices;
+
+const int gShadowCacheSettleFrames = 8;
+
+// track which mesh components are dynamic shadow casters from this frame's transform updates
+void UpdateMeshMobility(int frame)
+{
+	gMobilityChangedMeshIndices.clear();
+
+	// new components start dynamic
+	for (int c = (int)gMeshDynamicFlags.size(), nc = (int)MeshComponent::gMeshComponentContainer.size(); c < nc; ++c)
+	{
+		gMeshLastMovedFrame.push_back(frame);
+		gMeshDynamicFlags.push_back(1);
+		gDynamicMeshIndices.push_back(c);
+	}
+
+	for (int k = 0, nk = gTransformSystem.GetLastUpdateCount(); k < nk; ++k)
+	{
+		MeshComponent* meshComp = gTransformSystem.GetLastUpdatedOwner(k);
+		if (!meshComp || meshComp->GetCullingIndex() < 0)
+			continue;
+		int c = meshComp->GetCullingIndex();
+		gMeshLastMovedFrame[c] = frame;
+		if (!gMeshDynamicFlags[c])
+		{
+			gMeshDynamicFlags[c] = 1;
+			gDynamicMeshIndices.push_back(c);
+			gMobilityChangedMeshIndices.push_back(c);
+		}
+	}
+
+	// settled components become static
+	for (int i = 0; i < (int)gDynamicMeshIndices.size();)
+	{
+		int c = gDynamicMeshIndices[i];
+		if (frame - gMeshLastMovedFrame[c] > gShadowCacheSettleFrames)
+		{
+			gMeshDynamicFlags[c] = 0;
+			gMobilityChangedMeshIndices.push_back(c);
+			gDynamicMeshIndices[i] = gDynamicMeshIndices.back();
+			gDynamicMeshIndices.pop_back();
+		}
+		else
+		{
+			++i;
+		}
+	}
+}
+
+// decide which local light shadow views are cached, if their cache is still valid,
+// and which ones are drawn this frame
+void UpdateLocalLightShadows(RenderContext& renderContext, int frame)
+{
+	gLocalShadowStates.resize(gPointLights.size() + gSpotLights.size());
+
+	bool bUseCache = gRenderSettings.bShadowCache;
+	bool bUseBudget = gRenderSettings.bShadowUpdateBudget;
+	// views that can keep last drawn content
+	static REArray<int> budgetViews;
+	budgetViews.clear();
+	for (int v = 0, nv = (int)gShadowViews.size(); v < nv; ++v)
+	{
+		ShadowView& view = gShadowViews[v];
+		if (view.type == EShadowViewType::Cascade)
+			continue;
+
+		const LightRenderData& lightData = gVisibleLightList[view.lightIndex];
+		const Light& light = *lightData.light;
+		LocalShadowState& state = gLocalShadowStates[GetLocalLightId(lightData)];
+
+		// shadow map region still has what this light drew last time
+		bool bSameRegion = state.lastFrame == frame - 1 &&
+			state.shadowMapIndex == lightData.shadowMapIndex &&
+			state.bSpot == lightData.bSpot &&
+			state.bUseTetrahedronShadowMap == lightData.bUseTetrahedronShadowMap;
+		state.lastFrame = frame;
+
+		view.bCached = bUseCache && !light.bDynamic;
+		if (!view.bCached || !bSameRegion ||
+			state.radius != light.radius ||
+			state.outerHalfAngle != light.outerHalfAngle ||
+			memcmp(&state.lightViewMat, &light.lightViewMat, sizeof(Matrix4)) != 0)
+			state.bCacheValid = false;
+		view.bCacheValid = state.bCacheValid;
+
+		view.bBudgeted = bUseBudget && (lightData.bSpot || lightData.bUseTetrahedronShadowMap) &&
+			lightData.shadowMapSize <= gShadowBudgetMaxTileSize;
+		view.bUpdate = true;
+		if (view.bBudgeted && bSameRegion && state.lastUpdateFrame >= 0)
+			budgetViews.push_back(v);
+	}
+
+	// casters changed between static and dynamic, test bounds before and after moving,
+	// a caster leaving a light is still in its static shadow map
+	for (int i = 0, ni = (int)gMobilityChangedMeshIndices.size(); i < ni; ++i)
+	{
+		MeshComponent* meshComp = MeshComponent::gMeshComponentContainer[gMobilityChangedMeshIndices[i]];
+		BoxBounds worldBounds = meshComp->OBB.GetAABB();
+		worldBounds += meshComp->bounds.GetTransformedBounds(meshComp->prevModelMat);
+		for (int v = 0, nv = (int)gShadowViews.size(); v < nv; ++v)
+		{
+			ShadowView& view = gShadowViews[v];
+			if (view.bCacheValid &&
+				IsAABBIntersectAABB(view.worldBounds.min, view.worldBounds.max, worldBounds.min, worldBounds.max))
+			{
+				view.bCacheValid = false;
+				gLocalShadowStates[GetLocalLightId(gVisibleLightList[view.lightIndex])].bCacheValid = false;
+			}
+		}
+	}
+
+	// update budget, least recently drawn first, view order breaks ties
+	std::sort(budgetViews.begin(), budgetViews.end(), [](int a, int b)
+	{
+		int frameA = gLocalShadowStates[GetLocalLightId(gVisibleLightList[gShadowViews[a].lightIndex])].lastUpdateFrame;
+		int frameB = gLocalShadowStates[GetLocalLightId(gVisibleLightList[gShadowViews[b].lightIndex])].lastUpdateFrame;
+		return frameA < frameB || (frameA == frameB && a < b);
+	});
+	for (int i = 0, ni = (int)budgetViews.size(); i < ni; ++i)
+	{
+		ShadowView& view = gShadowViews[budgetViews[i]];
+		const LocalShadowState& state = gLocalShadowStates[GetLocalLightId(gVisibleLightList[view.lightIndex])];
+		view.bUpdate = i < gShadowUpdateBudget || frame - state.lastUpdateFrame >= gShadowMaxUpdateInterval;
+	}
+
+	// views drawn this frame, static cache is valid after the draw
+	for (int v = 0, nv = (int)gShadowViews.size(); v < nv; ++v)
+	{
+		ShadowView& view = gShadowViews[v];
+		if (view.type == EShadowViewType::Cascade)
+			continue;
+
+		if (!view.bUpdate)
+		{
+			++renderContext.stats.shadowSkipCount;
+			continue;
+		}
+		++renderContext.stats.shadowUpdateCount;
+
+		const LightRenderData& lightData = gVisibleLightList[view.lightIndex];
+		const Light& light = *lightData.light;
+		LocalShadowState& state = gLocalShadowStates[GetLocalLightId(lightData)];
+		state.bCacheValid = view.bCached;
+		state.lastUpdateFrame = frame;
+		state.lightViewMat = light.lightViewMat;
+		state.radius = light.radius;
+		state.outerHalfAngle = light.outerHalfAngle;
+		state.shadowMapIndex = lightData.shadowMapIndex;
+		state.bSpot = lightData.bSpot;
+		state.bUseTetrahedronShadowMap = lightData.bUseTetrahedronShadowMap;
+	}
+}
+
+// collect shadow views in the order ShadowPass renders them
+void SetupShadowViews(RenderContext& renderContext)
+{
+	Viewpoint& viewPoint = renderContext.viewPoint;
+
+	gShadowViews.clear();
+
+	ShadowView view;
+	view.casterStart = 0;
+	view.casterCount = 0;
+	view.bCached = false;
+	view.bCacheValid = false;
+	view.bBudgeted = false;
+	view.bUpdate = true;
+
+	// cascades
+	if (gRenderSettings.bDrawShadow && gRenderSettings.bDrawShadowCSM)
+	{
+		Vector4_3 clipPoints[4];
+		view.type = EShadowViewType::Cascade;
+		for (int lightIdx = 0, nlightIdx = (int)gDirectionalLights.size(); lightIdx < nlightIdx; ++lightIdx)
+		{
+			Light& light = gDirectionalLights[lightIdx];
+			if (!light.bCastShadow)
+				continue;
+
+			view.lightIndex = lightIdx;
+			for (int cascadeIdx = 0; cascadeIdx < RenderConsts::MAX_CSM_COUNT; ++cascadeIdx)
+			{
+				// near and far plane for this cascade
+				float n = (cascadeIdx == 0) ? viewPoint.nearPlane : viewPoint.farPlane * gCascadeRatio[cascadeIdx - 1];
+				float f = viewPoint.farPlane * gCascadeRatio[cascadeIdx];
+
+				// process frustum bounds
+				BoxBounds frustumBounds;
+				viewPoint.GetClipPoints(-n, clipPoints);
+				for (int i = 0; i < 4; ++i)
+					frustumBounds += light.lightViewMat.TransformPoint(clipPoints[i]);
+				viewPoint.GetClipPoints(-f, clipPoints);
+				for (int i = 0; i < 4; ++i)
+					frustumBounds += light.lightViewMat.TransformPoint(clipPoints[i]);
+
+				// extent test bound max(near plane) a little bit to include geometry behind us
+				// this value need to be increased if we are missing shadow
+				const float stepBack = 50.f;
+				frustumBounds.max.z += stepBack;
+
+				view.frustumBounds = frustumBounds;
+				view.worldBounds = frustumBounds.GetTransformedBounds(light.lightInvViewMat);
+				gShadowViews.push_back(view);
+			}
+		}
+	}
+
+	// local lights
+	bool bDrawShadowPoint = gRenderSettings.bDrawShadow && gRenderSettings.bDrawShadowPoint;
+	bool bDrawShadowSpot = gRenderSettings.bDrawShadow && gRenderSettings.bDrawShadowSpot;
+	for (int lightIdx = 0, nlightIdx = (int)gVisibleLightList.size(); lightIdx < nlightIdx; ++lightIdx)
+	{
+		LightRenderData& lightData = gVisibleLightList[lightIdx];
+		Light& light = *lightData.light;
+		if (!lightData.bActualCastShadow)
+			continue;
+
+		view.lightIndex = lightIdx;
+		if (lightData.bSpot && bDrawShadowSpot)
+		{
+			// jitter doesn't change frustum planes
+			Matrix4 lightProjMat = MakeMatrixPerspectiveProj(
+				DegToRad(light.outerHalfAngle) * 2,
+				lightData.shadowMapSize, lightData.shadowMapSize,
+				gLocalLightShadowNearPlane, light.radius);
+			GetFrustumPlanes(light.lightViewMat, lightProjMat.m[0][0], lightProjMat.m[1][1],
+				gLocalLightShadowNearPlane, light.radius, view.frustumPlanes);
+
+			view.type = EShadowViewType::Spot;
+			view.worldBounds.SetCenterAndExtent(light.sphereBounds.centerRadius, Vector4_3(light.sphereBounds.centerRadius.w));
+			gShadowViews.push_back(view);
+		}
+		else if (!lightData.bSpot && bDrawShadowPoint)
+		{
+			view.type = EShadowViewType::Point;
+			view.worldBounds.SetCenterAndExtent(light.position, Vector4_3(light.radius));
+			gShadowViews.push_back(view);
+		}
+	}
+}
+
+// by VAO and index range of first mesh at its LOD, same order on every run
+bool CompareCasterMesh(MeshComponent* a, MeshComponent* b)
+{
+	const REArray<Mesh*>& meshListA = a->GetMeshList();
+	const REArray<Mesh*>& meshListB = b->GetMeshList();
+	const MeshData* meshDataA = meshListA.size() > 0 ? meshListA[0]->meshData : 0;
+	const MeshData* meshDataB = meshListB.size() > 0 ? meshListB[0]->meshData : 0;
+	GLuint VAOA = meshDataA ? meshDataA->VAO : 0;
+	GLuint VAOB = meshDataB ? meshDataB->VAO : 0;
+	if (VAOA != VAOB)
+		return VAOA < VAOB;
+	GLsizei idxOffsetA = meshDataA ? meshDataA->firstIndex + meshDataA->lods[a->GetMeshLOD(0)].idxOffset : 0;
+	GLsizei idxOffsetB = meshDataB ? meshDataB->firstIndex + meshDataB->lods[b->GetMeshLOD(0)].idxOffset : 0;
+	return idxOffsetA < idxOffsetB;
+}
+
+// test every candidate against all shadow views in one pass, in parallel slices of fixed size.
+// cascades compare light space bounds, transformed once per directional light instead of once per cascade,
+// spot lights test OBB against frustum, point lights test OBB against sphere.
+// each candidate gets a view bit mask, then casters are grouped by view in candidate order
+void CullShadowCasters(RenderContext& renderContext, int jobCount)
+{
+	CPU_SCOPED_PROFILE("cull shadow casters");
+
+	int viewCount = (int)gShadowViews.size();
+	gShadowCasterCandidates.clear();
+	gShadowCasterList.clear();
+	if (viewCount == 0)
+		return;
+
+	// one BVH query with bounds of all views
+	BoxBounds allViewBounds;
+	for (int v = 0; v < viewCount; ++v)
+		allViewBounds += gShadowViews[v].worldBounds;
+	gMeshBVH.QueryAABB(allViewBounds.min, allViewBounds.max, gShadowCasterCandidates);
+
+	int candidateCount = (int)gShadowCasterCandidates.size();
+	int wordCount = (viewCount + 31) / 32;
+	gShadowViewMaskWordCount = wordCount;
+	gShadowCasterMask.resize(candidateCount * wordCount);
+
+	// light space bounds of cascade casters, per slice
+	int sliceCount = (candidateCount + gShadowCullSliceSize - 1) / gShadowCullSliceSize;
+	static REArray<BoxBounds, 16> sliceSceneBounds;
+	sliceSceneBounds.clear();
+	sliceSceneBounds.resize(sliceCount * viewCount);
+
+	const Viewpoint& viewPoint = renderContext.viewPoint;
+	float maxScreenError = GetLODMaxScreenError();
+	ParallelForSlices(sliceCount, jobCount, [&](int s)
+	{
+		BoxBounds* sceneBounds = &sliceSceneBounds[s * viewCount];
+		for (int c = s * gShadowCullSliceSize, nc = Min(c + gShadowCullSliceSize, candidateCount); c < nc; ++c)
+		{
+			MeshComponent* meshComp = MeshComponent::gMeshComponentContainer[gShadowCasterCandidates[c]];
+			unsigned __int32* mask = &gShadowCasterMask[c * wordCount];
+			for (int w = 0; w < wordCount; ++w)
+				mask[w] = 0;
+
+			BoxBounds worldBounds = meshComp->OBB.GetAABB();
+			// cascades of a light are next to each other
+			int lightSpaceLightIdx = -1;
+			BoxBounds lightSpaceBounds;
+			for (int v = 0; v < viewCount; ++v)
+			{
+				ShadowView& view = gShadowViews[v];
+				if (!IsAABBIntersectAABB(view.worldBounds.min, view.worldBounds.max, worldBounds.min, worldBounds.max))
+					continue;
+
+				bool bVisible = false;
+				if (view.type == EShadowViewType::Cascade)
+				{
+					if (view.lightIndex != lightSpaceLightIdx)
+					{
+						lightSpaceLightIdx = view.lightIndex;
+						lightSpaceBounds = meshComp->bounds.GetTransformedBounds(gDirectionalLights[lightSpaceLightIdx].lightViewMat * meshComp->modelMat);
+					}
+					bVisible = IsAABBIntersectAABB(view.frustumBounds.min, view.frustumBounds.max,
+						lightSpaceBounds.min, lightSpaceBounds.max);
+					if (bVisible)
+						sceneBounds[v] += lightSpaceBounds;
+				}
+				else if (view.type == EShadowViewType::Spot)
+				{
+					bVisible = IsOBBIntersectFrustum(meshComp->OBB.permutedAxisCenter, meshComp->OBB.extent, view.frustumPlanes, 6);
+				}
+				else
+				{
+					const Light& light = *gVisibleLightList[view.lightIndex].light;
+					bVisible = IsOBBIntersectSphere(
+						meshComp->OBB.permutedAxisCenter, meshComp->OBB.center, meshComp->OBB.extent,
+						light.position, light.radius);
+				}
+
+				if (bVisible)
+					mask[v >> 5] |= (1u << (v & 31));
+			}
+
+			// LOD by main view, so casters in view shadow with the same triangles they are drawn with
+			bool bCaster = false;
+			for (int w = 0; w < wordCount && !bCaster; ++w)
+				bCaster = mask[w] != 0;
+			if (bCaster)
+				meshComp->SelectLODs(viewPoint.position, viewPoint.screenScale, maxScreenError);
+		}
+	});
+
+	// merge scene bounds in slice order
+	for (int v = 0; v < viewCount; ++v)
+	{
+		ShadowView& view = gShadowViews[v];
+		view.sceneBounds = BoxBounds();
+		view.casterCount = 0;
+		if (view.type == EShadowViewType::Cascade)
+		{
+			for (int s = 0; s < sliceCount; ++s)
+				view.sceneBounds += sliceSceneBounds[s * viewCount + v];
+		}
+	}
+
+	// group casters by view, count then fill
+	for (int c = 0; c < candidateCount; ++c)
+	{
+		for (int w = 0; w < wordCount; ++w)
+		{
+			unsigned long bits = gShadowCasterMask[c * wordCount + w];
+			while (bits)
+			{
+				unsigned long bit;
+				_BitScanForward(&bit, bits);
+				bits &= bits - 1;
+				++gShadowViews[w * 32 + bit].casterCount;
+			}
+		}
+	}
+
+	int casterCount = 0;
+	for (int v = 0; v < viewCount; ++v)
+	{
+		ShadowView& view = gShadowViews[v];
+		view.casterStart = casterCount;
+		casterCount += view.casterCount;
+		view.casterCount = 0;
+	}
 
-	LightVolumePass(renderContext);
+	gShadowCasterList.resize(casterCount);
+	for (int c = 0; c < candidateCount; ++c)
+	{
+		MeshComponent* meshComp = MeshComponent::gMeshComponentContainer[gShadowCasterCandidates[c]];
+		for (int w = 0; w < wordCount; ++w)
+		{
+			unsigned long bits = gShadowCasterMask[c * wordCount + w];
+			while (bits)
+			{
+				unsigned long bit;
+				_BitScanForward(&bit, bits);
+				bits &= bits - 1;
+				ShadowView& view = gShadowViews[w * 32 + bit];
+				gShadowCasterList[view.casterStart + view.casterCount] = meshComp;
+				++view.casterCount;
+			}
+		}
+	}
 
-	// disable blend
-	glDisable(GL_BLEND);
+	// same meshes next to each other in each view, so multi draw lists make them instances
+	if (gRenderSettings.bMultiDraw && gRenderSettings.bInstancing)
+	{
+		ParallelForSlices(viewCount, jobCount, [&](int v)
+		{
+			const ShadowView& view = gShadowViews[v];
+			MeshComponent** casters = gShadowCasterList.data() + view.casterStart;
+			std::sort(casters, casters + view.casterCount, CompareCasterMesh);
+		});
+	}
 }
 
-void TileInfoPass(RenderContext& renderContext)
+// casters DrawShadowScene() draws, by gMeshDynamicFlags
+enum class EShadowCasterFilter
 {
-	GPU_SCOPED_PROFILE("light");
-	GPU_SCOPED_PROFILE_SUB("tile based culling", tileBasedCulling);
+	All,
+	Static,
+	Dynamic,
+};
 
-	if (!gRenderSettings.bTileCullingCombined)
+// safe to call from jobs
+void RecordShadowScene(CommandList& commandList, Material* material, const ShadowView& shadowView, EShadowCasterFilter filter)
+{
+	Uint64 recordStart = SDL_GetPerformanceCounter();
+	MultiDrawList* multiDrawList = gRenderSettings.bMultiDraw ? &commandList.MultiDraw() : 0;
+	if (multiDrawList)
+		multiDrawList->SetInstancing(gRenderSettings.bInstancing);
+	for (int i = shadowView.casterStart, ni = shadowView.casterStart + shadowView.casterCount; i < ni; ++i)
 	{
-		gLightTileReductionCompMaterial->DispatchCompute(renderContext, gRenderInfo.TileCountX, gRenderInfo.TileCountY);
-
-		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		MeshComponent* meshComp = gShadowCasterList[i];
+		if (filter != EShadowCasterFilter::All &&
+			(gMeshDynamicFlags[meshComp->GetCullingIndex()] != 0) != (filter == EShadowCasterFilter::Dynamic))
+			continue;
+		if (multiDrawList)
+			multiDrawList->Add(meshComp, material);
+		else
+			commandList.Draw(meshComp, material);
+	}
+	commandList.recordTime += (double)(SDL_GetPerformanceCounter() - recordStart) * gInvPerformanceFreq * 1000.0;
+}
 
-		// 32 for NVidia, 64 for AMD
-		const unsigned int threadPerGroup = 128;
-		unsigned int cullingGroupCount = (gRenderInfo.TileCountX * gRenderInfo.TileCountY + threadPerGroup - 1) / threadPerGroup;
-		// for culling, 1 thread per tile, use max thread per warp/wavefront in a group
-		gLightTileCullingCompMaterial->DispatchCompute(renderContext, cullingGroupCount);
+// command lists of a shadow view, one per EShadowCasterFilter
+struct ShadowViewCommands
+{
+	CommandList lists[3];
+	// shadow material the lists are recorded with
+	Material* material;
+	bool bRecorded[3];
+};
+// by gShadowViews index, grows as needed and never shrinks
+REArray<ShadowViewCommands*> gShadowViewCommands;
 
-		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-	}
-	else
+Material* GetShadowViewMaterial(const ShadowView& shadowView)
+{
+	switch (shadowView.type)
 	{
-		gLightTileReductionAndCullingCompMaterial->DispatchCompute(renderContext, gRenderInfo.TileCountX, gRenderInfo.TileCountY);
-
-		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	case EShadowViewType::Cascade:
+		return gPrepassMaterial;
+	case EShadowViewType::Spot:
+		return gPrepassTiledMaterial;
+	default:
+		return gVisibleLightList[shadowView.lightIndex].bUseTetrahedronShadowMap ? gPrepassTetrahedronMaterial : gPrepassCubeMaterial;
 	}
 }
 
-void TileBasedDeferredLightPass(RenderContext& renderContext)
+// record the caster draws every shadow view will do this frame, in parallel, one job per view.
+// cached views only record static casters when the cache is rebuilt
+void RecordShadowViews(RenderContext& renderContext, int jobCount)
 {
-	GPU_SCOPED_PROFILE("light");
-	GPU_SCOPED_PROFILE_SUB("tile based render", tileBasedRender);
-	
-	if (!gRenderSettings.bTileOnePass)
-	{
-		// now render light
-		const static RenderState renderState([](RenderState& s) {
-			// depth test to skip sky box (depth == 1)
-			s.bDepthTest = true;
-			s.depthTestFunc = GL_GREATER;
-			s.bDepthWrite = false;
-		});
+	CPU_SCOPED_PROFILE("record shadow views");
 
-		// directional light
-		renderState.Apply(renderContext);
+	int viewCount = (int)gShadowViews.size();
+	while ((int)gShadowViewCommands.size() < viewCount)
+		gShadowViewCommands.push_back(new ShadowViewCommands());
 
-		if (!gRenderSettings.bSkybox)
+	Uint64 recordStart = SDL_GetPerformanceCounter();
+	ParallelForSlices(viewCount, jobCount, [&](int v)
+	{
+		CPU_SCOPED_PROFILE("record shadow view");
+		const ShadowView& shadowView = gShadowViews[v];
+		ShadowViewCommands& commands = *gShadowViewCommands[v];
+		commands.material = GetShadowViewMaterial(shadowView);
+		for (int f = 0; f < 3; ++f)
 		{
-			glClearColor(0, 0, 0, 0);
-			glClear(GL_COLOR_BUFFER_BIT);
+			commands.lists[f].Reset();
+			commands.lists[f].recordTime = 0;
+			commands.bRecorded[f] = false;
 		}
 
-		// draw quad
-		gFSQuadMesh->Draw(renderContext, gTiledDeferredLightMaterial);
-	}
-	else
-	{
-		Texture2D& curSceneColorTex = gSceneColorTex[gSceneColorWriteIdx];
-		curSceneColorTex.access = GL_WRITE_ONLY;
-#if 0
-		gTileBasedDeferredLightCompMaterial->SetParameter("outColor", &curSceneColorTex, true);
-		gTileBasedDeferredLightCompMaterial->DispatchCompute(renderContext, gRenderInfo.TileCountX, gRenderInfo.TileCountY);
-
-		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-#else
-		gLightTileOnePassCompMaterial->SetParameter("outColor", &curSceneColorTex, true);
-		gLightTileOnePassCompMaterial->DispatchCompute(renderContext, gRenderInfo.TileCountX, gRenderInfo.TileCountY);
-
-		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-#endif
+		if (!shadowView.bUpdate || shadowView.casterCount == 0)
+			return;
 
-	}
+		bool bRecord[3] = { !shadowView.bCached, shadowView.bCached && !shadowView.bCacheValid, shadowView.bCached };
+		for (int f = 0; f < 3; ++f)
+		{
+			if (!bRecord[f])
+				continue;
+			RecordShadowScene(commands.lists[f], commands.material, shadowView, (EShadowCasterFilter)f);
+			commands.bRecorded[f] = true;
+		}
+	});
+	renderContext.stats.recordTime += (double)(SDL_GetPerformanceCounter() - recordStart) * gInvPerformanceFreq * 1000.0;
 }
 
 void DrawShadowScene(RenderContext& renderContext, Texture* shadowMap, const RenderInfo& renderInfo, Material* material,
-	REArray<MeshComponent*>& involvedMeshComps)
+	const ShadowView& shadowView, EShadowCasterFilter filter = EShadowCasterFilter::All)
 {
 	if (shadowMap)
 	{
@@ -2020,7 +3849,7 @@ void DrawShadowScene(RenderContext& renderContext, Texture* shadowMap, const Ren
 		gDepthOnlyBuffer.AttachDepth(shadowMap, false);
 
 		// set viewport
-		glViewport(0, 0, shadowMap->width, shadowMap->height);
+		gGLState.Viewport(0, 0, shadowMap->width, shadowMap->height);
 
 		// clear depth
 		glClearDepth(1);
@@ -2028,22 +3857,116 @@ void DrawShadowScene(RenderContext& renderContext, Texture* shadowMap, const Ren
 	}
 
 	// update ubo
-	glBindBuffer(GL_UNIFORM_BUFFER, gUBO_Matrices);
-	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(RenderInfo), &renderInfo);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	UpdateUniformBlock(EShaderBindingUBO::RenderInfo, gUBO_Matrices, &renderInfo, sizeof(RenderInfo));
+
+	// draw models, recorded by RecordShadowViews(), record here if that didn't match
+	int viewIdx = (int)(&shadowView - gShadowViews.data());
+	ShadowViewCommands* commands = (viewIdx >= 0 && viewIdx < (int)gShadowViewCommands.size()) ? gShadowViewCommands[viewIdx] : 0;
+	CommandList* commandList;
+	if (commands && commands->bRecorded[(int)filter] && commands->material == material)
+	{
+		commandList = &commands->lists[(int)filter];
+	}
+	else
+	{
+		static CommandList inlineCommandList;
+		commandList = &inlineCommandList;
+		commandList->Reset();
+		commandList->recordTime = 0;
+		RecordShadowScene(*commandList, material, shadowView, filter);
+		renderContext.stats.recordTime += commandList->recordTime;
+	}
+	commandList->Replay(renderContext);
+	renderContext.stats.submitTime += commandList->replayTime;
+	renderContext.stats.shadowReplayTime += commandList->replayTime;
+}
+
+// region of a local light in the shadow map, same in its static copy
+struct ShadowMapRegion
+{
+	Texture* shadowMap;
+	Texture* staticShadowMap;
+	int x, y, width, height;
+	// first layer and layer count, cube map array has 6 layers per cube map
+	int layer, layerCount;
+};
+
+// clear only the region of shadowMap, which is left attached
+void ClearShadowMapRegion(Texture* shadowMap, const ShadowMapRegion& region)
+{
+	if (region.layerCount > 1)
+	{
+		for (int i = 0; i < region.layerCount; ++i)
+		{
+			gDepthOnlyBuffer.AttachDepth(shadowMap, false, region.layer + i);
+			glClear(GL_DEPTH_BUFFER_BIT);
+		}
+		gDepthOnlyBuffer.AttachDepth(shadowMap, false);
+	}
+	else
+	{
+		gDepthOnlyBuffer.AttachDepth(shadowMap, false);
+		gGLState.Enable(GL_SCISSOR_TEST);
+		glScissor(region.x, region.y, region.width, region.height);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		gGLState.Disable(GL_SCISSOR_TEST);
+	}
+}
+
+// draw shadow of a local light into its region of the attached shadow map,
+// other regions are left as is, they may hold shadows reused this frame.
+// cached views draw static casters into the static shadow map only when the cache is invalid,
+// then copy the region to the shadow map and draw dynamic casters on top
+void DrawLocalLightShadowScene(RenderContext& renderContext, const RenderInfo& renderInfo, Material* material,
+	const ShadowView& shadowView, const ShadowMapRegion& region)
+{
+	if (!shadowView.bCached)
+	{
+		ClearShadowMapRegion(region.shadowMap, region);
+		if (shadowView.casterCount > 0)
+			DrawShadowScene(renderContext, 0, renderInfo, material, shadowView);
+		return;
+	}
 
-	// draw models
-	for (int i = 0, ni = (int)involvedMeshComps.size(); i < ni; ++i)
+	if (!shadowView.bCacheValid)
+	{
+		ClearShadowMapRegion(region.staticShadowMap, region);
+		DrawShadowScene(renderContext, 0, renderInfo, material, shadowView, EShadowCasterFilter::Static);
+		gDepthOnlyBuffer.AttachDepth(region.shadowMap, false);
+		++renderContext.stats.shadowCacheRebuildCount;
+	}
+	else
 	{
-		MeshComponent*& meshComp = involvedMeshComps[i];
-		if(meshComp->bRenderVisibile)
-			meshComp->Draw(renderContext, material);
+		++renderContext.stats.shadowCacheHitCount;
 	}
+
+	glCopyImageSubData(
+		region.staticShadowMap->textureID, region.staticShadowMap->textureType, 0, region.x, region.y, region.layer,
+		region.shadowMap->textureID, region.shadowMap->textureType, 0, region.x, region.y, region.layer,
+		region.width, region.height, region.layerCount);
+
+	DrawShadowScene(renderContext, 0, renderInfo, material, shadowView, EShadowCasterFilter::Dynamic);
+}
+
+// tile of the tiled shadow map from normalized offset and size
+ShadowMapRegion GetTiledShadowMapRegion(float offsetX, float offsetY, float tileSize)
+{
+	ShadowMapRegion region;
+	region.shadowMap = &gShadowTiledTex;
+	region.staticShadowMap = &gShadowTiledStaticTex;
+	region.x = (int)(offsetX * gShadowTiledTex.width);
+	region.y = (int)(offsetY * gShadowTiledTex.height);
+	region.width = (int)(tileSize * gShadowTiledTex.width);
+	region.height = (int)(tileSize * gShadowTiledTex.height);
+	region.layer = 0;
+	region.layerCount = 1;
+	return region;
 }
 
 void ShadowPass(RenderContext& renderContext)
 {
 	GPU_SCOPED_PROFILE("shadow");
+	GL_STATE_SCOPED_PASS("shadow");
 	CPU_SCOPED_PROFILE("shadow");
 
 	const static RenderState renderState([](RenderState& s) {
@@ -2053,6 +3976,14 @@ void ShadowPass(RenderContext& renderContext)
 
 	renderState.Apply(renderContext);
 
+	// cull casters of all shadow views together
+	SetupShadowViews(renderContext);
+	CullShadowCasters(renderContext, gCullJobCount);
+	UpdateMeshMobility(gRenderFrameIndex);
+	UpdateLocalLightShadows(renderContext, gRenderFrameIndex);
+	RecordShadowViews(renderContext, gCullJobCount);
+	int shadowViewIdx = 0;
+
 	const static Matrix4 remapMat(
 		Vector4(0.5f, 0.f, 0.f, 0.0f),
 		Vector4(0.f, 0.5f, 0.f, 0.0f),
@@ -2094,17 +4025,11 @@ void ShadowPass(RenderContext& renderContext)
 		// attach to frame buffers
 		gDepthOnlyBuffer.AttachDepth(&gCSMTexArray, false);
 		// set viewport
-		glViewport(0, 0, gCSMTexArray.width, gCSMTexArray.height);
+		gGLState.Viewport(0, 0, gCSMTexArray.width, gCSMTexArray.height);
 		// clear depth
 		glClearDepth(1);
 		glClear(GL_DEPTH_BUFFER_BIT);
 
-		const static float cascadeRatio[RenderConsts::MAX_CSM_COUNT] = {
-			0.12f, 0.36f, 1.f
-		};
-
-		Vector4_3 clipPoints[4];
-
 		float aspectRatio = viewPoint.height / viewPoint.width;
 		float tanHF = Tan(viewPoint.fov * 0.5f) * Sqrt(1 + aspectRatio * aspectRatio);
 		float tanHF2 = tanHF * tanHF;
@@ -2112,9 +4037,6 @@ void ShadowPass(RenderContext& renderContext)
 		bool bFixedSize = false;
 		int csmIndex = 0;
 
-		REArray<BoxBounds, 16> lightSpaceBounds;
-		lightSpaceBounds.resize(MeshComponent::gMeshComponentContainer.size());
-		
 		int shadowIdx = 0;
 		for (int lightIdx = 0, nlightIdx = (int)gDirectionalLights.size(); lightIdx < nlightIdx; ++lightIdx)
 		{
@@ -2129,15 +4051,6 @@ void ShadowPass(RenderContext& renderContext)
 			if (!light.bCastShadow)
 				continue;
 
-			// calculate light space bounds
-			for (int i = 0, ni = (int)MeshComponent::gMeshComponentContainer.size(); i < ni; ++i)
-			{
-				MeshComponent*& meshComp = MeshComponent::gMeshComponentContainer[i];
-				const Matrix4& adjustMat = light.lightViewMat * meshComp->modelMat;
-				// tranform bounds into light space
-				lightSpaceBounds[i] = meshComp->bounds.GetTransformedBounds(adjustMat);
-			}
-
 			Matrix4 viewToLight = light.lightViewMat * viewPoint.invViewMat;
 
 			const int cascadeCount = RenderConsts::MAX_CSM_COUNT;
@@ -2145,9 +4058,11 @@ void ShadowPass(RenderContext& renderContext)
 			int cascadeIdx = 0;
 			for (; cascadeIdx < cascadeCount; ++cascadeIdx)
 			{
+				const ShadowView& shadowView = gShadowViews[shadowViewIdx++];
+
 				// near and far plane for this cascade
-				float n = (cascadeIdx == 0) ? viewPoint.nearPlane : viewPoint.farPlane * cascadeRatio[cascadeIdx - 1];
-				float f = viewPoint.farPlane * cascadeRatio[cascadeIdx];
+				float n = (cascadeIdx == 0) ? viewPoint.nearPlane : viewPoint.farPlane * gCascadeRatio[cascadeIdx - 1];
+				float f = viewPoint.farPlane * gCascadeRatio[cascadeIdx];
 
 				// minimal bounding sphere diameter
 				float diameter = ((f + n) * tanHF2 >= (f - n)) ?
@@ -2156,42 +4071,12 @@ void ShadowPass(RenderContext& renderContext)
 
 				float pixelRate = diameter / gCSMTexArray.width;
 
-				// process frustum bounds
-				BoxBounds frustumBounds;
-				viewPoint.GetClipPoints(-n, clipPoints);
-				for (int i = 0; i < 4; ++i)
-					frustumBounds += light.lightViewMat.TransformPoint(clipPoints[i]);
-				viewPoint.GetClipPoints(-f, clipPoints);
-				for (int i = 0; i < 4; ++i)
-					frustumBounds += light.lightViewMat.TransformPoint(clipPoints[i]);
-
-				// extent test bound max(near plane) a little bit to include geometry behind us
-				// this value need to be increased if we are missing shadow
-				const float stepBack = 50.f;
-				frustumBounds.max.z += stepBack;
-
-				// process scene bounds and do frustum culling
-				bool bHasMeshToRender = false;
-				BoxBounds sceneBounds;
-				for (int i = 0, ni = (int)MeshComponent::gMeshComponentContainer.size(); i < ni; ++i)
-				{
-					MeshComponent*& meshComp = MeshComponent::gMeshComponentContainer[i];
-					// overlap test
-					if (IsAABBIntersectAABB(frustumBounds.min, frustumBounds.max, 
-						lightSpaceBounds[i].min, lightSpaceBounds[i].max))
-					{
-						sceneBounds += lightSpaceBounds[i];
-						meshComp->bRenderVisibile = true;
-						bHasMeshToRender = true;
-					}
-					else
-					{
-						meshComp->bRenderVisibile = false;
-					}
-				}
+				// cascade bounds and light space bounds of its casters, from CullShadowCasters()
+				BoxBounds frustumBounds = shadowView.frustumBounds;
+				const BoxBounds& sceneBounds = shadowView.sceneBounds;
 
 				// skip if we have no mesh to render
-				if (!bHasMeshToRender)
+				if (shadowView.casterCount == 0)
 					continue;
 
 				// only change far plane if scene bounds are closer, don't extend it
@@ -2240,7 +4125,7 @@ void ShadowPass(RenderContext& renderContext)
 
 				// attach to right layer
 				gDepthOnlyBuffer.AttachDepth(&gCSMTexArray, false, csmIndex);
-				DrawShadowScene(renderContext, 0, shadowRenderInfo, gPrepassMaterial, MeshComponent::gMeshComponentContainer);
+				DrawShadowScene(renderContext, 0, shadowRenderInfo, gPrepassMaterial, shadowView);
 				++csmIndex;
 			}
 
@@ -2267,10 +4152,10 @@ void ShadowPass(RenderContext& renderContext)
 
 
 	// enable custom clipping planes, clip distance is sent in vertex shader or geometry shader via gl_ClipDistance
-	glEnable(GL_CLIP_DISTANCE0);
-	glEnable(GL_CLIP_DISTANCE1);
-	glEnable(GL_CLIP_DISTANCE2);
-	glEnable(GL_CLIP_DISTANCE3);
+	gGLState.Enable(GL_CLIP_DISTANCE0);
+	gGLState.Enable(GL_CLIP_DISTANCE1);
+	gGLState.Enable(GL_CLIP_DISTANCE2);
+	gGLState.Enable(GL_CLIP_DISTANCE3);
 
 
 	// local light data
@@ -2284,7 +4169,7 @@ void ShadowPass(RenderContext& renderContext)
 
 	LightRenderInfo lightTmpl;
 
-	const float lightNearPlane = 0.01f;
+	const float lightNearPlane = gLocalLightShadowNearPlane;
 
 	float maxLocalLightDist = 0.f;
 
@@ -2333,7 +4218,7 @@ void ShadowPass(RenderContext& renderContext)
 				bShouldInitTiledShadowMap = true;
 			
 			// only need 3 clipping planes
-			glDisable(GL_CLIP_DISTANCE3);
+			gGLState.Disable(GL_CLIP_DISTANCE3);
 		}
 		if (!bCubeMapPass && !lightData.bSpot && !lightData.bUseTetrahedronShadowMap && bDrawShadowPoint)
 		{
@@ -2342,22 +4227,27 @@ void ShadowPass(RenderContext& renderContext)
 			bShouldInitCubeMapArray = true;
 
 			// disable custom clipping planes
-			glDisable(GL_CLIP_DISTANCE0);
-			glDisable(GL_CLIP_DISTANCE1);
-			glDisable(GL_CLIP_DISTANCE2);
-			glDisable(GL_CLIP_DISTANCE3);
+			gGLState.Disable(GL_CLIP_DISTANCE0);
+			gGLState.Disable(GL_CLIP_DISTANCE1);
+			gGLState.Disable(GL_CLIP_DISTANCE2);
+			gGLState.Disable(GL_CLIP_DISTANCE3);
 
 		}
 
 		if (bShouldInitTiledShadowMap)
 		{
+			if (gRenderSettings.bShadowCache && gShadowTiledStaticTex.width != gShadowTiledTex.width)
+			{
+				gShadowTiledStaticTex.AllocateForFrameBuffer(gShadowTiledTex.width, gShadowTiledTex.height,
+					GL_DEPTH_COMPONENT16, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, true);
+			}
+
 			// attach to frame buffers
 			gDepthOnlyBuffer.AttachDepth(&gShadowTiledTex, false);
 			// set viewport
-			glViewport(0, 0, gShadowTiledTex.width, gShadowTiledTex.height);
-			// clear depth
+			gGLState.Viewport(0, 0, gShadowTiledTex.width, gShadowTiledTex.height);
+			// tiles are cleared one by one, lights not drawn this frame keep their tiles
 			glClearDepth(1);
-			glClear(GL_DEPTH_BUFFER_BIT);
 		}
 		if (bShouldInitCubeMapArray)
 		{
@@ -2372,20 +4262,43 @@ void ShadowPass(RenderContext& renderContext)
 				gShadowCubeTexArray.Reallocate(cubeMapSize, cubeMapSize, gShadowCubeMapCount);
 			}
 
+			if (gRenderSettings.bShadowCache && gShadowCubeStaticTexArray.count != gShadowCubeMapCount)
+			{
+				if (gShadowCubeStaticTexArray.count == 0)
+					gShadowCubeStaticTexArray.AllocateForFrameBuffer(cubeMapSize, cubeMapSize, gShadowCubeMapCount, GL_DEPTH_COMPONENT16, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, true);
+				else
+					gShadowCubeStaticTexArray.Reallocate(cubeMapSize, cubeMapSize, gShadowCubeMapCount);
+
+				// content is lost
+				for (int v = 0, nv = (int)gShadowViews.size(); v < nv; ++v)
+				{
+					if (gShadowViews[v].type == EShadowViewType::Point)
+						gShadowViews[v].bCacheValid = false;
+				}
+			}
+
 			// attach to frame buffers
 			gDepthOnlyBuffer.AttachDepth(&gShadowCubeTexArray, false);
 			// set viewport
-			glViewport(0, 0, gShadowCubeTexArray.width, gShadowCubeTexArray.height);
-			// clear depth
+			gGLState.Viewport(0, 0, gShadowCubeTexArray.width, gShadowCubeTexArray.height);
+			// cube maps are cleared one by one
 			glClearDepth(1);
-			glClear(GL_DEPTH_BUFFER_BIT);
 		}
 
 
 		// spot lights
 		if (lightData.bSpot && bDrawShadowSpot)
 		{
-			Plane frustumPlanes[6];
+			const ShadowView& shadowView = gShadowViews[shadowViewIdx++];
+			LocalShadowState& shadowState = gLocalShadowStates[GetLocalLightId(lightData)];
+
+			// keep last drawn shadow
+			if (!shadowView.bUpdate)
+			{
+				light.shadowMat[0] = shadowState.shadowViewMat * viewPoint.invViewMat;
+				shadowMatrices.push_back(light.shadowMat[0]);
+				continue;
+			}
 
 			int totalSize = gShadowTiledTex.width;
 			float offsetX = 0.f, offsetY = 0.f, tileSize = 0.f;
@@ -2403,13 +4316,18 @@ void ShadowPass(RenderContext& renderContext)
 				Vector4(offsetX, offsetX + tileSize, offsetY, offsetY + tileSize) * 2.f - 1.f,
 				4);
 
+			// cached or reused shadow can't follow jitter
+			bool bNoJitter = shadowView.bCached || shadowView.bBudgeted;
+			float jitterX = bNoJitter ? 0.f : viewPoint.jitterX;
+			float jitterY = bNoJitter ? 0.f : viewPoint.jitterY;
 			Matrix4 lightProjMat = MakeMatrixPerspectiveProj(
 				DegToRad(light.outerHalfAngle) * 2,
 				lightData.shadowMapSize, lightData.shadowMapSize,
 				lightNearPlane, light.radius,
-				viewPoint.jitterX, viewPoint.jitterY);
+				jitterX, jitterY);
 
-			light.shadowMat[0] = remapMat * tileMat * lightProjMat * light.lightViewMat * viewPoint.invViewMat;
+			shadowState.shadowViewMat = remapMat * tileMat * lightProjMat * light.lightViewMat;
+			light.shadowMat[0] = shadowState.shadowViewMat * viewPoint.invViewMat;
 			shadowMatrices.push_back(light.shadowMat[0]);
 
 			// update render info
@@ -2417,36 +4335,36 @@ void ShadowPass(RenderContext& renderContext)
 			shadowRenderInfo.Proj = tileMat * lightProjMat;
 			shadowRenderInfo.ViewProj = tileMat * lightProjMat * light.lightViewMat;
 
-			// culling
-			GetFrustumPlanes(light.lightViewMat, lightProjMat.m[0][0], lightProjMat.m[1][1],
-				lightNearPlane, light.radius, frustumPlanes);
-
-			bool bHasMeshToRender = false;
-			for (int i = 0, ni = (int)MeshComponent::gMeshComponentContainer.size(); i < ni; ++i)
-			{
-				MeshComponent*& meshComp = MeshComponent::gMeshComponentContainer[i];
-				if (IsOBBIntersectFrustum(meshComp->OBB.permutedAxisCenter, meshComp->OBB.extent, frustumPlanes, 6))
-				{
-					meshComp->bRenderVisibile = true;
-					bHasMeshToRender = true;
-				}
-				else
-				{
-					meshComp->bRenderVisibile = false;
-				}
-			}
-
-			if (bHasMeshToRender)
-				DrawShadowScene(renderContext, 0, shadowRenderInfo, gPrepassTiledMaterial, MeshComponent::gMeshComponentContainer);
+			ShadowMapRegion region = GetTiledShadowMapRegion(offsetX, offsetY, tileSize);
+			DrawLocalLightShadowScene(renderContext, shadowRenderInfo, gPrepassTiledMaterial, shadowView, region);
 		}
 		// point lights
 		else if (!lightData.bSpot && bDrawShadowPoint)
 		{
+			const ShadowView& shadowView = gShadowViews[shadowViewIdx++];
+			LocalShadowState& shadowState = gLocalShadowStates[GetLocalLightId(lightData)];
+
+			// keep last drawn shadow, only tetrahedron maps are budgeted
+			if (!shadowView.bUpdate)
+			{
+				light.shadowMat[0] = shadowState.shadowViewMat * viewPoint.invViewMat;
+				shadowMatrices.push_back(light.shadowMat[0]);
+				for (int i = 0; i < 4; ++i)
+					shadowMatrices.push_back(light.shadowMat[i + 1]);
+				continue;
+			}
+
 			// update render info, only do view, since we proj in geometry shader
 			shadowRenderInfo.View = light.lightViewMat;
 			shadowRenderInfo.Proj = Matrix4::Identity();
 			shadowRenderInfo.ViewProj = light.lightViewMat;
 
+			// cached or reused shadow can't follow jitter
+			bool bNoJitter = shadowView.bCached || shadowView.bBudgeted;
+			float jitterX = bNoJitter ? 0.f : viewPoint.jitterX;
+			float jitterY = bNoJitter ? 0.f : viewPoint.jitterY;
+			ShadowMapRegion region;
+
 			if(lightData.bUseTetrahedronShadowMap)
 			{
 				int totalSize = gShadowTiledTex.width;
@@ -2469,7 +4387,7 @@ void ShadowPass(RenderContext& renderContext)
 					tetrahedronFov,
 					tetrahedronWidth * lightData.shadowMapSize, lightData.shadowMapSize,
 					lightNearPlane, light.radius,
-					viewPoint.jitterX * jitterScale, viewPoint.jitterY * jitterScale);
+					jitterX * jitterScale, jitterY * jitterScale);
 
 				const Matrix4 gLightOmniTextureProjMat[4] =
 				{
@@ -2484,6 +4402,7 @@ void ShadowPass(RenderContext& renderContext)
 				};
 
 
+				shadowState.shadowViewMat = light.lightViewMat;
 				light.shadowMat[0] = light.lightViewMat * viewPoint.invViewMat;
 				shadowMatrices.push_back(light.shadowMat[0]);
 
@@ -2494,6 +4413,8 @@ void ShadowPass(RenderContext& renderContext)
 					shadowMatrices.push_back(light.shadowMat[i+1]);
 					gPrepassTetrahedronMaterial->SetParameter(ShaderNameBuilder("lightViewProjMat")[i].c_str(), lightViewProjMat);
 				}
+
+				region = GetTiledShadowMapRegion(offsetX, offsetY, tileSize);
 			}
 			else
 			{
@@ -2501,7 +4422,7 @@ void ShadowPass(RenderContext& renderContext)
 					DegToRad(90.f),
 					(float)gShadowCubeTexArray.width, (float)gShadowCubeTexArray.height,
 					lightNearPlane, light.radius,
-					viewPoint.jitterX, viewPoint.jitterY);
+					jitterX, jitterY);
 
 				light.shadowMat[0] = light.lightViewMat * viewPoint.invViewMat;
 				light.shadowMat[1] = remapMat * lightProjMat;
@@ -2513,53 +4434,40 @@ void ShadowPass(RenderContext& renderContext)
 					gPrepassCubeMaterial->SetParameter(ShaderNameBuilder("lightViewProjMat")[i].c_str(), lightProjMat * gLightCubeViewMat[i]);
 				}
 				gPrepassCubeMaterial->SetParameter("cubeMapArrayIndex", lightData.shadowMapIndex);
-			}
 
-			bool bHasMeshToRender = false;
-			// process scene bounds and do frustum culling
-			for (int i = 0, ni = (int)MeshComponent::gMeshComponentContainer.size(); i < ni; ++i)
-			{
-				MeshComponent*& meshComp = MeshComponent::gMeshComponentContainer[i];
-				if (IsOBBIntersectSphere(
-					meshComp->OBB.permutedAxisCenter, meshComp->OBB.center, meshComp->OBB.extent,
-					light.position, light.radius))
-				{
-					bHasMeshToRender = true;
-					meshComp->bRenderVisibile = true;
-				}
-				else
-				{
-					meshComp->bRenderVisibile = false;
-				}
+				region.shadowMap = &gShadowCubeTexArray;
+				region.staticShadowMap = &gShadowCubeStaticTexArray;
+				region.x = 0;
+				region.y = 0;
+				region.width = gShadowCubeTexArray.width;
+				region.height = gShadowCubeTexArray.height;
+				region.layer = lightData.shadowMapIndex * 6;
+				region.layerCount = 6;
 			}
 
-			if (bHasMeshToRender)
-			{
-				DrawShadowScene(renderContext, 0, shadowRenderInfo, 
-					lightData.bUseTetrahedronShadowMap ? gPrepassTetrahedronMaterial : gPrepassCubeMaterial,
-					MeshComponent::gMeshComponentContainer);
-			}
+			DrawLocalLightShadowScene(renderContext, shadowRenderInfo,
+				lightData.bUseTetrahedronShadowMap ? gPrepassTetrahedronMaterial : gPrepassCubeMaterial,
+				shadowView, region);
 		}
 	}
 
 	if (!bCubeMapPass)
 	{
 		// disable custom clipping planes
-		glDisable(GL_CLIP_DISTANCE0);
-		glDisable(GL_CLIP_DISTANCE1);
-		glDisable(GL_CLIP_DISTANCE2);
-		glDisable(GL_CLIP_DISTANCE3);
+		gGLState.Disable(GL_CLIP_DISTANCE0);
+		gGLState.Disable(GL_CLIP_DISTANCE1);
+		gGLState.Disable(GL_CLIP_DISTANCE2);
+		gGLState.Disable(GL_CLIP_DISTANCE3);
 	}
 
 	assert(shadowMatrices.size() == gCurLocalLightShadowMatCount);
+	assert(shadowViewIdx == (int)gShadowViews.size());
 
 	// set max local light dist
 	globalLightsRenderInfo.maxLocalLightDist = maxLocalLightDist;
 
 	// global light ubo
-	glBindBuffer(GL_UNIFORM_BUFFER, gUBO_GlobalLights);
-	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(GlobalLightsRenderInfo), &globalLightsRenderInfo);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	UpdateUniformBlock(EShaderBindingUBO::GlobalLightsRenderInfo, gUBO_GlobalLights, &globalLightsRenderInfo, sizeof(GlobalLightsRenderInfo));
 	
 	// send ssbo
 	bool bNeedReallocate = false;
@@ -2622,6 +4530,7 @@ void AlphaBlendPass(RenderContext& renderContext)
 {
 	//CPU_SCOPED_PROFILE("alpha blend");
 	GPU_SCOPED_PROFILE("alpha blend");
+	GL_STATE_SCOPED_PASS("alpha blend");
 
 	const static RenderState renderState([](RenderState& s) {
 		// don't write depth
@@ -2631,19 +4540,20 @@ void AlphaBlendPass(RenderContext& renderContext)
 	renderState.Apply(renderContext);
 
 	// enable blend for skybox additive
-	glEnable(GL_BLEND);
-	glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
-	glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
+	gGLState.Enable(GL_BLEND);
+	gGLState.BlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
+	gGLState.BlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
 
 	// draw mesh
-	DrawMeshList(renderContext, gAlphaBlendMeshRenderList);
+	ReplayPassCommandList(renderContext, EPassCommandList::AlphaBlend);
 
-	glDisable(GL_BLEND);
+	gGLState.Disable(GL_BLEND);
 }
 
 void DebugForwardPass(RenderContext& renderContext)
 {
 	//GPU_SCOPED_PROFILE("debug foward");
+	GL_STATE_SCOPED_PASS("debug forward");
 
 	static const RenderState renderState;
 
@@ -2674,7 +4584,7 @@ void DebugForwardPass(RenderContext& renderContext)
 
 	// wireframes
 	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	glDisable(GL_CULL_FACE);
+	gGLState.Disable(GL_CULL_FACE);
 
 	if (gRenderSettings.bDrawBounds)
 	{
@@ -2845,6 +4755,7 @@ void PostProcessPassBeforeAlpha(RenderContext& renderContext)
 	if (!gRenderSettings.bForward && gRenderSettings.bSSR)
 	{
 		GPU_SCOPED_PROFILE("SSR");
+		GL_STATE_SCOPED_PASS("SSR");
 
 		PreparePostProcessPass();
 
@@ -2907,6 +4818,7 @@ void PostProcessPassBeforeAlpha(RenderContext& renderContext)
 void PostProcessPass(RenderContext& renderContext)
 {
 	GPU_SCOPED_PROFILE("post process");
+	GL_STATE_SCOPED_PASS("post process");
 
 	const static RenderState renderState( [] (RenderState& s) {
 		// no depth test
@@ -3006,7 +4918,7 @@ void VisualizeTexturePass(RenderContext& renderContext)
 	renderState.Apply(renderContext);
 	
 	// unbind frame buffer, draw to screen
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	gGLState.BindFramebuffer(GL_FRAMEBUFFER, 0);
 
 	Texture2D* vTex = &gShadowTiledTex;//(Texture2D*)(gPointLights[2].shadowData[0].shadowMap);
 	//assert(gPointLights[2].shadowData[0].shadowMap->textureType == GL_TEXTURE_2D);
@@ -3022,6 +4934,20 @@ void VisualizeTexturePass(RenderContext& renderContext)
 	gFSQuadMesh->Draw(renderContext, gVisualizeTextureMaterial);
 }
 
+// timers by "/parent/name" path, indented by depth
+void UIProfileTimers(const RESortedMap<std::string, double>& timerMap, float averageFrameTime)
+{
+	for (auto it = timerMap.begin(); it != timerMap.end(); ++it)
+	{
+		size_t layer = std::count(it->first.begin(), it->first.end(), '/') - 1;
+		std::string displayName(layer, '\t');
+		displayName.append(it->first.substr(it->first.find_last_of('/') + 1));
+		float timeRatio = Clamp((float)(it->second / averageFrameTime), 0.0f, 1.0f);
+		ImGui::Text("%s \t %.3f ms %.2f%%", displayName.c_str(), it->second, timeRatio * 100);
+		ImGui::ProgressBar(timeRatio, ImVec2(0.f, 5.f));
+	}
+}
+
 void UIPass()
 {
 	//GPU_SCOPED_PROFILE("UI");
@@ -3039,27 +4965,75 @@ void UIPass()
 		ImColor fpsColor = fps > 60 ? green : (fps > 30 ? yellow : red);
 		ImGui::TextColored(fpsColor, "FPS %.1f \t %.3f ms", fps, averageFrameTime);
 
-		// profiling cpu
+		// profiling cpu, all threads, then each thread
 		ImGui::Text("CPU");
-		for (auto it = ScopedProfileTimerCPU::timerMap.begin(); it != ScopedProfileTimerCPU::timerMap.end(); ++it)
+		UIProfileTimers(ScopedProfileTimerCPU::timerMap, averageFrameTime);
+		for (int i = 0, ni = (int)ScopedProfileTimerCPU::threadTimerMaps.size(); i < ni; ++i)
 		{
-			size_t layer = std::count(it->first.begin(), it->first.end(), '/') - 1;
-			std::string displayName(layer, '\t');
-			displayName.append(it->first.substr(it->first.find_last_of('/') + 1));
-			float timeRatio = Clamp((float)(it->second / averageFrameTime), 0.0f, 1.0f);
-			ImGui::Text("%s \t %.3f ms %.2f%%", displayName.c_str(), it->second, timeRatio * 100);
-			ImGui::ProgressBar(timeRatio, ImVec2(0.f, 5.f));
+			if (ImGui::TreeNode((void*)(intptr_t)i, "thread %d", i))
+			{
+				UIProfileTimers(ScopedProfileTimerCPU::threadTimerMaps[i], averageFrameTime);
+				ImGui::TreePop();
+			}
 		}
+		if (ScopedProfileTimerCPU::droppedEventCount > 0)
+			ImGui::TextColored(red, "profile events dropped %d", ScopedProfileTimerCPU::droppedEventCount);
 		// profiling gpu
 		ImGui::Text("GPU");
-		for (auto &it = ScopedProfileTimerGPU::timerMap.begin(); it != ScopedProfileTimerGPU::timerMap.end(); ++it)
+		UIProfileTimers(ScopedProfileTimerGPU::timerMap, averageFrameTime);
+
+		// draws
+		ImGui::Text("Draws");
+		ImGui::Text("draws %d \t triangles %d \t sort %.3f ms", gRenderStats.drawCount, gRenderStats.triangleCount, gRenderStats.sortTime);
+		ImGui::Text("shader %d \t material %d \t VAO %d \t material upload %d B",
+			gRenderStats.shaderChangeCount, gRenderStats.materialChangeCount, gRenderStats.VAOChangeCount, gRenderStats.materialUploadBytes);
+		ImGui::Text("multi draw %d \t meshes %d \t instanced %d \t submit %.3f ms",
+			gRenderStats.multiDrawCount, gRenderStats.multiDrawMeshCount, gRenderStats.instancedMeshCount, gRenderStats.submitTime);
+		if (IsGPUCullingActive())
+		{
+			ImGui::Text("GPU culling draws %d \t batches %d \t uploaded %d \t update %.3f ms%s",
+				gRenderStats.gpuCullDrawCount, gGPUCulling.GetBatchCount(), gGPUCulling.uploadCount, gGPUCulling.updateTime,
+				gGPUCulling.HasIndirectCount() ? "" : " \t no indirect count");
+		}
+		ImGui::Text("command lists record %.3f ms \t shadow replay %.3f ms", gRenderStats.recordTime, gRenderStats.shadowReplayTime);
+		for (int i = 0; i < (int)EPassCommandList::Count; ++i)
+		{
+			ImGui::Text("\t%s \t record %.3f ms \t replay %.3f ms",
+				gPassCommandListNames[i], gPassCommandLists[i].recordTime, gPassCommandLists[i].replayTime);
+		}
+		ImGui::Text("culling tested %d \t skipped %d", gRenderStats.cullTestedCount, gRenderStats.cullSkippedCount);
+		ImGui::Text("shadow cache hit %d \t rebuild %d", gRenderStats.shadowCacheHitCount, gRenderStats.shadowCacheRebuildCount);
+		ImGui::Text("shadow update %d \t skip %d", gRenderStats.shadowUpdateCount, gRenderStats.shadowSkipCount);
+		const ShadowAtlasStats& atlasStats = gShadowAtlas.stats;
+		ImGui::Text("shadow atlas %.1f%% \t tiles %d \t new %d \t evict %d \t fail %d",
+			atlasStats.occupancy * 100.f, atlasStats.tileCount, atlasStats.allocCount, atlasStats.evictCount, atlasStats.failCount);
+		const GLStateStats& glStateStats = gGLState.lastFrameStats;
+		ImGui::Text("GL state calls %d \t filtered %d", glStateStats.total.issued, glStateStats.total.filtered);
+		for (int i = 0, ni = (int)glStateStats.passes.size(); i < ni; ++i)
+		{
+			const GLStatePassStats& passStats = glStateStats.passes[i];
+			ImGui::Text("\t%s \t calls %d \t filtered %d", passStats.name, passStats.counters.issued, passStats.counters.filtered);
+		}
+		const RingBufferStats& ringStats = gFrameRingBuffer.stats;
+		ImGui::Text("ring buffer %d / %d KB \t waits %d \t %s",
+			(int)(ringStats.usedBytes / 1024), (int)(ringStats.sectionBytes / 1024), ringStats.waitCount,
+			ringStats.bPersistent ? "persistent" : "mapped per write");
+
+		// occlusion
+		const OcclusionStats& occlusionStats = gOcclusionBuffer.stats;
+		ImGui::Text("Occlusion");
+		ImGui::Text("occluders %d \t triangles %d \t raster %.3f ms",
+			occlusionStats.occluderCount, occlusionStats.triangleCount, occlusionStats.rasterTime);
+		ImGui::Text("tested %d \t occluded %d", occlusionStats.testedCount, occlusionStats.occludedCount);
+
+		// light clusters
+		if (gRenderSettings.bCPULightClusters)
 		{
-			size_t layer = std::count(it->first.begin(), it->first.end(), '/') - 1;
-			std::string displayName(layer, '\t');
-			displayName.append(it->first.substr(it->first.find_last_of('/') + 1));
-			float timeRatio = Clamp((float)(it->second / averageFrameTime), 0.0f, 1.0f);
-			ImGui::Text("%s \t %.3f ms %.2f%%", displayName.c_str(), it->second, timeRatio * 100);
-			ImGui::ProgressBar(timeRatio, ImVec2(0.f, 5.f));
+			const LightClusterStats& clusterStats = gLightClusterGrid.stats;
+			ImGui::Text("Light Clusters");
+			ImGui::Text("lights %d \t clusters %d \t build %.3f ms",
+				clusterStats.lightCount, clusterStats.clusterCount, clusterStats.buildTime);
+			ImGui::Text("indices %d \t max per cluster %d", clusterStats.indexCount, clusterStats.maxClusterLightCount);
 		}
 
 		ImGui::End();
@@ -3073,7 +5047,16 @@ void UIPass()
 		ImGui::Checkbox("- CSM", &gRenderSettings.bDrawShadowCSM);
 		ImGui::Checkbox("- Spot", &gRenderSettings.bDrawShadowSpot);
 		ImGui::Checkbox("- Point", &gRenderSettings.bDrawShadowPoint);
+		ImGui::Checkbox("- Cache", &gRenderSettings.bShadowCache);
+		ImGui::Checkbox("- Update Budget", &gRenderSettings.bShadowUpdateBudget);
 		ImGui::Checkbox("Bounds", &gRenderSettings.bDrawBounds);
+		ImGui::Checkbox("Occlusion Culling", &gRenderSettings.bOcclusionCulling);
+		ImGui::Checkbox("Temporal Culling", &gRenderSettings.bTemporalCulling);
+		ImGui::Checkbox("Mesh LOD", &gRenderSettings.bMeshLOD);
+		ImGui::Checkbox("Multi Draw", &gRenderSettings.bMultiDraw);
+		ImGui::Checkbox("Instancing", &gRenderSettings.bInstancing);
+		ImGui::Checkbox("GPU Culling", &gRenderSettings.bGPUCulling);
+		ImGui::Checkbox("- Occlusion", &gRenderSettings.bGPUOcclusion);
 		ImGui::Checkbox("Light Volume", &gRenderSettings.bDrawLightVolume);
 		ImGui::Checkbox("TAA", &gRenderSettings.bUseTAA);
 		ImGui::Checkbox("Jitter", &gRenderSettings.bUseJitter);
@@ -3084,6 +5067,7 @@ void UIPass()
 		ImGui::Checkbox("Tile Based", &gRenderSettings.bTileBasedDeferred);
 		ImGui::Checkbox("Tile One Pass", &gRenderSettings.bTileOnePass);
 		ImGui::Checkbox("Tile Combined", &gRenderSettings.bTileCullingCombined);
+		ImGui::Checkbox("CPU Light Clusters", &gRenderSettings.bCPULightClusters);
 
 		ImGui::End();
 	}
@@ -3095,7 +5079,7 @@ void UIPass()
 	//}
 
 #if SHADER_DEBUG_BUFFER
-	glBindTexture(GL_TEXTURE_2D, gDebugTex.textureID);
+	gGLState.BindTexture(GL_TEXTURE_2D, gDebugTex.textureID);
 	glGetTexImage(GL_TEXTURE_2D, 0, gDebugTex.format, gDebugTex.type, gDebugTexBuffer);
 
 	int x, y;
@@ -3118,6 +5102,8 @@ void UIPass()
 #endif
 
 	ImGui::Render();
+	// ImGui sets its own state and restores what it queried, none of it through gGLState
+	gGLState.Invalidate();
 }
 
 void Render()
@@ -3125,6 +5111,12 @@ void Render()
 	GPU_SCOPED_PROFILE("render");
 	CPU_SCOPED_PROFILE("render");
 
+	++gRenderFrameIndex;
+
+	// waits if GPU is still reading this section, 2 frames ago
+	gFrameRingBuffer.BeginFrame();
+	gGLState.BeginFrame();
+
 	RenderContext renderContext;
 	float jitterX = 0, jitterY = 0;
 	if (gRenderSettings.bUseJitter)
@@ -3139,16 +5131,34 @@ void Render()
 	renderContext.viewPoint = gCamera.ProcessCamera((GLfloat)gWindowWidth, (GLfloat)gWindowHeight, 0.1f, 200.f, jitterX, jitterY);
 	
 	// cull lights
-	CullLights(renderContext);
+	CullLights(renderContext, gCullJobCount);
+
+	// CPU light clusters only replace tile culling for deferred, one pass compute always use tiles
+	bool bCPULightClusters = gRenderSettings.bCPULightClusters && !gRenderSettings.bForward && gRenderSettings.bTileBasedDeferred;
+	bool bTileOnePass = gRenderSettings.bTileOnePass && !bCPULightClusters;
+	if (bCPULightClusters)
+		BuildLightClusters(renderContext, gCullJobCount);
 	
 	// bind shadow buffer
 	gDepthOnlyBuffer.Bind();
 	ShadowPass(renderContext);
 
 	// cull meshes
-	CullMeshes(renderContext);
+	CullMeshes(renderContext, gCullJobCount);
+
+	// record draws of mesh passes, replayed by each pass
+	RecordPassCommandLists(renderContext, gCullJobCount);
+
+#if CULLING_BENCHMARK
+	static bool bCullingBenchmarkDone = false;
+	if (!bCullingBenchmarkDone)
+	{
+		bCullingBenchmarkDone = true;
+		BenchmarkCullMeshes(renderContext);
+	}
+#endif
 
-	glViewport(0, 0, gWindowWidth, gWindowHeight);
+	gGLState.Viewport(0, 0, gWindowWidth, gWindowHeight);
 	//glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
 	// update ubo
@@ -3174,13 +5184,14 @@ void Render()
 	gRenderInfo.Resolution.w = renderContext.viewPoint.farPlane;
 	gRenderInfo.Time = (float)gTime;
 	gRenderInfo.Exposure = 1.0f;
-	glBindBuffer(GL_UNIFORM_BUFFER, gUBO_Matrices);
-	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(RenderInfo), &gRenderInfo);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	UpdateUniformBlock(EShaderBindingUBO::RenderInfo, gUBO_Matrices, &gRenderInfo, sizeof(RenderInfo));
 
 	if (gHasResetFrame)
 		SetupLightTileBuffer(gRenderInfo.TileCountX * gRenderInfo.TileCountY);
 
+	if (IsGPUCullingActive())
+		GPUCullPass(renderContext);
+
 	// bind pre Z buffer
 	gPreZBuffer.Bind();
 	PreZPass(renderContext);
@@ -3201,7 +5212,7 @@ void Render()
 	gDepthStencilTex.Bind(Shader::gDepthStencilTexUnit);
 
 	// run compute to fill in tile info right after we have depth buffer
-	if (gRenderSettings.bForward || (gRenderSettings.bTileBasedDeferred && !gRenderSettings.bTileOnePass))
+	if (gRenderSettings.bForward || (gRenderSettings.bTileBasedDeferred && !bTileOnePass && !bCPULightClusters))
 		TileInfoPass(renderContext);
 
 	if (gRenderSettings.bForward)
@@ -3230,7 +5241,7 @@ void Render()
 	gShadowTiledTex.Bind(Shader::gShadowTiledTexUnit);
 	gShadowCubeTexArray.Bind(Shader::gShadowCubeTexArrayUnit);
 
-	if (!gRenderSettings.bForward && gRenderSettings.bTileBasedDeferred && gRenderSettings.bTileOnePass)
+	if (!gRenderSettings.bForward && gRenderSettings.bTileBasedDeferred && bTileOnePass)
 		TileBasedDeferredLightPass(renderContext);
 
 	// bind Scene-buffer
@@ -3239,7 +5250,7 @@ void Render()
 	gSceneBuffer.AttachColor(&gSceneColorTex[gSceneColorWriteIdx], 0);
 	//gSceneBuffer.AttachDepth(&gSceneDepthStencilTex[gSceneDepthCurrentIdx], true);
 
-	if (!gRenderSettings.bForward && gRenderSettings.bTileBasedDeferred && !gRenderSettings.bTileOnePass)
+	if (!gRenderSettings.bForward && gRenderSettings.bTileBasedDeferred && !bTileOnePass)
 		TileBasedDeferredLightPass(renderContext);
 
 	if (!gRenderSettings.bForward && !gRenderSettings.bTileBasedDeferred)
@@ -3264,9 +5275,7 @@ void Render()
 	debugRenderInfo.Proj.m[2][0] = 0;
 	debugRenderInfo.Proj.m[2][1] = 0;
 	debugRenderInfo.ViewProj = debugRenderInfo.Proj * debugRenderInfo.View;
-	glBindBuffer(GL_UNIFORM_BUFFER, gUBO_Matrices);
-	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(RenderInfo), &debugRenderInfo);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	UpdateUniformBlock(EShaderBindingUBO::RenderInfo, gUBO_Matrices, &debugRenderInfo, sizeof(RenderInfo));
 
 	DebugForwardPass(renderContext);
 	
@@ -3275,7 +5284,7 @@ void Render()
 	// bind read texture
 	gSceneColorTex[gSceneColorReadIdx].Bind(Shader::gSceneColorTexUnit);
 	// unbind frame buffer, draw to screen
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	gGLState.BindFramebuffer(GL_FRAMEBUFFER, 0);
 
 	ToneMapPass(renderContext);
 
@@ -3283,7 +5292,28 @@ void Render()
 	VisualizeTexturePass(renderContext);
 #endif
 
-	UIPass();
+	// draw counters of this frame, before UI draws
+	gRenderStats = renderContext.stats;
+
+	if (!gHeadlessSettings.bEnabled || gHeadlessSettings.bUI)
+		UIPass();
+
+	gFrameRingBuffer.EndFrame();
+}
+
+// reload materials after their shaders are reloaded, resolve parameter bindings now instead of on first use
+void ReloadMaterials(const REArray<Material*>& materials)
+{
+	Uint64 start = SDL_GetPerformanceCounter();
+	for (int i = 0, ni = (int)materials.size(); i < ni; ++i)
+	{
+		if (!materials[i]->shader)
+			continue;
+		materials[i]->Reload();
+		materials[i]->ResolveBindings();
+	}
+	double time = (double)(SDL_GetPerformanceCounter() - start) * gInvPerformanceFreq * 1000.0;
+	printf("Material Reload: %d materials %.3f ms\n", (int)materials.size(), time);
 }
 
 void ProcessShaderReload()
@@ -3291,9 +5321,11 @@ void ProcessShaderReload()
 	static REArray<FileChangeResult> results;
 	static RESet<std::string> changedFiles;
 	static RESet<Shader*> changedShaders;
+	static REArray<Material*> changedMaterials;
 	results.clear();
 	changedFiles.clear();
 	changedShaders.clear();
+	changedMaterials.clear();
 	fileWatcher.Update(results);
 	for (int i = 0; i < results.size(); ++i)
 	{
@@ -3334,9 +5366,53 @@ void ProcessShaderReload()
 		shader->Reload();
 		for (Material* material : shader->referenceMaterials)
 		{
-			material->Reload();
+			changedMaterials.push_back(material);
 		}
 	}
+	if (changedMaterials.size() > 0)
+		ReloadMaterials(changedMaterials);
+}
+
+// record frame timings after warmup, write report after the last frame, true when done
+bool BenchmarkEndFrame(double frameTime)
+{
+	++gBenchmarkFrameIndex;
+	if (gBenchmarkFrameIndex > gHeadlessSettings.warmupFrameCount)
+		gBenchmarkReport.AddFrame(frameTime);
+	if (gBenchmarkReport.GetFrameCount() < gHeadlessSettings.frameCount)
+		return false;
+
+	gBenchmarkReport.AddInfo("renderer", (const char*)glGetString(GL_RENDERER));
+	gBenchmarkReport.AddInfo("version", (const char*)glGetString(GL_VERSION));
+	gBenchmarkReport.AddInfo("headless", gHeadlessSettings.bEnabled ? 1 : 0);
+	gBenchmarkReport.AddInfo("width", gWindowWidth);
+	gBenchmarkReport.AddInfo("height", gWindowHeight);
+	gBenchmarkReport.AddInfo("warmupFrames", gHeadlessSettings.warmupFrameCount);
+	if (gBenchmarkConfig.bEnabled)
+	{
+		gBenchmarkReport.AddInfo("config", gHeadlessSettings.benchmarkPath);
+		gBenchmarkReport.AddInfo("seed", (int)gBenchmarkConfig.seed);
+		gBenchmarkReport.AddInfo("meshes", gBenchmarkConfig.meshCount);
+		gBenchmarkReport.AddInfo("materials", gBenchmarkConfig.materialCount);
+		gBenchmarkReport.AddInfo("components", gBenchmarkConfig.componentCount);
+		gBenchmarkReport.AddInfo("pointLights", gBenchmarkConfig.pointLightCount);
+		gBenchmarkReport.AddInfo("spotLights", gBenchmarkConfig.spotLightCount);
+		gBenchmarkReport.AddInfo("shadowLights", gBenchmarkConfig.shadowLightCount);
+	}
+
+	gBenchmarkReportWritten = gBenchmarkReport.Write(gHeadlessSettings.reportPath);
+	if (gBenchmarkReportWritten)
+		printf("Benchmark report: %s\n", gHeadlessSettings.reportPath);
+	if (gHeadlessSettings.jsonPath[0])
+	{
+		bool bJSONWritten = gBenchmarkReport.WriteJSON(gHeadlessSettings.jsonPath);
+		if (bJSONWritten)
+			printf("Benchmark JSON report: %s\n", gHeadlessSettings.jsonPath);
+		else
+			printf("Benchmark JSON report failed: %s\n", gHeadlessSettings.jsonPath);
+		gBenchmarkReportWritten = bJSONWritten && gBenchmarkReportWritten;
+	}
+	return true;
 }
 
 JOB_ENTRY_POINT(MainGameLoop)
@@ -3356,7 +5432,8 @@ JOB_ENTRY_POINT(MainGameLoop)
 
 		while (!quit) {
 			int shouldQuit = 0;
-			while (SDL_PollEvent(&event)) {
+			// no input in headless runs, the window is hidden
+			while (!gHeadlessSettings.bEnabled && SDL_PollEvent(&event)) {
 				if (event.type == SDL_QUIT) {
 					quit = true;
 					break;
@@ -3371,12 +5448,24 @@ JOB_ENTRY_POINT(MainGameLoop)
 					if (event.key.keysym.sym == SDLK_r)
 					{
 						LoadShaders(true);
-						for (int i = 0, ni = (int)Material::gMaterialContainer.size(); i < ni; ++i)
-							Material::gMaterialContainer[i]->Reload();
+						ReloadMaterials(Material::gMaterialContainer);
 						//Mesh** meshlContainerPtr = Mesh::gMeshContainer.data();
 						//for (int i = 0, ni = (int)Mesh::gMeshContainer.size(); i < ni; ++i)
 						//	meshlContainerPtr[i]->SetAttributes();
 					}
+					else if (event.key.keysym.sym == SDLK_k && !IsBenchmarkRun())
+					{
+						gRecordingCameraPath = !gRecordingCameraPath;
+						if (gRecordingCameraPath)
+						{
+							gRecordedCameraPath.Clear();
+							printf("Camera path recording\n");
+						}
+						else if (gRecordedCameraPath.Save("camera_path.txt"))
+						{
+							printf("Camera path: %d keys saved to camera_path.txt\n", gRecordedCameraPath.GetKeyCount());
+						}
+					}
 #if LOAD_CACHE_SIM
 					else if (event.key.keysym.sym == SDLK_c)
 					{
@@ -3404,11 +5493,17 @@ JOB_ENTRY_POINT(MainGameLoop)
 
 			ProcessShaderReload();
 
-			Update(gLastDeltaTime);
+			Update(IsBenchmarkRun() ? gBenchmarkDeltaTime : gLastDeltaTime);
+
+			if (gRecordingCameraPath)
+				gRecordedCameraPath.AddKey(gCamera.position, gCamera.euler);
 
 			Render();
 
-			SDL_GL_SwapWindow(gWindow);
+			if (gHeadlessSettings.bEnabled)
+				gHeadlessContext.Present();
+			else
+				SDL_GL_SwapWindow(gWindow);
 
 			// we changed pipeline, refresh materials
 			if (bPrevForward != gRenderSettings.bForward)
@@ -3463,6 +5558,9 @@ JOB_ENTRY_POINT(MainGameLoop)
 
 			gHasResetFrame = false;
 
+			if (IsBenchmarkRun() && BenchmarkEndFrame(deltaTime * 1000.0))
+				quit = true;
+
 #if LOAD_CACHE_SIM
 			if (bCacheSimCaptureFrame)
 			{
@@ -3478,9 +5576,18 @@ JOB_ENTRY_POINT(MainGameLoop)
 
 int main(int argc, char **argv)
 {
+	if (!ParseHeadlessArgs(argc, argv, gHeadlessSettings))
+		return EXIT_FAILURE;
+	if (gHeadlessSettings.benchmarkPath[0] && !LoadBenchmarkConfig(gHeadlessSettings.benchmarkPath, gBenchmarkConfig))
+		return EXIT_FAILURE;
+
 	JobDescriptor startJobDesc(&MainGameLoop, 0, EJobPriority::Render);
 
 	RunJobSystem(&startJobDesc);
 
+	// benchmark runs fail without report
+	if (IsBenchmarkRun() && !gBenchmarkReportWritten)
+		return EXIT_FAILURE;
+
 	return EXIT_SUCCESS;
 }